@@ -0,0 +1,426 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*******************************************************************************************************************/ /**
+ * @file DnnAutoTuner.cpp
+ * @brief Implementation file for the DnnAutoTuner class
+ *
+ * This class selects the DNN backend, target and input size of a network by timing warm-up forward passes
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "DnnAutoTuner.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+/*******************************************************************************************************************/ /**
+ * @brief Class constructor
+ * @param[in] modelFile path of the model weights, which identifies the cached decision
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+DnnAutoTuner::DnnAutoTuner(const std::string &modelFile) : m_modelFile(modelFile), m_tolerance(0.1), m_warmupRuns(2), m_timedRuns(5)
+{
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Set the candidate input sizes, the first of which is the reference for accuracy
+ * @param[in] inputSizes the candidate input sizes
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::setInputSizes(const std::vector<cv::Size> &inputSizes)
+{
+    m_inputSizes = inputSizes;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Set the output layers read by each forward pass, all unconnected output layers if empty
+ * @param[in] outNames the output layer names
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::setOutputNames(const std::vector<std::string> &outNames)
+{
+    m_outNames = outNames;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Set the largest accepted detection mismatch with the reference
+ * @param[in] tolerance the mismatch between 0 (identical detections) and 1 (no detection in common)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::setAccuracyTolerance(double tolerance)
+{
+    m_tolerance = tolerance;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Set the number of untimed and timed forward passes of each configuration
+ * @param[in] warmupRuns the number of untimed forward passes
+ * @param[in] timedRuns the number of timed forward passes, the median of which is used
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::setIterations(int warmupRuns, int timedRuns)
+{
+    m_warmupRuns = std::max(warmupRuns, 0);
+    m_timedRuns = std::max(timedRuns, 1);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Set the frame the configurations are compared on
+ * @param[in] frame a representative input frame
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::setFrame(const cv::Mat &frame)
+{
+    m_frame = frame;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Build the text identifying the conditions a cached decision is valid for
+ * @param[in] backends the backend and target pairs that are benchmarked
+ * @return the cache key, empty if the model file can not be read
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+std::string DnnAutoTuner::getCacheKey(const std::vector<std::pair<int, int> > &backends) const
+{
+    struct stat fileStats;
+    if (stat(m_modelFile.c_str(), &fileStats) != 0)
+    {
+        return std::string();
+    }
+
+    std::ostringstream key;
+    key << "size=" << fileStats.st_size << " mtime=" << fileStats.st_mtime << " opencv=" << CV_VERSION << " inputs=";
+    for (size_t i = 0; i < m_inputSizes.size(); i++)
+    {
+        key << (i > 0 ? "," : "") << m_inputSizes.at(i).width << "x" << m_inputSizes.at(i).height;
+    }
+    key << " backends=";
+    for (size_t i = 0; i < backends.size(); i++)
+    {
+        key << (i > 0 ? "," : "") << backends.at(i).first << "/" << backends.at(i).second;
+    }
+    key << " tolerance=" << m_tolerance;
+    return key.str();
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Read the cached decision for the model
+ * @param[in] key the cache key of the current conditions
+ * @param[out] config the cached configuration
+ * @return true if a decision was cached for the same conditions
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool DnnAutoTuner::loadCachedConfig(const std::string &key, DnnConfig &config) const
+{
+    std::ifstream cacheFile((m_modelFile + ".tuning").c_str());
+    std::string cachedKey;
+    if (key.empty() || !std::getline(cacheFile, cachedKey) || cachedKey != key)
+    {
+        return false;
+    }
+    return static_cast<bool>(cacheFile >> config.backend >> config.target >> config.inputSize.width >> config.inputSize.height);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Write the decision for the model to the cache file
+ * @param[in] key the cache key of the current conditions
+ * @param[in] config the chosen configuration
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::saveCachedConfig(const std::string &key, const DnnConfig &config) const
+{
+    std::string cacheFileName = m_modelFile + ".tuning";
+    std::ofstream cacheFile(cacheFileName.c_str());
+    if (key.empty() || !cacheFile)
+    {
+        std::printf("Unable to write the tuning cache %s \n", cacheFileName.c_str());
+        return;
+    }
+    cacheFile << key << "\n" << config.backend << " " << config.target << " " << config.inputSize.width << " " << config.inputSize.height << "\n";
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Time the forward passes of the network in its current configuration
+ * @param[in] network the network to run
+ * @param[in] setInput function setting the network input
+ * @param[in] inputSize the network input size
+ * @param[out] outputs the outputs of the last forward pass
+ * @return the median forward pass time in milliseconds
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+double DnnAutoTuner::measure(cv::dnn::Net &network, const InputSetter &setInput, const cv::Size &inputSize, std::vector<cv::Mat> &outputs) const
+{
+    std::vector<double> times;
+    for (int i = 0; i < m_warmupRuns + m_timedRuns; i++)
+    {
+        double startTicks = static_cast<double>(cv::getTickCount());
+        setInput(network, m_frame, inputSize);
+        network.forward(outputs, m_outNames);
+        double elapsedTime = (static_cast<double>(cv::getTickCount()) - startTicks) * 1000.0 / cv::getTickFrequency();
+        if (i >= m_warmupRuns)
+        {
+            times.push_back(elapsedTime);
+        }
+    }
+
+    // copy the outputs, since they may refer to network memory that the next configuration reuses
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        outputs.at(i) = outputs.at(i).clone();
+    }
+
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times.at(times.size() / 2);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Choose the configuration of a network, from the cache or by benchmarking
+ * @param[in] loadNetwork function reading the network from the model files
+ * @param[in] setInput function converting a frame into the network input at a given size
+ * @param[in] decodeOutputs function converting the network outputs into detections
+ * @param[out] config the chosen configuration
+ * @return true if a configuration was chosen
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool DnnAutoTuner::tune(const NetworkLoader &loadNetwork, const InputSetter &setInput, const OutputDecoder &decodeOutputs, DnnConfig &config)
+{
+    if (m_inputSizes.empty())
+    {
+        return false;
+    }
+
+    // list the backend and target pairs, with the OpenCV CPU reference first
+    std::vector<std::pair<int, int> > backends(1, std::make_pair(static_cast<int>(cv::dnn::DNN_BACKEND_OPENCV), static_cast<int>(cv::dnn::DNN_TARGET_CPU)));
+    std::vector<std::pair<cv::dnn::Backend, cv::dnn::Target> > available = cv::dnn::getAvailableBackends();
+    for (size_t i = 0; i < available.size(); i++)
+    {
+        std::pair<int, int> backend(available.at(i).first, available.at(i).second);
+        if (std::find(backends.begin(), backends.end(), backend) == backends.end())
+        {
+            backends.push_back(backend);
+        }
+    }
+
+    // reuse the decision of an earlier launch if nothing has changed
+    std::string key = getCacheKey(backends);
+    if (loadCachedConfig(key, config))
+    {
+        std::printf("Using cached DNN configuration: %s / %s at %dx%d \n", getBackendName(config.backend).c_str(), getTargetName(config.target).c_str(), config.inputSize.width, config.inputSize.height);
+        return true;
+    }
+
+    cv::dnn::Net network;
+    if (!loadNetwork(network))
+    {
+        return false;
+    }
+    if (m_outNames.empty())
+    {
+        m_outNames = network.getUnconnectedOutLayersNames();
+    }
+
+    // fall back to a synthetic frame if no representative one was given
+    if (m_frame.empty())
+    {
+        m_frame.create(m_inputSizes.front(), CV_8UC3);
+        cv::RNG rng(12345);
+        rng.fill(m_frame, cv::RNG::UNIFORM, 0, 256);
+    }
+
+    // time every configuration and compare its detections with the reference
+    std::printf("Benchmarking %d DNN configurations for %s \n", static_cast<int>(backends.size() * m_inputSizes.size()), m_modelFile.c_str());
+    std::vector<DetectionBox> referenceBoxes;
+    std::vector<DetectionBox> boxes;
+    std::vector<cv::Mat> outputs;
+    bool checkAccuracy = true;
+    double bestTime = -1.0;
+    for (size_t i = 0; i < backends.size(); i++)
+    {
+        for (size_t j = 0; j < m_inputSizes.size(); j++)
+        {
+            // without reference detections a smaller input can not be shown to lose accuracy, so keep the reference size
+            if (j > 0 && !checkAccuracy)
+            {
+                continue;
+            }
+
+            DnnConfig candidate;
+            candidate.backend = backends.at(i).first;
+            candidate.target = backends.at(i).second;
+            candidate.inputSize = m_inputSizes.at(j);
+
+            double time;
+            try
+            {
+                applyConfig(network, candidate);
+                time = measure(network, setInput, candidate.inputSize, outputs);
+            }
+            catch (const cv::Exception &e)
+            {
+                std::printf("    %s / %s at %dx%d: failed \n", getBackendName(candidate.backend).c_str(), getTargetName(candidate.target).c_str(), candidate.inputSize.width, candidate.inputSize.height);
+                if (i == 0 && j == 0)
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            boxes.clear();
+            decodeOutputs(outputs, boxes);
+            if (i == 0 && j == 0)
+            {
+                referenceBoxes = boxes;
+                checkAccuracy = !referenceBoxes.empty();
+                if (!checkAccuracy)
+                {
+                    std::printf("    no reference detections, comparing backends at %dx%d only \n", candidate.inputSize.width, candidate.inputSize.height);
+                }
+            }
+            double error = computeDetectionError(referenceBoxes, boxes, 0.5f);
+            bool accepted = (error <= m_tolerance);
+            std::printf("    %s / %s at %dx%d: %.1f ms, %d detections, mismatch %.2f%s \n", getBackendName(candidate.backend).c_str(), getTargetName(candidate.target).c_str(), candidate.inputSize.width, candidate.inputSize.height, time, static_cast<int>(boxes.size()), error, accepted ? "" : " (rejected)");
+
+            if (accepted && (bestTime < 0.0 || time < bestTime))
+            {
+                bestTime = time;
+                config = candidate;
+            }
+        }
+    }
+
+    // only cache a decision that was checked for accuracy, so a later launch with a representative frame tunes again
+    std::printf("Selected DNN configuration: %s / %s at %dx%d \n", getBackendName(config.backend).c_str(), getTargetName(config.target).c_str(), config.inputSize.width, config.inputSize.height);
+    if (checkAccuracy)
+    {
+        saveCachedConfig(key, config);
+    }
+    return true;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Select the backend and target of a network
+ * @param[in,out] network the network to configure
+ * @param[in] config the configuration to apply
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnAutoTuner::applyConfig(cv::dnn::Net &network, const DnnConfig &config)
+{
+    network.setPreferableBackend(config.backend);
+    network.setPreferableTarget(config.target);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Measure how much a set of detections differs from a reference set
+ *
+ * Each reference detection is matched to the unmatched detection of the same class that overlaps it most, if the
+ * overlap is at least the minimum. The mismatch is one minus the F1 score of the matches.
+ *
+ * @param[in] reference the reference detections
+ * @param[in] boxes the detections to compare
+ * @param[in] minOverlap the smallest intersection over union of a match
+ * @return the mismatch, 0 if the detections agree and 1 if none match
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+double DnnAutoTuner::computeDetectionError(const std::vector<DetectionBox> &reference, const std::vector<DetectionBox> &boxes, float minOverlap)
+{
+    if (reference.empty() && boxes.empty())
+    {
+        return 0.0;
+    }
+
+    std::vector<bool> matched(boxes.size(), false);
+    int numMatches = 0;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        int bestIndex = -1;
+        float bestOverlap = minOverlap;
+        for (size_t j = 0; j < boxes.size(); j++)
+        {
+            if (matched.at(j) || boxes.at(j).classId != reference.at(i).classId)
+            {
+                continue;
+            }
+            float intersection = (reference.at(i).box & boxes.at(j).box).area();
+            float overlap = intersection / (reference.at(i).box.area() + boxes.at(j).box.area() - intersection);
+            if (overlap >= bestOverlap)
+            {
+                bestOverlap = overlap;
+                bestIndex = static_cast<int>(j);
+            }
+        }
+        if (bestIndex >= 0)
+        {
+            matched.at(bestIndex) = true;
+            numMatches++;
+        }
+    }
+    return 1.0 - 2.0 * numMatches / static_cast<double>(reference.size() + boxes.size());
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Get a printable name of a DNN backend
+ * @param[in] backend the backend identifier
+ * @return the backend name
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+std::string DnnAutoTuner::getBackendName(int backend)
+{
+    switch (backend)
+    {
+        case cv::dnn::DNN_BACKEND_DEFAULT:
+            return "DEFAULT";
+        case cv::dnn::DNN_BACKEND_OPENCV:
+            return "OPENCV";
+        case cv::dnn::DNN_BACKEND_INFERENCE_ENGINE:
+            return "INFERENCE_ENGINE";
+        case cv::dnn::DNN_BACKEND_CUDA:
+            return "CUDA";
+        default:
+            return "BACKEND_" + std::to_string(backend);
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Get a printable name of a DNN target
+ * @param[in] target the target identifier
+ * @return the target name
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+std::string DnnAutoTuner::getTargetName(int target)
+{
+    switch (target)
+    {
+        case cv::dnn::DNN_TARGET_CPU:
+            return "CPU";
+        case cv::dnn::DNN_TARGET_OPENCL:
+            return "OPENCL";
+        case cv::dnn::DNN_TARGET_OPENCL_FP16:
+            return "OPENCL_FP16";
+        case cv::dnn::DNN_TARGET_CUDA:
+            return "CUDA";
+        case cv::dnn::DNN_TARGET_CUDA_FP16:
+            return "CUDA_FP16";
+        default:
+            return "TARGET_" + std::to_string(target);
+    }
+}
@@ -0,0 +1,118 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*******************************************************************************************************************/ /**
+ * @file DnnAutoTuner.h
+ * @brief Header file for the DnnAutoTuner class
+ *
+ * This class selects the DNN backend, target and input size of a network by timing warm-up forward passes
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef DNNAUTOTUNER_H
+#define DNNAUTOTUNER_H
+
+#include <opencv2/dnn.hpp>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*******************************************************************************************************************/ /**
+ * @struct DnnConfig
+ * @brief The execution settings of a network
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct DnnConfig
+{
+    int backend;
+    int target;
+    cv::Size inputSize;
+};
+
+/*******************************************************************************************************************/ /**
+ * @struct DetectionBox
+ * @brief A detected object used to compare network outputs, with its box relative to the image size
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct DetectionBox
+{
+    cv::Rect2f box;
+    int classId;
+};
+
+/*******************************************************************************************************************/ /**
+ * @class DnnAutoTuner
+ *
+ * @brief Class for selecting the fastest backend, target and input size of a network that stays accurate
+ *
+ * Every available backend and target pair is timed at every candidate input size on one frame, with a few warm-up
+ * forward passes before the timed ones. The detections of each run are compared with those of the OpenCV CPU backend
+ * at the first input size, and the fastest configuration whose detection mismatch is within the tolerance is chosen.
+ * Without a frame a synthetic noise image is used, which measures speed but has no objects to compare. If the
+ * reference run detects nothing, only the backends and targets are compared at the first input size and the decision
+ * is not cached. Otherwise the decision is cached in a file next to the model, keyed by the model file size and
+ * modification time, the OpenCV version, the candidate input sizes, the available backends and targets and the
+ * tolerance, so later launches skip the benchmark. Deleting the cache file forces a new benchmark.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class DnnAutoTuner
+{
+public:
+    typedef std::function<bool(cv::dnn::Net &network)> NetworkLoader;
+    typedef std::function<void(cv::dnn::Net &network, const cv::Mat &frame, const cv::Size &inputSize)> InputSetter;
+    typedef std::function<void(const std::vector<cv::Mat> &outputs, std::vector<DetectionBox> &boxes)> OutputDecoder;
+
+private:
+    // settings
+    std::string m_modelFile;
+    std::vector<cv::Size> m_inputSizes;
+    std::vector<std::string> m_outNames;
+    double m_tolerance;
+    int m_warmupRuns;
+    int m_timedRuns;
+    cv::Mat m_frame;
+
+    // helper functions
+    std::string getCacheKey(const std::vector<std::pair<int, int> > &backends) const;
+    bool loadCachedConfig(const std::string &key, DnnConfig &config) const;
+    void saveCachedConfig(const std::string &key, const DnnConfig &config) const;
+    double measure(cv::dnn::Net &network, const InputSetter &setInput, const cv::Size &inputSize, std::vector<cv::Mat> &outputs) const;
+
+public:
+    // constructors
+    DnnAutoTuner(const std::string &modelFile);
+
+    // settings
+    void setInputSizes(const std::vector<cv::Size> &inputSizes);
+    void setOutputNames(const std::vector<std::string> &outNames);
+    void setAccuracyTolerance(double tolerance);
+    void setIterations(int warmupRuns, int timedRuns);
+    void setFrame(const cv::Mat &frame);
+
+    // processing
+    bool tune(const NetworkLoader &loadNetwork, const InputSetter &setInput, const OutputDecoder &decodeOutputs, DnnConfig &config);
+    static void applyConfig(cv::dnn::Net &network, const DnnConfig &config);
+    static double computeDetectionError(const std::vector<DetectionBox> &reference, const std::vector<DetectionBox> &boxes, float minOverlap);
+    static std::string getBackendName(int backend);
+    static std::string getTargetName(int target);
+};
+
+#endif // DNNAUTOTUNER_H
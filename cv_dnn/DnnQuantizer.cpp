@@ -0,0 +1,310 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*******************************************************************************************************************/ /**
+ * @file DnnQuantizer.cpp
+ * @brief Implementation file for the DnnQuantizer class
+ *
+ * This class runs a network at reduced precision and measures the accuracy lost against full precision
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "DnnQuantizer.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// true if the OpenCV headers are at least the given version
+#define OPENCV_VERSION_AT_LEAST(major, minor, revision) \
+    (CV_VERSION_MAJOR > (major) || (CV_VERSION_MAJOR == (major) && (CV_VERSION_MINOR > (minor) || (CV_VERSION_MINOR == (minor) && CV_VERSION_REVISION >= (revision)))))
+
+/*******************************************************************************************************************/ /**
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+DnnQuantizer::DnnQuantizer() : m_precision(DNN_PRECISION_FP32), m_numCalibrationBlobs(0)
+{
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Set the precision apply() converts networks to
+ * @param[in] precision the target precision
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnQuantizer::setPrecision(DnnPrecision precision)
+{
+    m_precision = precision;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Get the precision apply() converts networks to
+ * @return the target precision
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+DnnPrecision DnnQuantizer::getPrecision() const
+{
+    return m_precision;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Read the images of a directory as calibration frames
+ * @param[in] directory the directory containing the sample frames
+ * @param[in] maxFrames the largest number of frames to read
+ * @return the number of frames read
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int DnnQuantizer::loadCalibrationFrames(const std::string &directory, int maxFrames)
+{
+    std::vector<cv::String> fileNames;
+    cv::glob(directory + "/*", fileNames, false);
+    std::sort(fileNames.begin(), fileNames.end());
+
+    int numFrames = 0;
+    for (size_t i = 0; i < fileNames.size() && numFrames < maxFrames; i++)
+    {
+        cv::Mat frame = cv::imread(fileNames.at(i), cv::IMREAD_COLOR);
+        if (!frame.empty())
+        {
+            m_frames.push_back(frame);
+            numFrames++;
+        }
+    }
+    return numFrames;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Add a calibration frame
+ * @param[in] frame a representative input frame
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnQuantizer::addCalibrationFrame(const cv::Mat &frame)
+{
+    if (!frame.empty())
+    {
+        m_frames.push_back(frame);
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Convert the calibration frames into network inputs, holding out the last third of them for compare()
+ * @param[in] makeBlob function converting a frame into the exact input blob of the network
+ * @param[in] inputSize the network input size
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnQuantizer::prepare(const BlobMaker &makeBlob, const cv::Size &inputSize)
+{
+    m_blobs.resize(m_frames.size());
+    for (size_t i = 0; i < m_frames.size(); i++)
+    {
+        makeBlob(m_frames.at(i), inputSize, m_blobs.at(i));
+    }
+
+    // hold out at least one frame if there are two or more, the frames are sorted so the last ones differ the most
+    size_t numHeldOut = (m_blobs.size() >= 2) ? std::max<size_t>(m_blobs.size() / 3, 1) : 0;
+    m_numCalibrationBlobs = m_blobs.size() - numHeldOut;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Convert a loaded network to the target precision
+ * @param[in,out] network the network, replaced by its quantized version for INT8
+ * @param[in,out] config the network configuration, updated with the backend and target used
+ * @return true if the network runs at the target precision, false if it was left unchanged
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool DnnQuantizer::apply(cv::dnn::Net &network, DnnConfig &config) const
+{
+    if (m_precision == DNN_PRECISION_FP32)
+    {
+        return true;
+    }
+
+    std::vector<cv::dnn::Target> targets = cv::dnn::getAvailableTargets(cv::dnn::DNN_BACKEND_OPENCV);
+    DnnConfig converted = config;
+    converted.backend = cv::dnn::DNN_BACKEND_OPENCV;
+    if (m_precision == DNN_PRECISION_FP16)
+    {
+        // prefer the half precision CPU target, then the OpenCL one
+        converted.target = -1;
+#if OPENCV_VERSION_AT_LEAST(4, 8, 0)
+        if (std::find(targets.begin(), targets.end(), cv::dnn::DNN_TARGET_CPU_FP16) != targets.end())
+        {
+            converted.target = cv::dnn::DNN_TARGET_CPU_FP16;
+        }
+#endif
+        if (converted.target < 0 && std::find(targets.begin(), targets.end(), cv::dnn::DNN_TARGET_OPENCL_FP16) != targets.end())
+        {
+            converted.target = cv::dnn::DNN_TARGET_OPENCL_FP16;
+        }
+        if (converted.target < 0)
+        {
+            std::printf("No FP16 target is available, running at FP32 \n");
+            return false;
+        }
+        DnnAutoTuner::applyConfig(network, converted);
+    }
+    else
+    {
+#if OPENCV_VERSION_AT_LEAST(4, 5, 4)
+        if (m_numCalibrationBlobs == 0)
+        {
+            std::printf("INT8 quantization needs calibration frames, running at FP32 \n");
+            return false;
+        }
+        try
+        {
+            // quantize with float inputs and outputs, so the pre and post processing is unchanged
+            std::vector<cv::Mat> calibrationBlobs(m_blobs.begin(), m_blobs.begin() + m_numCalibrationBlobs);
+            cv::dnn::Net quantized = network.quantize(calibrationBlobs, CV_32F, CV_32F);
+            converted.target = cv::dnn::DNN_TARGET_CPU;
+            DnnAutoTuner::applyConfig(quantized, converted);
+            network = quantized;
+        }
+        catch (const cv::Exception &e)
+        {
+            std::printf("INT8 quantization failed, running at FP32: %s \n", e.what());
+            return false;
+        }
+#else
+        std::printf("INT8 quantization needs OpenCV 4.5.4 or newer, running at FP32 \n");
+        return false;
+#endif
+    }
+
+    config = converted;
+    return true;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Report the detection mismatch and the speedup of a reduced precision network
+ *
+ * An INT8 network is compared on the held out frames, or on its single calibration frame, which is reported as in
+ * sample. FP16 networks are not calibrated, so they are compared on all of the frames.
+ *
+ * @param[in] reference the full precision network
+ * @param[in] network the reduced precision network
+ * @param[in] outNames the output layers read by each forward pass
+ * @param[in] decodeOutputs function converting the network outputs into detections
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void DnnQuantizer::compare(cv::dnn::Net &reference, cv::dnn::Net &network, const std::vector<std::string> &outNames, const DnnAutoTuner::OutputDecoder &decodeOutputs) const
+{
+    if (m_blobs.empty())
+    {
+        return;
+    }
+
+    // skip the frames the INT8 ranges were chosen from, unless there are no others
+    size_t firstBlob = 0;
+    const char *frameKind = "sample";
+    if (m_precision == DNN_PRECISION_INT8)
+    {
+        firstBlob = (m_numCalibrationBlobs < m_blobs.size()) ? m_numCalibrationBlobs : 0;
+        frameKind = (firstBlob > 0) ? "held out" : "calibration (in sample)";
+    }
+    size_t numBlobs = m_blobs.size() - firstBlob;
+
+    std::vector<cv::Mat> outputs;
+    std::vector<DetectionBox> referenceBoxes;
+    std::vector<DetectionBox> boxes;
+    double referenceTime = 0.0;
+    double time = 0.0;
+    double totalError = 0.0;
+    size_t numReferenceBoxes = 0;
+    size_t numBoxes = 0;
+    for (size_t i = firstBlob; i < m_blobs.size(); i++)
+    {
+        // run both networks, excluding the first frame from the times since it includes the network setup
+        double startTicks = static_cast<double>(cv::getTickCount());
+        reference.setInput(m_blobs.at(i));
+        reference.forward(outputs, outNames);
+        double middleTicks = static_cast<double>(cv::getTickCount());
+        referenceBoxes.clear();
+        decodeOutputs(outputs, referenceBoxes);
+
+        double networkTicks = static_cast<double>(cv::getTickCount());
+        network.setInput(m_blobs.at(i));
+        network.forward(outputs, outNames);
+        double endTicks = static_cast<double>(cv::getTickCount());
+        boxes.clear();
+        decodeOutputs(outputs, boxes);
+
+        if (i > firstBlob || numBlobs == 1)
+        {
+            referenceTime += middleTicks - startTicks;
+            time += endTicks - networkTicks;
+        }
+        totalError += DnnAutoTuner::computeDetectionError(referenceBoxes, boxes, 0.5f);
+        numReferenceBoxes += referenceBoxes.size();
+        numBoxes += boxes.size();
+    }
+
+    double numTimed = static_cast<double>(std::max<size_t>(numBlobs - 1, 1));
+    double referenceMs = referenceTime * 1000.0 / (cv::getTickFrequency() * numTimed);
+    double networkMs = time * 1000.0 / (cv::getTickFrequency() * numTimed);
+    std::printf("%s vs FP32 on %d %s frames: mean mismatch %.3f, %d vs %d detections, %.1f vs %.1f ms per frame (%.2fx) \n", getPrecisionName(m_precision), static_cast<int>(numBlobs), frameKind, totalError / numBlobs, static_cast<int>(numBoxes), static_cast<int>(numReferenceBoxes), networkMs, referenceMs, (networkMs > 0.0) ? referenceMs / networkMs : 0.0);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Parse the name of a precision
+ * @param[in] name the precision name, one of "fp32", "fp16" or "int8"
+ * @param[out] precision the parsed precision
+ * @return true if the name is valid
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool DnnQuantizer::parsePrecision(const char *name, DnnPrecision &precision)
+{
+    if (std::strcmp(name, "fp32") == 0)
+    {
+        precision = DNN_PRECISION_FP32;
+    }
+    else if (std::strcmp(name, "fp16") == 0)
+    {
+        precision = DNN_PRECISION_FP16;
+    }
+    else if (std::strcmp(name, "int8") == 0)
+    {
+        precision = DNN_PRECISION_INT8;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Get the printable name of a precision
+ * @param[in] precision the precision
+ * @return the precision name
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const char* DnnQuantizer::getPrecisionName(DnnPrecision precision)
+{
+    switch (precision)
+    {
+        case DNN_PRECISION_FP16:
+            return "FP16";
+        case DNN_PRECISION_INT8:
+            return "INT8";
+        default:
+            return "FP32";
+    }
+}
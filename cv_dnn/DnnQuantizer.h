@@ -0,0 +1,90 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*******************************************************************************************************************/ /**
+ * @file DnnQuantizer.h
+ * @brief Header file for the DnnQuantizer class
+ *
+ * This class runs a network at reduced precision and measures the accuracy lost against full precision
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef DNNQUANTIZER_H
+#define DNNQUANTIZER_H
+
+#include "DnnAutoTuner.h"
+
+#include <opencv2/dnn.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// numeric precisions a network can run at
+enum DnnPrecision
+{
+    DNN_PRECISION_FP32,
+    DNN_PRECISION_FP16,
+    DNN_PRECISION_INT8
+};
+
+/*******************************************************************************************************************/ /**
+ * @class DnnQuantizer
+ *
+ * @brief Class for converting a loaded network to FP16 or INT8 execution
+ *
+ * INT8 networks are produced in memory with cv::dnn::Net::quantize (OpenCV 4.5.4 or newer), using the calibration
+ * frames to choose the quantization ranges, and run on the OpenCV CPU backend. FP16 execution selects a half
+ * precision target of the OpenCV backend, the CPU one where available (OpenCV 4.8 or newer) and the OpenCL one
+ * otherwise, since the Darknet and TensorFlow readers have no FP16 weight format. With two or more calibration frames
+ * the last third of them is held out of the quantization, and compare() reports the detection mismatch and the
+ * speedup against the full precision network on those frames, so the INT8 accuracy is measured out of sample.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class DnnQuantizer
+{
+public:
+    typedef std::function<void(const cv::Mat &frame, const cv::Size &inputSize, cv::Mat &blob)> BlobMaker;
+
+private:
+    // settings
+    DnnPrecision m_precision;
+    std::vector<cv::Mat> m_frames;
+    std::vector<cv::Mat> m_blobs;
+    size_t m_numCalibrationBlobs;
+
+public:
+    // constructors
+    DnnQuantizer();
+
+    // settings
+    void setPrecision(DnnPrecision precision);
+    DnnPrecision getPrecision() const;
+    int loadCalibrationFrames(const std::string &directory, int maxFrames);
+    void addCalibrationFrame(const cv::Mat &frame);
+    void prepare(const BlobMaker &makeBlob, const cv::Size &inputSize);
+
+    // processing
+    bool apply(cv::dnn::Net &network, DnnConfig &config) const;
+    void compare(cv::dnn::Net &reference, cv::dnn::Net &network, const std::vector<std::string> &outNames, const DnnAutoTuner::OutputDecoder &decodeOutputs) const;
+    static bool parsePrecision(const char *name, DnnPrecision &precision);
+    static const char* getPrecisionName(DnnPrecision precision);
+};
+
+#endif // DNNQUANTIZER_H
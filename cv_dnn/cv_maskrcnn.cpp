@@ -23,11 +23,18 @@
  * @author Christopher D. McMurrough
  **********************************************************************************************************************/
 
+#include "DnnAutoTuner.h"
+#include "DnnQuantizer.h"
+
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <cstdio>
 #include <string.h>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
@@ -45,17 +52,64 @@ float maskThreshold = 0.3; // Mask threshold
 vector<string> classes;
 vector<Scalar> colors;
 
+// A detection of a tile moved into frame coordinates, with a copy of its mask
+struct TileDetection
+{
+	int classId;
+	float score;
+	Rect box;
+	Mat mask;
+	bool cutByTile;
+	int tile;
+};
+
+// The network and reusable buffers of one tile worker thread
+struct TileWorker
+{
+	Net network;
+	Mat blob;
+	vector<Mat> outs;
+	vector<Mat> tileViews;
+	vector<TileDetection> detections;
+};
+
 // Draw the predicted bounding box
 void drawBox(Mat& frame, int classId, float conf, Rect box, Mat& objectMask);
 
 // Postprocess the neural network's output for each frame
 void postprocess(Mat& frame, const vector<Mat>& outs);
 
+// Choose the backend, target and input size of the network
+bool tuneNetwork(const Mat& frame, const string& modelWeights, const string& textGraph, const vector<String>& outNames, DnnConfig& config);
+
+// Convert the network outputs into detection boxes relative to the frame size
+void decodeBoxes(const vector<Mat>& outs, vector<DetectionBox>& boxes);
+
+// Create the network input blob of a frame
+void makeInputBlob(const Mat& frame, const Size& inputSize, Mat& blob);
+
+// Split large frames into overlapping tiles and detect objects in batches of tiles
+vector<int> computeTileOffsets(int length, int tileLength, int overlap);
+vector<Rect> computeTiles(const Size& frameSize, int tileSize, int overlap);
+void detectTileBatch(const Mat& frame, const Size& inputSize, const vector<String>& outNames, const vector<Rect>& tiles, size_t firstTile, size_t endTile, TileWorker& worker);
+void detectTiled(Mat& frame, vector<TileWorker>& workers, const Size& inputSize, const vector<String>& outNames, const vector<Rect>& tiles, int& tileBatchSize);
+
 
 
 // configuration parameters
 #define NUM_COMNMAND_LINE_ARGUMENTS 1
 #define DISPLAY_WINDOW_NAME "Video Frame"
+#define TUNING_TOLERANCE 0.1
+#define MAX_CALIBRATION_FRAMES 16
+
+// tiling parameters, frames larger than one tile are processed in overlapping tiles
+#define TILE_SIZE 1024
+#define TILE_OVERLAP 192
+#define TILE_BATCH_SIZE 4
+#define TILE_NUM_WORKERS 2
+#define TILE_EDGE_MARGIN 2
+#define TILE_NMS_THRESHOLD 0.5
+#define TILE_CONTAINMENT_THRESHOLD 0.8
 
 /*******************************************************************************************************************//**
  * @brief program entry point
@@ -69,16 +123,24 @@ int main(int argc, char **argv)
     // store video capture parameters
     std::string fileName;
     int trackerSelection = 0;
+    DnnPrecision precision = DNN_PRECISION_FP32;
+    std::string calibrationDirectory;
 
     // validate and parse the command line arguments
-    if(argc != NUM_COMNMAND_LINE_ARGUMENTS + 1)
+    if(argc < NUM_COMNMAND_LINE_ARGUMENTS + 1 || argc > NUM_COMNMAND_LINE_ARGUMENTS + 3 || (argc >= NUM_COMNMAND_LINE_ARGUMENTS + 2 && !DnnQuantizer::parsePrecision(argv[2], precision)))
     {
-        std::printf("USAGE: %s <file_path> \n", argv[0]);
+        std::printf("USAGE: %s <file_path> [precision] [calibration_dir] \n", argv[0]);
+        std::printf("    precision: fp32, fp16 or int8 (default: fp32)\n");
+        std::printf("    calibration_dir: directory of sample frames for int8 calibration and the accuracy report (default: first video frame)\n");
         return 0;
     }
     else
     {
         fileName = argv[1];
+        if(argc == NUM_COMNMAND_LINE_ARGUMENTS + 3)
+        {
+            calibrationDirectory = argv[3];
+        }
     }
 
     // open the video file
@@ -126,10 +188,84 @@ int main(int argc, char **argv)
 	std::string textGraph = "./mask_rcnn_inception_v2_coco_2018_01_28/mask_rcnn_inception_v2_coco_2018_01_28.pbtxt";
 	std::string modelWeights = "./mask_rcnn_inception_v2_coco_2018_01_28/frozen_inference_graph.pb";
 
+	// define the output layers read by each forward pass
+	std::vector<String> outNames(2);
+	outNames[0] = "detection_out_final";
+	outNames[1] = "detection_masks";
+
+	// choose the network configuration using the first frame, then rewind the source
+	Mat tuningFrame;
+	DnnConfig config;
+	capture.read(tuningFrame);
+	capture.set(CAP_PROP_POS_FRAMES, 0);
+
+	// split frames larger than a tile into overlapping tiles, and configure the network for the center tile
+	vector<Rect> tiles = computeTiles(Size(tuningFrame.cols, tuningFrame.rows), TILE_SIZE, TILE_OVERLAP);
+	int tileBatchSize = TILE_BATCH_SIZE;
+	if (tiles.size() > 1)
+	{
+		std::printf("Processing frames in %d tiles of %dx%d \n", static_cast<int>(tiles.size()), tiles[0].width, tiles[0].height);
+		Rect centerTile = tiles[0];
+		centerTile.x = (tuningFrame.cols - centerTile.width) / 2;
+		centerTile.y = (tuningFrame.rows - centerTile.height) / 2;
+		tuningFrame = tuningFrame(centerTile).clone();
+	}
+	if (tuningFrame.empty() || !tuneNetwork(tuningFrame, modelWeights, textGraph, outNames, config))
+	{
+		std::printf("Unable to load the network, terminating program! \n");
+		return 0;
+	}
+
 	// load the DNN network
 	cv::dnn::Net network = readNetFromTensorflow(modelWeights, textGraph);
-	network.setPreferableBackend(DNN_BACKEND_OPENCV);
-	network.setPreferableTarget(DNN_TARGET_CPU);
+	DnnAutoTuner::applyConfig(network, config);
+
+	// convert the network to the requested precision and compare it with a full precision copy
+	DnnQuantizer quantizer;
+	quantizer.setPrecision(precision);
+	if (precision != DNN_PRECISION_FP32)
+	{
+		if (calibrationDirectory.empty() || quantizer.loadCalibrationFrames(calibrationDirectory, MAX_CALIBRATION_FRAMES) == 0)
+		{
+			std::printf("No calibration frames read, calibrating on the first video frame \n");
+			quantizer.addCalibrationFrame(tuningFrame);
+		}
+		quantizer.prepare(makeInputBlob, config.inputSize);
+
+		cv::dnn::Net reference = readNetFromTensorflow(modelWeights, textGraph);
+		DnnAutoTuner::applyConfig(reference, config);
+		if (quantizer.apply(network, config))
+		{
+			quantizer.compare(reference, network, outNames, decodeBoxes);
+			std::printf("Running at %s on %s / %s \n", DnnQuantizer::getPrecisionName(precision), DnnAutoTuner::getBackendName(config.backend).c_str(), DnnAutoTuner::getTargetName(config.target).c_str());
+		}
+		else
+		{
+			quantizer.setPrecision(DNN_PRECISION_FP32);
+		}
+	}
+
+	// load one network per tile worker, since a network can not run forward passes from several threads, reusing the
+	// converted one for the first worker and keeping a single worker at INT8, which would need calibrating again
+	vector<TileWorker> tileWorkers(1);
+	tileWorkers[0].network = network;
+	if (tiles.size() > 1 && quantizer.getPrecision() != DNN_PRECISION_INT8)
+	{
+		int numWorkers = min(TILE_NUM_WORKERS, max(static_cast<int>(std::thread::hardware_concurrency()), 1));
+		while (static_cast<int>(tileWorkers.size()) < numWorkers)
+		{
+			TileWorker worker;
+			DnnConfig workerConfig = config;
+			worker.network = readNetFromTensorflow(modelWeights, textGraph);
+			DnnAutoTuner::applyConfig(worker.network, workerConfig);
+			if (worker.network.empty() || !quantizer.apply(worker.network, workerConfig))
+			{
+				break;
+			}
+			tileWorkers.push_back(worker);
+		}
+		std::printf("Running %d tile workers \n", static_cast<int>(tileWorkers.size()));
+	}
 
 	// Open a video file or an image file or a camera stream.
 	string str, outputFile;
@@ -155,27 +291,35 @@ int main(int argc, char **argv)
 			waitKey(3000);
 			break;
 		}
-		// Create a 4D blob from a frame.
-		blobFromImage(frame, blob, 1.0, Size(frame.cols, frame.rows), Scalar(), true, false);
-		//blobFromImage(frame, blob);
+		double t;
+		if (tiles.size() > 1)
+		{
+			// detect the objects of each tile and stitch them back together
+			double startTicks = static_cast<double>(getTickCount());
+			detectTiled(frame, tileWorkers, config.inputSize, outNames, tiles, tileBatchSize);
+			t = (static_cast<double>(getTickCount()) - startTicks) * 1000.0 / getTickFrequency();
+		}
+		else
+		{
+			// Create a 4D blob from a frame.
+			makeInputBlob(frame, config.inputSize, blob);
+			//blobFromImage(frame, blob);
 
-		//Sets the input to the network
-		network.setInput(blob);
+			//Sets the input to the network
+			network.setInput(blob);
 
-		// Runs the forward pass to get output from the output layers
-		std::vector<String> outNames(2);
-		outNames[0] = "detection_out_final";
-		outNames[1] = "detection_masks";
-		vector<Mat> outs;
-		network.forward(outs, outNames);
+			// Runs the forward pass to get output from the output layers
+			vector<Mat> outs;
+			network.forward(outs, outNames);
 
-		// Extract the bounding box and mask for each of the detected objects
-		postprocess(frame, outs);
+			// Extract the bounding box and mask for each of the detected objects
+			postprocess(frame, outs);
 
-		// Put efficiency information. The function getPerfProfile returns the overall time for inference(t) and the timings for each of the layers(in layersTimes)
-		vector<double> layersTimes;
-		double freq = getTickFrequency() / 1000;
-		double t = network.getPerfProfile(layersTimes) / freq;
+			// Put efficiency information. The function getPerfProfile returns the overall time for inference(t) and the timings for each of the layers(in layersTimes)
+			vector<double> layersTimes;
+			double freq = getTickFrequency() / 1000;
+			t = network.getPerfProfile(layersTimes) / freq;
+		}
 		string label = format("Mask-RCNN on 2.5 GHz Intel Core i7 CPU, Inference time for a frame : %0.0f ms", t);
 		putText(frame, label, Point(0, 15), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 0, 0));
 
@@ -190,6 +334,315 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+/*******************************************************************************************************************//**
+ * @brief Choose the backend, target and input size of the network, benchmarking them if no decision is cached
+ * @param[in] frame a representative input frame
+ * @param[in] modelWeights path of the frozen graph
+ * @param[in] textGraph path of the text graph description
+ * @param[in] outNames the output layers read by each forward pass
+ * @param[out] config the chosen configuration
+ * @return true if a configuration was chosen
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool tuneNetwork(const Mat& frame, const string& modelWeights, const string& textGraph, const vector<String>& outNames, DnnConfig& config)
+{
+	// the full frame size is the accuracy reference, smaller sizes are faster
+	vector<Size> inputSizes;
+	const double scales[] = {1.0, 0.75, 0.5};
+	for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++)
+	{
+		inputSizes.push_back(Size(cvRound(frame.cols * scales[i]), cvRound(frame.rows * scales[i])));
+	}
+
+	DnnAutoTuner tuner(modelWeights);
+	tuner.setInputSizes(inputSizes);
+	tuner.setOutputNames(outNames);
+	tuner.setAccuracyTolerance(TUNING_TOLERANCE);
+	tuner.setFrame(frame);
+
+	DnnAutoTuner::NetworkLoader loadNetwork = [&](Net& network)
+	{
+		network = readNetFromTensorflow(modelWeights, textGraph);
+		return !network.empty();
+	};
+
+	Mat blob;
+	DnnAutoTuner::InputSetter setInput = [&blob](Net& network, const Mat& image, const Size& inputSize)
+	{
+		makeInputBlob(image, inputSize, blob);
+		network.setInput(blob);
+	};
+
+	return tuner.tune(loadNetwork, setInput, decodeBoxes, config);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Convert the network outputs into the boxes of the detections above the confidence threshold
+ * @param[in] outs the detection and mask outputs of the network
+ * @param[out] boxes the detections, relative to the frame size, appended to the list
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void decodeBoxes(const vector<Mat>& outs, vector<DetectionBox>& boxes)
+{
+	Mat outDetections = outs[0].reshape(1, outs[0].total() / 7);
+	for (int i = 0; i < outDetections.rows; ++i)
+	{
+		float score = outDetections.at<float>(i, 2);
+		if (score > confThreshold)
+		{
+			DetectionBox box;
+			box.classId = static_cast<int>(outDetections.at<float>(i, 1));
+			box.box.x = outDetections.at<float>(i, 3);
+			box.box.y = outDetections.at<float>(i, 4);
+			box.box.width = outDetections.at<float>(i, 5) - box.box.x;
+			box.box.height = outDetections.at<float>(i, 6) - box.box.y;
+			boxes.push_back(box);
+		}
+	}
+}
+
+/*******************************************************************************************************************//**
+ * @brief Create the network input blob of a frame
+ * @param[in] frame the input image frame
+ * @param[in] inputSize the network input size
+ * @param[out] blob the input blob
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void makeInputBlob(const Mat& frame, const Size& inputSize, Mat& blob)
+{
+	blobFromImage(frame, blob, 1.0, inputSize, Scalar(), true, false);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Compute the offsets of equally sized tiles covering a length with a minimum overlap
+ * @param[in] length the length to cover
+ * @param[in] tileLength the length of each tile, at most the covered length
+ * @param[in] overlap the minimum overlap between neighboring tiles
+ * @return the tile offsets, the last tile ending at the covered length
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+vector<int> computeTileOffsets(int length, int tileLength, int overlap)
+{
+	vector<int> offsets(1, 0);
+	int step = max(tileLength - overlap, 1);
+	while (offsets.back() + tileLength < length)
+	{
+		offsets.push_back(min(offsets.back() + step, length - tileLength));
+	}
+	return offsets;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Split a frame into overlapping tiles of equal size
+ * @param[in] frameSize the frame size
+ * @param[in] tileSize the largest tile width and height
+ * @param[in] overlap the minimum overlap between neighboring tiles
+ * @return the tile regions in row order, a single region covering the frame if it fits in one tile
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+vector<Rect> computeTiles(const Size& frameSize, int tileSize, int overlap)
+{
+	int tileWidth = min(tileSize, frameSize.width);
+	int tileHeight = min(tileSize, frameSize.height);
+	vector<int> xOffsets = computeTileOffsets(frameSize.width, tileWidth, overlap);
+	vector<int> yOffsets = computeTileOffsets(frameSize.height, tileHeight, overlap);
+
+	vector<Rect> tiles;
+	for (size_t i = 0; i < yOffsets.size(); i++)
+	{
+		for (size_t j = 0; j < xOffsets.size(); j++)
+		{
+			tiles.push_back(Rect(xOffsets[j], yOffsets[i], tileWidth, tileHeight));
+		}
+	}
+	return tiles;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Detect the objects of a batch of tiles with one forward pass, appending them to the worker detections
+ * @param[in] frame the frame holding the tiles
+ * @param[in] inputSize the network input size of one tile
+ * @param[in] outNames the detection and mask output layers
+ * @param[in] tiles the tile regions of the frame
+ * @param[in] firstTile index of the first tile of the batch
+ * @param[in] endTile index after the last tile of the batch
+ * @param[in,out] worker the network and buffers of the calling thread
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void detectTileBatch(const Mat& frame, const Size& inputSize, const vector<String>& outNames, const vector<Rect>& tiles, size_t firstTile, size_t endTile, TileWorker& worker)
+{
+	// create one blob from the tile views of the batch, without copying the tiles
+	worker.tileViews.clear();
+	for (size_t t = firstTile; t < endTile; t++)
+	{
+		worker.tileViews.push_back(frame(tiles[t]));
+	}
+	blobFromImages(worker.tileViews, worker.blob, 1.0, inputSize, Scalar(), true, false);
+	worker.network.setInput(worker.blob);
+	worker.network.forward(worker.outs, outNames);
+
+	// move the detections of each tile into frame coordinates, the first column holding the tile index in the batch
+	Mat outDetections = worker.outs[0].reshape(1, worker.outs[0].total() / 7);
+	const Mat& outMasks = worker.outs[1];
+	for (int i = 0; i < outDetections.rows; ++i)
+	{
+		int batchIndex = static_cast<int>(outDetections.at<float>(i, 0));
+		float score = outDetections.at<float>(i, 2);
+		if (batchIndex < 0 || batchIndex >= static_cast<int>(endTile - firstTile) || score <= confThreshold)
+		{
+			continue;
+		}
+
+		const Rect& tile = tiles[firstTile + batchIndex];
+		int left = max(0, min(static_cast<int>(tile.width * outDetections.at<float>(i, 3)), tile.width - 1));
+		int top = max(0, min(static_cast<int>(tile.height * outDetections.at<float>(i, 4)), tile.height - 1));
+		int right = max(0, min(static_cast<int>(tile.width * outDetections.at<float>(i, 5)), tile.width - 1));
+		int bottom = max(0, min(static_cast<int>(tile.height * outDetections.at<float>(i, 6)), tile.height - 1));
+
+		TileDetection detection;
+		detection.classId = static_cast<int>(outDetections.at<float>(i, 1));
+		detection.score = score;
+		detection.box = Rect(tile.x + left, tile.y + top, right - left + 1, bottom - top + 1);
+		detection.mask = Mat(outMasks.size[2], outMasks.size[3], CV_32F, const_cast<float*>(outMasks.ptr<float>(i, detection.classId))).clone();
+		detection.cutByTile = (left <= TILE_EDGE_MARGIN && tile.x > 0) || (top <= TILE_EDGE_MARGIN && tile.y > 0) ||
+			(right >= tile.width - 1 - TILE_EDGE_MARGIN && tile.x + tile.width < frame.cols) || (bottom >= tile.height - 1 - TILE_EDGE_MARGIN && tile.y + tile.height < frame.rows);
+		detection.tile = static_cast<int>(firstTile) + batchIndex;
+		worker.detections.push_back(detection);
+	}
+}
+
+/*******************************************************************************************************************//**
+ * @brief Detect objects in a large frame by running the network on overlapping tiles
+ *
+ * The tiles are passed through the network in batches, so the memory of each forward pass is bounded by the batch and
+ * input size rather than the frame size. Each worker thread runs its own network and takes the next batch when it
+ * finishes one. The detections of each tile are moved into frame coordinates with a copy of their masks, and
+ * duplicates found in overlapping tiles are removed by a class-aware non-maximum suppression over the whole frame.
+ * Detections cut by an inner tile edge are ranked after the others, so the complete view of an object from a
+ * neighboring tile is kept. A cut detection lying inside a kept one of another tile is suppressed by the containment
+ * test, while nested objects found in the same tile are both kept.
+ *
+ * @param[in,out] frame the frame to process and annotate
+ * @param[in,out] workers the networks and buffers of the worker threads, at least one
+ * @param[in] inputSize the network input size of one tile
+ * @param[in] outNames the detection and mask output layers
+ * @param[in] tiles the tile regions of the frame
+ * @param[in,out] tileBatchSize the number of tiles per forward pass, reduced to one if the network rejects batches
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void detectTiled(Mat& frame, vector<TileWorker>& workers, const Size& inputSize, const vector<String>& outNames, const vector<Rect>& tiles, int& tileBatchSize)
+{
+	static vector<TileDetection> detections;
+	detections.clear();
+
+	for (;;)
+	{
+		// hand out the batches to the workers until all are done or a forward pass fails
+		const size_t numBatches = (tiles.size() + tileBatchSize - 1) / tileBatchSize;
+		const size_t numThreads = min(workers.size(), numBatches);
+		std::atomic<size_t> nextBatch(0);
+		std::atomic<bool> failed(false);
+		vector<std::exception_ptr> errors(numThreads);
+		vector<std::exception_ptr> fatalErrors(numThreads);
+		auto runWorker = [&](size_t w)
+		{
+			workers[w].detections.clear();
+			try
+			{
+				for (size_t b = nextBatch++; b < numBatches && !failed; b = nextBatch++)
+				{
+					size_t firstTile = b * tileBatchSize;
+					size_t endTile = min(firstTile + static_cast<size_t>(tileBatchSize), tiles.size());
+					detectTileBatch(frame, inputSize, outNames, tiles, firstTile, endTile, workers[w]);
+				}
+			}
+			catch (const cv::Exception&)
+			{
+				errors[w] = std::current_exception();
+				failed = true;
+			}
+			catch (...)
+			{
+				// an exception escaping the thread would terminate the program, so hand it to the caller
+				fatalErrors[w] = std::current_exception();
+				failed = true;
+			}
+		};
+		vector<std::thread> threads;
+		for (size_t w = 1; w < numThreads; w++)
+		{
+			threads.push_back(std::thread(runWorker, w));
+		}
+		runWorker(0);
+		for (size_t w = 0; w < threads.size(); w++)
+		{
+			threads[w].join();
+		}
+
+		if (!failed)
+		{
+			break;
+		}
+		// only an OpenCV error can come from the batch size, anything else is passed on without a retry
+		for (size_t w = 0; w < numThreads; w++)
+		{
+			if (fatalErrors[w])
+			{
+				std::rethrow_exception(fatalErrors[w]);
+			}
+		}
+		if (tileBatchSize == 1)
+		{
+			for (size_t w = 0; w < numThreads; w++)
+			{
+				if (errors[w])
+				{
+					std::rethrow_exception(errors[w]);
+				}
+			}
+		}
+		std::printf("Batched tile inference failed, processing one tile per forward pass \n");
+		tileBatchSize = 1;
+	}
+	for (size_t w = 0; w < workers.size(); w++)
+	{
+		detections.insert(detections.end(), workers[w].detections.begin(), workers[w].detections.end());
+	}
+
+	// remove the duplicates of overlapping tiles, complete detections and higher scores first
+	sort(detections.begin(), detections.end(), [](const TileDetection& a, const TileDetection& b)
+	{
+		return (a.cutByTile != b.cutByTile) ? !a.cutByTile : (a.score > b.score);
+	});
+	size_t numKept = 0;
+	for (size_t i = 0; i < detections.size(); i++)
+	{
+		bool keep = true;
+		for (size_t j = 0; j < numKept && keep; j++)
+		{
+			if (detections[j].classId != detections[i].classId)
+			{
+				continue;
+			}
+			double intersection = (detections[j].box & detections[i].box).area();
+			double overlap = intersection / (detections[j].box.area() + detections[i].box.area() - intersection);
+			double containment = intersection / min(detections[j].box.area(), detections[i].box.area());
+			bool croppedDuplicate = detections[i].cutByTile && detections[j].tile != detections[i].tile;
+			keep = (overlap <= TILE_NMS_THRESHOLD && (!croppedDuplicate || containment <= TILE_CONTAINMENT_THRESHOLD));
+		}
+		if (keep)
+		{
+			swap(detections[numKept++], detections[i]);
+		}
+	}
+
+	// draw the stitched detections and masks
+	for (size_t i = 0; i < numKept; i++)
+	{
+		drawBox(frame, detections[i].classId, detections[i].score, detections[i].box, detections[i].mask);
+	}
+}
+
 // For each frame, extract the bounding box and mask for each detected object
 void postprocess(Mat& frame, const vector<Mat>& outs)
 {
@@ -22,9 +22,23 @@
  **********************************************************************************************************************/
 
 // include necessary dependencies
-#include <iostream>
+#include "DnnAutoTuner.h"
+#include "DnnQuantizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "opencv2/opencv.hpp"
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
@@ -33,89 +47,955 @@
 // configuration parameters
 #define NUM_COMNMAND_LINE_ARGUMENTS 1
 #define DISPLAY_WINDOW_NAME "Video Frame"
+#define DEFAULT_BATCH_SIZE 1
+#define DEFAULT_INPUT_SIZE 416
+#define TUNING_TOLERANCE 0.1
+#define MAX_CALIBRATION_FRAMES 32
+#define MODEL_FILE "yolov3-tiny.weights"
+#define CONFIG_FILE "yolov3-tiny.cfg"
+#define CONFIDENCE_THRESHOLD 0.5f
+#define NMS_THRESHOLD 0.4f
+#define DEFAULT_NUM_WORKERS 1
+#define QUEUE_BATCHES_PER_WORKER 2
+
+// policies for handling a full queue
+enum DropPolicy
+{
+    DROP_POLICY_BLOCK,
+    DROP_POLICY_OLDEST,
+    DROP_POLICY_NEWEST
+};
 
 // define the list of class names
 std::vector<std::string> classes;
 
+/*******************************************************************************************************************/ /**
+ * @struct Detection
+ * @brief A detected object, with its box in pixels
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct Detection
+{
+    float left;
+    float top;
+    float width;
+    float height;
+    float score;
+    int classId;
+};
+
+/*******************************************************************************************************************/ /**
+ * @class YoloDetector
+ *
+ * @brief Class for running batched YOLO forward passes and decoding the detections of every output scale
+ *
+ * The names of all unconnected output layers are resolved when the network is loaded, so the detections of every YOLO
+ * head are read instead of only those of the last layer. The detections of all scales are merged before non-maximum
+ * suppression, which also removes duplicates of one object found at several scales. The input blob, the output Mats
+ * and the per frame detection lists are members that keep their storage between calls, so detecting in a sequence of
+ * batches of the same size does not allocate once they have grown.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class YoloDetector
+{
+private:
+    cv::dnn::Net m_network;
+    std::vector<std::string> m_outNames;
+    cv::Size m_inputSize;
+    cv::Mat m_blob;
+    std::vector<cv::Mat> m_outMats;
+    std::vector<std::vector<Detection> > m_detections;
+
+public:
+    bool load(const DnnConfig &config, const DnnQuantizer &quantizer);
+    bool load(const cv::dnn::Net &network, const DnnConfig &config);
+    bool detect(const std::vector<cv::Mat> &images);
+    const std::vector<Detection>& getDetections(int frameIndex) const;
+};
+
 // declare function prototypes
-bool processFrame(const cv::Mat &imageIn, cv::Mat &imageOut);
+int findMaxScore(const float *scores, int count, float &maxScore);
+void decodeDetections(const cv::Mat &outRows, const cv::Size &imageSize, float confThreshold, std::vector<Detection> &detections);
+float computeOverlap(const Detection &a, const Detection &b);
+void suppressOverlaps(std::vector<Detection> &detections, float nmsThreshold);
+void annotateDetections(const std::vector<Detection> &detections, cv::Mat &imageOut);
+void getFrameDetections(const cv::Mat &outMat, int frameIndex, int batchSize, cv::Mat &detections);
+bool processFrames(const std::vector<cv::Mat> &imagesIn, std::vector<cv::Mat> &imagesOut, YoloDetector &detector);
+bool processFrame(const cv::Mat &imageIn, cv::Mat &imageOut, YoloDetector &detector);
+bool loadNetwork(cv::dnn::Net &network);
+void setNetworkInput(cv::dnn::Net &network, const std::vector<cv::Mat> &images, const cv::Size &inputSize, cv::Mat &blob);
+bool tuneNetwork(const cv::Mat &frame, DnnConfig &config);
+void decodeBoxes(const std::vector<cv::Mat> &outputs, std::vector<DetectionBox> &boxes);
+void makeInputBlob(const cv::Mat &frame, const cv::Size &inputSize, cv::Mat &blob);
+void prepareQuantizer(DnnQuantizer &quantizer, const std::string &calibrationDirectory, const cv::Mat &frame, const DnnConfig &config, cv::dnn::Net &network);
+bool parseDropPolicy(const char *name, DropPolicy &policy);
+bool renderFrames(const std::vector<cv::Mat> &frames);
+void runSerial(cv::VideoCapture &capture, YoloDetector &detector, int batchSize);
+void runPipelined(cv::VideoCapture &capture, const DnnConfig &config, const DnnQuantizer &quantizer, const cv::dnn::Net &convertedNetwork, int batchSize, int numWorkers, DropPolicy dropPolicy);
+
+/*******************************************************************************************************************/ /**
+ * @brief Find the highest score in an array of class scores
+ * @param[in] scores the class scores
+ * @param[in] count the number of class scores, at least one
+ * @param[out] maxScore the highest score
+ * @return the index of the first class with the highest score
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int findMaxScore(const float *scores, int count, float &maxScore)
+{
+    int i = 1;
+    float best = scores[0];
+
+#ifdef __SSE2__
+    // reduce four lanes at a time, then across the lanes
+    if (count >= 8)
+    {
+        __m128 maxValues = _mm_loadu_ps(scores);
+        for (i = 4; i + 4 <= count; i += 4)
+        {
+            maxValues = _mm_max_ps(maxValues, _mm_loadu_ps(scores + i));
+        }
+        maxValues = _mm_max_ps(maxValues, _mm_shuffle_ps(maxValues, maxValues, _MM_SHUFFLE(1, 0, 3, 2)));
+        maxValues = _mm_max_ps(maxValues, _mm_shuffle_ps(maxValues, maxValues, _MM_SHUFFLE(2, 3, 0, 1)));
+        best = _mm_cvtss_f32(maxValues);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        best = std::max(best, scores[i]);
+    }
+
+    // locate the winning class
+    maxScore = best;
+    for (i = 0; i < count; i++)
+    {
+        if (scores[i] == best)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Convert the network output rows of a single frame into detections
+ *
+ * Each row holds [center_x, center_y, width, height, objectness, class_1_score, ..., class_N_score] relative to the
+ * image size. The class scores are already scaled by the objectness, so rows whose objectness is below the threshold
+ * are rejected before their class scores are read.
+ *
+ * @param[in] outRows the network output rows of the frame
+ * @param[in] imageSize the size of the frame in pixels
+ * @param[in] confThreshold minimum class score of a detection
+ * @param[in,out] detections the list the detections above the threshold are appended to
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void decodeDetections(const cv::Mat &outRows, const cv::Size &imageSize, float confThreshold, std::vector<Detection> &detections)
+{
+    const int numClasses = outRows.cols - 5;
+    if (numClasses <= 0)
+    {
+        return;
+    }
+
+    for (int j = 0; j < outRows.rows; j++)
+    {
+        const float *row = outRows.ptr<float>(j);
+        if (row[4] < confThreshold)
+        {
+            continue;
+        }
+
+        float score;
+        int classId = findMaxScore(row + 5, numClasses, score);
+        if (score < confThreshold)
+        {
+            continue;
+        }
+
+        Detection detection;
+        detection.width = row[2] * imageSize.width;
+        detection.height = row[3] * imageSize.height;
+        detection.left = row[0] * imageSize.width - detection.width * 0.5f;
+        detection.top = row[1] * imageSize.height - detection.height * 0.5f;
+        detection.score = score;
+        detection.classId = classId;
+        detections.push_back(detection);
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Compute the intersection over union of two detection boxes
+ * @param[in] a the first detection
+ * @param[in] b the second detection
+ * @return the overlap ratio between 0 and 1
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float computeOverlap(const Detection &a, const Detection &b)
+{
+    float intersectWidth = std::min(a.left + a.width, b.left + b.width) - std::max(a.left, b.left);
+    float intersectHeight = std::min(a.top + a.height, b.top + b.height) - std::max(a.top, b.top);
+    if (intersectWidth <= 0.0f || intersectHeight <= 0.0f)
+    {
+        return 0.0f;
+    }
+    float intersection = intersectWidth * intersectHeight;
+    return intersection / (a.width * a.height + b.width * b.height - intersection);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Remove detections that overlap a higher scoring detection of the same class
+ *
+ * The detections are grouped by class with the highest score first, and each detection is compared only against the
+ * detections already kept for its class. The kept detections are compacted in place.
+ *
+ * @param[in,out] detections the detections to filter
+ * @param[in] nmsThreshold overlap ratio above which the lower scoring detection is removed
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void suppressOverlaps(std::vector<Detection> &detections, float nmsThreshold)
+{
+    std::sort(detections.begin(), detections.end(), [](const Detection &a, const Detection &b) {
+        return (a.classId != b.classId) ? (a.classId < b.classId) : (a.score > b.score);
+    });
+
+    size_t numKept = 0;
+    size_t classStart = 0;
+    for (size_t i = 0; i < detections.size(); i++)
+    {
+        const Detection candidate = detections[i];
+        if (numKept == 0 || detections[numKept - 1].classId != candidate.classId)
+        {
+            classStart = numKept;
+        }
+
+        bool keep = true;
+        for (size_t j = classStart; j < numKept && keep; j++)
+        {
+            keep = computeOverlap(detections[j], candidate) <= nmsThreshold;
+        }
+        if (keep)
+        {
+            detections[numKept++] = candidate;
+        }
+    }
+    detections.resize(numKept);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Draw the detections of a single frame
+ * @param[in] detections the detections of the frame
+ * @param[in,out] imageOut the image frame to annotate
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void annotateDetections(const std::vector<Detection> &detections, cv::Mat &imageOut)
+{
+    char label[64];
+    for (size_t i = 0; i < detections.size(); i++)
+    {
+        const Detection &detection = detections[i];
+        cv::Rect box(cvRound(detection.left), cvRound(detection.top), cvRound(detection.width), cvRound(detection.height));
+
+        // annotate the image with the class name and score
+        const char *className = (detection.classId < static_cast<int>(classes.size())) ? classes.at(detection.classId).c_str() : "?";
+        std::snprintf(label, sizeof(label), "%s %.2f", className, detection.score);
+        cv::putText(imageOut, label, cv::Point(box.x, box.y), 1, 2, cv::Scalar(0, 255, 255), 2, false);
+        cv::rectangle(imageOut, box, cv::Scalar(0, 128, 255), 2, 8, 0);
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Get the detection rows of one frame from the output of a batched forward pass
+ *
+ * The region layer returns a 3D [batch, rows, cols] output for batches of more than one frame, and a 2D [rows, cols]
+ * output otherwise. The detections refer to the output data without copying it.
+ *
+ * @param[in] outMat the network output
+ * @param[in] frameIndex the index of the frame within the batch
+ * @param[in] batchSize the number of frames in the batch
+ * @param[out] detections the detection rows of the frame
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void getFrameDetections(const cv::Mat &outMat, int frameIndex, int batchSize, cv::Mat &detections)
+{
+    if (outMat.dims == 3)
+    {
+        detections = cv::Mat(outMat.size[1], outMat.size[2], CV_32F, const_cast<float*>(outMat.ptr<float>(frameIndex)));
+    }
+    else
+    {
+        int rowsPerFrame = outMat.rows / batchSize;
+        detections = outMat.rowRange(frameIndex * rowsPerFrame, (frameIndex + 1) * rowsPerFrame);
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Load the network, apply its configuration and precision and resolve the names of its output layers
+ * @param[in] config the backend, target and input size to use
+ * @param[in] quantizer the calibrated quantizer selecting the precision
+ * @return true if the network was loaded successfully
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool YoloDetector::load(const DnnConfig &config, const DnnQuantizer &quantizer)
+{
+    if (!loadNetwork(m_network))
+    {
+        return false;
+    }
+    DnnConfig converted = config;
+    DnnAutoTuner::applyConfig(m_network, config);
+    if (!quantizer.apply(m_network, converted))
+    {
+        return false;
+    }
+    m_inputSize = config.inputSize;
+    m_outNames = m_network.getUnconnectedOutLayersNames();
+    return !m_outNames.empty();
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Use a network that is already loaded and converted, such as the one calibrated by prepareQuantizer
+ * @param[in] network the configured network, which must not be used by any other detector
+ * @param[in] config the configuration holding the input size
+ * @return true if the output layers of the network were resolved
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool YoloDetector::load(const cv::dnn::Net &network, const DnnConfig &config)
+{
+    m_network = network;
+    m_inputSize = config.inputSize;
+    m_outNames = m_network.getUnconnectedOutLayersNames();
+    return !m_outNames.empty();
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Detect the objects in a batch of image frames with a single forward pass
+ * @param[in] images the input image frames
+ * @return true if the frames were processed successfully
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool YoloDetector::detect(const std::vector<cv::Mat> &images)
+{
+    const int batchSize = static_cast<int>(images.size());
+    if (batchSize == 0)
+    {
+        return false;
+    }
+
+    // set the input blob from all of the image frames
+    setNetworkInput(m_network, images, m_inputSize, m_blob);
+
+    // feed forward the inputs through the network once for the whole batch, reading every output scale
+    m_network.forward(m_outMats, m_outNames);
+
+    // merge the detections of all scales for each frame, growing the lists only when the batch size grows
+    if (m_detections.size() < images.size())
+    {
+        m_detections.resize(images.size());
+    }
+    for (int i = 0; i < batchSize; i++)
+    {
+        std::vector<Detection> &detections = m_detections.at(i);
+        detections.clear();
+        for (size_t j = 0; j < m_outMats.size(); j++)
+        {
+            cv::Mat outRows;
+            getFrameDetections(m_outMats.at(j), i, batchSize, outRows);
+            decodeDetections(outRows, images.at(i).size(), CONFIDENCE_THRESHOLD, detections);
+        }
+        suppressOverlaps(detections, NMS_THRESHOLD);
+    }
+
+    return true;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Get the detections of one frame of the last batch
+ * @param[in] frameIndex the index of the frame within the batch
+ * @return the detections of the frame after non-maximum suppression
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const std::vector<Detection>& YoloDetector::getDetections(int frameIndex) const
+{
+    return m_detections.at(frameIndex);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Process a batch of image frames with a single forward pass
+ * @param[in] imagesIn the input image frames
+ * @param[out] imagesOut the processed image frames, in the same order
+ * @param[in] detector the loaded detector
+ * @return true if the frames were processed successfully
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool processFrames(const std::vector<cv::Mat> &imagesIn, std::vector<cv::Mat> &imagesOut, YoloDetector &detector)
+{
+    imagesOut.resize(imagesIn.size());
+    if (!detector.detect(imagesIn))
+    {
+        return false;
+    }
+
+    // annotate each frame with its detections
+    for (size_t i = 0; i < imagesIn.size(); i++)
+    {
+        // copy the input image frame to the ouput image (deep copy)
+        imagesOut.at(i) = imagesIn.at(i).clone();
+        annotateDetections(detector.getDetections(static_cast<int>(i)), imagesOut.at(i));
+    }
+
+    // return true on success
+    return true;
+}
 
 /*******************************************************************************************************************/ /**
  * @brief Process a single image frame
  * @param[in] imageIn the input image frame
  * @param[out] imageOut the processed image frame
- * @param[in] network input DNN network
+ * @param[in] detector the loaded detector
  * @return true if frame was processed successfully
  * @author Christopher D. McMurrough
  **********************************************************************************************************************/
-bool processFrame(const cv::Mat &imageIn, cv::Mat &imageOut, cv::dnn::Net &network)
+bool processFrame(const cv::Mat &imageIn, cv::Mat &imageOut, YoloDetector &detector)
+{
+    std::vector<cv::Mat> imagesOut;
+    if (!processFrames(std::vector<cv::Mat>(1, imageIn), imagesOut, detector))
+    {
+        return false;
+    }
+    imageOut = imagesOut.at(0);
+    return true;
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Load the YOLO network
+ * @param[out] network the loaded network
+ * @return true if the network was loaded successfully
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool loadNetwork(cv::dnn::Net &network)
 {
-    // copy the input image frame to the ouput image (deep copy)
-    imageOut = imageIn.clone();
+    std::string model_file = MODEL_FILE;
+    std::string config_file = CONFIG_FILE;
+    network = cv::dnn::readNet(model_file, config_file, "Darknet");
+    return !network.empty();
+}
 
-    // create the input DNN blob from the image frame
-    static cv::Mat blobFromImg;
+/*******************************************************************************************************************/ /**
+ * @brief Create the 4D input blob from a batch of image frames and set it as the network input
+ * @param[in,out] network the network
+ * @param[in] images the input image frames
+ * @param[in] inputSize the network input size
+ * @param[out] blob the input blob, which keeps its storage between calls
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void setNetworkInput(cv::dnn::Net &network, const std::vector<cv::Mat> &images, const cv::Size &inputSize, cv::Mat &blob)
+{
+    // create the 4D input DNN blob from all of the image frames
     const double scaleFactor = 1.0;
-    const cv::Size size = cv::Size(416, 416);
     const cv::Scalar mean = cv::Scalar();
     const bool swapRB = false;
     const bool crop = false;
-    const int ddepth = CV_32F;
-    cv::dnn::blobFromImage(imageIn, blobFromImg, scaleFactor, size, mean, swapRB, crop);
+    cv::dnn::blobFromImages(images, blob, scaleFactor, inputSize, mean, swapRB, crop);
 
     // set the blob as input to the network
     const float blob_scale = 1.0 / 255.0;
     const cv::Scalar blob_mean = 0;
-    network.setInput(blobFromImg, "", blob_scale, blob_mean);
+    network.setInput(blob, "", blob_scale, blob_mean);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Choose the backend, target and input size of the network, benchmarking them if no decision is cached
+ * @param[in] frame a representative input frame
+ * @param[out] config the chosen configuration
+ * @return true if a configuration was chosen
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool tuneNetwork(const cv::Mat &frame, DnnConfig &config)
+{
+    // the default input size is the accuracy reference, smaller multiples of the network stride are faster
+    std::vector<cv::Size> inputSizes;
+    const int sizes[] = {DEFAULT_INPUT_SIZE, 352, 320, 288};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        inputSizes.push_back(cv::Size(sizes[i], sizes[i]));
+    }
+
+    DnnAutoTuner tuner(MODEL_FILE);
+    tuner.setInputSizes(inputSizes);
+    tuner.setAccuracyTolerance(TUNING_TOLERANCE);
+    tuner.setFrame(frame);
+
+    cv::Mat blob;
+    DnnAutoTuner::InputSetter setInput = [&blob](cv::dnn::Net &network, const cv::Mat &image, const cv::Size &inputSize) {
+        setNetworkInput(network, std::vector<cv::Mat>(1, image), inputSize, blob);
+    };
+
+    return tuner.tune(loadNetwork, setInput, decodeBoxes, config);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Convert the network outputs of a single frame into detections relative to the frame size
+ * @param[in] outputs the outputs of every scale
+ * @param[out] boxes the detections after non-maximum suppression, appended to the list
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void decodeBoxes(const std::vector<cv::Mat> &outputs, std::vector<DetectionBox> &boxes)
+{
+    // decode the detections of all scales relative to a unit image size
+    static thread_local std::vector<Detection> detections;
+    detections.clear();
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        cv::Mat outRows;
+        getFrameDetections(outputs.at(i), 0, 1, outRows);
+        decodeDetections(outRows, cv::Size(1, 1), CONFIDENCE_THRESHOLD, detections);
+    }
+    suppressOverlaps(detections, NMS_THRESHOLD);
+    for (size_t i = 0; i < detections.size(); i++)
+    {
+        DetectionBox box;
+        box.box = cv::Rect2f(detections.at(i).left, detections.at(i).top, detections.at(i).width, detections.at(i).height);
+        box.classId = detections.at(i).classId;
+        boxes.push_back(box);
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Create the exact network input blob of a single frame, with the pixel scaling applied
+ * @param[in] frame the input image frame
+ * @param[in] inputSize the network input size
+ * @param[out] blob the input blob
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void makeInputBlob(const cv::Mat &frame, const cv::Size &inputSize, cv::Mat &blob)
+{
+    cv::dnn::blobFromImage(frame, blob, 1.0 / 255.0, inputSize, cv::Scalar(), false, false);
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Calibrate the reduced precision network and report its accuracy and speed against full precision
+ * @param[in,out] quantizer the quantizer, reset to full precision if the conversion is not possible
+ * @param[in] calibrationDirectory directory of sample frames, or empty to calibrate on the given frame
+ * @param[in] frame a representative input frame
+ * @param[in] config the full precision network configuration
+ * @param[out] network the converted network, left empty at full precision
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void prepareQuantizer(DnnQuantizer &quantizer, const std::string &calibrationDirectory, const cv::Mat &frame, const DnnConfig &config, cv::dnn::Net &network)
+{
+    if (quantizer.getPrecision() == DNN_PRECISION_FP32)
+    {
+        return;
+    }
 
-    // feed forward the inputs through the network
-    cv::Mat outMat;
-    network.forward(outMat);
+    // read the calibration frames
+    int numFrames = calibrationDirectory.empty() ? 0 : quantizer.loadCalibrationFrames(calibrationDirectory, MAX_CALIBRATION_FRAMES);
+    if (numFrames == 0)
+    {
+        std::printf("No calibration frames read, calibrating on the first video frame \n");
+        quantizer.addCalibrationFrame(frame);
+    }
+    quantizer.prepare(makeInputBlob, config.inputSize);
 
-    // reach row represents one result per detected object
-    int numRows = outMat.rows;
+    // convert a second copy of the network and compare it with the full precision one
+    cv::dnn::Net reference;
+    DnnConfig converted = config;
+    if (!loadNetwork(reference) || !loadNetwork(network))
+    {
+        quantizer.setPrecision(DNN_PRECISION_FP32);
+        network = cv::dnn::Net();
+        return;
+    }
+    DnnAutoTuner::applyConfig(reference, config);
+    DnnAutoTuner::applyConfig(network, config);
+    if (!quantizer.apply(network, converted))
+    {
+        quantizer.setPrecision(DNN_PRECISION_FP32);
+        network = cv::dnn::Net();
+        return;
+    }
+    quantizer.compare(reference, network, reference.getUnconnectedOutLayersNames(), decodeBoxes);
+    std::printf("Running at %s on %s / %s \n", DnnQuantizer::getPrecisionName(quantizer.getPrecision()), DnnAutoTuner::getBackendName(converted.backend).c_str(), DnnAutoTuner::getTargetName(converted.target).c_str());
+}
 
-    // column arrangement:
-    // [x, y, w, h, class_1_score, class_2_score, ..., ... class_N_score]
-    int numCols = outMat.cols;
-    for (int j = 0; j < numRows; ++j)
+/*******************************************************************************************************************/ /**
+ * @brief Parse the name of a queue drop policy
+ * @param[in] name the policy name, one of "block", "oldest" or "newest"
+ * @param[out] policy the parsed policy
+ * @return true if the name is valid
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool parseDropPolicy(const char *name, DropPolicy &policy)
+{
+    if (std::strcmp(name, "block") == 0)
+    {
+        policy = DROP_POLICY_BLOCK;
+    }
+    else if (std::strcmp(name, "oldest") == 0)
+    {
+        policy = DROP_POLICY_OLDEST;
+    }
+    else if (std::strcmp(name, "newest") == 0)
+    {
+        policy = DROP_POLICY_NEWEST;
+    }
+    else
     {
-        // get scores for each possible class (starting at element 5)
-        cv::Mat scores = outMat.row(j).colRange(5, numCols);
+        return false;
+    }
+    return true;
+}
 
-        // find indexes of min and max confidence and related index of element.
-        cv::Point maxPos;
-        double confidence;
-        cv::minMaxLoc(scores, 0, &confidence, 0, &maxPos);
+/*******************************************************************************************************************/ /**
+ * @brief Display a sequence of processed frames
+ * @param[in] frames the frames to display, in order
+ * @return false if the user requested program termination
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool renderFrames(const std::vector<cv::Mat> &frames)
+{
+    bool keepRunning = true;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        cv::imshow(DISPLAY_WINDOW_NAME, frames.at(i));
 
-        // consider only scores above a minimum threshold
-        const double minConfidence = 0.0001;
-        if (confidence > minConfidence)
+        // check for program termination
+        if (((char)cv::waitKey(1)) == 'q')
         {
-            // parse the coordinates and parameters of this result
-            int center_x = (int)(outMat.at<float>(j, 0) * imageOut.cols);
-            int center_y = (int)(outMat.at<float>(j, 1) * imageOut.rows);
-            int width = (int)(outMat.at<float>(j, 2) * imageOut.cols + 20);
-            int height = (int)(outMat.at<float>(j, 3) * imageOut.rows + 100);
+            keepRunning = false;
+        }
+    }
+    return keepRunning;
+}
+
+/*******************************************************************************************************************/ /**
+ * @struct FrameBatch
+ * @brief A batch of consecutive video frames passed between the pipeline stages
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct FrameBatch
+{
+    long long sequence;
+    std::vector<cv::Mat> frames;
+};
+
+/*******************************************************************************************************************/ /**
+ * @class BoundedQueue
+ *
+ * @brief Thread safe FIFO queue with a fixed capacity
+ *
+ * When the queue is full, push() either waits for space (DROP_POLICY_BLOCK), discards the oldest queued item to make
+ * room (DROP_POLICY_OLDEST), or discards the pushed item (DROP_POLICY_NEWEST). After close(), push() fails and pop()
+ * returns the remaining items and then fails, which lets each stage shut down once its input has been drained.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+template <typename T>
+class BoundedQueue
+{
+private:
+    std::deque<T> m_items;
+    size_t m_capacity;
+    DropPolicy m_dropPolicy;
+    bool m_closed;
+    size_t m_dropCount;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+
+public:
+    BoundedQueue(size_t capacity, DropPolicy dropPolicy) : m_capacity(std::max(capacity, (size_t)1)), m_dropPolicy(dropPolicy), m_closed(false), m_dropCount(0)
+    {
+    }
 
-            // calculate top left
-            int left = center_x - width / 2;
-            int top = center_y - height / 2;
+    // add an item, returning false if the item was discarded or the queue is closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_dropPolicy == DROP_POLICY_BLOCK)
+        {
+            m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+        }
+        if (m_closed)
+        {
+            return false;
+        }
+        if (m_items.size() >= m_capacity)
+        {
+            m_dropCount++;
+            if (m_dropPolicy == DROP_POLICY_NEWEST)
+            {
+                return false;
+            }
+            m_items.pop_front();
+        }
+        m_items.push_back(std::move(item));
+        lock.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
 
-            // annotate the image
-            std::stringstream ss;
-            ss << classes.at(maxPos.x);
-            std::string clas = ss.str();
-            cv::putText(imageOut, clas, cv::Point(left, top), 1, 2, cv::Scalar(0, 255, 255), 2, false);
-            std::stringstream ss2;
-            ss << confidence;
-            std::string conf = ss.str();
-            cv::rectangle(imageOut, cv::Rect(left, top, width, height), cv::Scalar(0, 128, 255), 2, 8, 0);
+    // remove the oldest item, waiting for one if needed, returning false once the queue is closed and empty
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+        {
+            return false;
         }
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        lock.unlock();
+        m_notFull.notify_one();
+        return true;
     }
 
-    // return true on success
-    return true;
+    // stop accepting items and wake all waiting threads
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    // discard the queued items, used when the consumer stops early
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.clear();
+        m_notFull.notify_all();
+    }
+
+    size_t getDropCount()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropCount;
+    }
+};
+
+/*******************************************************************************************************************/ /**
+ * @brief Process frames from a video source one batch at a time on the calling thread
+ * @param[in] capture the opened video source
+ * @param[in] detector the loaded detector
+ * @param[in] batchSize number of frames processed by each forward pass
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void runSerial(cv::VideoCapture &capture, YoloDetector &detector, int batchSize)
+{
+    // process data until program termination
+    bool doCapture = true;
+    int frameCount = 0;
+    double totalTime = 0.0;
+    std::vector<cv::Mat> captureFrames;
+    std::vector<cv::Mat> processedFrames;
+    while (doCapture)
+    {
+        // get the start time
+        double startTicks = static_cast<double>(cv::getTickCount());
+
+        // attempt to acquire a batch of image frames, each into its own buffer
+        captureFrames.clear();
+        for (int i = 0; i < batchSize; i++)
+        {
+            cv::Mat captureFrame;
+            if (!capture.read(captureFrame))
+            {
+                doCapture = false;
+                break;
+            }
+            captureFrames.push_back(captureFrame);
+        }
+        if (captureFrames.empty())
+        {
+            std::printf("Unable to acquire image frame! \n");
+            break;
+        }
+
+        // process the image frames
+        processFrames(captureFrames, processedFrames, detector);
+
+        // increment the frame counter
+        frameCount += static_cast<int>(captureFrames.size());
+
+        // update the GUI window with each frame of the batch
+        if (!renderFrames(processedFrames))
+        {
+            doCapture = false;
+        }
+
+        // compute the frame processing time
+        double endTicks = static_cast<double>(cv::getTickCount());
+        double elapsedTime = (endTicks - startTicks) / cv::getTickFrequency();
+        totalTime += elapsedTime;
+        std::cout << "Frame processing time: " << elapsedTime / captureFrames.size() << std::endl;
+    }
+
+    // report the overall throughput
+    if (totalTime > 0.0)
+    {
+        std::cout << "Processed " << frameCount << " frames in " << totalTime << " seconds (" << frameCount / totalTime << " fps, batch size " << batchSize << ")" << std::endl;
+    }
+}
+
+/*******************************************************************************************************************/ /**
+ * @brief Process frames from a video source with decoding, inference and rendering running concurrently
+ *
+ * A decode thread reads batches of frames into a bounded queue, each inference worker owns a detector and moves
+ * processed batches into a second bounded queue, and the calling thread renders them, since the HighGUI window
+ * functions must stay on one thread. With DROP_POLICY_BLOCK every frame is rendered in capture order; otherwise full
+ * queues discard batches and batches that arrive behind a newer one are skipped, which keeps the display current when
+ * inference cannot keep up with the source.
+ *
+ * @param[in] capture the opened video source
+ * @param[in] config the backend, target and input size of the networks
+ * @param[in] quantizer the calibrated quantizer selecting the precision of the networks
+ * @param[in] convertedNetwork the network converted by prepareQuantizer, used by the first worker, or empty
+ * @param[in] batchSize number of frames processed by each forward pass
+ * @param[in] numWorkers number of inference threads
+ * @param[in] dropPolicy policy applied to both queues when they are full
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void runPipelined(cv::VideoCapture &capture, const DnnConfig &config, const DnnQuantizer &quantizer, const cv::dnn::Net &convertedNetwork, int batchSize, int numWorkers, DropPolicy dropPolicy)
+{
+    // load one detector per worker, since a network can not run forward passes from several threads
+    std::vector<YoloDetector> detectors(numWorkers);
+    for (int i = 0; i < numWorkers; i++)
+    {
+        bool loaded = (i == 0 && !convertedNetwork.empty()) ? detectors.at(i).load(convertedNetwork, config) : detectors.at(i).load(config, quantizer);
+        if (!loaded)
+        {
+            std::printf("Unable to load the network, terminating program! \n");
+            return;
+        }
+    }
+
+    // create the queues between the stages
+    const size_t queueCapacity = static_cast<size_t>(numWorkers) * QUEUE_BATCHES_PER_WORKER;
+    BoundedQueue<FrameBatch> decodeQueue(queueCapacity, dropPolicy);
+    BoundedQueue<FrameBatch> renderQueue(queueCapacity, dropPolicy);
+
+    // per stage busy times in ticks
+    std::atomic<long long> decodeTicks(0);
+    std::atomic<long long> inferenceTicks(0);
+    long long renderTicks = 0;
+    std::atomic<int> activeWorkers(numWorkers);
+    std::atomic<bool> stopRequested(false);
+    double startTicks = static_cast<double>(cv::getTickCount());
+
+    // read batches of frames until the end of the source or until the queue is closed
+    std::thread decodeThread([&]() {
+        bool doCapture = true;
+        long long sequence = 0;
+        while (doCapture && !stopRequested)
+        {
+            long long batchStartTicks = cv::getTickCount();
+            FrameBatch batch;
+            batch.sequence = sequence++;
+            for (int i = 0; i < batchSize; i++)
+            {
+                cv::Mat captureFrame;
+                if (!capture.read(captureFrame))
+                {
+                    doCapture = false;
+                    break;
+                }
+                batch.frames.push_back(captureFrame);
+            }
+            decodeTicks += cv::getTickCount() - batchStartTicks;
+            if (batch.frames.empty())
+            {
+                break;
+            }
+            decodeQueue.push(std::move(batch));
+        }
+        decodeQueue.close();
+    });
+
+    // run the forward passes, closing the render queue when the last worker finishes
+    std::vector<std::thread> workerThreads;
+    for (int w = 0; w < numWorkers; w++)
+    {
+        workerThreads.push_back(std::thread([&, w]() {
+            FrameBatch batch;
+            while (!stopRequested && decodeQueue.pop(batch))
+            {
+                long long batchStartTicks = cv::getTickCount();
+                FrameBatch result;
+                result.sequence = batch.sequence;
+                processFrames(batch.frames, result.frames, detectors.at(w));
+                inferenceTicks += cv::getTickCount() - batchStartTicks;
+                renderQueue.push(std::move(result));
+            }
+            if (--activeWorkers == 0)
+            {
+                renderQueue.close();
+            }
+        }));
+    }
+
+    // render the batches on this thread, restoring the capture order of batches finished by different workers
+    std::map<long long, FrameBatch> pending;
+    long long nextSequence = 0;
+    size_t framesRendered = 0;
+    size_t lateBatches = 0;
+    bool doRender = true;
+    FrameBatch batch;
+    while (doRender && renderQueue.pop(batch))
+    {
+        long long batchStartTicks = cv::getTickCount();
+        if (dropPolicy == DROP_POLICY_BLOCK)
+        {
+            pending[batch.sequence] = std::move(batch);
+            while (doRender && !pending.empty() && pending.begin()->first == nextSequence)
+            {
+                doRender = renderFrames(pending.begin()->second.frames);
+                framesRendered += pending.begin()->second.frames.size();
+                pending.erase(pending.begin());
+                nextSequence++;
+            }
+        }
+        else if (batch.sequence < nextSequence)
+        {
+            lateBatches++;
+        }
+        else
+        {
+            doRender = renderFrames(batch.frames);
+            framesRendered += batch.frames.size();
+            nextSequence = batch.sequence + 1;
+        }
+        renderTicks += cv::getTickCount() - batchStartTicks;
+    }
+
+    // stop the other stages if rendering ended early, then wait for them
+    stopRequested = true;
+    decodeQueue.close();
+    renderQueue.close();
+    decodeQueue.clear();
+    renderQueue.clear();
+    decodeThread.join();
+    for (size_t i = 0; i < workerThreads.size(); i++)
+    {
+        workerThreads.at(i).join();
+    }
+
+    // report the overall throughput and the time spent in each stage
+    double totalTime = (static_cast<double>(cv::getTickCount()) - startTicks) / cv::getTickFrequency();
+    if (totalTime > 0.0)
+    {
+        double tickScale = 1.0 / cv::getTickFrequency();
+        std::cout << "Rendered " << framesRendered << " frames in " << totalTime << " seconds (" << framesRendered / totalTime << " fps, batch size " << batchSize << ", " << numWorkers << " workers)" << std::endl;
+        std::cout << "Stage busy time: decode " << decodeTicks * tickScale << ", inference " << inferenceTicks * tickScale / numWorkers << " per worker, render " << renderTicks * tickScale << " seconds" << std::endl;
+    }
+    if (dropPolicy != DROP_POLICY_BLOCK)
+    {
+        std::cout << "Dropped batches: decode queue " << decodeQueue.getDropCount() << ", render queue " << renderQueue.getDropCount() << ", late " << lateBatches << std::endl;
+    }
 }
 
 /*******************************************************************************************************************/ /**
@@ -129,16 +1009,40 @@ int main(int argc, char **argv)
 {
     // store video capture parameters
     std::string videoFileName;
+    int batchSize = DEFAULT_BATCH_SIZE;
+    int numWorkers = DEFAULT_NUM_WORKERS;
+    DropPolicy dropPolicy = DROP_POLICY_BLOCK;
+    DnnPrecision precision = DNN_PRECISION_FP32;
+    std::string calibrationDirectory;
 
     // validate and parse the command line arguments
-    if (argc != NUM_COMNMAND_LINE_ARGUMENTS + 1)
+    if (argc < NUM_COMNMAND_LINE_ARGUMENTS + 1 || argc > NUM_COMNMAND_LINE_ARGUMENTS + 6 || (argc >= NUM_COMNMAND_LINE_ARGUMENTS + 4 && !parseDropPolicy(argv[4], dropPolicy)) || (argc >= NUM_COMNMAND_LINE_ARGUMENTS + 5 && !DnnQuantizer::parsePrecision(argv[5], precision)))
     {
-        std::printf("USAGE: %s <file_path> \n", argv[0]);
+        std::printf("USAGE: %s <file_path> [batch_size] [num_workers] [drop_policy] [precision] [calibration_dir] \n", argv[0]);
+        std::printf("    batch_size: number of frames processed by each forward pass (default: %d)\n", DEFAULT_BATCH_SIZE);
+        std::printf("    num_workers: number of inference threads, 0 processes frames serially (default: %d)\n", DEFAULT_NUM_WORKERS);
+        std::printf("    drop_policy: block, oldest or newest, frames dropped when a pipeline queue is full (default: block)\n");
+        std::printf("    precision: fp32, fp16 or int8 (default: fp32)\n");
+        std::printf("        fp16 needs the DNN_TARGET_CPU_FP16 target, which is ARM only, or an OpenCL FP16 device, and falls back to fp32 otherwise (as on most x86 machines)\n");
+        std::printf("        int8 is calibrated once and runs with a single inference worker, since a quantized network can not be copied\n");
+        std::printf("    calibration_dir: directory of sample frames for int8 calibration and the accuracy report (default: first video frame)\n");
         return 0;
     }
     else
     {
         videoFileName = argv[1];
+        if (argc >= NUM_COMNMAND_LINE_ARGUMENTS + 2)
+        {
+            batchSize = std::max(atoi(argv[2]), 1);
+        }
+        if (argc >= NUM_COMNMAND_LINE_ARGUMENTS + 3)
+        {
+            numWorkers = std::max(atoi(argv[3]), 0);
+        }
+        if (argc >= NUM_COMNMAND_LINE_ARGUMENTS + 6)
+        {
+            calibrationDirectory = argv[6];
+        }
     }
 
     // open the video file
@@ -155,16 +1059,34 @@ int main(int argc, char **argv)
     int captureFPS = static_cast<int>(capture.get(cv::CAP_PROP_FPS));
     std::cout << "Video source opened successfully (width=" << captureWidth << " height=" << captureHeight << " fps=" << captureFPS << ")!" << std::endl;
 
+    // choose the network configuration using the first frame, then rewind the source
+    cv::Mat tuningFrame;
+    DnnConfig config;
+    capture.read(tuningFrame);
+    capture.set(cv::CAP_PROP_POS_FRAMES, 0);
+    if (!tuneNetwork(tuningFrame, config))
+    {
+        std::printf("Unable to load the network, terminating program! \n");
+        return 0;
+    }
+
+    // calibrate the reduced precision network if one was requested
+    DnnQuantizer quantizer;
+    cv::dnn::Net convertedNetwork;
+    quantizer.setPrecision(precision);
+    prepareQuantizer(quantizer, calibrationDirectory, tuningFrame, config, convertedNetwork);
+
+    // calibrating INT8 runs the network over every calibration frame, so the one calibrated network is reused rather than
+    // quantizing another copy for each worker
+    if (quantizer.getPrecision() == DNN_PRECISION_INT8 && numWorkers > 1)
+    {
+        std::printf("Running the INT8 network with a single inference worker \n");
+        numWorkers = 1;
+    }
+
     // create image window
     cv::namedWindow(DISPLAY_WINDOW_NAME, cv::WINDOW_AUTOSIZE);
 
-    // initialize YOLO
-    std::string model_file = "yolov3-tiny.weights";
-    std::string config_file = "yolov3-tiny.cfg";
-    cv::dnn::Net network = cv::dnn::readNet(model_file, config_file, "Darknet");
-    network.setPreferableBackend(cv::dnn::DNN_BACKEND_DEFAULT);
-    network.setPreferableTarget(cv::dnn::DNN_TARGET_OPENCL);
-    
     // load the class label names
     std::string classes_file = "mscoco_labels.names.txt";
     std::ifstream ifs(classes_file.c_str());
@@ -172,49 +1094,21 @@ int main(int argc, char **argv)
     while(std::getline(ifs, line)) classes.push_back(line);
 
     // process data until program termination
-    bool doCapture = true;
-    int frameCount = 0;
-    while (doCapture)
+    if (numWorkers == 0)
     {
-        // get the start time
-        double startTicks = static_cast<double>(cv::getTickCount());
-
-        // attempt to acquire and process an image frame
-        cv::Mat captureFrame;
-        cv::Mat processedFrame;
-        bool captureSuccess = capture.read(captureFrame);
-        if (captureSuccess)
-        {
-            // process the image frame
-            processFrame(captureFrame, processedFrame, network);
-
-            // increment the frame counter
-            frameCount++;
-        }
-        else
-        {
-            std::printf("Unable to acquire image frame! \n");
-        }
-
-        // update the GUI window if necessary
-        if (captureSuccess)
+        // initialize YOLO
+        YoloDetector detector;
+        bool loaded = convertedNetwork.empty() ? detector.load(config, quantizer) : detector.load(convertedNetwork, config);
+        if (!loaded)
         {
-            cv::imshow(DISPLAY_WINDOW_NAME, processedFrame);
-
-            // get the number of milliseconds per frame
-            int delayMs = (1.0 / captureFPS) * 1000;
-
-            // check for program termination
-            if (((char)cv::waitKey(1)) == 'q')
-            {
-                doCapture = false;
-            }
+            std::printf("Unable to load the network, terminating program! \n");
+            return 0;
         }
-
-        // compute the frame processing time
-        double endTicks = static_cast<double>(cv::getTickCount());
-        double elapsedTime = (endTicks - startTicks) / cv::getTickFrequency();
-        std::cout << "Frame processing time: " << elapsedTime << std::endl;
+        runSerial(capture, detector, batchSize);
+    }
+    else
+    {
+        runPipelined(capture, config, quantizer, convertedNetwork, batchSize, numWorkers, dropPolicy);
     }
 
     // release program resources before returning
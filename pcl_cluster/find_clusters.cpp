@@ -24,6 +24,12 @@
 **********************************************************************************************************************/
 
 #include "CloudVisualizer.h"
+#include "CloudIO.h"
+#include "ParallelVoxelGrid.h"
+#include "ParallelOutlierRemoval.h"
+#include "ParallelClusterExtraction.h"
+#include "SpatialIndexCache.h"
+#include "PointBuffer.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -32,14 +38,24 @@
 #include <pcl/common/time.h>
 
 #include <pcl/filters/voxel_grid.h>
+#include <pcl/filters/statistical_outlier_removal.h>
 
 #include <pcl/kdtree/kdtree_flann.h>
 #include <pcl/kdtree/io.h>
 #include <pcl/segmentation/euclidean_cluster_comparator.h>
 #include <pcl/segmentation/extract_clusters.h>
 
+#include <sstream>
+
 #define NUM_COMMAND_ARGS 1
 
+// processing engines selectable from the command line, combined as bit flags, no flags runs the PCL baseline
+#define ENGINE_PARALLEL_VOXEL_GRID 1
+#define ENGINE_PARALLEL_CLUSTERING 2
+#define ENGINE_CACHED_SEARCH_TREE 4
+#define ENGINE_PARALLEL_OUTLIERS 8
+#define ENGINE_PCL_OUTLIERS 16
+
 using namespace std;
 
 // function prototypes
@@ -99,56 +115,6 @@ void keyboardCallback(const pcl::visualization::KeyboardEvent &event, void* view
     }
 }
 
-/***********************************************************************************************************************
-* @brief Opens a point cloud file
-*
-* Opens a point cloud file in either PCD or PLY format
-*
-* @param[out] cloudOut pointer to opened point cloud
-* @param[in] filename path and name of input file
-* @return false if an error occurred while opening file
-* @author Christopher D. McMurrough
-**********************************************************************************************************************/
-bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fileName)
-{
-    // convert the file name to string
-    std::string fileNameStr(fileName);
-
-    // handle various file types
-    std::string fileExtension = fileNameStr.substr(fileNameStr.find_last_of(".") + 1);
-    if(fileExtension.compare("pcd") == 0)
-    {
-        // attempt to open the file
-        if(pcl::io::loadPCDFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcd file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
-        {
-            return true;
-        }
-    }
-    else if(fileExtension.compare("ply") == 0)
-    {
-        // attempt to open the file
-        if(pcl::io::loadPLYFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcl file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
-        {
-            return true;
-        }
-    }
-    else
-    {
-        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileNameStr.c_str());
-        return false;
-    }
-}
-
 /***********************************************************************************************************************
 * @brief program entry point
 * @param[in] argc number of command line arguments
@@ -159,14 +125,22 @@ bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fi
 int main(int argc, char** argv)
 {
     // validate and parse the command line arguments
-    if(argc != NUM_COMMAND_ARGS + 1)
+    if(argc != NUM_COMMAND_ARGS + 1 && argc != NUM_COMMAND_ARGS + 2)
     {
-        std::printf("USAGE: %s <file_name>\n", argv[0]);
+        std::printf("USAGE: %s <file_name> [engines]\n", argv[0]);
+        std::printf("    engines: sum of the stages to replace or add, 0 runs the PCL baseline (default)\n");
+        std::printf("        %d: multithreaded voxel grid, %d: multithreaded clustering, %d: cached search tree for PCL clustering\n", ENGINE_PARALLEL_VOXEL_GRID, ENGINE_PARALLEL_CLUSTERING, ENGINE_CACHED_SEARCH_TREE);
+        std::printf("        %d: multithreaded outlier removal, %d: PCL outlier removal\n", ENGINE_PARALLEL_OUTLIERS, ENGINE_PCL_OUTLIERS);
         return 0;
     }
 
     // parse the command line arguments
     char* fileName = argv[1];
+    int engines = 0;
+    if(argc == NUM_COMMAND_ARGS + 2)
+    {
+        engines = atoi(argv[2]);
+    }
 
     // create a stop watch for measuring time
     pcl::StopWatch watch;
@@ -184,12 +158,51 @@ int main(int argc, char** argv)
     // downsample the cloud using a voxel grid filter
     const float voxelSize = 0.01;
     pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloudFiltered(new pcl::PointCloud<pcl::PointXYZRGBA>);
-    pcl::VoxelGrid<pcl::PointXYZRGBA> voxFilter;
-    voxFilter.setInputCloud(cloudIn);
-    voxFilter.setLeafSize(static_cast<float>(voxelSize), static_cast<float>(voxelSize), static_cast<float>(voxelSize));
-    voxFilter.filter(*cloudFiltered);
+    pcl::StopWatch stageWatch;
+    if(engines & ENGINE_PARALLEL_VOXEL_GRID)
+    {
+        ParallelVoxelGrid voxFilter;
+        voxFilter.setInputCloud(cloudIn);
+        voxFilter.setLeafSize(static_cast<float>(voxelSize), static_cast<float>(voxelSize), static_cast<float>(voxelSize));
+        voxFilter.filter(*cloudFiltered);
+    }
+    else
+    {
+        pcl::VoxelGrid<pcl::PointXYZRGBA> voxFilter;
+        voxFilter.setInputCloud(cloudIn);
+        voxFilter.setLeafSize(static_cast<float>(voxelSize), static_cast<float>(voxelSize), static_cast<float>(voxelSize));
+        voxFilter.filter(*cloudFiltered);
+    }
     std::cout << "Points before downsampling: " << cloudIn->points.size() << std::endl;
-    std::cout << "Points before downsampling: " << cloudFiltered->points.size() << std::endl;
+    std::cout << "Points before downsampling: " << cloudFiltered->points.size() << " (" << stageWatch.getTime() << " ms)" << std::endl;
+
+    // remove the sparse sensor noise before clustering if requested
+    const int outlierMeanK = 50;
+    const double outlierStddevMul = 1.0;
+    const bool removeOutliers = (engines & (ENGINE_PARALLEL_OUTLIERS | ENGINE_PCL_OUTLIERS)) != 0;
+    stageWatch.reset();
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloudInliers(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    if(engines & ENGINE_PARALLEL_OUTLIERS)
+    {
+        ParallelOutlierRemoval outlierFilter;
+        outlierFilter.setInputCloud(cloudFiltered);
+        outlierFilter.setMeanK(outlierMeanK);
+        outlierFilter.setStddevMulThresh(outlierStddevMul);
+        outlierFilter.filter(*cloudInliers);
+    }
+    else if(engines & ENGINE_PCL_OUTLIERS)
+    {
+        pcl::StatisticalOutlierRemoval<pcl::PointXYZRGBA> outlierFilter;
+        outlierFilter.setInputCloud(cloudFiltered);
+        outlierFilter.setMeanK(outlierMeanK);
+        outlierFilter.setStddevMulThresh(outlierStddevMul);
+        outlierFilter.filter(*cloudInliers);
+    }
+    if(removeOutliers)
+    {
+        std::cout << "Points after outlier removal: " << cloudInliers->points.size() << " (" << stageWatch.getTime() << " ms)" << std::endl;
+        cloudFiltered.swap(cloudInliers);
+    }
 
     // create the vector of indices lists (each element contains a list of imultiple indices)
     const float clusterDistance = 0.02;
@@ -197,38 +210,77 @@ int main(int argc, char** argv)
     int maxClusterSize = 100000;
     std::vector<pcl::PointIndices> clusterIndices;
 
-    // Creating the KdTree object for the search method of the extraction
-    pcl::search::KdTree<pcl::PointXYZRGBA>::Ptr tree(new pcl::search::KdTree<pcl::PointXYZRGBA>);
-    tree->setInputCloud(cloudFiltered);
+    stageWatch.reset();
+    if(engines & ENGINE_PARALLEL_CLUSTERING)
+    {
+        // create the multithreaded cluster extraction object, which does not need a search tree
+        ParallelClusterExtraction ec;
+        ec.setClusterTolerance(clusterDistance);
+        ec.setMinClusterSize(minClusterSize);
+        ec.setMaxClusterSize(maxClusterSize);
+        ec.setInputCloud(cloudFiltered);
+
+        // perform the clustering
+        ec.extract(clusterIndices);
+    }
+    else
+    {
+        pcl::search::Search<pcl::PointXYZRGBA>::Ptr tree;
+        if(engines & ENGINE_CACHED_SEARCH_TREE)
+        {
+            // load the search tree for the filtered cloud from the index cache, or build and cache it, naming it after
+            // every stage that changes the filtered points
+            std::ostringstream indexName;
+            indexName << "kdtree_voxel_" << voxelSize;
+            if(removeOutliers)
+            {
+                indexName << "_outliers_" << outlierMeanK << "_" << outlierStddevMul;
+            }
+            SpatialIndexCache indexCache(fileName);
+            FlatKdTree::Ptr flatTree(new FlatKdTree(false));
+            if(indexCache.loadKdTree(indexName.str(), cloudFiltered, *flatTree))
+            {
+                std::cout << "Loaded search tree from " << indexCache.getCacheFileName(indexName.str()) << std::endl;
+            }
+            else
+            {
+                flatTree->setInputCloud(cloudFiltered);
+                indexCache.saveKdTree(indexName.str(), *flatTree);
+            }
+            tree = flatTree;
+        }
+        else
+        {
+            // Creating the KdTree object for the search method of the extraction
+            tree.reset(new pcl::search::KdTree<pcl::PointXYZRGBA>);
+            tree->setInputCloud(cloudFiltered);
+        }
 
-    // create the euclidian cluster extraction object
-    pcl::EuclideanClusterExtraction<pcl::PointXYZRGBA> ec;
-    ec.setClusterTolerance(clusterDistance);
-    ec.setMinClusterSize(minClusterSize);
-    ec.setMaxClusterSize(maxClusterSize);
-    ec.setSearchMethod(tree);
-    ec.setInputCloud(cloudFiltered);
+        // create the euclidian cluster extraction object
+        pcl::EuclideanClusterExtraction<pcl::PointXYZRGBA> ec;
+        ec.setClusterTolerance(clusterDistance);
+        ec.setMinClusterSize(minClusterSize);
+        ec.setMaxClusterSize(maxClusterSize);
+        ec.setSearchMethod(tree);
+        ec.setInputCloud(cloudFiltered);
 
-    // perform the clustering
-    ec.extract(clusterIndices);
-    std::cout << "Clusters identified: " << clusterIndices.size() << std::endl;
+        // perform the clustering
+        ec.extract(clusterIndices);
+    }
+    std::cout << "Clusters identified: " << clusterIndices.size() << " (" << stageWatch.getTime() << " ms)" << std::endl;
 
-    // color each cluster
+    // color each cluster in a separate color array, then write the colors back to the cloud
+    PointBuffer colors;
+    colors.loadColors(*cloudFiltered);
     for(int i = 0; i < clusterIndices.size(); i++)
     {
         // create a random color for this cluster
         int r = rand() % 256;
         int g = rand() % 256;
         int b = rand() % 256;
-
-        // iterate through the cluster points
-        for(int j = 0; j < clusterIndices.at(i).indices.size(); j++)
-        {
-            cloudFiltered->points.at(clusterIndices.at(i).indices.at(j)).r = r;
-            cloudFiltered->points.at(clusterIndices.at(i).indices.at(j)).g = g;
-            cloudFiltered->points.at(clusterIndices.at(i).indices.at(j)).b = b;
-        }
+        colors.setColor(clusterIndices.at(i).indices, r, g, b);
     }
+    colors.storeColors(*cloudFiltered);
 
     // get the elapsed time
     double elapsedTime = watch.getTimeSeconds();
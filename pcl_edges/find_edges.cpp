@@ -18,12 +18,16 @@
 * @file find_edges.cpp
 * @brief finds edges using organized edge detection
 *
-* Simple example of locating edges in a PCD file using organized edge detection
+* Simple example of locating edges in a PCD file using organized edge detection. Edges can also be located in every
+* frame streamed by an OpenNI2 device, with the results rendered as they are computed.
 *
 * @author Christopher D. McMurrough
 **********************************************************************************************************************/
 
 #include "CloudVisualizer.h"
+#include "CloudIO.h"
+#include "ParallelNormalEstimation.h"
+#include "PointBuffer.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -32,13 +36,29 @@
 #include <pcl/common/time.h>
 #include <pcl/features/integral_image_normal.h>
 #include <pcl/features/organized_edge_detection.h>
+#include <pcl/io/openni2_grabber.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #define NUM_COMMAND_ARGS 1
 
+// normal estimation modes
+#define PROCESSING_MODE_PCL 0
+#define PROCESSING_MODE_PARALLEL 1
+
+// file name that selects live processing of OpenNI2 frames
+#define LIVE_SOURCE "live"
+
 // function prototypes
 void pointPickingCallback(const pcl::visualization::PointPickingEvent& event, void* cookie);
 void keyboardCallback(const pcl::visualization::KeyboardEvent &event, void* viewer_void);
-bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fileName);
+void colorEdgeLabels(const std::vector<pcl::PointIndices> &labelIndices, PointBuffer &colors, pcl::PointCloud<pcl::PointXYZRGBA> &cloud);
 
 /***********************************************************************************************************************
 * @brief callback function for handling a point picking event
@@ -94,54 +114,254 @@ void keyboardCallback(const pcl::visualization::KeyboardEvent &event, void* view
 }
 
 /***********************************************************************************************************************
-* @brief Opens a point cloud file
+* @brief color the points of a cloud by their edge labels
+* @param[in] labelIndices the point indices of each edge type, as computed by OrganizedEdgeFromRGBNormals
+* @param[in,out] colors scratch color buffer, reused between calls
+* @param[in,out] cloud the cloud to color
+* @author Christoper D. McMurrough
+**********************************************************************************************************************/
+void colorEdgeLabels(const std::vector<pcl::PointIndices> &labelIndices, PointBuffer &colors, pcl::PointCloud<pcl::PointXYZRGBA> &cloud)
+{
+    // color the edges in a separate color array
+    colors.loadColors(cloud);
+
+    // color boundary edges blue
+    colors.setColor(labelIndices.at(0).indices, 0, 0, 255);
+
+    // color occluding edges green
+    colors.setColor(labelIndices.at(1).indices, 0, 255, 0);
+
+    // color occluded edges red
+    colors.setColor(labelIndices.at(2).indices, 255, 0, 0);
+
+    // color high curvature edges yellow
+    colors.setColor(labelIndices.at(3).indices, 255, 255, 0);
+
+    // color RGB edges pink
+    colors.setColor(labelIndices.at(4).indices, 255, 0, 255);
+
+    // write the colors back to the cloud
+    colors.storeColors(cloud);
+}
+
+/***********************************************************************************************************************
+* @class LiveEdgeProcessor
+* @brief Class for detecting edges in the organized clouds streamed by an OpenNI2 device
 *
-* Opens a point cloud file in either PCD or PLY format
+* The grabber callback only stores the newest frame, replacing one that has not been processed yet, so the grabber is
+* never blocked. A processing thread estimates the normals and edge labels of the newest frame using objects and
+* buffers that are reused between frames, colors a copy of the frame into the back buffer, and swaps it with the front
+* buffer that the viewer uploads from.
 *
-* @param[out] cloudOut pointer to opened point cloud
-* @param[in] filename path and name of input file
-* @return false if an error occurred while opening file
-* @author Christopher D. McMurrough
+* @author Christoper D. McMurrough
 **********************************************************************************************************************/
-bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fileName)
+class LiveEdgeProcessor
 {
-    // convert the file name to string
-    std::string fileNameStr(fileName);
+private:
+
+    // processing settings
+    int m_processingMode;
+
+    // newest grabbed frame waiting to be processed
+    std::mutex m_inputMutex;
+    std::condition_variable m_inputReady;
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr m_inputCloud;
+    bool m_running;
+
+    // processing objects and buffers, reused between frames
+    ParallelNormalEstimation m_parallelNormalEstimation;
+    pcl::IntegralImageNormalEstimation<pcl::PointXYZRGBA, pcl::Normal> m_normalEstimation;
+    pcl::OrganizedEdgeFromRGBNormals<pcl::PointXYZRGBA, pcl::Normal, pcl::Label> m_edgeDetection;
+    pcl::PointCloud<pcl::Normal>::Ptr m_normals;
+    pcl::PointCloud<pcl::Label> m_labels;
+    std::vector<pcl::PointIndices> m_labelIndices;
+    PointBuffer m_colors;
+
+    // double buffered results, the processing thread writes the back buffer while the viewer reads the front buffer
+    std::mutex m_outputMutex;
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr m_outputClouds[2];
+    int m_frontIndex;
+    bool m_outputReady;
+
+    // frame counters and processing times
+    std::atomic<long> m_framesGrabbed;
+    std::atomic<long> m_framesSkipped;
+    std::atomic<long> m_framesProcessed;
+    std::atomic<long> m_normalTimeUs;
+    std::atomic<long> m_edgeTimeUs;
+
+public:
+
+    /*******************************************************************************************************************
+    * @brief Class constructor
+    * @param[in] processingMode the normal estimation mode (PROCESSING_MODE_PCL or PROCESSING_MODE_PARALLEL)
+    * @param[in] normalDepthChange the maximum depth change factor of the normal estimation
+    * @param[in] normalSmoothing the normal smoothing size
+    * @param[in] discontinuityThreshold the depth discontinuity threshold of the edge detection
+    * @param[in] maxSearchNeighbors the maximum number of neighbors searched by the edge detection
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    LiveEdgeProcessor(int processingMode, double normalDepthChange, double normalSmoothing, double discontinuityThreshold, int maxSearchNeighbors) : m_normals(new pcl::PointCloud<pcl::Normal>), m_framesGrabbed(0), m_framesSkipped(0), m_framesProcessed(0), m_normalTimeUs(0), m_edgeTimeUs(0)
+    {
+        m_processingMode = processingMode;
+        m_running = false;
+        m_frontIndex = 0;
+        m_outputReady = false;
+        m_outputClouds[0].reset(new pcl::PointCloud<pcl::PointXYZRGBA>);
+        m_outputClouds[1].reset(new pcl::PointCloud<pcl::PointXYZRGBA>);
+
+        // configure the processing objects once
+        m_parallelNormalEstimation.setMaxDepthChangeFactor(normalDepthChange);
+        m_parallelNormalEstimation.setNormalSmoothingSize(normalSmoothing);
+        m_normalEstimation.setNormalEstimationMethod(m_normalEstimation.COVARIANCE_MATRIX);
+        m_normalEstimation.setMaxDepthChangeFactor(normalDepthChange);
+        m_normalEstimation.setNormalSmoothingSize(normalSmoothing);
+        m_edgeDetection.setDepthDisconThreshold(discontinuityThreshold);
+        m_edgeDetection.setMaxSearchNeighbors(maxSearchNeighbors);
+        m_edgeDetection.setInputNormals(m_normals);
+    }
 
-    // handle various file types
-    std::string fileExtension = fileNameStr.substr(fileNameStr.find_last_of(".") + 1);
-    if(fileExtension.compare("pcd") == 0)
+    /*******************************************************************************************************************
+    * @brief Grab and process frames, rendering the results until the window is closed
+    * @param[in] CV the viewer to render the results in
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    void run(CloudVisualizer &CV)
     {
-        // attempt to open the file
-        if(pcl::io::loadPCDFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
+        // start the processing thread before any frames arrive
+        m_running = true;
+        std::thread processor(&LiveEdgeProcessor::processLoop, this);
+
+        // create a new grabber for OpenNI2 devices and bind the callback
+        pcl::Grabber* interface = new pcl::io::OpenNI2Grabber();
+        boost::function<void (const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr&)> f = boost::bind(&LiveEdgeProcessor::cloudCallback, this, _1);
+        interface->registerCallback(f);
+        interface->start();
+
+        // render each new result, reporting the counters once per second
+        bool cloudAdded = false;
+        std::chrono::steady_clock::time_point reportTime = std::chrono::steady_clock::now();
+        long lastProcessed = 0;
+        while(CV.isRunning())
         {
-            PCL_ERROR("error while attempting to read pcd file: %s \n", fileNameStr.c_str());
-            return false;
+            CV.spin(5);
+            {
+                // upload the front buffer, the processing thread cannot swap while the lock is held
+                std::lock_guard<std::mutex> lock(m_outputMutex);
+                if(m_outputReady)
+                {
+                    const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &front = m_outputClouds[m_frontIndex];
+                    if(!cloudAdded)
+                    {
+                        CV.addCloud(front);
+                        CV.addCoordinateFrame(front->sensor_origin_, front->sensor_orientation_);
+                        cloudAdded = true;
+                    }
+                    else
+                    {
+                        CV.updateCloud(front, 0, front->size());
+                    }
+                    m_outputReady = false;
+                }
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - reportTime).count();
+            if(elapsed >= 1.0)
+            {
+                long processed = m_framesProcessed.load();
+                long numProcessed = std::max(processed, 1L);
+                std::printf("%ld frames grabbed, %ld skipped, %.1f fps processed, normals %.2f ms avg, edges %.2f ms avg\n", m_framesGrabbed.load(), m_framesSkipped.load(), (processed - lastProcessed) / elapsed, m_normalTimeUs.load() / 1000.0 / numProcessed, m_edgeTimeUs.load() / 1000.0 / numProcessed);
+                lastProcessed = processed;
+                reportTime = now;
+            }
         }
-        else
+
+        // stop the grabber, then the processing thread
+        interface->stop();
+        delete interface;
         {
-            return true;
+            std::lock_guard<std::mutex> lock(m_inputMutex);
+            m_running = false;
         }
+        m_inputReady.notify_all();
+        processor.join();
     }
-    else if(fileExtension.compare("ply") == 0)
+
+    /*******************************************************************************************************************
+    * @brief Callback function for received cloud data, replaces any frame that has not been processed yet
+    * @param[in] cloudIn the organized cloud received by the OpenNI2 device
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    void cloudCallback(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn)
     {
-        // attempt to open the file
-        if(pcl::io::loadPLYFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcl file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
         {
-            return true;
+            std::lock_guard<std::mutex> lock(m_inputMutex);
+            if(m_inputCloud)
+            {
+                m_framesSkipped++;
+            }
+            m_inputCloud = cloudIn;
         }
+        m_framesGrabbed++;
+        m_inputReady.notify_one();
     }
-    else
+
+    /*******************************************************************************************************************
+    * @brief Process the newest frame until the processor is stopped
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    void processLoop()
     {
-        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileNameStr.c_str());
-        return false;
+        while(true)
+        {
+            // wait for a new frame
+            pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr cloud;
+            {
+                std::unique_lock<std::mutex> lock(m_inputMutex);
+                m_inputReady.wait(lock, [this]() { return m_inputCloud || !m_running; });
+                if(!m_running)
+                {
+                    break;
+                }
+                cloud.swap(m_inputCloud);
+            }
+
+            // compute the normals into the reused normal cloud
+            std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            if(m_processingMode == PROCESSING_MODE_PARALLEL)
+            {
+                m_parallelNormalEstimation.setInputCloud(cloud);
+                m_parallelNormalEstimation.compute(*m_normals);
+            }
+            else
+            {
+                m_normalEstimation.setInputCloud(cloud);
+                m_normalEstimation.compute(*m_normals);
+            }
+            std::chrono::steady_clock::time_point normalTime = std::chrono::steady_clock::now();
+
+            // compute the edge labels
+            m_edgeDetection.setInputCloud(cloud);
+            m_edgeDetection.compute(m_labels, m_labelIndices);
+            m_normalTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(normalTime - startTime).count();
+            m_edgeTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - normalTime).count();
+
+            // color a copy of the frame in the back buffer, the copy reuses the buffer's storage
+            pcl::PointCloud<pcl::PointXYZRGBA> &back = *m_outputClouds[1 - m_frontIndex];
+            back = *cloud;
+            colorEdgeLabels(m_labelIndices, m_colors, back);
+
+            // publish the back buffer
+            {
+                std::lock_guard<std::mutex> lock(m_outputMutex);
+                m_frontIndex = 1 - m_frontIndex;
+                m_outputReady = true;
+            }
+            m_framesProcessed++;
+        }
     }
-}
+};
 
 /***********************************************************************************************************************
 * @brief program entry point
@@ -153,14 +373,27 @@ bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fi
 int main(int argc, char** argv)
 {
     // validate and parse the command line arguments
-    if(argc != NUM_COMMAND_ARGS + 1)
+    if(argc != NUM_COMMAND_ARGS + 1 && argc != NUM_COMMAND_ARGS + 2)
     {
-        std::printf("USAGE: %s <file_name>\n", argv[0]);
+        std::printf("USAGE: %s <file_name> [processing_mode]\n", argv[0]);
+        std::printf("    file_name: cloud file to process, or \"%s\" to process frames from an OpenNI2 device\n", LIVE_SOURCE);
+        std::printf("    processing_mode 0: PCL normal estimation (default), 1: multithreaded normal estimation\n");
         return 0;
     }
 
     // parse the command line arguments
     char* fileName = argv[1];
+    int processingMode = PROCESSING_MODE_PCL;
+    if(argc == NUM_COMMAND_ARGS + 2)
+    {
+        processingMode = atoi(argv[2]);
+    }
+
+    // set the normal estimation and edge detection parameters
+    double normalDepthChange = 0.3;
+    double normalSmoothing = 20;
+    double discontinuityThreshold = 0.02;
+    int maxSearchNeighbors = 50;
 
     // create a stop watch for measuring time
     pcl::StopWatch watch;
@@ -168,6 +401,15 @@ int main(int argc, char** argv)
     // initialize the cloud viewer
     CloudVisualizer CV("Rendering Window");
 
+    // process frames from the device until the window is closed
+    if(std::strcmp(fileName, LIVE_SOURCE) == 0)
+    {
+        LiveEdgeProcessor processor(processingMode, normalDepthChange, normalSmoothing, discontinuityThreshold, maxSearchNeighbors);
+        CV.registerKeyboardCallback(keyboardCallback);
+        processor.run(CV);
+        return 0;
+    }
+
     // start timing the processing step
     watch.reset();
 
@@ -176,19 +418,26 @@ int main(int argc, char** argv)
     openCloud(cloudIn, fileName);
 
     // compute point cloud normals
-    double normalDepthChange = 0.3;
-    double normalSmoothing = 20;
     pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>);
-    pcl::IntegralImageNormalEstimation<pcl::PointXYZRGBA, pcl::Normal> ne;
-    ne.setNormalEstimationMethod(ne.COVARIANCE_MATRIX);
-    ne.setMaxDepthChangeFactor(normalDepthChange);
-    ne.setNormalSmoothingSize(normalSmoothing);
-    ne.setInputCloud(cloudIn);
-    ne.compute(*normals);
+    if(processingMode == PROCESSING_MODE_PARALLEL)
+    {
+        ParallelNormalEstimation ne;
+        ne.setMaxDepthChangeFactor(normalDepthChange);
+        ne.setNormalSmoothingSize(normalSmoothing);
+        ne.setInputCloud(cloudIn);
+        ne.compute(*normals);
+    }
+    else
+    {
+        pcl::IntegralImageNormalEstimation<pcl::PointXYZRGBA, pcl::Normal> ne;
+        ne.setNormalEstimationMethod(ne.COVARIANCE_MATRIX);
+        ne.setMaxDepthChangeFactor(normalDepthChange);
+        ne.setNormalSmoothingSize(normalSmoothing);
+        ne.setInputCloud(cloudIn);
+        ne.compute(*normals);
+    }
 
     // compute the edges
-    double discontinuityThreshold = 0.02;
-    int maxSearchNeighbors = 50;
     pcl::PointIndices::Ptr boundaryEdges(new pcl::PointIndices);
     pcl::PointIndices::Ptr occludingEdges(new pcl::PointIndices);
     pcl::PointIndices::Ptr occludedEdges(new pcl::PointIndices);
@@ -203,47 +452,9 @@ int main(int argc, char** argv)
     std::vector<pcl::PointIndices> labelIndices;
     oed.compute(labels, labelIndices);
 
-    // color boundary edges blue
-    for(int i = 0; i < labelIndices.at(0).indices.size(); i++)
-    {
-        cloudIn->points.at(labelIndices.at(0).indices.at(i)).r = 0;
-        cloudIn->points.at(labelIndices.at(0).indices.at(i)).g = 0;
-        cloudIn->points.at(labelIndices.at(0).indices.at(i)).b = 255;
-    }
-
-    // color occluding edges green
-    for(int i = 0; i < labelIndices.at(1).indices.size(); i++)
-    {
-        cloudIn->points.at(labelIndices.at(1).indices.at(i)).r = 0;
-        cloudIn->points.at(labelIndices.at(1).indices.at(i)).g = 255;
-        cloudIn->points.at(labelIndices.at(1).indices.at(i)).b = 0;
-    }
-
-
-    // color occluded edges red
-    for(int i = 0; i < labelIndices.at(2).indices.size(); i++)
-    {
-        cloudIn->points.at(labelIndices.at(2).indices.at(i)).r = 255;
-        cloudIn->points.at(labelIndices.at(2).indices.at(i)).g = 0;
-        cloudIn->points.at(labelIndices.at(2).indices.at(i)).b = 0;
-    }
-
-    // color high curvature edges yellow
-    for(int i = 0; i < labelIndices.at(3).indices.size(); i++)
-    {
-        cloudIn->points.at(labelIndices.at(3).indices.at(i)).r = 255;
-        cloudIn->points.at(labelIndices.at(3).indices.at(i)).g = 255;
-        cloudIn->points.at(labelIndices.at(3).indices.at(i)).b = 0;
-    }
-
-    // color RGB edges pink
-    for(int i = 0; i < labelIndices.at(4).indices.size(); i++)
-    {
-        cloudIn->points.at(labelIndices.at(4).indices.at(i)).r = 255;
-        cloudIn->points.at(labelIndices.at(4).indices.at(i)).g = 0;
-        cloudIn->points.at(labelIndices.at(4).indices.at(i)).b = 255;
-    }
-
+    // color the edge points by type
+    PointBuffer colors;
+    colorEdgeLabels(labelIndices, colors, *cloudIn);
 
     // get the elapsed time
     double elapsedTime = watch.getTimeSeconds();
@@ -18,96 +18,405 @@
 * @file pcl_headless.cpp
 * @brief loads a PCD file, makes some changes, and saves an output PCD file
 *
-* Simple example of loading and saving PCD files, can be used as a template for processing saved data
+* Simple example of loading and saving PCD files, can be used as a template for processing saved data. A directory or
+* glob pattern of input files can be given instead of a single file, in which case the files are spread over a pool of
+* worker threads and written to an output directory. A pipeline file can be given to run a configurable chain of
+* filter stages on each whole cloud instead of the default chunked recoloring.
 *
 * @author Christopher D. McMurrough
 **********************************************************************************************************************/
 
+#include "ChunkedCloudReader.h"
+#include "ChunkedCloudWriter.h"
+#include "FilterPipeline.h"
+#include "PointBuffer.h"
+#include "ParallelFor.h"
+
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/io/ply_io.h>
 #include <pcl/common/time.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+
 #define NUM_COMMAND_ARGS 2
 
+// number of points processed at a time
+#define DEFAULT_CHUNK_SIZE 1000000
 
 /***********************************************************************************************************************
-* @brief Opens a point cloud file
-*
-* Opens a point cloud file in either PCD or PLY format
-*
-* @param[out] cloudOut pointer to opened point cloud
-* @param[in] filename path and name of input file
-* @return false if an error occurred while opening file
-* @author Christopher D. McMurrough
+* @struct FileStats
+* @brief Point count, size, stage times and pipeline step statistics of one processed file
+* @author Christoper D. McMurrough
+**********************************************************************************************************************/
+struct FileStats
+{
+    size_t points;
+    size_t bytes;
+    double readTime;
+    double processTime;
+    double writeTime;
+    std::vector<StageStats> pipelineStages;
+
+    FileStats() : points(0), bytes(0), readTime(0), processTime(0), writeTime(0) {}
+};
+
+/***********************************************************************************************************************
+* @class CloudFileProcessor
+* @brief Class for processing one cloud file at a time, reusing its reader, writer and buffers between files
+* @author Christoper D. McMurrough
 **********************************************************************************************************************/
-bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, std::string fileName)
+class CloudFileProcessor
 {
-    // handle various file types
-    std::string fileExtension = fileName.substr(fileName.find_last_of(".") + 1);
-    if(fileExtension.compare("pcd") == 0)
+private:
+
+    // file handling and processing buffers
+    ChunkedCloudReader m_reader;
+    ChunkedCloudWriter m_writer;
+    pcl::PointCloud<pcl::PointXYZRGBA> m_cloud;
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr m_pipelineInput;
+    PointBuffer m_colors;
+    FilterPipeline m_pipeline;
+
+public:
+
+    /*******************************************************************************************************************
+    * @brief Class constructor
+    * @param[in] numThreads the number of threads used to process each chunk, or 0 to use all hardware threads
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    explicit CloudFileProcessor(int numThreads=0) : m_pipelineInput(new pcl::PointCloud<pcl::PointXYZRGBA>)
     {
-        // attempt to open the file
-        if(pcl::io::loadPCDFile<pcl::PointXYZRGBA>(fileName, *cloudOut) == -1)
+        m_reader.setNumberOfThreads(numThreads);
+        m_colors.setNumberOfThreads(numThreads);
+        m_pipeline.setNumberOfThreads(numThreads);
+    }
+
+    /*******************************************************************************************************************
+    * @brief Load a filter pipeline to run on each whole cloud in place of the chunked recoloring
+    * @param[in] configFileName the pipeline configuration file
+    * @return true if the pipeline was loaded
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    bool loadPipeline(const std::string &configFileName)
+    {
+        return m_pipeline.load(configFileName);
+    }
+
+    /*******************************************************************************************************************
+    * @brief Print the per stage statistics of the last pipeline run
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    void printPipelineStats() const
+    {
+        m_pipeline.printStageStats();
+    }
+
+    /*******************************************************************************************************************
+    * @brief Process a cloud file one chunk at a time, only one chunk of points is held in memory at a time
+    *
+    * If a pipeline is loaded the whole cloud is read as a single chunk, since stages such as clustering need every
+    * point, and the output is unorganized.
+    *
+    * @param[in] inputFilePath the PCD or PLY file to process
+    * @param[in] outputFilePath the PCD file to write
+    * @param[in] chunkSize the number of points processed at a time
+    * @param[out] stats the point count and stage times of the file
+    * @param[in] verbose print the progress after each chunk
+    * @return true if the whole file was processed and saved
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    bool processFile(const std::string &inputFilePath, const std::string &outputFilePath, size_t chunkSize, FileStats &stats, bool verbose)
+    {
+        stats = FileStats();
+        struct stat status;
+        if(stat(inputFilePath.c_str(), &status) == 0)
         {
-            PCL_ERROR("error while attempting to read pcd file: %s \n", fileName.c_str());
+            stats.bytes = static_cast<size_t>(status.st_size);
+        }
+
+        // open the input and output files
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        if(m_pipeline.size() > 0)
+        {
+            chunkSize = std::numeric_limits<size_t>::max();
+        }
+        if(!m_reader.open(inputFilePath, chunkSize))
+        {
+            return false;
+        }
+        if(!m_writer.open(outputFilePath, m_reader.getSensorOrigin(), m_reader.getSensorOrientation()))
+        {
+            m_reader.close();
             return false;
         }
-        else
+        if(m_pipeline.size() > 0)
         {
-            return true;
+            return processWholeFile(inputFilePath, startTime, stats);
         }
+
+        // process the cloud one chunk at a time
+        uint64_t chunkIndex = 0;
+        bool success = true;
+        while(true)
+        {
+            bool chunkRead = m_reader.readChunk(m_cloud);
+            std::chrono::steady_clock::time_point readTime = std::chrono::steady_clock::now();
+            stats.readTime += std::chrono::duration<double>(readTime - startTime).count();
+            if(!chunkRead)
+            {
+                break;
+            }
+
+            // color all of the points random colors in a separate color array, then write them back to the chunk
+            m_colors.loadColors(m_cloud);
+            m_colors.randomizeColors(chunkIndex++);
+            m_colors.storeColors(m_cloud);
+            std::chrono::steady_clock::time_point processTime = std::chrono::steady_clock::now();
+            stats.processTime += std::chrono::duration<double>(processTime - readTime).count();
+
+            // save the processed chunk
+            success = m_writer.writeChunk(m_cloud) && success;
+            startTime = std::chrono::steady_clock::now();
+            stats.writeTime += std::chrono::duration<double>(startTime - processTime).count();
+            if(verbose)
+            {
+                std::cout << m_reader.getPointsRead() << " of " << m_reader.size() << " points processed" << std::endl;
+            }
+        }
+
+        // finalize the output file, preserving the organized structure of the input
+        success = m_writer.close(m_reader.getWidth(), m_reader.getHeight()) && success;
+        stats.writeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        stats.points = m_writer.getPointsWritten();
+        if(m_reader.getPointsRead() != m_reader.size())
+        {
+            PCL_ERROR("input file ended early, %zu of %zu points written \n", m_writer.getPointsWritten(), m_reader.size());
+            success = false;
+        }
+        m_reader.close();
+        return success;
     }
-    else if(fileExtension.compare("ply") == 0)
+
+private:
+
+    /*******************************************************************************************************************
+    * @brief Run the pipeline on the whole cloud of the open reader and save the result with the open writer
+    * @param[in] inputFilePath the input file, its base name is passed to the stages
+    * @param[in] startTime the time the file was opened
+    * @param[in,out] stats the point count and stage times of the file
+    * @return true if the cloud was processed and saved
+    * @author Christoper D. McMurrough
+    *******************************************************************************************************************/
+    bool processWholeFile(const std::string &inputFilePath, std::chrono::steady_clock::time_point startTime, FileStats &stats)
     {
-        // attempt to open the file
-        if(pcl::io::loadPLYFile<pcl::PointXYZRGBA>(fileName, *cloudOut) == -1)
+        // read the whole cloud
+        bool success = m_reader.readChunk(*m_pipelineInput) || m_reader.size() == 0;
+        m_pipelineInput->sensor_origin_ = m_reader.getSensorOrigin();
+        m_pipelineInput->sensor_orientation_ = m_reader.getSensorOrientation();
+        std::chrono::steady_clock::time_point readTime = std::chrono::steady_clock::now();
+        stats.readTime += std::chrono::duration<double>(readTime - startTime).count();
+
+        // run the stages, naming their outputs after the input file
+        size_t slash = inputFilePath.find_last_of("/");
+        std::string baseName = slash == std::string::npos ? inputFilePath : inputFilePath.substr(slash + 1);
+        m_pipeline.setInputName(baseName.substr(0, baseName.find_last_of(".")));
+        if(success)
         {
-            PCL_ERROR("error while attempting to read pcl file: %s \n", fileName.c_str());
-            return false;
+            success = m_pipeline.run(m_pipelineInput, m_cloud);
+            stats.pipelineStages = m_pipeline.getStageStats();
         }
-        else
+        std::chrono::steady_clock::time_point processTime = std::chrono::steady_clock::now();
+        stats.processTime += std::chrono::duration<double>(processTime - readTime).count();
+
+        // save the result
+        if(success)
         {
-            return true;
+            success = m_writer.writeChunk(m_cloud);
+        }
+        success = m_writer.close(static_cast<uint32_t>(m_writer.getPointsWritten()), 1) && success;
+        stats.writeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - processTime).count();
+        stats.points = m_reader.getPointsRead();
+        m_reader.close();
+        return success;
+    }
+};
+
+/***********************************************************************************************************************
+* @brief list the cloud files of a directory, or the files matching a glob pattern
+* @param[in] source the directory or glob pattern
+* @param[out] fileNames the sorted PCD and PLY file paths
+* @author Christoper D. McMurrough
+**********************************************************************************************************************/
+void listInputFiles(const std::string &source, std::vector<std::string> &fileNames)
+{
+    fileNames.clear();
+    std::vector<std::string> candidates;
+    struct stat status;
+    if(stat(source.c_str(), &status) == 0 && S_ISDIR(status.st_mode))
+    {
+        DIR* directory = opendir(source.c_str());
+        if(directory != NULL)
+        {
+            struct dirent* entry;
+            while((entry = readdir(directory)) != NULL)
+            {
+                candidates.push_back(source + "/" + entry->d_name);
+            }
+            closedir(directory);
         }
     }
     else
     {
-        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileName.c_str());
-        return false;
+        glob_t matches;
+        if(glob(source.c_str(), 0, NULL, &matches) == 0)
+        {
+            for(size_t i = 0; i < matches.gl_pathc; i++)
+            {
+                candidates.push_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
     }
+
+    // keep the supported file types
+    for(size_t i = 0; i < candidates.size(); i++)
+    {
+        const std::string &name = candidates.at(i);
+        size_t dot = name.find_last_of(".");
+        std::string extension = dot == std::string::npos ? "" : name.substr(dot + 1);
+        if(extension.compare("pcd") == 0 || extension.compare("ply") == 0)
+        {
+            fileNames.push_back(name);
+        }
+    }
+    std::sort(fileNames.begin(), fileNames.end());
 }
 
-/*******************************************************************************************************************//**
- * @brief Saves a point cloud to file
- *
- * Saves a given point cloud to disk in PCD format
- *
- * @param[in] cloudIn pointer to output point cloud
- * @param[in] filename path and name of output file
- * @param[in] binaryMode saves the file in binary form if true (default:false)
- * @return false if an error occured while writing file
- * @author Christopher D. McMurrough
- **********************************************************************************************************************/
-bool saveCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, std::string fileName, bool binaryMode=true)
+/***********************************************************************************************************************
+* @brief process every cloud file of a directory or glob pattern on a pool of worker threads
+*
+* Each worker takes the next unprocessed file and streams it through its own reader, buffers and writer, so the disk
+* reads and writes of some workers overlap the processing of others. The stage times of each file are printed as it
+* finishes, followed by the aggregate throughput and, if a pipeline is used, the step statistics merged over all files.
+*
+* @param[in] source the input directory or glob pattern
+* @param[in] outputDirectory the directory to write the processed PCD files to, created if it does not exist
+* @param[in] chunkSize the number of points processed at a time
+* @param[in] numThreads the number of worker threads, or 0 to use all hardware threads
+* @param[in] pipelineFilePath the filter pipeline run on each cloud, or an empty string for the default processing
+* @return the number of files that failed, counting no matching files or files that would share an output as failures
+* @author Christoper D. McMurrough
+**********************************************************************************************************************/
+size_t processBatch(const std::string &source, const std::string &outputDirectory, size_t chunkSize, int numThreads, const std::string &pipelineFilePath)
 {
-    // if the input cloud is empty, return
-    if(cloudIn->points.size() == 0)
+    // find the input files and create the output directory
+    std::vector<std::string> fileNames;
+    listInputFiles(source, fileNames);
+    if(fileNames.empty())
     {
-        return false;
+        PCL_ERROR("no pcd or ply files found in: %s \n", source.c_str());
+        return 1;
     }
 
-    // attempt to save the file
-    if(pcl::io::savePCDFile<pcl::PointXYZRGBA>(fileName, *cloudIn, binaryMode) == -1)
+    // name each output after its input file, refusing inputs that differ only by directory or extension, since their
+    // workers would write the same output file
+    std::vector<std::string> baseNames(fileNames.size());
+    std::vector<std::string> outputFilePaths(fileNames.size());
+    std::map<std::string, size_t> outputOwners;
+    size_t numConflicts = 0;
+    for(size_t i = 0; i < fileNames.size(); i++)
     {
-        PCL_ERROR("error while attempting to save pcd file: %s \n", fileName);
-        return false;
+        const std::string &inputFilePath = fileNames.at(i);
+        size_t slash = inputFilePath.find_last_of("/");
+        baseNames.at(i) = slash == std::string::npos ? inputFilePath : inputFilePath.substr(slash + 1);
+        outputFilePaths.at(i) = outputDirectory + "/" + baseNames.at(i).substr(0, baseNames.at(i).find_last_of(".")) + ".pcd";
+        std::pair<std::map<std::string, size_t>::iterator, bool> owner = outputOwners.insert(std::make_pair(outputFilePaths.at(i), i));
+        if(!owner.second)
+        {
+            PCL_ERROR("%s and %s would both be written to %s \n", fileNames.at(owner.first->second).c_str(), inputFilePath.c_str(), outputFilePaths.at(i).c_str());
+            numConflicts++;
+        }
     }
-    else
+    if(numConflicts > 0)
+    {
+        return numConflicts;
+    }
+    mkdir(outputDirectory.c_str(), 0755);
+    int numWorkers = static_cast<int>(std::min<size_t>(static_cast<size_t>(getThreadCount(numThreads)), fileNames.size()));
+    std::printf("Processing %zu files with %d worker threads... \n", fileNames.size(), numWorkers);
+
+    // workers claim files in order until none are left
+    std::atomic<size_t> nextFile(0);
+    std::atomic<size_t> filesDone(0);
+    std::mutex statsMutex;
+    FileStats total;
+    std::vector<StageStats> pipelineTotals;
+    size_t numFailed = 0;
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    auto worker = [&]()
+    {
+        CloudFileProcessor processor(1);
+        if(!pipelineFilePath.empty() && !processor.loadPipeline(pipelineFilePath))
+        {
+            return;
+        }
+        FileStats stats;
+        size_t index;
+        while((index = nextFile++) < fileNames.size())
+        {
+            // write the output next to the other results, keeping the input file name
+            const std::string &baseName = baseNames.at(index);
+            bool success = processor.processFile(fileNames.at(index), outputFilePaths.at(index), chunkSize, stats, false);
+
+            // report the file and add it to the totals
+            std::lock_guard<std::mutex> lock(statsMutex);
+            double fileTime = std::max(stats.readTime + stats.processTime + stats.writeTime, 1e-9);
+            std::printf("[%zu/%zu] %s: %s, %zu points, read %.1f ms, process %.1f ms, write %.1f ms, %.2f Mpts/s\n", ++filesDone, fileNames.size(), baseName.c_str(), success ? "ok" : "FAILED", stats.points, stats.readTime * 1000.0, stats.processTime * 1000.0, stats.writeTime * 1000.0, stats.points / fileTime / 1e6);
+            total.points += stats.points;
+            total.bytes += stats.bytes;
+            total.readTime += stats.readTime;
+            total.processTime += stats.processTime;
+            total.writeTime += stats.writeTime;
+            FilterPipeline::mergeStageStats(stats.pipelineStages, pipelineTotals);
+            numFailed += success ? 0 : 1;
+        }
+    };
+    std::vector<std::thread> workers;
+    for(int i = 1; i < numWorkers; i++)
     {
-        return true;
+        workers.push_back(std::thread(worker));
     }
+    worker();
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        workers.at(i).join();
+    }
+
+    // report the aggregate throughput
+    double wallTime = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(), 1e-9);
+    std::printf("Processed %zu files (%zu failed), %zu points, %.1f MB in %.2f seconds\n", fileNames.size(), numFailed, total.points, total.bytes / 1048576.0, wallTime);
+    std::printf("Throughput: %.1f files/s, %.2f Mpts/s, %.1f MB/s\n", fileNames.size() / wallTime, total.points / wallTime / 1e6, total.bytes / 1048576.0 / wallTime);
+    std::printf("Stage time summed over workers: read %.2f s, process %.2f s, write %.2f s\n", total.readTime, total.processTime, total.writeTime);
+    if(!pipelineTotals.empty())
+    {
+        std::printf("Pipeline steps summed over files (peak output and resident memory):\n");
+        FilterPipeline::printStageStats(pipelineTotals);
+    }
+    return numFailed;
 }
 
 /***********************************************************************************************************************
@@ -120,39 +429,67 @@ bool saveCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, std:
 int main(int argc, char** argv)
 {
     // validate and parse the command line arguments
-    if(argc != NUM_COMMAND_ARGS + 1)
+    if(argc < NUM_COMMAND_ARGS + 1 || argc > NUM_COMMAND_ARGS + 4)
     {
-        std::printf("USAGE: %s <file_name>\n", argv[0]);
+        std::printf("USAGE: %s <input_file> <output_file> [chunk_size] [num_threads] [pipeline_file]\n", argv[0]);
+        std::printf("    input_file: cloud file, or a directory or quoted glob pattern of cloud files to process in batch\n");
+        std::printf("    output_file: output cloud file, or the output directory in batch mode\n");
+        std::printf("    num_threads: number of files processed at once in batch mode (default: all hardware threads)\n");
+        std::printf("    pipeline_file: filter stages to run on each whole cloud, one \"type key=value ...\" line per stage\n");
         return 0;
     }
-	std::string inputFilePath(argv[1]);
-	std::string outputFilePath(argv[2]);
-
-    // create a stop watch for measuring time
-    pcl::StopWatch watch;
+    std::string inputFilePath(argv[1]);
+    std::string outputFilePath(argv[2]);
+    size_t chunkSize = DEFAULT_CHUNK_SIZE;
+    int numThreads = 0;
+    if(argc > NUM_COMMAND_ARGS + 1)
+    {
+        chunkSize = static_cast<size_t>(atol(argv[3]));
+    }
+    if(argc > NUM_COMMAND_ARGS + 2)
+    {
+        numThreads = atoi(argv[4]);
+    }
+    std::string pipelineFilePath;
+    if(argc > NUM_COMMAND_ARGS + 3)
+    {
+        pipelineFilePath = argv[5];
+    }
 
-    // open the point cloud
-    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBA>);
-    openCloud(cloud, inputFilePath);
+    // check the pipeline file before starting any work
+    if(!pipelineFilePath.empty())
+    {
+        FilterPipeline pipeline;
+        if(!pipeline.load(pipelineFilePath))
+        {
+            return 1;
+        }
+    }
 
-	// start timing the processing step
-    watch.reset();
-	
-	// color all of the points random colors
-	for(int i = 0; i < cloud->points.size(); i++)
-	{
-		cloud->points.at(i).r = rand() % 256;
-		cloud->points.at(i).g = rand() % 256;
-		cloud->points.at(i).b = rand() % 256;
-	}
+    // process a directory or glob pattern in batch mode
+    struct stat status;
+    bool isDirectory = stat(inputFilePath.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+    if(isDirectory || inputFilePath.find_first_of("*?[") != std::string::npos)
+    {
+        return processBatch(inputFilePath, outputFilePath, chunkSize, numThreads, pipelineFilePath) == 0 ? 0 : 1;
+    }
 
-    // get the elapsed time
-    double elapsedTime = watch.getTimeSeconds();
-    std::cout << elapsedTime << " seconds passed " << std::endl;
+    // process a single file
+    CloudFileProcessor processor(numThreads);
+    if(!pipelineFilePath.empty() && !processor.loadPipeline(pipelineFilePath))
+    {
+        return 1;
+    }
+    FileStats stats;
+    bool success = processor.processFile(inputFilePath, outputFilePath, chunkSize, stats, true);
+    if(!pipelineFilePath.empty())
+    {
+        processor.printPipelineStats();
+    }
 
-    // save the point cloud
-	saveCloud(cloud, outputFilePath);
+    // report the processing time
+    std::cout << stats.processTime << " seconds passed " << std::endl;
 
-    // exit program
-    return 0;
+    // exit program, reporting a failed file in the return code as batch mode does
+    return success ? 0 : 1;
 }
@@ -19,15 +19,26 @@
  * @brief Template for acquiring PCL point clouds from an OpenNI2 device
  *
  * Template for acquiring PCL point clouds from an OpenNI2 device. Incoming data streams from an OpenNI2 compliant
- * device are acquired and converted to PCL point clouds, which are then visualized in real time.
+ * device are acquired and converted to PCL point clouds, which are then visualized in real time. Clouds can be saved
+ * from the grabber callback, or handed to a pool of writer threads through a lock-free queue so that capture never
+ * waits on the disk. A directory of cloud files or a recording can be replayed in place of the device, so the pipeline
+ * can be benchmarked without hardware.
  *
  * @author Christopher D. McMurrough
  **********************************************************************************************************************/
 
+#include "LockFreeQueue.h"
+#include "CloudRecordingWriter.h"
+#include "CloudReplayGrabber.h"
+
 #include <iostream>
 #include <iomanip>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <ctime>
 
 #include <pcl/io/openni2_grabber.h>
 #include <pcl/visualization/cloud_viewer.h>
@@ -39,8 +50,89 @@
 
 #define NUM_COMMAND_ARGS 2
 
+// number of captured clouds the save queue can hold before frames are dropped
+#define SAVE_QUEUE_CAPACITY 64
+
+// disk save modes selectable from the command line
+#define SAVE_MODE_OFF 0
+#define SAVE_MODE_PCD 1
+#define SAVE_MODE_RECORDING 2
+
 using namespace std;
 
+/***********************************************************************************************************************
+ * @struct CapturedCloud
+ * @brief A captured cloud waiting to be saved
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct CapturedCloud
+{
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr cloud;
+    int index;
+    std::chrono::steady_clock::time_point captureTime;
+};
+
+/***********************************************************************************************************************
+ * @class PipelineCounters
+ * @brief Thread safe frame and latency counters for the capture and save stages
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class PipelineCounters
+{
+public:
+
+    // capture stage
+    std::atomic<long> captured;
+    std::atomic<long> dropped;
+    std::atomic<long> callbackTimeUs;
+    std::atomic<long> maxCallbackTimeUs;
+
+    // save stage
+    std::atomic<long> saved;
+    std::atomic<long> failed;
+    std::atomic<long> queueTimeUs;
+    std::atomic<long> maxQueueTimeUs;
+    std::atomic<long> saveTimeUs;
+    std::atomic<long> maxSaveTimeUs;
+
+    /*******************************************************************************************************************
+     * @brief Class constructor
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    PipelineCounters() : captured(0), dropped(0), callbackTimeUs(0), maxCallbackTimeUs(0), saved(0), failed(0), queueTimeUs(0), maxQueueTimeUs(0), saveTimeUs(0), maxSaveTimeUs(0)
+    {
+    }
+
+    /*******************************************************************************************************************
+     * @brief Add a latency sample to a running total and maximum
+     * @param[in,out] total the running total, in microseconds
+     * @param[in,out] maximum the running maximum, in microseconds
+     * @param[in] sample the measured latency, in microseconds
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    static void addSample(std::atomic<long> &total, std::atomic<long> &maximum, long sample)
+    {
+        total += sample;
+        long current = maximum.load();
+        while(sample > current && !maximum.compare_exchange_weak(current, sample))
+        {
+        }
+    }
+
+    /*******************************************************************************************************************
+     * @brief Print the counters to the console
+     * @param[in] queueSize the current number of clouds waiting to be saved
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    void print(size_t queueSize) const
+    {
+        long numCaptured = std::max(captured.load(), 1L);
+        long numSaved = std::max(saved.load(), 1L);
+        std::printf("capture: %ld frames, %ld dropped, callback %.2f ms avg %.2f ms max | ", captured.load(), dropped.load(), callbackTimeUs.load() / 1000.0 / numCaptured, maxCallbackTimeUs.load() / 1000.0);
+        std::printf("save: %ld saved, %ld failed, %zu queued, wait %.2f ms avg %.2f ms max, write %.2f ms avg %.2f ms max\n", saved.load(), failed.load(), queueSize, queueTimeUs.load() / 1000.0 / numSaved, maxQueueTimeUs.load() / 1000.0, saveTimeUs.load() / 1000.0 / numSaved, maxSaveTimeUs.load() / 1000.0);
+    }
+};
+
 /***********************************************************************************************************************
  * @class OpenNI2Processor
  * @brief Class containing data acquisition mechanics for OpenNI2 devices
@@ -53,33 +145,69 @@ private:
     // store the display and save settings for the session
     int m_cloudRenderSetting;
     int m_cloudSaveSetting;
+    int m_numWriterThreads;
+
+    // replay settings, an empty source uses the OpenNI2 device
+    string m_replaySource;
+    int m_replayPacing;
+    float m_replayRate;
+
+    // save pipeline state
+    LockFreeQueue<CapturedCloud> m_saveQueue;
+    std::vector<std::thread> m_writers;
+    std::atomic<bool> m_capturing;
+    int m_saveCount;
+    PipelineCounters m_counters;
+
+    // single file recording state
+    CloudRecordingWriter m_recorder;
 
     // create a stop watch for measuring time
     pcl::StopWatch m_stopWatch;
 
-    // create the cloud viewer object
-    pcl::visualization::CloudViewer m_viewer;
+    // the cloud viewer, only created when rendering so that saving and replay can run without a display
+    boost::shared_ptr<pcl::visualization::CloudViewer> m_viewer;
 
 public:
 
     /***********************************************************************************************************************
      * @brief Class constructor
      * @param[in] cloudRenderSetting sets the cloud visualization mode (render_off:0, render_on:1)
-     * @param[in] cloudSaveSetting sets the disk save mode for cloud data (saves_off:0, saves_on:1)
+     * @param[in] cloudSaveSetting sets the disk save mode for cloud data (saves_off:0, pcd_files:1, recording:2)
+     * @param[in] numWriterThreads the number of threads saving clouds, or 0 to save in the grabber callback (default: 0)
+     *            a recording is appended in order, so at most one writer thread is used
+     * @param[in] replaySource a directory of cloud files or a recording to replay, or "" to use the device (default: "")
+     * @param[in] replayPacing the replay pacing (real_time:0, fixed_rate:1, as_fast_as_possible:2) (default: 0)
+     * @param[in] replayRate the fixed replay rate in frames per second (default: 30)
      * @author Christopher D. McMurrough
      **********************************************************************************************************************/
-    OpenNI2Processor(int cloudRenderSetting, int cloudSaveSetting) : m_viewer("Rendering Window")
+    OpenNI2Processor(int cloudRenderSetting, int cloudSaveSetting, int numWriterThreads=0, const string &replaySource="", int replayPacing=0, float replayRate=30.0f) : m_saveQueue(SAVE_QUEUE_CAPACITY)
     {
+        // store the replay settings
+        m_replaySource = replaySource;
+        m_replayPacing = replayPacing;
+        m_replayRate = replayRate;
+
         // store the render and save settings
         m_cloudRenderSetting = cloudRenderSetting;
         m_cloudSaveSetting = cloudSaveSetting;
+        m_numWriterThreads = std::max(numWriterThreads, 0);
+        if(m_cloudSaveSetting == SAVE_MODE_RECORDING)
+        {
+            m_numWriterThreads = std::min(m_numWriterThreads, 1);
+        }
+        m_capturing = false;
+        m_saveCount = 0;
 
-        // if the render setting is 0, force the visualization window to close
+        // only open the visualization window if rendering is enabled
         if(m_cloudRenderSetting == 0)
         {
-            m_viewer.~CloudViewer();
             std::printf("Running with visualization OFF... \n");
         }
+        else
+        {
+            m_viewer.reset(new pcl::visualization::CloudViewer("Rendering Window"));
+        }
     }
 
     /***********************************************************************************************************************
@@ -88,8 +216,23 @@ public:
      **********************************************************************************************************************/
     void run()
     {
-        // create a new grabber for OpenNI2 devices
-        pcl::Grabber* interface = new pcl::io::OpenNI2Grabber();
+        // create a new grabber for OpenNI2 devices, or replay recorded clouds
+        pcl::Grabber* interface;
+        if(m_replaySource.empty())
+        {
+            interface = new pcl::io::OpenNI2Grabber();
+        }
+        else
+        {
+            CloudReplayGrabber* replayGrabber = new CloudReplayGrabber(m_replaySource, static_cast<CloudReplayGrabber::PacingMode>(m_replayPacing), m_replayRate);
+            if(!replayGrabber->isValid())
+            {
+                delete replayGrabber;
+                return;
+            }
+            std::printf("Replaying %zu clouds from %s... \n", replayGrabber->size(), m_replaySource.c_str());
+            interface = replayGrabber;
+        }
 
         // bind the callbacks to the appropriate member functions
         boost::function<void (const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr&)> f = boost::bind(&OpenNI2Processor::cloudCallback, this, _1);
@@ -97,21 +240,69 @@ public:
         // connect callback function for desired signal. In this case its a point cloud with color values
         interface->registerCallback(f);
 
+        // create the recording file if necessary
+        if(m_cloudSaveSetting == SAVE_MODE_RECORDING)
+        {
+            std::stringstream ss;
+            ss << "recording_" << std::time(NULL) << ".rec";
+            if(!m_recorder.open(ss.str()))
+            {
+                delete interface;
+                return;
+            }
+            std::printf("Recording clouds to %s... \n", ss.str().c_str());
+        }
+
+        // start the writer threads before any clouds arrive
+        m_capturing = true;
+        if(m_cloudSaveSetting && m_numWriterThreads > 0)
+        {
+            for(int i = 0; i < m_numWriterThreads; i++)
+            {
+                m_writers.push_back(std::thread(&OpenNI2Processor::writerLoop, this));
+            }
+            std::printf("Saving clouds with %d writer threads... \n", m_numWriterThreads);
+        }
+
         // start receiving point clouds
         interface->start();
 
         // start the timer
         m_stopWatch.reset();
 
-        // wait until user quits program
-        while (!m_viewer.wasStopped())
+        // wait until user quits program or the replay ends, reporting the pipeline counters once per second
+        int loopCount = 0;
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        while ((!m_viewer || !m_viewer->wasStopped()) && interface->isRunning())
         {
-            //m_viewer.spinOnce();
+            //m_viewer->spinOnce();
             std::this_thread::sleep_for (std::chrono::milliseconds(100));
+            if(++loopCount % 10 == 0)
+            {
+                m_counters.print(m_saveQueue.size());
+            }
         }
 
-        // stop the grabber
+        // stop the grabber, then let the writers drain the queue
         interface->stop();
+        delete interface;
+        double runTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        m_capturing = false;
+        for(size_t i = 0; i < m_writers.size(); i++)
+        {
+            m_writers.at(i).join();
+        }
+        m_writers.clear();
+        m_counters.print(m_saveQueue.size());
+        std::printf("Processed %ld clouds in %.2f seconds (%.2f fps)\n", m_counters.captured.load(), runTime, m_counters.captured.load() / std::max(runTime, 1e-6));
+
+        // write the recording index
+        if(m_recorder.isOpen())
+        {
+            size_t numFrames = m_recorder.getFramesWritten();
+            m_recorder.close();
+            std::printf("Recorded %zu frames (%.1f MB)\n", numFrames, m_recorder.getBytesWritten() / 1048576.0);
+        }
     }
 
     /***********************************************************************************************************************
@@ -122,30 +313,120 @@ public:
     void cloudCallback(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn)
     {
         // get the elapsed time since the last callback
+        std::chrono::steady_clock::time_point captureTime = std::chrono::steady_clock::now();
         double elapsedTime = m_stopWatch.getTimeSeconds();
         m_stopWatch.reset();
-        std::printf("Seconds elapsed since last cloud callback: %f \n", elapsedTime);
-
-        // store the cloud save count
-        static int saveCount = 0;
+        if(m_numWriterThreads == 0)
+        {
+            std::printf("Seconds elapsed since last cloud callback: %f \n", elapsedTime);
+        }
+        m_counters.captured++;
 
         // render cloud if necessary
-        if(m_cloudRenderSetting)
+        if(m_viewer)
         {
-            m_viewer.showCloud(cloudIn);
+            m_viewer->showCloud(cloudIn);
         }
 
         // save the cloud if necessary
         if(m_cloudSaveSetting)
         {
-            std::stringstream ss;
-            string str;
-            ss << saveCount << ".pcd";
+            CapturedCloud captured;
+            captured.cloud = cloudIn;
+            captured.index = m_saveCount;
+            captured.captureTime = captureTime;
+            if(m_numWriterThreads == 0)
+            {
+                // save in the callback, blocking the grabber
+                saveCloud(captured);
+                m_saveCount++;
+            }
+            else if(m_saveQueue.tryPush(captured))
+            {
+                // hand the cloud to the writers
+                m_saveCount++;
+            }
+            else
+            {
+                // drop the frame rather than wait for the writers
+                m_counters.dropped++;
+            }
+        }
+
+        // measure the time spent in the callback
+        long callbackTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - captureTime).count();
+        PipelineCounters::addSample(m_counters.callbackTimeUs, m_counters.maxCallbackTimeUs, callbackTimeUs);
+    }
+
+    /***********************************************************************************************************************
+     * @brief Save queued clouds until capture has stopped and the queue is empty
+     * @author Christopher D. McMurrough
+     **********************************************************************************************************************/
+    void writerLoop()
+    {
+        CapturedCloud captured;
+        while(true)
+        {
+            if(m_saveQueue.tryPop(captured))
+            {
+                saveCloud(captured);
+                captured.cloud.reset();
+            }
+            else if(m_capturing)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            else if(m_saveQueue.size() == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    /***********************************************************************************************************************
+     * @brief Save a captured cloud to disk and update the save counters
+     * @param[in] captured the cloud to save
+     * @author Christopher D. McMurrough
+     **********************************************************************************************************************/
+    void saveCloud(const CapturedCloud &captured)
+    {
+        // measure the time the cloud spent waiting in the queue
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        long queueTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(startTime - captured.captureTime).count();
+
+        // write the cloud
+        std::stringstream ss;
+        string str;
+        bool success;
+        if(m_cloudSaveSetting == SAVE_MODE_RECORDING)
+        {
+            ss << "recording frame " << captured.index;
+            str = ss.str();
+            success = m_recorder.writeFrame(*captured.cloud);
+        }
+        else
+        {
+            ss << captured.index << ".pcd";
             str = ss.str();
-            pcl::io::savePCDFile<pcl::PointXYZRGBA> (str.c_str(), *cloudIn, true);
-            std::printf("cloud saved to %s\n", str.c_str());
-            saveCount++;
+            success = pcl::io::savePCDFile<pcl::PointXYZRGBA> (str.c_str(), *captured.cloud, true) == 0;
+        }
+        if(success)
+        {
+            m_counters.saved++;
+            if(m_numWriterThreads == 0)
+            {
+                std::printf("cloud saved to %s\n", str.c_str());
+            }
         }
+        else
+        {
+            m_counters.failed++;
+        }
+
+        // measure the time spent writing
+        long saveTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+        PipelineCounters::addSample(m_counters.queueTimeUs, m_counters.maxQueueTimeUs, queueTimeUs);
+        PipelineCounters::addSample(m_counters.saveTimeUs, m_counters.maxSaveTimeUs, saveTimeUs);
     }
 };
 
@@ -161,6 +442,10 @@ int main (int argc, char** argv)
     // store the run time settings
     int cloudRenderSetting;
     int cloudSaveSetting;
+    int numWriterThreads = 0;
+    string replaySource;
+    int replayPacing = 0;
+    float replayRate = 30.0f;
 
     // parse and validate the command line arguments
     if(argc == 1)
@@ -169,10 +454,15 @@ int main (int argc, char** argv)
         cloudRenderSetting = 1;
         cloudSaveSetting = 0;
     }
-    else if(argc != NUM_COMMAND_ARGS + 1)
+    else if(argc < NUM_COMMAND_ARGS + 1 || argc > NUM_COMMAND_ARGS + 5)
     {
         // return if we do not have the proper amount of arguments
-        std::printf("USAGE: %s <cloud_render_setting> <cloud_save_setting> \n", argv[0]);
+        std::printf("USAGE: %s <cloud_render_setting> <cloud_save_setting> [writer_threads] [replay_source] [replay_pacing] [replay_rate] \n", argv[0]);
+        std::printf("    cloud_save_setting 0: off, 1: one pcd file per cloud, 2: single compressed recording file\n");
+        std::printf("    writer_threads 0: save in the grabber callback (default), >0: pipelined saving with that many threads\n");
+        std::printf("    replay_source: directory of pcd/ply files or recording file to replay instead of the device\n");
+        std::printf("    replay_pacing 0: recorded time stamps (default), 1: fixed rate, 2: as fast as possible\n");
+        std::printf("    replay_rate: frames per second for fixed rate pacing (default: 30)\n");
         return 0;
     }
     else
@@ -180,10 +470,26 @@ int main (int argc, char** argv)
         // parse the command line arguments
         cloudRenderSetting = atoi(argv[1]);
         cloudSaveSetting = atoi(argv[2]);
+        if(argc > NUM_COMMAND_ARGS + 1)
+        {
+            numWriterThreads = atoi(argv[3]);
+        }
+        if(argc > NUM_COMMAND_ARGS + 2)
+        {
+            replaySource = argv[4];
+        }
+        if(argc > NUM_COMMAND_ARGS + 3)
+        {
+            replayPacing = atoi(argv[5]);
+        }
+        if(argc > NUM_COMMAND_ARGS + 4)
+        {
+            replayRate = static_cast<float>(atof(argv[6]));
+        }
     }
 
     // create the processing object
-    OpenNI2Processor ONI2Processor(cloudRenderSetting, cloudSaveSetting);
+    OpenNI2Processor ONI2Processor(cloudRenderSetting, cloudSaveSetting, numWriterThreads, replaySource, replayPacing, replayRate);
 
     // start the processing object
     ONI2Processor.run();
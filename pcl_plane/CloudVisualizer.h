@@ -29,6 +29,9 @@
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/octree/octree.h>
 #include <Eigen/Core>
+#include <vtkPolyData.h>
+
+#include <vector>
 
 using namespace std;
 
@@ -48,6 +51,10 @@ private:
 
     boost::shared_ptr<pcl::visualization::PCLVisualizer> myViewer;
 
+    // incremental update helpers
+    vtkPolyData* getIndexedCloudData(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, const string &id);
+    static void patchPoint(const pcl::PointXYZRGBA &point, float *xyz, unsigned char *rgb, int numComponents);
+
 public:
 
     // constructors
@@ -62,6 +69,8 @@ public:
     // rendering functions
     void addCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, double pointSize=1.0, const string &id="cloud", int viewPort=0);
     void updateCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, const string &id="cloud");
+    void updateCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, size_t firstIndex, size_t numPoints, const string &id="cloud");
+    void updateCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, const std::vector<bool> &changedMask, const string &id="cloud");
     void addCoordinateFrame(const Eigen::Vector4f &position, const Eigen::Quaternionf &orientation, double scale=1.0, const string &id="frame", int viewPort=0);
     void addCoordinateFrame(double x, double y, double z, double roll, double pitch, double yaw, double scale=1.0, const string &id="frame", int viewPort=0);
     void addLine(double x1, double y1, double z1, double x2, double y2, double z2, double r=255.0, double g=255.0, double b=255.0, double opacity=1.0, double lineWidth=1.0, const string &id="line", int viewPort=0);
@@ -74,6 +83,7 @@ public:
     void addPlane(const Eigen::Vector4f &plane, double r=255.0, double g=255.0, double b=255.0, double opacity=1.0, const string &id="plane", int viewPort=0);
     void addOccupancyGrid(const pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> &octree, double r=255.0, double g=255.0, double b=255.0, double opacity=1.0, double frameSize=1.0, const string &id="octree", int viewPort=0);
     void addOccupancyGrid(const pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::ConstPtr octree, double r=255.0, double g=255.0, double b=255.0, double opacity=1.0, double frameSize=1.0, const string &id="octree", int viewPort=0);
+    void addOccupancyGrid(const string &cloudFileName, const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, double resolution, double r=255.0, double g=255.0, double b=255.0, double opacity=1.0, double frameSize=1.0, const string &id="octree", int viewPort=0);
     void addOccupancyGridSpheres(const pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> &octree, double r, double g, double b, double opacity, const string &id, int viewPort);
     void addPolygonMesh(const pcl::PolygonMesh::ConstPtr &mesh, double r=255.0, double g=255.0, double b=255.0, double opacity=1.0, const string &id="mesh", int viewPort=0);
     void removePolygonMesh(const string &id="mesh", int viewPort=0);
@@ -24,12 +24,17 @@
 **********************************************************************************************************************/
 
 #include "CloudVisualizer.h"
+#include "CloudIO.h"
+#include "ParallelPlaneSegmentation.h"
+#include "ParallelOutlierRemoval.h"
+#include "PointBuffer.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/io/ply_io.h>
 #include <pcl/common/time.h>
+#include <pcl/filters/statistical_outlier_removal.h>
 #include <pcl/sample_consensus/model_types.h>
 #include <pcl/sample_consensus/method_types.h>
 #include <pcl/sample_consensus/sac_model_plane.h>
@@ -37,12 +42,18 @@
 
 #define NUM_COMMAND_ARGS 1
 
+// processing engines selectable from the command line, combined as bit flags, no flags runs the PCL baseline
+#define ENGINE_PARALLEL_SEGMENTATION 1
+#define ENGINE_PARALLEL_OUTLIERS 2
+#define ENGINE_PCL_OUTLIERS 4
+
 using namespace std;
 
 // function prototypes
 void pointPickingCallback(const pcl::visualization::PointPickingEvent& event, void* cookie);
 void keyboardCallback(const pcl::visualization::KeyboardEvent &event, void* viewer_void);
 void segmentPlane(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointIndices::Ptr &inliers, double distanceThreshold, int maxIterations);
+void segmentPlanes(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, std::vector<pcl::PointIndices> &planeInliers, std::vector<pcl::ModelCoefficients> &planeCoefficients, double distanceThreshold, int maxIterations, int maxPlanes, int minPlaneSize);
 
 /***********************************************************************************************************************
 * @brief callback function for handling a point picking event
@@ -97,56 +108,6 @@ void keyboardCallback(const pcl::visualization::KeyboardEvent &event, void* view
     }
 }
 
-/***********************************************************************************************************************
-* @brief Opens a point cloud file
-*
-* Opens a point cloud file in either PCD or PLY format
-*
-* @param[out] cloudOut pointer to opened point cloud
-* @param[in] filename path and name of input file
-* @return false if an error occurred while opening file
-* @author Christopher D. McMurrough
-**********************************************************************************************************************/
-bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fileName)
-{
-    // convert the file name to string
-    std::string fileNameStr(fileName);
-
-    // handle various file types
-    std::string fileExtension = fileNameStr.substr(fileNameStr.find_last_of(".") + 1);
-    if(fileExtension.compare("pcd") == 0)
-    {
-        // attempt to open the file
-        if(pcl::io::loadPCDFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcd file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
-        {
-            return true;
-        }
-    }
-    else if(fileExtension.compare("ply") == 0)
-    {
-        // attempt to open the file
-        if(pcl::io::loadPLYFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcl file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
-        {
-            return true;
-        }
-    }
-    else
-    {
-        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileNameStr.c_str());
-        return false;
-    }
-}
-
 /*******************************************************************************************************************//**
  * @brief Locate a plane in the cloud
  *
@@ -177,6 +138,36 @@ void segmentPlane(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, p
     seg.segment(*inliers, *coefficients);
 }
 
+/*******************************************************************************************************************//**
+ * @brief Locate multiple planes in the cloud
+ *
+ * Perform multi-plane segmentation using RANSAC with hypotheses scored on all cores, removing the inliers of each plane
+ * before searching for the next one
+ *
+ * @param[in] cloudIn pointer to input point cloud
+ * @param[out] planeInliers list containing the point indices of each plane, largest first
+ * @param[out] planeCoefficients list containing the model coefficients of each plane
+ * @param[in] distanceThreshold maximum distance of a point to the planar model to be considered an inlier
+ * @param[in] maxIterations maximum number of iterations to attempt per plane
+ * @param[in] maxPlanes maximum number of planes to extract
+ * @param[in] minPlaneSize minimum number of inliers for a plane to be accepted
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void segmentPlanes(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, std::vector<pcl::PointIndices> &planeInliers, std::vector<pcl::ModelCoefficients> &planeCoefficients, double distanceThreshold, int maxIterations, int maxPlanes, int minPlaneSize)
+{
+    // create the segmentation object and set the parameters
+    ParallelPlaneSegmentation seg;
+    seg.setDistanceThreshold(distanceThreshold);
+    seg.setMaxIterations(maxIterations);
+    seg.setProbability(0.99);
+    seg.setMaxPlanes(maxPlanes);
+    seg.setMinInliers(minPlaneSize);
+
+    // segment the planar components of the cloud
+    seg.setInputCloud(cloudIn);
+    seg.segment(planeInliers, planeCoefficients);
+}
+
 /***********************************************************************************************************************
 * @brief program entry point
 * @param[in] argc number of command line arguments
@@ -187,14 +178,21 @@ void segmentPlane(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, p
 int main(int argc, char** argv)
 {
     // validate and parse the command line arguments
-    if(argc != NUM_COMMAND_ARGS + 1)
+    if(argc != NUM_COMMAND_ARGS + 1 && argc != NUM_COMMAND_ARGS + 2)
     {
-        std::printf("USAGE: %s <file_name>\n", argv[0]);
+        std::printf("USAGE: %s <file_name> [engines]\n", argv[0]);
+        std::printf("    engines: sum of the stages to replace or add, 0 runs the PCL baseline of a single plane (default)\n");
+        std::printf("        %d: multithreaded multi-plane extraction, %d: multithreaded outlier removal, %d: PCL outlier removal\n", ENGINE_PARALLEL_SEGMENTATION, ENGINE_PARALLEL_OUTLIERS, ENGINE_PCL_OUTLIERS);
         return 0;
     }
 
     // parse the command line arguments
     char* fileName = argv[1];
+    int engines = 0;
+    if(argc == NUM_COMMAND_ARGS + 2)
+    {
+        engines = atoi(argv[2]);
+    }
 
     // create a stop watch for measuring time
     pcl::StopWatch watch;
@@ -209,21 +207,70 @@ int main(int argc, char** argv)
     pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBA>);
     openCloud(cloud, fileName);
 
-    // segment a plane
+    // remove the sparse sensor noise before segmentation if requested
+    const int outlierMeanK = 50;
+    const double outlierStddevMul = 1.0;
+    pcl::StopWatch stageWatch;
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloudInliers(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    if(engines & ENGINE_PARALLEL_OUTLIERS)
+    {
+        ParallelOutlierRemoval outlierFilter;
+        outlierFilter.setInputCloud(cloud);
+        outlierFilter.setMeanK(outlierMeanK);
+        outlierFilter.setStddevMulThresh(outlierStddevMul);
+        outlierFilter.filter(*cloudInliers);
+    }
+    else if(engines & ENGINE_PCL_OUTLIERS)
+    {
+        pcl::StatisticalOutlierRemoval<pcl::PointXYZRGBA> outlierFilter;
+        outlierFilter.setInputCloud(cloud);
+        outlierFilter.setMeanK(outlierMeanK);
+        outlierFilter.setStddevMulThresh(outlierStddevMul);
+        outlierFilter.filter(*cloudInliers);
+    }
+    if(engines & (ENGINE_PARALLEL_OUTLIERS | ENGINE_PCL_OUTLIERS))
+    {
+        std::cout << "Points before outlier removal: " << cloud->points.size() << std::endl;
+        std::cout << "Points after outlier removal: " << cloudInliers->points.size() << " (" << stageWatch.getTime() << " ms)" << std::endl;
+        cloud.swap(cloudInliers);
+    }
+
+    // segment the planes
     const float distanceThreshold = 0.0254;
     const int maxIterations = 5000;
-    pcl::PointIndices::Ptr inliers(new pcl::PointIndices);
-    segmentPlane(cloud, inliers, distanceThreshold, maxIterations);
-    std::cout << "Segmentation result: " << inliers->indices.size() << " points" << std::endl;
-    
-    // color the plane inliers green
-    for(int i = 0; i < inliers->indices.size(); i++)
+    PointBuffer colors;
+    colors.loadColors(*cloud);
+    stageWatch.reset();
+    if(engines & ENGINE_PARALLEL_SEGMENTATION)
     {
-        int index = inliers->indices.at(i);
-        cloud->points.at(index).r = 0;
-        cloud->points.at(index).g = 255;
-        cloud->points.at(index).b = 0;
+        // extract the dominant planes, largest first
+        const int maxPlanes = 8;
+        const int minPlaneSize = 1000;
+        std::vector<pcl::PointIndices> planeInliers;
+        std::vector<pcl::ModelCoefficients> planeCoefficients;
+        segmentPlanes(cloud, planeInliers, planeCoefficients, distanceThreshold, maxIterations, maxPlanes, minPlaneSize);
+        std::cout << "Planes identified: " << planeInliers.size() << " (" << stageWatch.getTime() << " ms)" << std::endl;
+
+        // color the first plane green and the remaining planes randomly
+        for(int i = 0; i < planeInliers.size(); i++)
+        {
+            std::cout << "Plane " << i << ": " << planeInliers.at(i).indices.size() << " points" << std::endl;
+            int r = (i == 0) ? 0 : rand() % 256;
+            int g = (i == 0) ? 255 : rand() % 256;
+            int b = (i == 0) ? 0 : rand() % 256;
+            colors.setColor(planeInliers.at(i).indices, r, g, b);
+        }
+    }
+    else
+    {
+        pcl::PointIndices::Ptr inliers(new pcl::PointIndices);
+        segmentPlane(cloud, inliers, distanceThreshold, maxIterations);
+        std::cout << "Segmentation result: " << inliers->indices.size() << " points (" << stageWatch.getTime() << " ms)" << std::endl;
+
+        // color the plane inliers green
+        colors.setColor(inliers->indices, 0, 255, 0);
     }
+    colors.storeColors(*cloud);
 
     // get the elapsed time
     double elapsedTime = watch.getTimeSeconds();
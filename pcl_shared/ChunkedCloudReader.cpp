@@ -0,0 +1,654 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ChunkedCloudReader.cpp
+ * @brief Implementation file for the ChunkedCloudReader class
+ *
+ * This class streams point clouds from disk in fixed-size chunks so that files larger than memory can be processed
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ChunkedCloudReader.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes an empty ChunkedCloudReader, call open() to start reading a file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ChunkedCloudReader::ChunkedCloudReader()
+{
+    m_format = FORMAT_BINARY;
+    m_chunkSize = 0;
+    m_pointsRead = 0;
+    m_header.numPoints = 0;
+    m_header.width = 0;
+    m_header.height = 0;
+    m_fieldX = -1;
+    m_fieldY = -1;
+    m_fieldZ = -1;
+    m_fieldRGBA = -1;
+    m_fieldRed = -1;
+    m_fieldGreen = -1;
+    m_fieldBlue = -1;
+    m_fieldAlpha = -1;
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of threads used to convert each chunk
+ *
+ * Callers that already run one reader per thread should use 1, so the readers do not oversubscribe the machine
+ *
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ChunkedCloudReader::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Open a point cloud file for chunked reading
+ *
+ * Parses the header of a PCD or PLY file and positions the reader at the first point
+ *
+ * @param[in] fileName path and name of input file
+ * @param[in] chunkSize the maximum number of points returned by each call to readChunk (default: 1000000)
+ * @return false if an error occurred while opening the file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudReader::open(const std::string &fileName, size_t chunkSize)
+{
+    close();
+    m_chunkSize = std::max<size_t>(chunkSize, 1);
+
+    // handle various file types
+    bool success = false;
+    std::string fileExtension = fileName.substr(fileName.find_last_of(".") + 1);
+    if(fileExtension.compare("pcd") == 0)
+    {
+        success = readPCDHeader(fileName);
+    }
+    else if(fileExtension.compare("ply") == 0)
+    {
+        success = readPLYHeader(fileName);
+    }
+    else
+    {
+        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileName.c_str());
+    }
+
+    // make sure the file has point coordinates
+    if(success)
+    {
+        findFields();
+        if(m_fieldX < 0 || m_fieldY < 0 || m_fieldZ < 0)
+        {
+            PCL_ERROR("file does not contain x, y, and z fields: %s \n", fileName.c_str());
+            success = false;
+        }
+    }
+    if(!success)
+    {
+        close();
+    }
+    return success;
+}
+
+/***********************************************************************************************************************
+ * @brief Close the input file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ChunkedCloudReader::close()
+{
+    if(m_file.is_open())
+    {
+        m_file.close();
+    }
+    m_file.clear();
+    m_mappedFile.close();
+    std::vector<uint8_t>().swap(m_buffer);
+    m_header.fields.clear();
+    m_header.numPoints = 0;
+    m_pointsRead = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Parse the header of a PCD file
+ * @param[in] fileName path and name of input file
+ * @return false if the header could not be parsed
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudReader::readPCDHeader(const std::string &fileName)
+{
+    m_file.open(fileName.c_str(), std::ios::in | std::ios::binary);
+    if(!m_file.is_open())
+    {
+        PCL_ERROR("error while attempting to read pcd file: %s \n", fileName.c_str());
+        return false;
+    }
+
+    // read enough of the file to contain the header
+    const size_t maxHeaderSize = 65536;
+    std::vector<uint8_t> headerBuffer(maxHeaderSize);
+    m_file.read(reinterpret_cast<char*>(&headerBuffer[0]), maxHeaderSize);
+    size_t bytesRead = static_cast<size_t>(m_file.gcount());
+    m_file.clear();
+    if(!PCDMappedFile::readHeader(&headerBuffer[0], bytesRead, m_header))
+    {
+        PCL_ERROR("error while attempting to parse pcd header: %s \n", fileName.c_str());
+        return false;
+    }
+
+    // position the stream at the first point, compressed files are decompressed as a whole
+    if(m_header.dataType.compare("binary") == 0)
+    {
+        m_format = FORMAT_BINARY;
+        m_file.seekg(m_header.dataOffset);
+    }
+    else if(m_header.dataType.compare("ascii") == 0)
+    {
+        m_format = FORMAT_ASCII;
+        m_file.seekg(m_header.dataOffset);
+    }
+    else if(m_header.dataType.compare("binary_compressed") == 0)
+    {
+        m_format = FORMAT_COMPRESSED;
+        m_file.close();
+        if(!m_mappedFile.open(fileName))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        PCL_ERROR("unsupported pcd data type %s: %s \n", m_header.dataType.c_str(), fileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Parse the header of a PLY file
+ *
+ * Reads the vertex element properties of an ascii or binary_little_endian PLY file. The vertex element must be the
+ * first element in the file, any following elements (faces, edges) are ignored.
+ *
+ * @param[in] fileName path and name of input file
+ * @return false if the header could not be parsed or describes an unsupported layout
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudReader::readPLYHeader(const std::string &fileName)
+{
+    m_file.open(fileName.c_str(), std::ios::in | std::ios::binary);
+    if(!m_file.is_open())
+    {
+        PCL_ERROR("error while attempting to read ply file: %s \n", fileName.c_str());
+        return false;
+    }
+
+    // initialize the header
+    m_header.fields.clear();
+    m_header.numPoints = 0;
+    m_header.pointSize = 0;
+    m_header.dataType.clear();
+    m_header.sensorOrigin = Eigen::Vector4f::Zero();
+    m_header.sensorOrientation = Eigen::Quaternionf::Identity();
+
+    // parse the header one line at a time
+    std::string line;
+    bool vertexElement = false;
+    bool vertexFound = false;
+    bool headerEnded = false;
+    while(!headerEnded && std::getline(m_file, line))
+    {
+        // strip any carriage return left by windows line endings
+        if(!line.empty() && line.at(line.size() - 1) == '\r')
+        {
+            line.erase(line.size() - 1);
+        }
+
+        std::stringstream ss(line);
+        std::string key;
+        ss >> key;
+        if(key.compare("format") == 0)
+        {
+            ss >> m_header.dataType;
+        }
+        else if(key.compare("element") == 0)
+        {
+            std::string elementName;
+            ss >> elementName;
+            vertexElement = elementName.compare("vertex") == 0;
+            if(vertexElement)
+            {
+                ss >> m_header.numPoints;
+                vertexFound = true;
+            }
+            else if(!vertexFound)
+            {
+                PCL_ERROR("ply vertex element must come first: %s \n", fileName.c_str());
+                return false;
+            }
+        }
+        else if(key.compare("property") == 0 && vertexElement)
+        {
+            // map the property type to the PCD type and size notation
+            std::string typeName;
+            PCDField field;
+            ss >> typeName >> field.name;
+            field.count = 1;
+            if(typeName.compare("char") == 0 || typeName.compare("int8") == 0)
+            {
+                field.type = 'I';
+                field.size = 1;
+            }
+            else if(typeName.compare("uchar") == 0 || typeName.compare("uint8") == 0)
+            {
+                field.type = 'U';
+                field.size = 1;
+            }
+            else if(typeName.compare("short") == 0 || typeName.compare("int16") == 0)
+            {
+                field.type = 'I';
+                field.size = 2;
+            }
+            else if(typeName.compare("ushort") == 0 || typeName.compare("uint16") == 0)
+            {
+                field.type = 'U';
+                field.size = 2;
+            }
+            else if(typeName.compare("int") == 0 || typeName.compare("int32") == 0)
+            {
+                field.type = 'I';
+                field.size = 4;
+            }
+            else if(typeName.compare("uint") == 0 || typeName.compare("uint32") == 0)
+            {
+                field.type = 'U';
+                field.size = 4;
+            }
+            else if(typeName.compare("float") == 0 || typeName.compare("float32") == 0)
+            {
+                field.type = 'F';
+                field.size = 4;
+            }
+            else if(typeName.compare("double") == 0 || typeName.compare("float64") == 0)
+            {
+                field.type = 'F';
+                field.size = 8;
+            }
+            else
+            {
+                PCL_ERROR("unsupported ply vertex property %s: %s \n", typeName.c_str(), fileName.c_str());
+                return false;
+            }
+            field.offset = m_header.pointSize;
+            m_header.pointSize += field.size;
+            m_header.fields.push_back(field);
+        }
+        else if(key.compare("end_header") == 0)
+        {
+            headerEnded = true;
+        }
+    }
+
+    // validate the header
+    if(!headerEnded || !vertexFound)
+    {
+        PCL_ERROR("error while attempting to parse ply header: %s \n", fileName.c_str());
+        return false;
+    }
+    for(size_t i = 0; i < m_header.fields.size(); i++)
+    {
+        m_header.fields.at(i).stride = m_header.pointSize;
+    }
+    m_header.width = static_cast<uint32_t>(m_header.numPoints);
+    m_header.height = 1;
+
+    // the stream is now positioned at the first vertex
+    if(m_header.dataType.compare("binary_little_endian") == 0)
+    {
+        m_format = FORMAT_BINARY;
+    }
+    else if(m_header.dataType.compare("ascii") == 0)
+    {
+        m_format = FORMAT_ASCII;
+    }
+    else
+    {
+        PCL_ERROR("unsupported ply format %s: %s \n", m_header.dataType.c_str(), fileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Look up the coordinate and color fields of the parsed header
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ChunkedCloudReader::findFields()
+{
+    m_fieldX = -1;
+    m_fieldY = -1;
+    m_fieldZ = -1;
+    m_fieldRGBA = -1;
+    m_fieldRed = -1;
+    m_fieldGreen = -1;
+    m_fieldBlue = -1;
+    m_fieldAlpha = -1;
+    m_tokenIndex.clear();
+
+    size_t tokenIndex = 0;
+    for(size_t i = 0; i < m_header.fields.size(); i++)
+    {
+        const PCDField &field = m_header.fields.at(i);
+        int index = static_cast<int>(i);
+        if(field.name.compare("x") == 0)
+        {
+            m_fieldX = index;
+        }
+        else if(field.name.compare("y") == 0)
+        {
+            m_fieldY = index;
+        }
+        else if(field.name.compare("z") == 0)
+        {
+            m_fieldZ = index;
+        }
+        else if((field.name.compare("rgba") == 0 || (field.name.compare("rgb") == 0 && m_fieldRGBA < 0)) && field.size == 4)
+        {
+            m_fieldRGBA = index;
+        }
+        else if(field.name.compare("red") == 0)
+        {
+            m_fieldRed = index;
+        }
+        else if(field.name.compare("green") == 0)
+        {
+            m_fieldGreen = index;
+        }
+        else if(field.name.compare("blue") == 0)
+        {
+            m_fieldBlue = index;
+        }
+        else if(field.name.compare("alpha") == 0)
+        {
+            m_fieldAlpha = index;
+        }
+        m_tokenIndex.push_back(tokenIndex);
+        tokenIndex += field.count;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Convert one binary point record
+ * @param[in] record pointer to the first byte of the point record
+ * @param[out] point the converted point
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ChunkedCloudReader::convertRecord(const uint8_t* record, pcl::PointXYZRGBA &point) const
+{
+    const PCDField &fieldX = m_header.fields[m_fieldX];
+    const PCDField &fieldY = m_header.fields[m_fieldY];
+    const PCDField &fieldZ = m_header.fields[m_fieldZ];
+    point.x = readFieldAsFloat(record + fieldX.offset, fieldX);
+    point.y = readFieldAsFloat(record + fieldY.offset, fieldY);
+    point.z = readFieldAsFloat(record + fieldZ.offset, fieldZ);
+
+    // copy packed colors directly, or assemble them from separate channels
+    if(m_fieldRGBA >= 0)
+    {
+        std::memcpy(&point.rgba, record + m_header.fields[m_fieldRGBA].offset, sizeof(uint32_t));
+    }
+    else
+    {
+        point.r = m_fieldRed >= 0 ? static_cast<uint8_t>(readFieldAsFloat(record + m_header.fields[m_fieldRed].offset, m_header.fields[m_fieldRed])) : 0;
+        point.g = m_fieldGreen >= 0 ? static_cast<uint8_t>(readFieldAsFloat(record + m_header.fields[m_fieldGreen].offset, m_header.fields[m_fieldGreen])) : 0;
+        point.b = m_fieldBlue >= 0 ? static_cast<uint8_t>(readFieldAsFloat(record + m_header.fields[m_fieldBlue].offset, m_header.fields[m_fieldBlue])) : 0;
+        point.a = m_fieldAlpha >= 0 ? static_cast<uint8_t>(readFieldAsFloat(record + m_header.fields[m_fieldAlpha].offset, m_header.fields[m_fieldAlpha])) : 255;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Convert one ascii point line
+ * @param[in] line the text line containing the point values
+ * @param[out] point the converted point
+ * @return false if the line does not contain enough values
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudReader::convertLine(const std::string &line, pcl::PointXYZRGBA &point) const
+{
+    // split the line into its numeric tokens
+    std::vector<const char*> tokenStart;
+    tokenStart.reserve(m_header.fields.size());
+    const char* cursor = line.c_str();
+    while(*cursor != '\0')
+    {
+        while(*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+        {
+            cursor++;
+        }
+        if(*cursor == '\0')
+        {
+            break;
+        }
+        tokenStart.push_back(cursor);
+        while(*cursor != '\0' && *cursor != ' ' && *cursor != '\t' && *cursor != '\r')
+        {
+            cursor++;
+        }
+    }
+    if(tokenStart.size() < m_tokenIndex.back() + m_header.fields.back().count)
+    {
+        return false;
+    }
+
+    // parse the coordinates
+    point.x = std::strtof(tokenStart[m_tokenIndex.at(m_fieldX)], NULL);
+    point.y = std::strtof(tokenStart[m_tokenIndex.at(m_fieldY)], NULL);
+    point.z = std::strtof(tokenStart[m_tokenIndex.at(m_fieldZ)], NULL);
+
+    // parse the colors, a float rgb field holds the packed color bits
+    if(m_fieldRGBA >= 0)
+    {
+        const char* token = tokenStart[m_tokenIndex.at(m_fieldRGBA)];
+        if(m_header.fields.at(m_fieldRGBA).type == 'F')
+        {
+            float packed = std::strtof(token, NULL);
+            std::memcpy(&point.rgba, &packed, sizeof(uint32_t));
+        }
+        else
+        {
+            point.rgba = static_cast<uint32_t>(std::strtoul(token, NULL, 10));
+        }
+    }
+    else
+    {
+        point.r = m_fieldRed >= 0 ? static_cast<uint8_t>(std::atoi(tokenStart[m_tokenIndex.at(m_fieldRed)])) : 0;
+        point.g = m_fieldGreen >= 0 ? static_cast<uint8_t>(std::atoi(tokenStart[m_tokenIndex.at(m_fieldGreen)])) : 0;
+        point.b = m_fieldBlue >= 0 ? static_cast<uint8_t>(std::atoi(tokenStart[m_tokenIndex.at(m_fieldBlue)])) : 0;
+        point.a = m_fieldAlpha >= 0 ? static_cast<uint8_t>(std::atoi(tokenStart[m_tokenIndex.at(m_fieldAlpha)])) : 255;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Read the next chunk of points
+ *
+ * Reads up to chunkSize points into the output cloud, reusing its storage. The output is always unorganized.
+ *
+ * @param[out] chunkOut the output point cloud
+ * @return false if there are no more points or an error occurred while reading
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudReader::readChunk(pcl::PointCloud<pcl::PointXYZRGBA> &chunkOut)
+{
+    if(m_header.fields.empty() || m_pointsRead >= m_header.numPoints)
+    {
+        return false;
+    }
+    size_t count = std::min(m_chunkSize, m_header.numPoints - m_pointsRead);
+
+    // compressed files are sliced out of the decompressed payload
+    if(m_format == FORMAT_COMPRESSED)
+    {
+        if(!m_mappedFile.toCloud(chunkOut, m_pointsRead, m_pointsRead + count, m_numThreads))
+        {
+            return false;
+        }
+        m_pointsRead += count;
+        return true;
+    }
+
+    // allocate the output cloud
+    chunkOut.points.resize(count);
+    chunkOut.width = static_cast<uint32_t>(count);
+    chunkOut.height = 1;
+    chunkOut.sensor_origin_ = m_header.sensorOrigin;
+    chunkOut.sensor_orientation_ = m_header.sensorOrientation;
+
+    if(m_format == FORMAT_BINARY)
+    {
+        // read the raw records for this chunk
+        m_buffer.resize(count * m_header.pointSize);
+        m_file.read(reinterpret_cast<char*>(&m_buffer[0]), m_buffer.size());
+        if(static_cast<size_t>(m_file.gcount()) != m_buffer.size())
+        {
+            PCL_ERROR("unexpected end of file after %zu points \n", m_pointsRead);
+            return false;
+        }
+
+        // convert the records in parallel
+        parallelFor(0, count, [&](size_t blockBegin, size_t blockEnd, int)
+        {
+            for(size_t i = blockBegin; i < blockEnd; i++)
+            {
+                convertRecord(&m_buffer[i * m_header.pointSize], chunkOut.points[i]);
+            }
+        }, m_numThreads);
+    }
+    else
+    {
+        // parse one point per line
+        std::string line;
+        size_t i = 0;
+        while(i < count && std::getline(m_file, line))
+        {
+            if(line.empty() || line.at(0) == '#' || line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            if(!convertLine(line, chunkOut.points[i]))
+            {
+                PCL_ERROR("malformed point on line after %zu points \n", m_pointsRead + i);
+                return false;
+            }
+            i++;
+        }
+        if(i != count)
+        {
+            PCL_ERROR("unexpected end of file after %zu points \n", m_pointsRead + i);
+            return false;
+        }
+    }
+
+    // the chunk is dense only if every point is finite
+    chunkOut.is_dense = true;
+    for(size_t i = 0; i < count; i++)
+    {
+        const pcl::PointXYZRGBA &p = chunkOut.points[i];
+        if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+        {
+            chunkOut.is_dense = false;
+            break;
+        }
+    }
+    m_pointsRead += count;
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the total number of points in the file
+ * @return the number of points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t ChunkedCloudReader::size() const
+{
+    return m_header.numPoints;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points read so far
+ * @return the number of points returned by readChunk
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t ChunkedCloudReader::getPointsRead() const
+{
+    return m_pointsRead;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the organized width stored in the file header
+ * @return the cloud width
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint32_t ChunkedCloudReader::getWidth() const
+{
+    return m_header.width;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the organized height stored in the file header
+ * @return the cloud height
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint32_t ChunkedCloudReader::getHeight() const
+{
+    return m_header.height;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the sensor origin stored in the file header
+ * @return the sensor origin
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const Eigen::Vector4f& ChunkedCloudReader::getSensorOrigin() const
+{
+    return m_header.sensorOrigin;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the sensor orientation stored in the file header
+ * @return the sensor orientation
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const Eigen::Quaternionf& ChunkedCloudReader::getSensorOrientation() const
+{
+    return m_header.sensorOrientation;
+}
@@ -0,0 +1,124 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ChunkedCloudReader.h
+ * @brief Header file for the ChunkedCloudReader class
+ *
+ * This class streams point clouds from disk in fixed-size chunks so that files larger than memory can be processed
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef CHUNKEDCLOUDREADER_H
+#define CHUNKEDCLOUDREADER_H
+
+#include "PCDMappedFile.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class ChunkedCloudReader
+ *
+ * @brief Class for reading a PCD or PLY file as a sequence of fixed-size point chunks
+ *
+ * Binary and ascii PCD files and binary_little_endian and ascii PLY files are read sequentially, so memory use is
+ * bounded by the chunk size. Binary_compressed PCD files are stored as a single LZF block and must be decompressed as a
+ * whole, in that case the decompressed payload is held in memory and sliced into chunks.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ChunkedCloudReader
+{
+private:
+
+    // supported storage formats
+    enum Format
+    {
+        FORMAT_BINARY,
+        FORMAT_ASCII,
+        FORMAT_COMPRESSED
+    };
+
+    // input file state
+    std::ifstream m_file;
+    Format m_format;
+    PCDHeader m_header;
+    size_t m_chunkSize;
+    size_t m_pointsRead;
+
+    // field indices (-1 if not present), PLY files store color as separate channels
+    int m_fieldX;
+    int m_fieldY;
+    int m_fieldZ;
+    int m_fieldRGBA;
+    int m_fieldRed;
+    int m_fieldGreen;
+    int m_fieldBlue;
+    int m_fieldAlpha;
+
+    // position of the first value of each field within an ascii line
+    std::vector<size_t> m_tokenIndex;
+
+    // reusable read buffer for binary files
+    std::vector<uint8_t> m_buffer;
+
+    // decompressed data for binary_compressed files
+    PCDMappedFile m_mappedFile;
+
+    // settings
+    int m_numThreads;
+
+    // header parsing
+    bool readPCDHeader(const std::string &fileName);
+    bool readPLYHeader(const std::string &fileName);
+    void findFields();
+
+    // point conversion
+    void convertRecord(const uint8_t* record, pcl::PointXYZRGBA &point) const;
+    bool convertLine(const std::string &line, pcl::PointXYZRGBA &point) const;
+
+public:
+
+    // constructors
+    ChunkedCloudReader();
+
+    // settings
+    void setNumberOfThreads(int numThreads);
+
+    // file handling
+    bool open(const std::string &fileName, size_t chunkSize=1000000);
+    void close();
+    bool readChunk(pcl::PointCloud<pcl::PointXYZRGBA> &chunkOut);
+
+    // accessors
+    size_t size() const;
+    size_t getPointsRead() const;
+    uint32_t getWidth() const;
+    uint32_t getHeight() const;
+    const Eigen::Vector4f& getSensorOrigin() const;
+    const Eigen::Quaternionf& getSensorOrientation() const;
+};
+
+#endif // CHUNKEDCLOUDREADER_H
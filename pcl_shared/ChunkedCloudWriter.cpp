@@ -0,0 +1,209 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ChunkedCloudWriter.cpp
+ * @brief Implementation file for the ChunkedCloudWriter class
+ *
+ * This class streams point clouds to a binary PCD file in fixed-size chunks
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ChunkedCloudWriter.h"
+
+#include <pcl/console/print.h>
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+// size of each stored point (x, y, z, rgba)
+#define POINT_RECORD_SIZE 16
+
+/***********************************************************************************************************************
+ * @brief Format a header value with a fixed number of digits
+ *
+ * Header values are zero padded so that they can be overwritten in place once the final point count is known
+ *
+ * @param[in] value the value to format
+ * @return the formatted value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static std::string formatHeaderValue(size_t value)
+{
+    std::stringstream ss;
+    ss << std::setw(20) << std::setfill('0') << value;
+    return ss.str();
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes an empty ChunkedCloudWriter, call open() to start writing a file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ChunkedCloudWriter::ChunkedCloudWriter()
+{
+    m_pointsWritten = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ *
+ * Finalizes the output file if it is still open
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ChunkedCloudWriter::~ChunkedCloudWriter()
+{
+    if(isOpen())
+    {
+        close();
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Open a PCD file for chunked writing
+ * @param[in] fileName path and name of output file
+ * @param[in] origin the sensor origin written to the VIEWPOINT header entry
+ * @param[in] orientation the sensor orientation written to the VIEWPOINT header entry
+ * @return false if the file could not be created
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudWriter::open(const std::string &fileName, const Eigen::Vector4f &origin, const Eigen::Quaternionf &orientation)
+{
+    m_file.open(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!m_file.is_open())
+    {
+        PCL_ERROR("error while attempting to save pcd file: %s \n", fileName.c_str());
+        return false;
+    }
+    m_pointsWritten = 0;
+
+    // write the header, remembering where the sizes are stored
+    m_file << "# .PCD v0.7 - Point Cloud Data file format\n";
+    m_file << "VERSION 0.7\n";
+    m_file << "FIELDS x y z rgba\n";
+    m_file << "SIZE 4 4 4 4\n";
+    m_file << "TYPE F F F U\n";
+    m_file << "COUNT 1 1 1 1\n";
+    m_file << "WIDTH ";
+    m_widthPosition = m_file.tellp();
+    m_file << formatHeaderValue(0) << "\n";
+    m_file << "HEIGHT ";
+    m_heightPosition = m_file.tellp();
+    m_file << formatHeaderValue(1) << "\n";
+    m_file << "VIEWPOINT " << origin[0] << " " << origin[1] << " " << origin[2] << " " << orientation.w() << " " << orientation.x() << " " << orientation.y() << " " << orientation.z() << "\n";
+    m_file << "POINTS ";
+    m_pointsPosition = m_file.tellp();
+    m_file << formatHeaderValue(0) << "\n";
+    m_file << "DATA binary\n";
+    return m_file.good();
+}
+
+/***********************************************************************************************************************
+ * @brief Append a chunk of points to the file
+ * @param[in] chunkIn the points to write
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudWriter::writeChunk(const pcl::PointCloud<pcl::PointXYZRGBA> &chunkIn)
+{
+    if(!isOpen())
+    {
+        return false;
+    }
+
+    // pack the points into the file layout
+    size_t count = chunkIn.points.size();
+    m_buffer.resize(count * POINT_RECORD_SIZE);
+    for(size_t i = 0; i < count; i++)
+    {
+        const pcl::PointXYZRGBA &p = chunkIn.points[i];
+        uint8_t* record = &m_buffer[i * POINT_RECORD_SIZE];
+        std::memcpy(record, &p.x, sizeof(float));
+        std::memcpy(record + 4, &p.y, sizeof(float));
+        std::memcpy(record + 8, &p.z, sizeof(float));
+        std::memcpy(record + 12, &p.rgba, sizeof(uint32_t));
+    }
+
+    // write the packed points
+    if(count > 0)
+    {
+        m_file.write(reinterpret_cast<const char*>(&m_buffer[0]), m_buffer.size());
+    }
+    m_pointsWritten += count;
+    return m_file.good();
+}
+
+/***********************************************************************************************************************
+ * @brief Finalize and close the file
+ *
+ * Writes the final point count into the header. The given organized dimensions are used only if they match the number
+ * of points written, otherwise the cloud is stored as unorganized.
+ *
+ * @param[in] width the organized width of the cloud (default: 0)
+ * @param[in] height the organized height of the cloud (default: 0)
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudWriter::close(uint32_t width, uint32_t height)
+{
+    if(!isOpen())
+    {
+        return false;
+    }
+
+    // fall back to an unorganized cloud if the dimensions do not match
+    if(static_cast<size_t>(width) * height != m_pointsWritten)
+    {
+        width = static_cast<uint32_t>(m_pointsWritten);
+        height = 1;
+    }
+
+    // patch the header sizes
+    m_file.seekp(m_widthPosition);
+    m_file << formatHeaderValue(width);
+    m_file.seekp(m_heightPosition);
+    m_file << formatHeaderValue(height);
+    m_file.seekp(m_pointsPosition);
+    m_file << formatHeaderValue(m_pointsWritten);
+    bool success = m_file.good();
+    m_file.close();
+    return success;
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if a file is currently open for writing
+ * @return true if the file is open
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ChunkedCloudWriter::isOpen() const
+{
+    return m_file.is_open();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points written so far
+ * @return the number of points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t ChunkedCloudWriter::getPointsWritten() const
+{
+    return m_pointsWritten;
+}
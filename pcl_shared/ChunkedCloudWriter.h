@@ -0,0 +1,79 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ChunkedCloudWriter.h
+ * @brief Header file for the ChunkedCloudWriter class
+ *
+ * This class streams point clouds to a binary PCD file in fixed-size chunks
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef CHUNKEDCLOUDWRITER_H
+#define CHUNKEDCLOUDWRITER_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class ChunkedCloudWriter
+ *
+ * @brief Class for writing a binary PCD file one chunk at a time
+ *
+ * The header is written with placeholder sizes when the file is opened and patched with the final point count when the
+ * file is closed, so the total number of points does not need to be known in advance.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ChunkedCloudWriter
+{
+private:
+
+    // output file state
+    std::ofstream m_file;
+    std::streampos m_widthPosition;
+    std::streampos m_heightPosition;
+    std::streampos m_pointsPosition;
+    size_t m_pointsWritten;
+
+    // reusable write buffer
+    std::vector<uint8_t> m_buffer;
+
+public:
+
+    // constructors
+    ChunkedCloudWriter();
+    ~ChunkedCloudWriter();
+
+    // file handling
+    bool open(const std::string &fileName, const Eigen::Vector4f &origin=Eigen::Vector4f::Zero(), const Eigen::Quaternionf &orientation=Eigen::Quaternionf::Identity());
+    bool writeChunk(const pcl::PointCloud<pcl::PointXYZRGBA> &chunkIn);
+    bool close(uint32_t width=0, uint32_t height=0);
+    bool isOpen() const;
+
+    // accessors
+    size_t getPointsWritten() const;
+};
+
+#endif // CHUNKEDCLOUDWRITER_H
@@ -0,0 +1,114 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudIO.cpp
+ * @brief Point cloud file loading and saving functions shared by the pcl_* tools
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "CloudIO.h"
+#include "PCDMappedFile.h"
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/io/ply_io.h>
+
+/***********************************************************************************************************************
+* @brief Opens a point cloud file
+*
+* Opens a point cloud file in either PCD or PLY format. Binary and binary_compressed PCD files are memory mapped and
+* deserialized using multiple threads, ascii PCD files and PLY files are loaded with the PCL readers.
+*
+* @param[out] cloudOut pointer to opened point cloud
+* @param[in] fileName path and name of input file
+* @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+* @return false if an error occurred while opening file
+* @author Christopher D. McMurrough
+**********************************************************************************************************************/
+bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const std::string &fileName, int numThreads)
+{
+    // handle various file types
+    std::string fileExtension = fileName.substr(fileName.find_last_of(".") + 1);
+    if(fileExtension.compare("pcd") == 0)
+    {
+        // attempt to map binary files directly
+        PCDMappedFile mappedFile;
+        if(mappedFile.open(fileName) && mappedFile.toCloud(*cloudOut, numThreads))
+        {
+            return true;
+        }
+
+        // fall back to the PCL reader for ascii files
+        if(pcl::io::loadPCDFile<pcl::PointXYZRGBA>(fileName, *cloudOut) == -1)
+        {
+            PCL_ERROR("error while attempting to read pcd file: %s \n", fileName.c_str());
+            return false;
+        }
+        else
+        {
+            return true;
+        }
+    }
+    else if(fileExtension.compare("ply") == 0)
+    {
+        // attempt to open the file
+        if(pcl::io::loadPLYFile<pcl::PointXYZRGBA>(fileName, *cloudOut) == -1)
+        {
+            PCL_ERROR("error while attempting to read pcl file: %s \n", fileName.c_str());
+            return false;
+        }
+        else
+        {
+            return true;
+        }
+    }
+    else
+    {
+        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileName.c_str());
+        return false;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Saves a point cloud to file
+ *
+ * Saves a given point cloud to disk in PCD format
+ *
+ * @param[in] cloudIn pointer to output point cloud
+ * @param[in] fileName path and name of output file
+ * @param[in] binaryMode saves the file in binary form if true (default:true)
+ * @return false if an error occured while writing file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool saveCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, const std::string &fileName, bool binaryMode)
+{
+    // if the input cloud is empty, return
+    if(cloudIn->points.size() == 0)
+    {
+        return false;
+    }
+
+    // attempt to save the file
+    if(pcl::io::savePCDFile<pcl::PointXYZRGBA>(fileName, *cloudIn, binaryMode) == -1)
+    {
+        PCL_ERROR("error while attempting to save pcd file: %s \n", fileName.c_str());
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
@@ -0,0 +1,406 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudRecordingCodec.cpp
+ * @brief Implementation file for the CloudRecordingCodec class
+ *
+ * This class compresses the points of one recorded frame
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "CloudRecordingCodec.h"
+#include "ParallelFor.h"
+
+#include <pcl/io/lzf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// number of points encoded together in one block
+#define BLOCK_SIZE 16384
+
+// size of the payload header and of each block table entry
+#define PAYLOAD_HEADER_SIZE 8
+#define BLOCK_ENTRY_SIZE 8
+
+/***********************************************************************************************************************
+ * @brief Append a signed value as a zigzag variable-length integer
+ * @param[in] value the value to append
+ * @param[out] out the buffer to append to
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline void appendVarint(int64_t value, std::vector<uint8_t> &out)
+{
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while(zigzag >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(zigzag));
+}
+
+/***********************************************************************************************************************
+ * @brief Read a signed zigzag variable-length integer
+ * @param[in,out] ptr the read position, advanced past the value
+ * @param[in] end one past the last readable byte
+ * @param[out] value the decoded value
+ * @return false if the buffer ended before the value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline bool readVarint(const uint8_t* &ptr, const uint8_t* end, int64_t &value)
+{
+    uint64_t zigzag = 0;
+    int shift = 0;
+    while(ptr < end && shift < 64)
+    {
+        uint8_t byte = *ptr++;
+        zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0)
+        {
+            value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes the codec with a 1 mm quantization step and one thread per hardware thread
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudRecordingCodec::CloudRecordingCodec()
+{
+    m_quantizationStep = 0.001f;
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the quantization step of the coordinates
+ * @param[in] quantizationStep the coordinate resolution, in cloud units (default: 0.001)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudRecordingCodec::setQuantizationStep(float quantizationStep)
+{
+    m_quantizationStep = quantizationStep > 0 ? quantizationStep : 0.001f;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of threads used to encode and decode blocks
+ * @param[in] numThreads the number of threads, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudRecordingCodec::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the quantization step of the coordinates
+ * @return the coordinate resolution, in cloud units
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float CloudRecordingCodec::getQuantizationStep() const
+{
+    return m_quantizationStep;
+}
+
+/***********************************************************************************************************************
+ * @brief Encode the points of a cloud
+ * @param[in] cloud the cloud to encode
+ * @param[out] payloadOut the encoded points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudRecordingCodec::encode(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud, std::vector<uint8_t> &payloadOut)
+{
+    size_t numPoints = cloud.points.size();
+    size_t numBlocks = (numPoints + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if(m_rawBlocks.size() < numBlocks)
+    {
+        m_rawBlocks.resize(numBlocks);
+        m_storedBlocks.resize(numBlocks);
+    }
+
+    // encode and compress the blocks in parallel
+    parallelFor(0, numBlocks, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            std::vector<uint8_t> &raw = m_rawBlocks[i];
+            std::vector<uint8_t> &stored = m_storedBlocks[i];
+            encodeBlock(cloud, i * BLOCK_SIZE, std::min((i + 1) * BLOCK_SIZE, numPoints), raw);
+
+            // keep the raw block if compression does not make it smaller
+            stored.resize(raw.size());
+            unsigned int storedSize = raw.size() > 1 ? pcl::lzfCompress(&raw[0], static_cast<unsigned int>(raw.size()), &stored[0], static_cast<unsigned int>(raw.size() - 1)) : 0;
+            if(storedSize == 0)
+            {
+                stored = raw;
+            }
+            else
+            {
+                stored.resize(storedSize);
+            }
+        }
+    }, m_numThreads, 1);
+
+    // write the block table followed by the block data
+    size_t payloadSize = PAYLOAD_HEADER_SIZE + numBlocks * BLOCK_ENTRY_SIZE;
+    for(size_t i = 0; i < numBlocks; i++)
+    {
+        payloadSize += m_storedBlocks[i].size();
+    }
+    payloadOut.resize(payloadSize);
+    uint8_t* ptr = &payloadOut[0];
+    uint32_t header[2] = {static_cast<uint32_t>(numBlocks), BLOCK_SIZE};
+    std::memcpy(ptr, header, sizeof(header));
+    ptr += PAYLOAD_HEADER_SIZE;
+    for(size_t i = 0; i < numBlocks; i++)
+    {
+        uint32_t entry[2] = {static_cast<uint32_t>(m_storedBlocks[i].size()), static_cast<uint32_t>(m_rawBlocks[i].size())};
+        std::memcpy(ptr, entry, sizeof(entry));
+        ptr += BLOCK_ENTRY_SIZE;
+    }
+    for(size_t i = 0; i < numBlocks; i++)
+    {
+        if(!m_storedBlocks[i].empty())
+        {
+            std::memcpy(ptr, &m_storedBlocks[i][0], m_storedBlocks[i].size());
+            ptr += m_storedBlocks[i].size();
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Decode the points of a cloud
+ *
+ * The output cloud must already be sized to the number of encoded points, its width, height, and header are not changed
+ *
+ * @param[in] payload the encoded points
+ * @param[in] payloadSize the size of the encoded points in bytes
+ * @param[in,out] cloudOut the decoded points
+ * @return false if the payload is malformed or does not match the cloud size
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingCodec::decode(const uint8_t* payload, size_t payloadSize, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    // read the block table
+    if(payloadSize < PAYLOAD_HEADER_SIZE)
+    {
+        return false;
+    }
+    uint32_t header[2];
+    std::memcpy(header, payload, sizeof(header));
+    size_t numBlocks = header[0];
+    size_t blockSize = header[1];
+    size_t numPoints = cloudOut.points.size();
+    if(blockSize == 0 || numBlocks != (numPoints + blockSize - 1) / blockSize || payloadSize < PAYLOAD_HEADER_SIZE + numBlocks * BLOCK_ENTRY_SIZE)
+    {
+        return false;
+    }
+    std::vector<size_t> offsets(numBlocks + 1);
+    std::vector<uint32_t> rawSizes(numBlocks);
+    offsets[0] = PAYLOAD_HEADER_SIZE + numBlocks * BLOCK_ENTRY_SIZE;
+    for(size_t i = 0; i < numBlocks; i++)
+    {
+        uint32_t entry[2];
+        std::memcpy(entry, payload + PAYLOAD_HEADER_SIZE + i * BLOCK_ENTRY_SIZE, sizeof(entry));
+        offsets[i + 1] = offsets[i] + entry[0];
+        rawSizes[i] = entry[1];
+    }
+    if(offsets[numBlocks] > payloadSize)
+    {
+        return false;
+    }
+    if(m_rawBlocks.size() < numBlocks)
+    {
+        m_rawBlocks.resize(numBlocks);
+    }
+
+    // decompress and decode the blocks in parallel
+    std::atomic<bool> success(true);
+    parallelFor(0, numBlocks, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd && success; i++)
+        {
+            const uint8_t* stored = payload + offsets[i];
+            size_t storedSize = offsets[i + 1] - offsets[i];
+            const uint8_t* raw = stored;
+            if(storedSize != rawSizes[i])
+            {
+                std::vector<uint8_t> &buffer = m_rawBlocks[i];
+                buffer.resize(rawSizes[i]);
+                if(rawSizes[i] == 0 || pcl::lzfDecompress(stored, static_cast<unsigned int>(storedSize), &buffer[0], rawSizes[i]) != rawSizes[i])
+                {
+                    success = false;
+                    break;
+                }
+                raw = &buffer[0];
+            }
+            if(!decodeBlock(raw, rawSizes[i], i * blockSize, std::min((i + 1) * blockSize, numPoints), cloudOut))
+            {
+                success = false;
+            }
+        }
+    }, m_numThreads, 1);
+    return success;
+}
+
+/***********************************************************************************************************************
+ * @brief Encode one block of points without compression
+ * @param[in] cloud the cloud being encoded
+ * @param[in] begin index of the first point of the block
+ * @param[in] end one past the index of the last point of the block
+ * @param[out] rawOut the encoded block
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudRecordingCodec::encodeBlock(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud, size_t begin, size_t end, std::vector<uint8_t> &rawOut) const
+{
+    // write the validity bits
+    size_t count = end - begin;
+    size_t maskSize = (count + 7) / 8;
+    rawOut.assign(maskSize, 0);
+    size_t numValid = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        const pcl::PointXYZRGBA &p = cloud.points[begin + i];
+        if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+        {
+            rawOut[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+            numValid++;
+        }
+    }
+    rawOut.reserve(maskSize + numValid * 6);
+
+    // write the quantized coordinate deltas
+    const double scale = 1.0 / m_quantizationStep;
+    int64_t previous[3] = {0, 0, 0};
+    for(size_t i = 0; i < count; i++)
+    {
+        if(rawOut[i / 8] & (1 << (i % 8)))
+        {
+            const pcl::PointXYZRGBA &p = cloud.points[begin + i];
+            for(int axis = 0; axis < 3; axis++)
+            {
+                int64_t value = static_cast<int64_t>(std::llround(p.data[axis] * scale));
+                appendVarint(value - previous[axis], rawOut);
+                previous[axis] = value;
+            }
+        }
+    }
+
+    // write the color deltas
+    uint8_t previousColor[3] = {0, 0, 0};
+    for(size_t i = 0; i < count; i++)
+    {
+        if(rawOut[i / 8] & (1 << (i % 8)))
+        {
+            const pcl::PointXYZRGBA &p = cloud.points[begin + i];
+            uint8_t color[3] = {p.r, p.g, p.b};
+            for(int channel = 0; channel < 3; channel++)
+            {
+                rawOut.push_back(static_cast<uint8_t>(color[channel] - previousColor[channel]));
+                previousColor[channel] = color[channel];
+            }
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Decode one uncompressed block of points
+ * @param[in] raw the encoded block
+ * @param[in] rawSize the size of the encoded block in bytes
+ * @param[in] begin index of the first point of the block
+ * @param[in] end one past the index of the last point of the block
+ * @param[in,out] cloudOut the cloud receiving the decoded points
+ * @return false if the block is malformed
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingCodec::decodeBlock(const uint8_t* raw, size_t rawSize, size_t begin, size_t end, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut) const
+{
+    size_t count = end - begin;
+    size_t maskSize = (count + 7) / 8;
+    if(rawSize < maskSize)
+    {
+        return false;
+    }
+    const uint8_t* mask = raw;
+    const uint8_t* ptr = raw + maskSize;
+    const uint8_t* rawEnd = raw + rawSize;
+
+    // read the coordinates, marking invalid points with NaN
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const double step = m_quantizationStep;
+    int64_t previous[3] = {0, 0, 0};
+    size_t numValid = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        pcl::PointXYZRGBA &p = cloudOut.points[begin + i];
+        if(mask[i / 8] & (1 << (i % 8)))
+        {
+            for(int axis = 0; axis < 3; axis++)
+            {
+                int64_t delta;
+                if(!readVarint(ptr, rawEnd, delta))
+                {
+                    return false;
+                }
+                previous[axis] += delta;
+                p.data[axis] = static_cast<float>(previous[axis] * step);
+            }
+            numValid++;
+        }
+        else
+        {
+            p.x = nan;
+            p.y = nan;
+            p.z = nan;
+            p.rgba = 0;
+        }
+        p.data[3] = 1.0f;
+    }
+
+    // read the colors
+    if(static_cast<size_t>(rawEnd - ptr) != numValid * 3)
+    {
+        return false;
+    }
+    uint8_t color[3] = {0, 0, 0};
+    for(size_t i = 0; i < count; i++)
+    {
+        if(mask[i / 8] & (1 << (i % 8)))
+        {
+            pcl::PointXYZRGBA &p = cloudOut.points[begin + i];
+            color[0] = static_cast<uint8_t>(color[0] + *ptr++);
+            color[1] = static_cast<uint8_t>(color[1] + *ptr++);
+            color[2] = static_cast<uint8_t>(color[2] + *ptr++);
+            p.r = color[0];
+            p.g = color[1];
+            p.b = color[2];
+            p.a = 255;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudRecordingCodec.h
+ * @brief Header file for the CloudRecordingCodec class and the cloud recording file layout
+ *
+ * This class compresses the points of one recorded frame
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef CLOUDRECORDINGCODEC_H
+#define CLOUDRECORDINGCODEC_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <vector>
+
+// cloud recording file layout, all values are stored in native byte order
+//
+//   file header:  magic "CLOUDREC", uint32 version, float quantization step
+//   frame:        uint32 FRAME_MAGIC, uint32 payload size, uint32 width, uint32 height, uint64 stamp,
+//                 float origin[4], float orientation[4] (w x y z), followed by the encoded payload
+//   index:        uint64 frame offset and uint64 stamp for each frame
+//   footer:       uint32 INDEX_MAGIC, uint32 frame count, uint64 index offset
+//
+// The index and footer are written when the recording is closed. Recordings that were not closed are read by scanning
+// the frame headers.
+#define RECORDING_FILE_MAGIC "CLOUDREC"
+#define RECORDING_VERSION 1
+#define RECORDING_FILE_HEADER_SIZE 16
+#define RECORDING_FRAME_MAGIC 0x454d5246
+#define RECORDING_FRAME_HEADER_SIZE 56
+#define RECORDING_INDEX_MAGIC 0x58444e49
+#define RECORDING_INDEX_ENTRY_SIZE 16
+#define RECORDING_FOOTER_SIZE 16
+
+/*******************************************************************************************************************//**
+ * @class CloudRecordingCodec
+ *
+ * @brief Class for encoding and decoding the points of a recorded frame
+ *
+ * The points are split into fixed-size blocks that are encoded independently, so both directions run on multiple
+ * threads. Each block stores a validity bit per point, then the coordinates of the valid points quantized to the
+ * quantization step and stored as variable-length deltas from the previous valid point, then the color channels as
+ * byte deltas from the previous valid point. Neighboring points of a scan are close in space and color, so most deltas
+ * fit in one byte. The block is then LZF compressed if that makes it smaller. Invalid points decode to NaN, and the
+ * alpha channel is not stored.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class CloudRecordingCodec
+{
+private:
+
+    // settings
+    float m_quantizationStep;
+    int m_numThreads;
+
+    // per block scratch buffers, reused between frames
+    std::vector<std::vector<uint8_t> > m_rawBlocks;
+    std::vector<std::vector<uint8_t> > m_storedBlocks;
+
+    // helper functions
+    void encodeBlock(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud, size_t begin, size_t end, std::vector<uint8_t> &rawOut) const;
+    bool decodeBlock(const uint8_t* raw, size_t rawSize, size_t begin, size_t end, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut) const;
+
+public:
+
+    // constructors
+    CloudRecordingCodec();
+
+    // settings
+    void setQuantizationStep(float quantizationStep);
+    void setNumberOfThreads(int numThreads);
+    float getQuantizationStep() const;
+
+    // processing
+    void encode(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud, std::vector<uint8_t> &payloadOut);
+    bool decode(const uint8_t* payload, size_t payloadSize, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+};
+
+#endif // CLOUDRECORDINGCODEC_H
@@ -0,0 +1,302 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudRecordingReader.cpp
+ * @brief Implementation file for the CloudRecordingReader class
+ *
+ * This class reads point cloud frames from a recording file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "CloudRecordingReader.h"
+
+#include <pcl/console/print.h>
+
+#include <cstring>
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes an empty CloudRecordingReader, call open() to read a recording
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudRecordingReader::CloudRecordingReader()
+{
+    m_fileSize = 0;
+    m_nextFrame = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Open a recording file
+ * @param[in] fileName path and name of the recording file
+ * @param[in] numThreads the number of decompression threads, or 0 to use all hardware threads (default: 0)
+ * @return false if the file could not be opened or is not a recording
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingReader::open(const std::string &fileName, int numThreads)
+{
+    close();
+    m_file.open(fileName.c_str(), std::ios::in | std::ios::binary);
+    if(!m_file.is_open())
+    {
+        PCL_ERROR("error while attempting to open recording file: %s \n", fileName.c_str());
+        return false;
+    }
+    m_file.seekg(0, std::ios::end);
+    m_fileSize = static_cast<uint64_t>(m_file.tellg());
+    m_file.seekg(0, std::ios::beg);
+
+    // validate the file header
+    uint8_t header[RECORDING_FILE_HEADER_SIZE];
+    m_file.read(reinterpret_cast<char*>(header), RECORDING_FILE_HEADER_SIZE);
+    uint32_t version;
+    float step;
+    std::memcpy(&version, header + 8, sizeof(uint32_t));
+    std::memcpy(&step, header + 12, sizeof(float));
+    if(m_file.gcount() != RECORDING_FILE_HEADER_SIZE || std::memcmp(header, RECORDING_FILE_MAGIC, 8) != 0 || version != RECORDING_VERSION)
+    {
+        PCL_ERROR("not a supported recording file: %s \n", fileName.c_str());
+        close();
+        return false;
+    }
+    m_codec.setQuantizationStep(step);
+    m_codec.setNumberOfThreads(numThreads);
+
+    // load the frame index, scanning the frames if the recording was not closed
+    if(!readIndex())
+    {
+        PCL_WARN("recording file has no index, scanning frames: %s \n", fileName.c_str());
+        scanFrames();
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Close the recording file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudRecordingReader::close()
+{
+    if(m_file.is_open())
+    {
+        m_file.close();
+    }
+    m_file.clear();
+    m_fileSize = 0;
+    m_nextFrame = 0;
+    m_frameOffsets.clear();
+    m_frameStamps.clear();
+}
+
+/***********************************************************************************************************************
+ * @brief Read and decompress a frame
+ * @param[in] index the index of the frame
+ * @param[out] cloudOut the recorded cloud
+ * @return false if the index is invalid or the frame could not be read
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingReader::readFrame(size_t index, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    if(index >= m_frameOffsets.size())
+    {
+        return false;
+    }
+
+    // read the frame header
+    uint8_t header[RECORDING_FRAME_HEADER_SIZE];
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(m_frameOffsets[index]));
+    m_file.read(reinterpret_cast<char*>(header), RECORDING_FRAME_HEADER_SIZE);
+    uint32_t values[4];
+    uint64_t stamp;
+    float pose[8];
+    std::memcpy(values, header, sizeof(values));
+    std::memcpy(&stamp, header + 16, sizeof(uint64_t));
+    std::memcpy(pose, header + 24, sizeof(pose));
+    if(m_file.gcount() != RECORDING_FRAME_HEADER_SIZE || values[0] != RECORDING_FRAME_MAGIC)
+    {
+        PCL_ERROR("corrupt frame header for frame %zu \n", index);
+        return false;
+    }
+
+    // read the payload
+    m_payload.resize(values[1]);
+    if(!m_payload.empty())
+    {
+        m_file.read(reinterpret_cast<char*>(&m_payload[0]), m_payload.size());
+        if(static_cast<size_t>(m_file.gcount()) != m_payload.size())
+        {
+            PCL_ERROR("unexpected end of recording file in frame %zu \n", index);
+            return false;
+        }
+    }
+
+    // allocate the output cloud and decode the points
+    cloudOut.width = values[2];
+    cloudOut.height = values[3];
+    cloudOut.points.resize(static_cast<size_t>(values[2]) * values[3]);
+    cloudOut.header.stamp = stamp;
+    cloudOut.sensor_origin_ = Eigen::Vector4f(pose[0], pose[1], pose[2], pose[3]);
+    cloudOut.sensor_orientation_ = Eigen::Quaternionf(pose[4], pose[5], pose[6], pose[7]);
+    if(!m_codec.decode(m_payload.empty() ? NULL : &m_payload[0], m_payload.size(), cloudOut))
+    {
+        PCL_ERROR("corrupt point data in frame %zu \n", index);
+        return false;
+    }
+    cloudOut.is_dense = false;
+    m_nextFrame = index + 1;
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Read the frame following the last one read
+ * @param[out] cloudOut the recorded cloud
+ * @return false if there are no more frames or an error occurred while reading
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingReader::readNextFrame(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    return readFrame(m_nextFrame, cloudOut);
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of frames in the recording
+ * @return the number of frames
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t CloudRecordingReader::size() const
+{
+    return m_frameOffsets.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the index of the frame returned by the next call to readNextFrame
+ * @return the frame index
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t CloudRecordingReader::getNextFrame() const
+{
+    return m_nextFrame;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the header stamp of a frame without reading it
+ * @param[in] index the index of the frame
+ * @return the stamp of the recorded cloud, or 0 if the index is invalid
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint64_t CloudRecordingReader::getFrameStamp(size_t index) const
+{
+    if(index >= m_frameStamps.size())
+    {
+        return 0;
+    }
+    return m_frameStamps[index];
+}
+
+/***********************************************************************************************************************
+ * @brief Get the quantization step the recording was written with
+ * @return the coordinate resolution, in cloud units
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float CloudRecordingReader::getQuantizationStep() const
+{
+    return m_codec.getQuantizationStep();
+}
+
+/***********************************************************************************************************************
+ * @brief Load the frame index from the end of the file
+ * @return false if the file does not end with a valid index
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingReader::readIndex()
+{
+    if(m_fileSize < RECORDING_FILE_HEADER_SIZE + RECORDING_FOOTER_SIZE)
+    {
+        return false;
+    }
+
+    // read and validate the footer
+    uint8_t footer[RECORDING_FOOTER_SIZE];
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(m_fileSize - RECORDING_FOOTER_SIZE));
+    m_file.read(reinterpret_cast<char*>(footer), RECORDING_FOOTER_SIZE);
+    uint32_t values[2];
+    uint64_t indexOffset;
+    std::memcpy(values, footer, sizeof(values));
+    std::memcpy(&indexOffset, footer + 8, sizeof(uint64_t));
+    uint64_t indexSize = static_cast<uint64_t>(values[1]) * RECORDING_INDEX_ENTRY_SIZE;
+    if(m_file.gcount() != RECORDING_FOOTER_SIZE || values[0] != RECORDING_INDEX_MAGIC || indexOffset < RECORDING_FILE_HEADER_SIZE || indexOffset + indexSize + RECORDING_FOOTER_SIZE != m_fileSize)
+    {
+        return false;
+    }
+
+    // read the index entries
+    std::vector<uint64_t> entries(2 * static_cast<size_t>(values[1]));
+    m_file.seekg(static_cast<std::streamoff>(indexOffset));
+    if(!entries.empty())
+    {
+        m_file.read(reinterpret_cast<char*>(&entries[0]), indexSize);
+        if(static_cast<uint64_t>(m_file.gcount()) != indexSize)
+        {
+            return false;
+        }
+    }
+    m_frameOffsets.resize(values[1]);
+    m_frameStamps.resize(values[1]);
+    for(size_t i = 0; i < m_frameOffsets.size(); i++)
+    {
+        m_frameOffsets[i] = entries[2 * i];
+        m_frameStamps[i] = entries[2 * i + 1];
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Rebuild the frame index by walking the frame headers
+ *
+ * Stops at the first incomplete or corrupt frame, which is expected at the end of a recording that was interrupted
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudRecordingReader::scanFrames()
+{
+    m_frameOffsets.clear();
+    m_frameStamps.clear();
+    uint64_t offset = RECORDING_FILE_HEADER_SIZE;
+    while(offset + RECORDING_FRAME_HEADER_SIZE <= m_fileSize)
+    {
+        uint8_t header[RECORDING_FRAME_HEADER_SIZE];
+        m_file.clear();
+        m_file.seekg(static_cast<std::streamoff>(offset));
+        m_file.read(reinterpret_cast<char*>(header), RECORDING_FRAME_HEADER_SIZE);
+        uint32_t values[4];
+        uint64_t stamp;
+        std::memcpy(values, header, sizeof(values));
+        std::memcpy(&stamp, header + 16, sizeof(uint64_t));
+        uint64_t frameEnd = offset + RECORDING_FRAME_HEADER_SIZE + values[1];
+        if(m_file.gcount() != RECORDING_FRAME_HEADER_SIZE || values[0] != RECORDING_FRAME_MAGIC || frameEnd > m_fileSize)
+        {
+            break;
+        }
+        m_frameOffsets.push_back(offset);
+        m_frameStamps.push_back(stamp);
+        offset = frameEnd;
+    }
+}
@@ -0,0 +1,88 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudRecordingReader.h
+ * @brief Header file for the CloudRecordingReader class
+ *
+ * This class reads point cloud frames from a recording file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef CLOUDRECORDINGREADER_H
+#define CLOUDRECORDINGREADER_H
+
+#include "CloudRecordingCodec.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class CloudRecordingReader
+ *
+ * @brief Class for reading the frames of a recording written by CloudRecordingWriter
+ *
+ * The frame index is loaded from the end of the file when the file is opened. If the recording was not closed, the
+ * frame headers are scanned instead and reading stops at the last complete frame. Frames can be read in any order.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class CloudRecordingReader
+{
+private:
+
+    // input file state
+    std::ifstream m_file;
+    uint64_t m_fileSize;
+    size_t m_nextFrame;
+
+    // frame index
+    std::vector<uint64_t> m_frameOffsets;
+    std::vector<uint64_t> m_frameStamps;
+
+    // decompression state and reusable buffers
+    CloudRecordingCodec m_codec;
+    std::vector<uint8_t> m_payload;
+
+    // helper functions
+    bool readIndex();
+    void scanFrames();
+
+public:
+
+    // constructors
+    CloudRecordingReader();
+
+    // file handling
+    bool open(const std::string &fileName, int numThreads=0);
+    void close();
+    bool readFrame(size_t index, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+    bool readNextFrame(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+
+    // accessors
+    size_t size() const;
+    size_t getNextFrame() const;
+    uint64_t getFrameStamp(size_t index) const;
+    float getQuantizationStep() const;
+};
+
+#endif // CLOUDRECORDINGREADER_H
@@ -0,0 +1,201 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudRecordingWriter.cpp
+ * @brief Implementation file for the CloudRecordingWriter class
+ *
+ * This class appends compressed point cloud frames to a single recording file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "CloudRecordingWriter.h"
+
+#include <pcl/console/print.h>
+
+#include <cstring>
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes an empty CloudRecordingWriter, call open() to start a recording
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudRecordingWriter::CloudRecordingWriter()
+{
+    m_bytesWritten = 0;
+    m_frameHeader.resize(RECORDING_FRAME_HEADER_SIZE);
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ *
+ * Finalizes the recording if it is still open
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudRecordingWriter::~CloudRecordingWriter()
+{
+    if(isOpen())
+    {
+        close();
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Create a recording file
+ * @param[in] fileName path and name of the recording file
+ * @param[in] quantizationStep the coordinate resolution, in cloud units (default: 0.001)
+ * @param[in] numThreads the number of compression threads, or 0 to use all hardware threads (default: 0)
+ * @return false if the file could not be created
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingWriter::open(const std::string &fileName, float quantizationStep, int numThreads)
+{
+    m_file.open(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!m_file.is_open())
+    {
+        PCL_ERROR("error while attempting to create recording file: %s \n", fileName.c_str());
+        return false;
+    }
+    m_codec.setQuantizationStep(quantizationStep);
+    m_codec.setNumberOfThreads(numThreads);
+    m_frameOffsets.clear();
+    m_frameStamps.clear();
+
+    // write the file header
+    uint8_t header[RECORDING_FILE_HEADER_SIZE];
+    uint32_t version = RECORDING_VERSION;
+    float step = m_codec.getQuantizationStep();
+    std::memcpy(header, RECORDING_FILE_MAGIC, 8);
+    std::memcpy(header + 8, &version, sizeof(uint32_t));
+    std::memcpy(header + 12, &step, sizeof(float));
+    m_file.write(reinterpret_cast<const char*>(header), RECORDING_FILE_HEADER_SIZE);
+    m_bytesWritten = RECORDING_FILE_HEADER_SIZE;
+    return m_file.good();
+}
+
+/***********************************************************************************************************************
+ * @brief Compress a cloud and append it to the recording
+ *
+ * The cloud dimensions, header stamp, and sensor pose are stored with the frame
+ *
+ * @param[in] cloud the cloud to record
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingWriter::writeFrame(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud)
+{
+    if(!isOpen())
+    {
+        return false;
+    }
+
+    // compress the points
+    m_codec.encode(cloud, m_payload);
+
+    // pack the frame header
+    uint32_t width = cloud.width;
+    uint32_t height = cloud.height;
+    if(static_cast<size_t>(width) * height != cloud.points.size())
+    {
+        width = static_cast<uint32_t>(cloud.points.size());
+        height = 1;
+    }
+    uint32_t values[4] = {RECORDING_FRAME_MAGIC, static_cast<uint32_t>(m_payload.size()), width, height};
+    uint64_t stamp = cloud.header.stamp;
+    float pose[8] = {cloud.sensor_origin_[0], cloud.sensor_origin_[1], cloud.sensor_origin_[2], cloud.sensor_origin_[3], cloud.sensor_orientation_.w(), cloud.sensor_orientation_.x(), cloud.sensor_orientation_.y(), cloud.sensor_orientation_.z()};
+    uint8_t* header = &m_frameHeader[0];
+    std::memcpy(header, values, sizeof(values));
+    std::memcpy(header + 16, &stamp, sizeof(uint64_t));
+    std::memcpy(header + 24, pose, sizeof(pose));
+
+    // append the frame and add it to the index
+    m_frameOffsets.push_back(m_bytesWritten);
+    m_frameStamps.push_back(stamp);
+    m_file.write(reinterpret_cast<const char*>(header), RECORDING_FRAME_HEADER_SIZE);
+    if(!m_payload.empty())
+    {
+        m_file.write(reinterpret_cast<const char*>(&m_payload[0]), m_payload.size());
+    }
+    m_bytesWritten += RECORDING_FRAME_HEADER_SIZE + m_payload.size();
+    return m_file.good();
+}
+
+/***********************************************************************************************************************
+ * @brief Write the frame index and close the file
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingWriter::close()
+{
+    if(!isOpen())
+    {
+        return false;
+    }
+
+    // write the index entries
+    uint64_t indexOffset = m_bytesWritten;
+    for(size_t i = 0; i < m_frameOffsets.size(); i++)
+    {
+        uint64_t entry[2] = {m_frameOffsets[i], m_frameStamps[i]};
+        m_file.write(reinterpret_cast<const char*>(entry), RECORDING_INDEX_ENTRY_SIZE);
+    }
+
+    // write the footer that locates the index
+    uint8_t footer[RECORDING_FOOTER_SIZE];
+    uint32_t values[2] = {RECORDING_INDEX_MAGIC, static_cast<uint32_t>(m_frameOffsets.size())};
+    std::memcpy(footer, values, sizeof(values));
+    std::memcpy(footer + 8, &indexOffset, sizeof(uint64_t));
+    m_file.write(reinterpret_cast<const char*>(footer), RECORDING_FOOTER_SIZE);
+    m_bytesWritten += m_frameOffsets.size() * RECORDING_INDEX_ENTRY_SIZE + RECORDING_FOOTER_SIZE;
+
+    bool success = m_file.good();
+    m_file.close();
+    return success;
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if a recording is currently open for writing
+ * @return true if the file is open
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudRecordingWriter::isOpen() const
+{
+    return m_file.is_open();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of frames written so far
+ * @return the number of frames
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t CloudRecordingWriter::getFramesWritten() const
+{
+    return m_frameOffsets.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of bytes written so far
+ * @return the size of the recording file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint64_t CloudRecordingWriter::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
@@ -0,0 +1,84 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudRecordingWriter.h
+ * @brief Header file for the CloudRecordingWriter class
+ *
+ * This class appends compressed point cloud frames to a single recording file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef CLOUDRECORDINGWRITER_H
+#define CLOUDRECORDINGWRITER_H
+
+#include "CloudRecordingCodec.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class CloudRecordingWriter
+ *
+ * @brief Class for recording a sequence of point clouds to a single file
+ *
+ * Frames are compressed with CloudRecordingCodec and appended to the file as they arrive. The frame index is kept in
+ * memory and written at the end of the file when the recording is closed. Frames written before a crash can still be
+ * read, since the reader falls back to scanning the frame headers when the index is missing.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class CloudRecordingWriter
+{
+private:
+
+    // output file state
+    std::ofstream m_file;
+    uint64_t m_bytesWritten;
+
+    // frame index
+    std::vector<uint64_t> m_frameOffsets;
+    std::vector<uint64_t> m_frameStamps;
+
+    // compression state and reusable buffers
+    CloudRecordingCodec m_codec;
+    std::vector<uint8_t> m_payload;
+    std::vector<uint8_t> m_frameHeader;
+
+public:
+
+    // constructors
+    CloudRecordingWriter();
+    ~CloudRecordingWriter();
+
+    // file handling
+    bool open(const std::string &fileName, float quantizationStep=0.001f, int numThreads=0);
+    bool writeFrame(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud);
+    bool close();
+    bool isOpen() const;
+
+    // accessors
+    size_t getFramesWritten() const;
+    uint64_t getBytesWritten() const;
+};
+
+#endif // CLOUDRECORDINGWRITER_H
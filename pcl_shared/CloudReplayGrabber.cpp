@@ -0,0 +1,347 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudReplayGrabber.cpp
+ * @brief Implementation file for the CloudReplayGrabber class
+ *
+ * This class replays recorded point clouds through the pcl::Grabber callback interface
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "CloudReplayGrabber.h"
+#include "CloudIO.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+/***********************************************************************************************************************
+ * @brief Compare two file names, treating runs of digits as numbers
+ * @param[in] a the first file name
+ * @param[in] b the second file name
+ * @return true if a sorts before b
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static bool naturalLess(const std::string &a, const std::string &b)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while(i < a.size() && j < b.size())
+    {
+        if(std::isdigit(static_cast<unsigned char>(a[i])) && std::isdigit(static_cast<unsigned char>(b[j])))
+        {
+            // compare the digit runs by value, ignoring leading zeros
+            size_t iEnd = i;
+            size_t jEnd = j;
+            while(iEnd < a.size() && std::isdigit(static_cast<unsigned char>(a[iEnd])))
+            {
+                iEnd++;
+            }
+            while(jEnd < b.size() && std::isdigit(static_cast<unsigned char>(b[jEnd])))
+            {
+                jEnd++;
+            }
+            while(i + 1 < iEnd && a[i] == '0')
+            {
+                i++;
+            }
+            while(j + 1 < jEnd && b[j] == '0')
+            {
+                j++;
+            }
+            if(iEnd - i != jEnd - j)
+            {
+                return iEnd - i < jEnd - j;
+            }
+            int comparison = a.compare(i, iEnd - i, b, j, jEnd - j);
+            if(comparison != 0)
+            {
+                return comparison < 0;
+            }
+            i = iEnd;
+            j = jEnd;
+        }
+        else
+        {
+            if(a[i] != b[j])
+            {
+                return a[i] < b[j];
+            }
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Opens the replay source. If the source cannot be read the grabber is created without frames, use isValid() to check.
+ *
+ * @param[in] sourceName a directory of PCD or PLY files, or a recording file
+ * @param[in] pacingMode how frames are paced (default: PACING_REAL_TIME)
+ * @param[in] frameRate the frame rate of PACING_FIXED_RATE, and of PACING_REAL_TIME when there are no stamps (default: 30)
+ * @param[in] repeat restart from the first frame after the last one (default: false)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudReplayGrabber::CloudReplayGrabber(const std::string &sourceName, PacingMode pacingMode, float frameRate, bool repeat)
+{
+    m_sourceName = sourceName;
+    m_useRecording = false;
+    m_pacingMode = pacingMode;
+    m_frameRate = frameRate > 0 ? frameRate : 30.0f;
+    m_repeat = repeat;
+    m_stopRequested = false;
+    m_running = false;
+    m_framesDelivered = 0;
+    m_cloudSignal = createSignal<sig_cb_cloud>();
+
+    // list the cloud files of a directory
+    struct stat status;
+    if(stat(sourceName.c_str(), &status) == 0 && S_ISDIR(status.st_mode))
+    {
+        DIR* directory = opendir(sourceName.c_str());
+        if(directory != NULL)
+        {
+            struct dirent* entry;
+            while((entry = readdir(directory)) != NULL)
+            {
+                std::string name(entry->d_name);
+                std::string extension = name.substr(name.find_last_of(".") + 1);
+                if(name.find('.') != std::string::npos && (extension.compare("pcd") == 0 || extension.compare("ply") == 0))
+                {
+                    m_fileNames.push_back(name);
+                }
+            }
+            closedir(directory);
+        }
+        std::sort(m_fileNames.begin(), m_fileNames.end(), naturalLess);
+        for(size_t i = 0; i < m_fileNames.size(); i++)
+        {
+            m_fileNames[i] = sourceName + "/" + m_fileNames[i];
+        }
+    }
+    else
+    {
+        // otherwise treat the source as a recording
+        m_useRecording = m_recording.open(sourceName);
+    }
+
+    if(getNumberOfFrames() == 0)
+    {
+        PCL_ERROR("no clouds to replay in: %s \n", sourceName.c_str());
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ *
+ * Stops the replay thread and disconnects the callbacks
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudReplayGrabber::~CloudReplayGrabber()
+{
+    stop();
+    disconnect_all_slots<sig_cb_cloud>();
+}
+
+/***********************************************************************************************************************
+ * @brief Start replaying frames on a background thread
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudReplayGrabber::start()
+{
+    if(m_running || getNumberOfFrames() == 0)
+    {
+        return;
+    }
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    m_stopRequested = false;
+    m_running = true;
+    m_thread = std::thread(&CloudReplayGrabber::replayLoop, this);
+}
+
+/***********************************************************************************************************************
+ * @brief Stop replaying frames and wait for the replay thread to finish
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudReplayGrabber::stop()
+{
+    m_stopRequested = true;
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    m_running = false;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the name of the grabber
+ * @return the grabber name
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+std::string CloudReplayGrabber::getName() const
+{
+    return std::string("CloudReplayGrabber");
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if frames are being replayed
+ * @return true until stop() is called or the last frame has been delivered
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudReplayGrabber::isRunning() const
+{
+    return m_running;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the nominal frame rate of the replay
+ * @return the fixed frame rate, or 0 when replaying as fast as possible
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float CloudReplayGrabber::getFramesPerSecond() const
+{
+    return m_pacingMode == PACING_AS_FAST_AS_POSSIBLE ? 0.0f : m_frameRate;
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if the replay source has any frames
+ * @return true if there are frames to replay
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudReplayGrabber::isValid() const
+{
+    return getNumberOfFrames() > 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of frames in the replay source
+ * @return the number of frames
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t CloudReplayGrabber::size() const
+{
+    return getNumberOfFrames();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of frames delivered to the callbacks since the grabber was created
+ * @return the number of frames
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t CloudReplayGrabber::getFramesDelivered() const
+{
+    return m_framesDelivered;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of frames in the replay source
+ * @return the number of frames
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t CloudReplayGrabber::getNumberOfFrames() const
+{
+    return m_useRecording ? m_recording.size() : m_fileNames.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Load a frame into a new cloud
+ * @param[in] index the index of the frame
+ * @param[out] cloudOut the loaded cloud
+ * @return false if the frame could not be loaded
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool CloudReplayGrabber::loadFrame(size_t index, pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut)
+{
+    cloudOut.reset(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    if(m_useRecording)
+    {
+        return m_recording.readFrame(index, *cloudOut);
+    }
+    return openCloud(cloudOut, m_fileNames.at(index));
+}
+
+/***********************************************************************************************************************
+ * @brief Load and deliver frames until the source is exhausted or stop() is called
+ *
+ * Frame times are measured from the first frame of each pass, so loading time does not accumulate as drift
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudReplayGrabber::replayLoop()
+{
+    size_t numFrames = getNumberOfFrames();
+    const double framePeriodUs = 1000000.0 / m_frameRate;
+
+    // recorded stamps are only used for real-time pacing if they never decrease
+    bool useStamps = m_pacingMode == PACING_REAL_TIME && m_useRecording && m_recording.getFrameStamp(0) > 0;
+    for(size_t i = 1; i < numFrames && useStamps; i++)
+    {
+        useStamps = m_recording.getFrameStamp(i) >= m_recording.getFrameStamp(i - 1);
+    }
+
+    do
+    {
+        std::chrono::steady_clock::time_point passStart = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < numFrames && !m_stopRequested; i++)
+        {
+            pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloud;
+            if(!loadFrame(i, cloud))
+            {
+                continue;
+            }
+
+            // find when the frame is due
+            double frameTimeUs = i * framePeriodUs;
+            if(useStamps)
+            {
+                frameTimeUs = static_cast<double>(m_recording.getFrameStamp(i) - m_recording.getFrameStamp(0));
+            }
+
+            // wait until the frame is due
+            if(m_pacingMode != PACING_AS_FAST_AS_POSSIBLE)
+            {
+                std::chrono::steady_clock::time_point due = passStart + std::chrono::microseconds(static_cast<long long>(frameTimeUs));
+                while(!m_stopRequested && std::chrono::steady_clock::now() < due)
+                {
+                    std::this_thread::sleep_until(std::min(due, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+                }
+            }
+
+            // deliver the frame
+            if(!m_stopRequested && m_cloudSignal->num_slots() > 0)
+            {
+                (*m_cloudSignal)(cloud);
+            }
+            m_framesDelivered++;
+        }
+    }
+    while(m_repeat && !m_stopRequested);
+    m_running = false;
+}
@@ -0,0 +1,112 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file CloudReplayGrabber.h
+ * @brief Header file for the CloudReplayGrabber class
+ *
+ * This class replays recorded point clouds through the pcl::Grabber callback interface
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef CLOUDREPLAYGRABBER_H
+#define CLOUDREPLAYGRABBER_H
+
+#include "CloudRecordingReader.h"
+
+#include <pcl/io/grabber.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class CloudReplayGrabber
+ *
+ * @brief Grabber that replays a directory of cloud files or a cloud recording
+ *
+ * Drop-in replacement for pcl::io::OpenNI2Grabber for clouds of type PointXYZRGBA. The source is either a directory of
+ * PCD and PLY files, replayed in natural name order (so 2.pcd comes before 10.pcd), or a recording written by
+ * CloudRecordingWriter. Each frame is loaded into a new cloud and delivered to the registered callbacks from the replay
+ * thread. Frames are paced by their recorded stamps, at a fixed rate, or as fast as they can be loaded. Cloud files do
+ * not store stamps, so real-time pacing of a directory falls back to the fixed rate.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class CloudReplayGrabber : public pcl::Grabber
+{
+public:
+
+    // signature of the cloud callbacks
+    typedef void (sig_cb_cloud)(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr&);
+
+    // frame pacing modes
+    enum PacingMode
+    {
+        PACING_REAL_TIME = 0,
+        PACING_FIXED_RATE = 1,
+        PACING_AS_FAST_AS_POSSIBLE = 2
+    };
+
+private:
+
+    // replay source
+    std::string m_sourceName;
+    std::vector<std::string> m_fileNames;
+    CloudRecordingReader m_recording;
+    bool m_useRecording;
+
+    // settings
+    PacingMode m_pacingMode;
+    float m_frameRate;
+    bool m_repeat;
+
+    // replay thread state
+    boost::signals2::signal<sig_cb_cloud>* m_cloudSignal;
+    std::thread m_thread;
+    std::atomic<bool> m_stopRequested;
+    std::atomic<bool> m_running;
+    std::atomic<size_t> m_framesDelivered;
+
+    // helper functions
+    size_t getNumberOfFrames() const;
+    bool loadFrame(size_t index, pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut);
+    void replayLoop();
+
+public:
+
+    // constructors
+    CloudReplayGrabber(const std::string &sourceName, PacingMode pacingMode=PACING_REAL_TIME, float frameRate=30.0f, bool repeat=false);
+    virtual ~CloudReplayGrabber();
+
+    // pcl::Grabber interface
+    virtual void start();
+    virtual void stop();
+    virtual std::string getName() const;
+    virtual bool isRunning() const;
+    virtual float getFramesPerSecond() const;
+
+    // accessors
+    bool isValid() const;
+    size_t size() const;
+    size_t getFramesDelivered() const;
+};
+
+#endif // CLOUDREPLAYGRABBER_H
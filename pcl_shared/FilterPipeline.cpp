@@ -0,0 +1,1045 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file FilterPipeline.cpp
+ * @brief Implementation file for the FilterStage and FilterPipeline classes
+ *
+ * These classes run a configurable chain of cloud processing stages
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "FilterPipeline.h"
+#include "CloudIO.h"
+#include "ParallelFor.h"
+#include "ParallelVoxelGrid.h"
+#include "ParallelOutlierRemoval.h"
+#include "ParallelPlaneSegmentation.h"
+#include "ParallelClusterExtraction.h"
+#include "PointBuffer.h"
+
+#include <pcl/console/print.h>
+#include <pcl/filters/statistical_outlier_removal.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <unistd.h>
+
+// smallest number of points worth giving a thread in a fused pointwise pass
+#define MIN_POINTWISE_BLOCK 65536
+
+/***********************************************************************************************************************
+ * @brief Parse a floating point parameter value
+ * @param[in] value the parameter string
+ * @param[out] result the parsed value
+ * @return true if the whole string is a number
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static bool parseDouble(const std::string &value, double &result)
+{
+    char* end = NULL;
+    result = std::strtod(value.c_str(), &end);
+    return !value.empty() && *end == '\0';
+}
+
+/***********************************************************************************************************************
+ * @brief Parse an integer parameter value
+ * @param[in] value the parameter string
+ * @param[out] result the parsed value
+ * @return true if the whole string is an integer
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static bool parseInt(const std::string &value, int &result)
+{
+    char* end = NULL;
+    result = static_cast<int>(std::strtol(value.c_str(), &end, 10));
+    return !value.empty() && *end == '\0';
+}
+
+/***********************************************************************************************************************
+ * @brief Parse a comma separated 3D vector parameter value
+ * @param[in] value the parameter string
+ * @param[out] result the parsed vector
+ * @return true if the string holds three numbers
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static bool parseVector(const std::string &value, Eigen::Vector3f &result)
+{
+    std::stringstream ss(value);
+    std::string item;
+    for(int i = 0; i < 3; i++)
+    {
+        double component;
+        if(!std::getline(ss, item, ',') || !parseDouble(item, component))
+        {
+            return false;
+        }
+        result[i] = static_cast<float>(component);
+    }
+    return !std::getline(ss, item, ',');
+}
+
+/***********************************************************************************************************************
+ * @brief Get the resident memory of the process
+ * @return the resident set size in bytes, or 0 if it is not available
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static size_t getResidentMemory()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0;
+    size_t residentPages = 0;
+    if(!(statm >> totalPages >> residentPages))
+    {
+        return 0;
+    }
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+/***********************************************************************************************************************
+ * @brief Copy the header and sensor pose of a cloud and mark the output as unorganized
+ * @param[in] cloudIn the source cloud
+ * @param[in,out] cloudOut the cloud to update, its points must already be filled
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static void copyCloudInfo(const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    cloudOut.header = cloudIn.header;
+    cloudOut.sensor_origin_ = cloudIn.sensor_origin_;
+    cloudOut.sensor_orientation_ = cloudIn.sensor_orientation_;
+    cloudOut.width = static_cast<uint32_t>(cloudOut.points.size());
+    cloudOut.height = 1;
+    cloudOut.is_dense = cloudIn.is_dense;
+}
+
+/***********************************************************************************************************************
+ * @brief Determine if a point has finite coordinates
+ * @param[in] point the point to check
+ * @return true if all coordinates are finite
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline bool isFinitePoint(const pcl::PointXYZRGBA &point)
+{
+    return std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z);
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+FilterStage::~FilterStage()
+{
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads, stages that do not use threads ignore it
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterStage::setNumberOfThreads(int)
+{
+}
+
+/***********************************************************************************************************************
+ * @brief Set the name of the cloud being processed, stages that do not name outputs ignore it
+ * @param[in] inputName the name of the input cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterStage::setInputName(const std::string&)
+{
+}
+
+/***********************************************************************************************************************
+ * @brief Determine if the stage decides each point on its own
+ * @return true if the stage implements keepPoint() instead of apply()
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FilterStage::isPointwise() const
+{
+    return false;
+}
+
+/***********************************************************************************************************************
+ * @brief Decide if a point passes a pointwise stage
+ * @param[in] point the point to test
+ * @return true to keep the point
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FilterStage::keepPoint(const pcl::PointXYZRGBA&) const
+{
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Transform a cloud, pointwise stages are applied through keepPoint() instead
+ * @param[in] cloudIn the input cloud
+ * @param[out] cloudOut the output cloud, which keeps its storage between calls
+ * @return true if the stage succeeded
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FilterStage::apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    cloudOut = *cloudIn;
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @class VoxelStage
+ * @brief Downsample the cloud with ParallelVoxelGrid
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class VoxelStage : public FilterStage
+{
+private:
+
+    ParallelVoxelGrid m_filter;
+    float m_leafSize;
+
+public:
+
+    VoxelStage() : m_leafSize(0.01f) {}
+
+    std::string getName() const
+    {
+        return "voxel";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        double number;
+        if(key == "leaf" && parseDouble(value, number) && number > 0)
+        {
+            m_leafSize = static_cast<float>(number);
+            return true;
+        }
+        return false;
+    }
+
+    void setNumberOfThreads(int numThreads)
+    {
+        m_filter.setNumberOfThreads(numThreads);
+    }
+
+    bool apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+    {
+        m_filter.setInputCloud(cloudIn);
+        m_filter.setLeafSize(m_leafSize, m_leafSize, m_leafSize);
+        m_filter.filter(cloudOut);
+        return true;
+    }
+};
+
+/***********************************************************************************************************************
+ * @class CropStage
+ * @brief Keep the finite points inside an axis aligned box, or outside it if negative is set
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class CropStage : public FilterStage
+{
+private:
+
+    Eigen::Vector3f m_min;
+    Eigen::Vector3f m_max;
+    bool m_negative;
+
+public:
+
+    CropStage() : m_min(Eigen::Vector3f::Constant(-1e30f)), m_max(Eigen::Vector3f::Constant(1e30f)), m_negative(false) {}
+
+    std::string getName() const
+    {
+        return "crop";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        int flag;
+        if(key == "min")
+        {
+            return parseVector(value, m_min);
+        }
+        if(key == "max")
+        {
+            return parseVector(value, m_max);
+        }
+        if(key == "negative" && parseInt(value, flag))
+        {
+            m_negative = flag != 0;
+            return true;
+        }
+        return false;
+    }
+
+    bool isPointwise() const
+    {
+        return true;
+    }
+
+    bool keepPoint(const pcl::PointXYZRGBA &point) const
+    {
+        if(!isFinitePoint(point))
+        {
+            return false;
+        }
+        bool inside = point.x >= m_min[0] && point.y >= m_min[1] && point.z >= m_min[2] && point.x <= m_max[0] && point.y <= m_max[1] && point.z <= m_max[2];
+        return inside != m_negative;
+    }
+};
+
+/***********************************************************************************************************************
+ * @class RangeStage
+ * @brief Keep the finite points within a distance range of the sensor origin
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class RangeStage : public FilterStage
+{
+private:
+
+    float m_minSquared;
+    float m_maxSquared;
+
+public:
+
+    RangeStage() : m_minSquared(0.0f), m_maxSquared(1e30f) {}
+
+    std::string getName() const
+    {
+        return "range";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        double number;
+        if(!parseDouble(value, number) || number < 0)
+        {
+            return false;
+        }
+        if(key == "min")
+        {
+            m_minSquared = static_cast<float>(number * number);
+            return true;
+        }
+        if(key == "max")
+        {
+            m_maxSquared = static_cast<float>(number * number);
+            return true;
+        }
+        return false;
+    }
+
+    bool isPointwise() const
+    {
+        return true;
+    }
+
+    bool keepPoint(const pcl::PointXYZRGBA &point) const
+    {
+        float distanceSquared = point.x * point.x + point.y * point.y + point.z * point.z;
+        return distanceSquared >= m_minSquared && distanceSquared <= m_maxSquared;
+    }
+};
+
+/***********************************************************************************************************************
+ * @class OutlierStage
+ * @brief Remove points whose mean neighbor distance is far above the cloud average, with ParallelOutlierRemoval or with
+ * pcl::StatisticalOutlierRemoval
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class OutlierStage : public FilterStage
+{
+private:
+
+    ParallelOutlierRemoval m_parallelFilter;
+    pcl::StatisticalOutlierRemoval<pcl::PointXYZRGBA> m_filter;
+    int m_meanK;
+    double m_stddev;
+    bool m_usePCL;
+
+public:
+
+    OutlierStage() : m_meanK(50), m_stddev(1.0), m_usePCL(false) {}
+
+    std::string getName() const
+    {
+        return "outliers";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        if(key == "mean_k")
+        {
+            return parseInt(value, m_meanK) && m_meanK > 0;
+        }
+        if(key == "stddev")
+        {
+            return parseDouble(value, m_stddev);
+        }
+        if(key == "method" && (value == "buckets" || value == "pcl"))
+        {
+            m_usePCL = value == "pcl";
+            return true;
+        }
+        return false;
+    }
+
+    void setNumberOfThreads(int numThreads)
+    {
+        m_parallelFilter.setNumberOfThreads(numThreads);
+    }
+
+    bool apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+    {
+        if(m_usePCL)
+        {
+            m_filter.setInputCloud(cloudIn);
+            m_filter.setMeanK(m_meanK);
+            m_filter.setStddevMulThresh(m_stddev);
+            m_filter.filter(cloudOut);
+        }
+        else
+        {
+            m_parallelFilter.setInputCloud(cloudIn);
+            m_parallelFilter.setMeanK(m_meanK);
+            m_parallelFilter.setStddevMulThresh(m_stddev);
+            m_parallelFilter.filter(cloudOut);
+        }
+        return true;
+    }
+};
+
+/***********************************************************************************************************************
+ * @class PlaneStage
+ * @brief Remove the inliers of the dominant planes found by ParallelPlaneSegmentation
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class PlaneStage : public FilterStage
+{
+private:
+
+    ParallelPlaneSegmentation m_segmentation;
+    double m_distance;
+    int m_maxIterations;
+    int m_maxPlanes;
+    int m_minSize;
+    std::vector<pcl::PointIndices> m_planeInliers;
+    std::vector<pcl::ModelCoefficients> m_planeCoefficients;
+    std::vector<char> m_removed;
+
+public:
+
+    PlaneStage() : m_distance(0.02), m_maxIterations(1000), m_maxPlanes(1), m_minSize(1000) {}
+
+    std::string getName() const
+    {
+        return "plane";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        if(key == "distance")
+        {
+            return parseDouble(value, m_distance) && m_distance > 0;
+        }
+        if(key == "max_iterations")
+        {
+            return parseInt(value, m_maxIterations) && m_maxIterations > 0;
+        }
+        if(key == "max_planes")
+        {
+            return parseInt(value, m_maxPlanes) && m_maxPlanes > 0;
+        }
+        if(key == "min_size")
+        {
+            return parseInt(value, m_minSize) && m_minSize >= 3;
+        }
+        return false;
+    }
+
+    void setNumberOfThreads(int numThreads)
+    {
+        m_segmentation.setNumberOfThreads(numThreads);
+    }
+
+    bool apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+    {
+        // find the planes
+        m_segmentation.setInputCloud(cloudIn);
+        m_segmentation.setDistanceThreshold(m_distance);
+        m_segmentation.setMaxIterations(m_maxIterations);
+        m_segmentation.setMaxPlanes(m_maxPlanes);
+        m_segmentation.setMinInliers(m_minSize);
+        m_segmentation.segment(m_planeInliers, m_planeCoefficients);
+
+        // keep the points that are not on a plane
+        m_removed.assign(cloudIn->points.size(), 0);
+        for(size_t i = 0; i < m_planeInliers.size(); i++)
+        {
+            const std::vector<int> &indices = m_planeInliers.at(i).indices;
+            for(size_t j = 0; j < indices.size(); j++)
+            {
+                m_removed[indices[j]] = 1;
+            }
+        }
+        cloudOut.points.clear();
+        for(size_t i = 0; i < cloudIn->points.size(); i++)
+        {
+            if(!m_removed[i])
+            {
+                cloudOut.points.push_back(cloudIn->points[i]);
+            }
+        }
+        copyCloudInfo(*cloudIn, cloudOut);
+        return true;
+    }
+};
+
+/***********************************************************************************************************************
+ * @class ClusterStage
+ * @brief Keep the points of the Euclidean clusters found by ParallelClusterExtraction, optionally colored per cluster
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ClusterStage : public FilterStage
+{
+private:
+
+    ParallelClusterExtraction m_extraction;
+    double m_tolerance;
+    int m_minSize;
+    int m_maxSize;
+    bool m_color;
+    std::vector<pcl::PointIndices> m_clusters;
+    PointBuffer m_colors;
+
+public:
+
+    ClusterStage() : m_tolerance(0.02), m_minSize(50), m_maxSize(100000), m_color(true) {}
+
+    std::string getName() const
+    {
+        return "cluster";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        int flag;
+        if(key == "tolerance")
+        {
+            return parseDouble(value, m_tolerance) && m_tolerance > 0;
+        }
+        if(key == "min_size")
+        {
+            return parseInt(value, m_minSize) && m_minSize > 0;
+        }
+        if(key == "max_size")
+        {
+            return parseInt(value, m_maxSize) && m_maxSize > 0;
+        }
+        if(key == "color" && parseInt(value, flag))
+        {
+            m_color = flag != 0;
+            return true;
+        }
+        return false;
+    }
+
+    void setNumberOfThreads(int numThreads)
+    {
+        m_extraction.setNumberOfThreads(numThreads);
+        m_colors.setNumberOfThreads(numThreads);
+    }
+
+    bool apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+    {
+        // find the clusters
+        m_extraction.setInputCloud(cloudIn);
+        m_extraction.setClusterTolerance(m_tolerance);
+        m_extraction.setMinClusterSize(m_minSize);
+        m_extraction.setMaxClusterSize(m_maxSize);
+        m_extraction.extract(m_clusters);
+
+        // gather the clustered points, one cluster after another
+        cloudOut.points.clear();
+        for(size_t i = 0; i < m_clusters.size(); i++)
+        {
+            const std::vector<int> &indices = m_clusters.at(i).indices;
+            for(size_t j = 0; j < indices.size(); j++)
+            {
+                cloudOut.points.push_back(cloudIn->points[indices[j]]);
+            }
+        }
+        copyCloudInfo(*cloudIn, cloudOut);
+
+        // give each cluster a pseudorandom color derived from its index
+        if(m_color)
+        {
+            m_colors.loadColors(cloudOut);
+            uint32_t* rgba = m_colors.rgba();
+            size_t index = 0;
+            for(size_t i = 0; i < m_clusters.size(); i++)
+            {
+                uint32_t color = static_cast<uint32_t>((i + 1) * 2654435761u) & 0x00FFFFFFu;
+                for(size_t j = 0; j < m_clusters.at(i).indices.size(); j++, index++)
+                {
+                    rgba[index] = (rgba[index] & 0xFF000000u) | color;
+                }
+            }
+            m_colors.storeColors(cloudOut);
+        }
+        return true;
+    }
+};
+
+/***********************************************************************************************************************
+ * @class SaveStage
+ * @brief Save the current cloud and pass it on unchanged
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class SaveStage : public FilterStage
+{
+private:
+
+    std::string m_fileName;
+    std::string m_inputName;
+
+public:
+
+    std::string getName() const
+    {
+        return "save";
+    }
+
+    bool setParameter(const std::string &key, const std::string &value)
+    {
+        if(key == "file" && !value.empty())
+        {
+            m_fileName = value;
+            return true;
+        }
+        return false;
+    }
+
+    void setInputName(const std::string &inputName)
+    {
+        m_inputName = inputName;
+    }
+
+    bool apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+    {
+        if(m_fileName.empty())
+        {
+            PCL_ERROR("[SaveStage::apply] No file name given.\n");
+            return false;
+        }
+
+        // substitute the input name into the file name
+        std::string fileName = m_fileName;
+        size_t position = fileName.find("{input}");
+        if(position != std::string::npos)
+        {
+            fileName.replace(position, 7, m_inputName);
+        }
+        cloudOut = *cloudIn;
+        return saveCloud(cloudIn, fileName);
+    }
+};
+
+/***********************************************************************************************************************
+ * @brief Create a stage of a built-in type
+ * @return the new stage
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+template<typename Stage>
+static FilterStage::Ptr createBuiltInStage()
+{
+    return FilterStage::Ptr(new Stage());
+}
+
+/***********************************************************************************************************************
+ * @brief Get the table of registered stage types, starting with the built-in types
+ * @return the stage factories by type name
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static std::map<std::string, FilterPipeline::StageFactory>& getStageRegistry()
+{
+    static std::map<std::string, FilterPipeline::StageFactory> registry;
+    if(registry.empty())
+    {
+        registry["voxel"] = &createBuiltInStage<VoxelStage>;
+        registry["crop"] = &createBuiltInStage<CropStage>;
+        registry["range"] = &createBuiltInStage<RangeStage>;
+        registry["outliers"] = &createBuiltInStage<OutlierStage>;
+        registry["plane"] = &createBuiltInStage<PlaneStage>;
+        registry["cluster"] = &createBuiltInStage<ClusterStage>;
+        registry["save"] = &createBuiltInStage<SaveStage>;
+    }
+    return registry;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+FilterPipeline::FilterPipeline()
+{
+    m_buffers[0].reset(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    m_buffers[1].reset(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Register a stage type so that configuration files can use it, replacing any type with the same name
+ * @param[in] type the stage type name
+ * @param[in] factory the function that creates a stage of the type
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::registerStage(const std::string &type, StageFactory factory)
+{
+    getStageRegistry()[type] = factory;
+}
+
+/***********************************************************************************************************************
+ * @brief Create a stage of a registered type
+ * @param[in] type the stage type name
+ * @return the new stage, or a null pointer if the type is not registered
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+FilterStage::Ptr FilterPipeline::createStage(const std::string &type)
+{
+    std::map<std::string, StageFactory> &registry = getStageRegistry();
+    std::map<std::string, StageFactory>::const_iterator it = registry.find(type);
+    if(it == registry.end())
+    {
+        return FilterStage::Ptr();
+    }
+    return it->second();
+}
+
+/***********************************************************************************************************************
+ * @brief Replace the stages with the ones described by a configuration file
+ * @param[in] configFileName the configuration file
+ * @return true if every line was understood, otherwise the pipeline is left empty
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FilterPipeline::load(const std::string &configFileName)
+{
+    clear();
+    std::ifstream file(configFileName.c_str());
+    if(!file.is_open())
+    {
+        PCL_ERROR("error while attempting to read pipeline file: %s \n", configFileName.c_str());
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(file, line))
+    {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::stringstream ss(line);
+        std::string type;
+        if(!(ss >> type))
+        {
+            continue;
+        }
+
+        // create the stage
+        FilterStage::Ptr stage = createStage(type);
+        if(!stage)
+        {
+            PCL_ERROR("%s:%d: unknown stage type: %s \n", configFileName.c_str(), lineNumber, type.c_str());
+            clear();
+            return false;
+        }
+
+        // apply the key=value parameters
+        std::string parameter;
+        while(ss >> parameter)
+        {
+            size_t separator = parameter.find('=');
+            if(separator == std::string::npos || !stage->setParameter(parameter.substr(0, separator), parameter.substr(separator + 1)))
+            {
+                PCL_ERROR("%s:%d: invalid %s parameter: %s \n", configFileName.c_str(), lineNumber, type.c_str(), parameter.c_str());
+                clear();
+                return false;
+            }
+        }
+        addStage(stage);
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Append a stage to the pipeline
+ * @param[in] stage the stage to append
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::addStage(const FilterStage::Ptr &stage)
+{
+    stage->setNumberOfThreads(m_numThreads);
+    m_stages.push_back(stage);
+}
+
+/***********************************************************************************************************************
+ * @brief Remove all stages
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::clear()
+{
+    m_stages.clear();
+    m_stats.clear();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of stages
+ * @return the number of stages
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t FilterPipeline::size() const
+{
+    return m_stages.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads of the pipeline and its stages
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+    for(size_t i = 0; i < m_stages.size(); i++)
+    {
+        m_stages.at(i)->setNumberOfThreads(numThreads);
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Set the name of the cloud being processed, used by stages that name their outputs
+ * @param[in] inputName the name of the input cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::setInputName(const std::string &inputName)
+{
+    for(size_t i = 0; i < m_stages.size(); i++)
+    {
+        m_stages.at(i)->setInputName(inputName);
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Apply a run of consecutive pointwise stages in a single pass over the cloud
+ *
+ * Each thread tests a block of points against all of the stages and records the kept indices, then the kept points of
+ * each block are copied to their offset in the output, so the point order is preserved.
+ *
+ * @param[in] firstStage the index of the first stage of the run
+ * @param[in] endStage one past the index of the last stage of the run
+ * @param[in] cloudIn the input cloud
+ * @param[out] cloudOut the kept points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::applyPointwise(size_t firstStage, size_t endStage, const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    // test the points block by block
+    m_keptIndices.resize(static_cast<size_t>(getThreadCount(m_numThreads)));
+    int numBlocks = parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        std::vector<int> &kept = m_keptIndices[threadIndex];
+        kept.clear();
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[i];
+            bool keep = true;
+            for(size_t s = firstStage; s < endStage && keep; s++)
+            {
+                keep = m_stages[s]->keepPoint(p);
+            }
+            if(keep)
+            {
+                kept.push_back(static_cast<int>(i));
+            }
+        }
+    }, m_numThreads, MIN_POINTWISE_BLOCK);
+
+    // copy the kept points of each block to its offset in the output
+    std::vector<size_t> offsets(numBlocks + 1, 0);
+    for(int b = 0; b < numBlocks; b++)
+    {
+        offsets[b + 1] = offsets[b] + m_keptIndices[b].size();
+    }
+    cloudOut.points.resize(offsets[numBlocks]);
+    parallelFor(0, numBlocks, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t b = blockBegin; b < blockEnd; b++)
+        {
+            const std::vector<int> &kept = m_keptIndices[b];
+            for(size_t k = 0; k < kept.size(); k++)
+            {
+                cloudOut.points[offsets[b] + k] = cloudIn.points[kept[k]];
+            }
+        }
+    }, numBlocks, 1);
+    copyCloudInfo(cloudIn, cloudOut);
+}
+
+/***********************************************************************************************************************
+ * @brief Run the stages on a cloud
+ * @param[in] cloudIn the input cloud
+ * @param[out] cloudOut the output of the last stage
+ * @return true if every stage succeeded
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FilterPipeline::run(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    m_stats.clear();
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr current = cloudIn;
+    int next = 0;
+    size_t stage = 0;
+    while(stage < m_stages.size())
+    {
+        // group consecutive pointwise stages into one step
+        size_t endStage = stage + 1;
+        std::string name = m_stages.at(stage)->getName();
+        if(m_stages.at(stage)->isPointwise())
+        {
+            while(endStage < m_stages.size() && m_stages.at(endStage)->isPointwise())
+            {
+                name += "+" + m_stages.at(endStage)->getName();
+                endStage++;
+            }
+        }
+
+        // run the step into the free buffer
+        pcl::PointCloud<pcl::PointXYZRGBA> &output = *m_buffers[next];
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        bool success = true;
+        if(m_stages.at(stage)->isPointwise())
+        {
+            applyPointwise(stage, endStage, *current, output);
+        }
+        else
+        {
+            success = m_stages.at(stage)->apply(current, output);
+        }
+        if(!success)
+        {
+            PCL_ERROR("[FilterPipeline::run] Stage %s failed.\n", name.c_str());
+            return false;
+        }
+
+        // record the step
+        StageStats stats;
+        stats.name = name;
+        stats.pointsIn = current->points.size();
+        stats.pointsOut = output.points.size();
+        stats.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        stats.outputBytes = output.points.size() * sizeof(pcl::PointXYZRGBA);
+        stats.residentBytes = getResidentMemory();
+        m_stats.push_back(stats);
+
+        current = m_buffers[next];
+        next = 1 - next;
+        stage = endStage;
+    }
+
+    // hand over the result, swapping storage with the output so the buffer keeps an allocation
+    if(current == cloudIn)
+    {
+        cloudOut = *cloudIn;
+    }
+    else
+    {
+        pcl::PointCloud<pcl::PointXYZRGBA> &result = *m_buffers[1 - next];
+        cloudOut.points.swap(result.points);
+        cloudOut.header = result.header;
+        cloudOut.width = result.width;
+        cloudOut.height = result.height;
+        cloudOut.is_dense = result.is_dense;
+        cloudOut.sensor_origin_ = result.sensor_origin_;
+        cloudOut.sensor_orientation_ = result.sensor_orientation_;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the statistics of each step of the last run
+ * @return the step statistics, fused pointwise stages share one entry
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const std::vector<StageStats>& FilterPipeline::getStageStats() const
+{
+    return m_stats;
+}
+
+/***********************************************************************************************************************
+ * @brief Print the statistics of each step of the last run to the console
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::printStageStats() const
+{
+    printStageStats(m_stats);
+}
+
+/***********************************************************************************************************************
+ * @brief Add the step statistics of one run to the totals of several runs of the same pipeline
+ *
+ * Point counts and times are summed. Output and resident sizes keep their largest value, since they measure the memory
+ * held at one time rather than work done. A run that stopped early only adds to the steps it completed.
+ *
+ * @param[in] stats the step statistics of one run
+ * @param[in,out] totals the step statistics of the previous runs, empty before the first run
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::mergeStageStats(const std::vector<StageStats> &stats, std::vector<StageStats> &totals)
+{
+    for(size_t i = 0; i < stats.size(); i++)
+    {
+        if(i == totals.size())
+        {
+            totals.push_back(stats.at(i));
+            continue;
+        }
+        StageStats &total = totals.at(i);
+        total.pointsIn += stats.at(i).pointsIn;
+        total.pointsOut += stats.at(i).pointsOut;
+        total.time += stats.at(i).time;
+        total.outputBytes = std::max(total.outputBytes, stats.at(i).outputBytes);
+        total.residentBytes = std::max(total.residentBytes, stats.at(i).residentBytes);
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Print a list of step statistics to the console
+ * @param[in] stats the step statistics
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FilterPipeline::printStageStats(const std::vector<StageStats> &stats)
+{
+    for(size_t i = 0; i < stats.size(); i++)
+    {
+        const StageStats &stage = stats.at(i);
+        std::printf("  %-24s %10zu -> %10zu points  %9.2f ms  output %8.1f MB  resident %8.1f MB\n", stage.name.c_str(), stage.pointsIn, stage.pointsOut, stage.time * 1000.0, stage.outputBytes / 1048576.0, stage.residentBytes / 1048576.0);
+    }
+}
@@ -0,0 +1,154 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file FilterPipeline.h
+ * @brief Header file for the FilterStage and FilterPipeline classes
+ *
+ * These classes run a configurable chain of cloud processing stages
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef FILTERPIPELINE_H
+#define FILTERPIPELINE_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class FilterStage
+ *
+ * @brief Base class for one stage of a FilterPipeline
+ *
+ * A stage either keeps or drops each point on its own, in which case it overrides isPointwise() and keepPoint() and
+ * consecutive pointwise stages are fused into one pass over the cloud, or it transforms the whole cloud in apply().
+ * Stages are configured by key and value strings, and new stage types can be added with FilterPipeline::registerStage.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class FilterStage
+{
+public:
+
+    typedef boost::shared_ptr<FilterStage> Ptr;
+
+    // constructors
+    virtual ~FilterStage();
+
+    // settings
+    virtual std::string getName() const = 0;
+    virtual bool setParameter(const std::string &key, const std::string &value) = 0;
+    virtual void setNumberOfThreads(int numThreads);
+    virtual void setInputName(const std::string &inputName);
+
+    // processing
+    virtual bool isPointwise() const;
+    virtual bool keepPoint(const pcl::PointXYZRGBA &point) const;
+    virtual bool apply(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+};
+
+/*******************************************************************************************************************//**
+ * @struct StageStats
+ * @brief Point counts, run time and memory use of one pipeline step
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct StageStats
+{
+    std::string name;
+    size_t pointsIn;
+    size_t pointsOut;
+    double time;
+    size_t outputBytes;
+    size_t residentBytes;
+};
+
+/*******************************************************************************************************************//**
+ * @class FilterPipeline
+ *
+ * @brief Class for running a chain of cloud processing stages configured from a text file
+ *
+ * Each line of the configuration file names a stage type followed by its key=value parameters, and '#' starts a
+ * comment. The built-in stage types are:
+ *
+ *   voxel    leaf=0.01                                          ParallelVoxelGrid downsampling
+ *   crop     min=x,y,z max=x,y,z negative=0                     keep the points inside (or outside) a box
+ *   range    min=0 max=10                                       keep the points within a distance of the sensor
+ *   outliers mean_k=50 stddev=1.0 method=buckets                statistical outlier removal, method=pcl uses the
+ *                                                               serial PCL filter
+ *   plane    distance=0.02 max_iterations=1000 max_planes=1 min_size=1000    remove the dominant planes
+ *   cluster  tolerance=0.02 min_size=50 max_size=100000 color=1 keep the clustered points, colored per cluster
+ *   save     file=name.pcd                                      save the current cloud, {input} is replaced by the
+ *                                                               input name
+ *
+ * Steps alternate between two buffers that keep their storage between runs, so processing a sequence of clouds does
+ * not reallocate once the buffers have grown. The time, output size and process resident memory after each step are
+ * recorded.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class FilterPipeline
+{
+public:
+
+    typedef FilterStage::Ptr (*StageFactory)();
+
+private:
+
+    // stages and per step statistics of the last run
+    std::vector<FilterStage::Ptr> m_stages;
+    std::vector<StageStats> m_stats;
+
+    // ping-pong buffers and per thread scratch space, reused between runs
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr m_buffers[2];
+    std::vector<std::vector<int> > m_keptIndices;
+
+    // settings
+    int m_numThreads;
+
+    // helper functions
+    void applyPointwise(size_t firstStage, size_t endStage, const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+
+public:
+
+    // constructors
+    FilterPipeline();
+
+    // stage types
+    static void registerStage(const std::string &type, StageFactory factory);
+    static FilterStage::Ptr createStage(const std::string &type);
+
+    // configuration
+    bool load(const std::string &configFileName);
+    void addStage(const FilterStage::Ptr &stage);
+    void clear();
+    size_t size() const;
+    void setNumberOfThreads(int numThreads);
+    void setInputName(const std::string &inputName);
+
+    // processing
+    bool run(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloudIn, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+    const std::vector<StageStats>& getStageStats() const;
+    void printStageStats() const;
+    static void mergeStageStats(const std::vector<StageStats> &stats, std::vector<StageStats> &totals);
+    static void printStageStats(const std::vector<StageStats> &stats);
+};
+
+#endif // FILTERPIPELINE_H
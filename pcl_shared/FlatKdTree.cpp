@@ -0,0 +1,573 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file FlatKdTree.cpp
+ * @brief Implementation file for the FlatKdTree class
+ *
+ * This class provides a kd-tree search method that can be saved to and restored from a byte buffer
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "FlatKdTree.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+// default number of points stored in each leaf
+#define DEFAULT_LEAF_SIZE 16
+
+// maximum depth of the search stack, enough for any tree built from 32 bit indices
+#define MAX_SEARCH_DEPTH 128
+
+// content hash constants
+#define HASH_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define HASH_PRIME 0x100000001B3ULL
+
+/***********************************************************************************************************************
+ * @brief Hash the coordinates of the indexed points in tree order
+ * @param[in] cloud the point cloud
+ * @param[in] permutation the cloud indices of the indexed points, in tree order
+ * @return the 64 bit content hash
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static uint64_t hashPoints(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud, const std::vector<int> &permutation)
+{
+    uint64_t hash = HASH_OFFSET_BASIS;
+    for(size_t i = 0; i < permutation.size(); i++)
+    {
+        const pcl::PointXYZRGBA &p = cloud.points[permutation[i]];
+        uint32_t words[4];
+        std::memcpy(words, p.data, 3 * sizeof(float));
+        words[3] = static_cast<uint32_t>(permutation[i]);
+        for(int w = 0; w < 4; w++)
+        {
+            hash = (hash ^ words[w]) * HASH_PRIME;
+        }
+    }
+    return hash;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @param[in] sortedResults whether search results are sorted by increasing distance (default: true)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+FlatKdTree::FlatKdTree(bool sortedResults) : pcl::search::Search<pcl::PointXYZRGBA>("FlatKdTree", sortedResults)
+{
+    m_cloudSize = 0;
+    m_contentHash = 0;
+    m_leafSize = DEFAULT_LEAF_SIZE;
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+FlatKdTree::~FlatKdTree()
+{
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum number of points stored in a leaf, takes effect on the next build
+ * @param[in] leafSize the leaf size (default: 16)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FlatKdTree::setLeafSize(int leafSize)
+{
+    m_leafSize = std::max(leafSize, 1);
+}
+
+/***********************************************************************************************************************
+ * @brief Discard the tree, so that the next setInputCloud rebuilds it even for the same cloud and indices
+ *
+ * Needed after editing a cloud in place in ways the content hash does not cover, such as making non-finite points
+ * finite
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FlatKdTree::invalidate()
+{
+    input_.reset();
+    indices_.reset();
+    m_nodes.clear();
+    m_permutation.clear();
+    m_points.clear();
+    m_cloudSize = 0;
+    m_contentHash = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the cloud to search and build the tree, unless it is already built for the same cloud and indices
+ * @param[in] cloud pointer to the input point cloud
+ * @param[in] indices optional subset of the cloud to index
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FlatKdTree::setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices)
+{
+    if(isIndexedFor(cloud, indices))
+    {
+        return;
+    }
+    input_ = cloud;
+    indices_ = indices;
+    m_cloudSize = cloud->points.size();
+
+    // collect the finite points to index
+    m_permutation.clear();
+    size_t count = indices ? indices->size() : cloud->points.size();
+    m_permutation.reserve(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        int index = indices ? (*indices)[i] : static_cast<int>(i);
+        const pcl::PointXYZRGBA &p = cloud->points[index];
+        if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+        {
+            m_permutation.push_back(index);
+        }
+    }
+
+    // build the tree from the root
+    m_nodes.clear();
+    if(!m_permutation.empty())
+    {
+        buildNode(0, m_permutation.size());
+    }
+    copyPoints();
+    m_contentHash = hashPoints(*cloud, m_permutation);
+}
+
+/***********************************************************************************************************************
+ * @brief Recursively build the subtree holding a range of the permutation
+ *
+ * Splits the range at its median along the axis of largest extent
+ *
+ * @param[in] begin first position of the range
+ * @param[in] end one past the last position of the range
+ * @return the index of the subtree root node
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int FlatKdTree::buildNode(size_t begin, size_t end)
+{
+    int nodeIndex = static_cast<int>(m_nodes.size());
+    m_nodes.push_back(Node());
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloud = *input_;
+
+    // store small ranges as leaves
+    if(end - begin <= static_cast<size_t>(m_leafSize))
+    {
+        m_nodes[nodeIndex].split = 0.0f;
+        m_nodes[nodeIndex].axis = -1;
+        m_nodes[nodeIndex].first = static_cast<int32_t>(begin);
+        m_nodes[nodeIndex].second = static_cast<int32_t>(end);
+        return nodeIndex;
+    }
+
+    // find the axis of largest extent
+    float minPt[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    float maxPt[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+    for(size_t i = begin; i < end; i++)
+    {
+        const pcl::PointXYZRGBA &p = cloud.points[m_permutation[i]];
+        minPt[0] = std::min(minPt[0], p.x);
+        minPt[1] = std::min(minPt[1], p.y);
+        minPt[2] = std::min(minPt[2], p.z);
+        maxPt[0] = std::max(maxPt[0], p.x);
+        maxPt[1] = std::max(maxPt[1], p.y);
+        maxPt[2] = std::max(maxPt[2], p.z);
+    }
+    int axis = 0;
+    for(int d = 1; d < 3; d++)
+    {
+        if(maxPt[d] - minPt[d] > maxPt[axis] - minPt[axis])
+        {
+            axis = d;
+        }
+    }
+
+    // partition the range around the median, points equal to the split may fall on either side
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(m_permutation.begin() + begin, m_permutation.begin() + middle, m_permutation.begin() + end, [&](int a, int b)
+    {
+        return cloud.points[a].data[axis] < cloud.points[b].data[axis];
+    });
+    float split = cloud.points[m_permutation[middle]].data[axis];
+
+    // build the children, the node vector may grow so store through the index
+    int left = buildNode(begin, middle);
+    int right = buildNode(middle, end);
+    m_nodes[nodeIndex].split = split;
+    m_nodes[nodeIndex].axis = axis;
+    m_nodes[nodeIndex].first = left;
+    m_nodes[nodeIndex].second = right;
+    return nodeIndex;
+}
+
+/***********************************************************************************************************************
+ * @brief Copy the indexed coordinates in tree order for cache friendly leaf scans
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FlatKdTree::copyPoints()
+{
+    m_points.resize(m_permutation.size() * 3);
+    for(size_t i = 0; i < m_permutation.size(); i++)
+    {
+        const pcl::PointXYZRGBA &p = input_->points[m_permutation[i]];
+        m_points[i * 3] = p.x;
+        m_points[i * 3 + 1] = p.y;
+        m_points[i * 3 + 2] = p.z;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Check whether the tree is already built for a cloud and index subset
+ *
+ * A null index list and a list of every cloud index in order are treated as equivalent, since PCL algorithms fill in
+ * the second when no indices are given. The indexed points are hashed again, so a cloud edited in place since the tree
+ * was built is indexed again.
+ *
+ * @param[in] cloud pointer to the point cloud
+ * @param[in] indices optional subset of the cloud
+ * @return true if the current tree indexes the same cloud, subset and point coordinates
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FlatKdTree::isIndexedFor(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices) const
+{
+    if(!input_ || cloud.get() != input_.get() || cloud->points.size() != m_cloudSize || hashPoints(*cloud, m_permutation) != m_contentHash)
+    {
+        return false;
+    }
+    if(indices == indices_)
+    {
+        return true;
+    }
+    if(indices && indices_)
+    {
+        return *indices == *indices_;
+    }
+
+    // one side is null, so the other must list every index in order
+    const IndicesConstPtr &list = indices ? indices : indices_;
+    if(list->size() != m_cloudSize)
+    {
+        return false;
+    }
+    for(size_t i = 0; i < list->size(); i++)
+    {
+        if((*list)[i] != static_cast<int>(i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Search for the k nearest neighbors of a point
+ * @param[in] point the query point
+ * @param[in] k the number of neighbors to find
+ * @param[out] k_indices the cloud indices of the neighbors, nearest first
+ * @param[out] k_sqr_distances the squared distances of the neighbors
+ * @return the number of neighbors found
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int FlatKdTree::nearestKSearch(const pcl::PointXYZRGBA &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const
+{
+    k_indices.clear();
+    k_sqr_distances.clear();
+    if(m_nodes.empty() || k <= 0)
+    {
+        return 0;
+    }
+
+    // keep the best candidates in a max heap of (squared distance, position)
+    std::vector<std::pair<float, int> > heap;
+    heap.reserve(static_cast<size_t>(k) + 1);
+    const float query[3] = {point.x, point.y, point.z};
+
+    // depth first traversal, visiting the near child first
+    std::pair<int, float> stack[MAX_SEARCH_DEPTH];
+    int stackSize = 0;
+    stack[stackSize++] = std::make_pair(0, 0.0f);
+    while(stackSize > 0)
+    {
+        std::pair<int, float> entry = stack[--stackSize];
+        if(static_cast<int>(heap.size()) == k && entry.second > heap.front().first)
+        {
+            continue;
+        }
+        const Node &node = m_nodes[entry.first];
+        if(node.axis < 0)
+        {
+            for(int32_t i = node.first; i < node.second; i++)
+            {
+                float dx = m_points[i * 3] - query[0];
+                float dy = m_points[i * 3 + 1] - query[1];
+                float dz = m_points[i * 3 + 2] - query[2];
+                float distance = dx * dx + dy * dy + dz * dz;
+                if(static_cast<int>(heap.size()) < k)
+                {
+                    heap.push_back(std::make_pair(distance, i));
+                    std::push_heap(heap.begin(), heap.end());
+                }
+                else if(distance < heap.front().first)
+                {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = std::make_pair(distance, i);
+                    std::push_heap(heap.begin(), heap.end());
+                }
+            }
+            continue;
+        }
+        float diff = query[node.axis] - node.split;
+        int nearChild = (diff < 0.0f) ? node.first : node.second;
+        int farChild = (diff < 0.0f) ? node.second : node.first;
+        stack[stackSize++] = std::make_pair(farChild, diff * diff);
+        stack[stackSize++] = std::make_pair(nearChild, entry.second);
+    }
+
+    // return the neighbors nearest first
+    std::sort_heap(heap.begin(), heap.end());
+    k_indices.resize(heap.size());
+    k_sqr_distances.resize(heap.size());
+    for(size_t i = 0; i < heap.size(); i++)
+    {
+        k_indices[i] = m_permutation[heap[i].second];
+        k_sqr_distances[i] = heap[i].first;
+    }
+    return static_cast<int>(heap.size());
+}
+
+/***********************************************************************************************************************
+ * @brief Search for all neighbors of a point within a radius
+ * @param[in] point the query point
+ * @param[in] radius the search radius
+ * @param[out] k_indices the cloud indices of the neighbors
+ * @param[out] k_sqr_distances the squared distances of the neighbors
+ * @param[in] max_nn the maximum number of neighbors to return, or 0 for no limit (default: 0)
+ * @return the number of neighbors found
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int FlatKdTree::radiusSearch(const pcl::PointXYZRGBA &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn) const
+{
+    k_indices.clear();
+    k_sqr_distances.clear();
+    if(m_nodes.empty())
+    {
+        return 0;
+    }
+    const float query[3] = {point.x, point.y, point.z};
+    const float squaredRadius = static_cast<float>(radius * radius);
+    const size_t maxNeighbors = (max_nn > 0) ? static_cast<size_t>(max_nn) : std::numeric_limits<size_t>::max();
+
+    // depth first traversal, skipping subtrees on the far side of a split plane outside the radius
+    std::vector<std::pair<float, int> > neighbors;
+    int stack[MAX_SEARCH_DEPTH];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0 && neighbors.size() < maxNeighbors)
+    {
+        const Node &node = m_nodes[stack[--stackSize]];
+        if(node.axis < 0)
+        {
+            for(int32_t i = node.first; i < node.second && neighbors.size() < maxNeighbors; i++)
+            {
+                float dx = m_points[i * 3] - query[0];
+                float dy = m_points[i * 3 + 1] - query[1];
+                float dz = m_points[i * 3 + 2] - query[2];
+                float distance = dx * dx + dy * dy + dz * dz;
+                if(distance <= squaredRadius)
+                {
+                    neighbors.push_back(std::make_pair(distance, m_permutation[i]));
+                }
+            }
+            continue;
+        }
+        float diff = query[node.axis] - node.split;
+        if(diff * diff <= squaredRadius)
+        {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = node.second;
+        }
+        else
+        {
+            stack[stackSize++] = (diff < 0.0f) ? node.first : node.second;
+        }
+    }
+
+    // sort the neighbors by distance if requested
+    if(sorted_results_)
+    {
+        std::sort(neighbors.begin(), neighbors.end());
+    }
+    k_indices.resize(neighbors.size());
+    k_sqr_distances.resize(neighbors.size());
+    for(size_t i = 0; i < neighbors.size(); i++)
+    {
+        k_indices[i] = neighbors[i].second;
+        k_sqr_distances[i] = neighbors[i].first;
+    }
+    return static_cast<int>(neighbors.size());
+}
+
+/***********************************************************************************************************************
+ * @brief Serialize the tree structure into a byte buffer
+ *
+ * The buffer holds the cloud size, a hash of the indexed coordinates, the permutation and the nodes in native byte
+ * order. Point coordinates are not stored, they are copied from the cloud given to deserializeTree.
+ *
+ * @param[out] bufferOut the serialized tree
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void FlatKdTree::serializeTree(std::vector<char> &bufferOut) const
+{
+    uint64_t counts[4] = {m_cloudSize, m_permutation.size(), m_nodes.size(), m_contentHash};
+    size_t permutationBytes = m_permutation.size() * sizeof(int);
+    size_t nodeBytes = m_nodes.size() * sizeof(Node);
+    bufferOut.resize(sizeof(counts) + permutationBytes + nodeBytes);
+    char* ptr = &bufferOut[0];
+    std::memcpy(ptr, counts, sizeof(counts));
+    ptr += sizeof(counts);
+    if(permutationBytes > 0)
+    {
+        std::memcpy(ptr, &m_permutation[0], permutationBytes);
+        ptr += permutationBytes;
+    }
+    if(nodeBytes > 0)
+    {
+        std::memcpy(ptr, &m_nodes[0], nodeBytes);
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Restore a tree serialized by serializeTree for the same cloud
+ * @param[in] bufferIn the serialized tree
+ * @param[in] cloud pointer to the point cloud the tree was built for
+ * @param[in] indices optional subset of the cloud the tree was built for
+ * @return false if the buffer is malformed or the indexed coordinates of the cloud differ from those it was built for
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool FlatKdTree::deserializeTree(const std::vector<char> &bufferIn, const PointCloudConstPtr &cloud, const IndicesConstPtr &indices)
+{
+    // read and validate the counts
+    uint64_t counts[4];
+    if(!cloud || bufferIn.size() < sizeof(counts))
+    {
+        return false;
+    }
+    std::memcpy(counts, &bufferIn[0], sizeof(counts));
+    if(counts[0] != cloud->points.size() || counts[1] > counts[0] || counts[2] > 2 * counts[1] + 1)
+    {
+        return false;
+    }
+    size_t permutationBytes = static_cast<size_t>(counts[1]) * sizeof(int);
+    size_t nodeBytes = static_cast<size_t>(counts[2]) * sizeof(Node);
+    if(bufferIn.size() != sizeof(counts) + permutationBytes + nodeBytes)
+    {
+        return false;
+    }
+
+    // copy the tree data
+    std::vector<int> permutation(static_cast<size_t>(counts[1]));
+    std::vector<Node> nodes(static_cast<size_t>(counts[2]));
+    const char* ptr = &bufferIn[0] + sizeof(counts);
+    if(permutationBytes > 0)
+    {
+        std::memcpy(&permutation[0], ptr, permutationBytes);
+        ptr += permutationBytes;
+    }
+    if(nodeBytes > 0)
+    {
+        std::memcpy(&nodes[0], ptr, nodeBytes);
+    }
+
+    // validate every index so that a corrupt buffer cannot cause out of range reads during searches
+    for(size_t i = 0; i < permutation.size(); i++)
+    {
+        if(permutation[i] < 0 || static_cast<uint64_t>(permutation[i]) >= counts[0])
+        {
+            return false;
+        }
+    }
+    std::vector<int> depths(nodes.size(), 0);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        const Node &node = nodes[i];
+        if(node.axis < 0)
+        {
+            if(node.axis != -1 || node.first < 0 || node.first > node.second || static_cast<size_t>(node.second) > permutation.size())
+            {
+                return false;
+            }
+        }
+        else if(node.axis > 2 || node.first <= static_cast<int32_t>(i) || node.second <= static_cast<int32_t>(i) || static_cast<size_t>(node.first) >= nodes.size() || static_cast<size_t>(node.second) >= nodes.size())
+        {
+            return false;
+        }
+        else
+        {
+            // children always follow their parent, so depths can be propagated in a single pass
+            depths[node.first] = std::max(depths[node.first], depths[i] + 1);
+            depths[node.second] = std::max(depths[node.second], depths[i] + 1);
+            if(depths[i] + 2 >= MAX_SEARCH_DEPTH)
+            {
+                return false;
+            }
+        }
+    }
+
+    // check that the cloud holds the same indexed points the tree was built from
+    if(hashPoints(*cloud, permutation) != counts[3])
+    {
+        return false;
+    }
+
+    // attach the cloud
+    input_ = cloud;
+    indices_ = indices;
+    m_cloudSize = cloud->points.size();
+    m_permutation.swap(permutation);
+    m_nodes.swap(nodes);
+    m_contentHash = counts[3];
+    copyPoints();
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of tree nodes
+ * @return the number of nodes
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t FlatKdTree::getNumberOfNodes() const
+{
+    return m_nodes.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points stored in the tree
+ * @return the number of indexed points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t FlatKdTree::getNumberOfIndexedPoints() const
+{
+    return m_permutation.size();
+}
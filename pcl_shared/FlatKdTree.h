@@ -0,0 +1,110 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file FlatKdTree.h
+ * @brief Header file for the FlatKdTree class
+ *
+ * This class provides a kd-tree search method that can be saved to and restored from a byte buffer
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef FLATKDTREE_H
+#define FLATKDTREE_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/search.h>
+
+#include <cstdint>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class FlatKdTree
+ *
+ * @brief Kd-tree search method stored in flat arrays so that it can be serialized
+ *
+ * Drop-in replacement for pcl::search::KdTree<pcl::PointXYZRGBA> (for example as the search method of
+ * pcl::EuclideanClusterExtraction). The tree is a list of nodes plus a permutation of the indexed point indices, so
+ * serializeTree and deserializeTree are plain copies. The serialized tree carries a hash of the indexed coordinates,
+ * so deserializeTree rejects a cloud whose points differ from the ones the tree was built for. Calling setInputCloud
+ * with the cloud and indices the tree was already built or deserialized for keeps the existing tree instead of
+ * rebuilding it, as long as the indexed coordinates still match the hash. Non-finite points are not indexed, so a
+ * cloud whose non-finite points were made finite in place needs invalidate() before setInputCloud.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class FlatKdTree : public pcl::search::Search<pcl::PointXYZRGBA>
+{
+public:
+
+    typedef pcl::search::Search<pcl::PointXYZRGBA>::PointCloudConstPtr PointCloudConstPtr;
+    typedef pcl::search::Search<pcl::PointXYZRGBA>::IndicesConstPtr IndicesConstPtr;
+    typedef boost::shared_ptr<FlatKdTree> Ptr;
+
+    using pcl::search::Search<pcl::PointXYZRGBA>::nearestKSearch;
+    using pcl::search::Search<pcl::PointXYZRGBA>::radiusSearch;
+
+private:
+
+    // tree node, leaves store a range of the permutation and branches store their children
+    struct Node
+    {
+        float split;
+        int32_t axis;
+        int32_t first;
+        int32_t second;
+    };
+
+    // tree data
+    std::vector<Node> m_nodes;
+    std::vector<int> m_permutation;
+    std::vector<float> m_points;
+    size_t m_cloudSize;
+    uint64_t m_contentHash;
+    int m_leafSize;
+
+    // helper functions
+    int buildNode(size_t begin, size_t end);
+    void copyPoints();
+    bool isIndexedFor(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices) const;
+
+public:
+
+    // constructors
+    FlatKdTree(bool sortedResults=true);
+    virtual ~FlatKdTree();
+
+    // settings
+    void setLeafSize(int leafSize);
+    void invalidate();
+
+    // pcl::search::Search interface
+    virtual void setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices=IndicesConstPtr());
+    virtual int nearestKSearch(const pcl::PointXYZRGBA &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const;
+    virtual int radiusSearch(const pcl::PointXYZRGBA &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn=0) const;
+
+    // serialization
+    void serializeTree(std::vector<char> &bufferOut) const;
+    bool deserializeTree(const std::vector<char> &bufferIn, const PointCloudConstPtr &cloud, const IndicesConstPtr &indices=IndicesConstPtr());
+
+    // accessors
+    size_t getNumberOfNodes() const;
+    size_t getNumberOfIndexedPoints() const;
+};
+
+#endif // FLATKDTREE_H
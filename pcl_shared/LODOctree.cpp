@@ -0,0 +1,950 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file LODOctree.cpp
+ * @brief Implementation file for the LODOctree class
+ *
+ * This class stores a point cloud file as an octree of progressively subsampled point sets for level of detail rendering
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "LODOctree.h"
+#include "ChunkedCloudReader.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include <sys/stat.h>
+
+// size of each stored point (x, y, z, rgba)
+#define POINT_RECORD_SIZE 16
+
+// data file identification
+#define LOD_FILE_MAGIC "PCLLOD01"
+
+// size of each stored node (center, half size, depth, children, point count, block count) and block (offset, count)
+#define NODE_RECORD_SIZE 68
+#define BLOCK_RECORD_SIZE 12
+
+// initial size of the occupied cell hash table of a node, and the marker of its empty slots
+#define OCCUPANCY_TABLE_SIZE 64
+#define OCCUPANCY_EMPTY_SLOT 0xFFFFFFFFFFFFFFFFULL
+
+/*******************************************************************************************************************//**
+ * @brief Header stored at the start of every data file, written last so that an interrupted build is never reused
+ **********************************************************************************************************************/
+struct LODFileHeader
+{
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    int32_t gridSize;
+    int32_t maxDepth;
+    uint64_t numPoints;
+    uint64_t numNodes;
+    uint64_t tableOffset;
+    float minBound[3];
+    float maxBound[3];
+    float sensorOrigin[4];
+    float sensorOrientation[4];
+};
+
+/***********************************************************************************************************************
+ * @brief Get the size and modification time of a file
+ * @param[in] fileName path and name of the file
+ * @param[out] size the file size in bytes
+ * @param[out] modified the modification time, in seconds since the epoch
+ * @return false if the file could not be found
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static bool getFileStamp(const std::string &fileName, uint64_t &size, int64_t &modified)
+{
+    struct stat fileStats;
+    if(stat(fileName.c_str(), &fileStats) != 0)
+    {
+        return false;
+    }
+    size = static_cast<uint64_t>(fileStats.st_size);
+    modified = static_cast<int64_t>(fileStats.st_mtime);
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes an empty LODOctree, call build() to index a cloud file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+LODOctree::LODOctree()
+{
+    m_numPoints = 0;
+    m_minBound.setZero();
+    m_maxBound.setZero();
+    m_sensorOrigin.setZero();
+    m_sensorOrientation.setIdentity();
+    m_dataSize = 0;
+    m_numPending = 0;
+    m_occupancyBytes = 0;
+    m_gridSize = 64;
+    m_maxDepth = 10;
+    m_flushSize = 65536;
+    m_pendingLimit = 4194304;
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ *
+ * Closes the point data file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+LODOctree::~LODOctree()
+{
+    if(m_dataFile.is_open())
+    {
+        m_dataFile.close();
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of grid cells along each axis of a node
+ *
+ * Each node keeps at most gridSize^3 points. Larger grids give fewer, larger nodes.
+ *
+ * @param[in] gridSize the number of cells per axis (default: 64)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::setGridSize(int gridSize)
+{
+    m_gridSize = std::max(gridSize, 1);
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum depth of the tree
+ *
+ * Nodes at the maximum depth keep every point that reaches them, regardless of their grid occupancy
+ *
+ * @param[in] maxDepth the depth of the deepest nodes, the root is at depth 0 (default: 10)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::setMaxDepth(int maxDepth)
+{
+    m_maxDepth = std::max(maxDepth, 0);
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of points each node buffers before writing them to the data file
+ * @param[in] flushSize the number of points per written block (default: 65536)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::setFlushSize(size_t flushSize)
+{
+    m_flushSize = std::max<size_t>(flushSize, 1);
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of points buffered across all nodes before the largest buffers are written to the data file
+ *
+ * Bounds the build memory regardless of the number of nodes. Buffered points take 32 bytes each, so the default limit
+ * holds about 128 MB. The occupied cell tables of the nodes count against the limit at the same 32 bytes per point, down
+ * to a quarter of the limit left for buffered points.
+ *
+ * @param[in] pendingLimit the number of buffered points (default: 4194304)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::setPendingLimit(size_t pendingLimit)
+{
+    m_pendingLimit = std::max<size_t>(pendingLimit, 1);
+}
+
+/***********************************************************************************************************************
+ * @brief Open the data file of a previous build of the same cloud file
+ *
+ * The data file is reused if it was completely written, its grid size and maximum depth match the current settings,
+ * and the cloud file has the size and modification time it had when the data file was built
+ *
+ * @param[in] cloudFileName path and name of the PCD or PLY file the data file was built from
+ * @param[in] dataFileName path and name of the data file
+ * @return false if the data file is missing or out of date, in which case build() must be called
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::open(const std::string &cloudFileName, const std::string &dataFileName)
+{
+    // reset the tree
+    m_nodes.clear();
+    m_buildState.clear();
+    m_numPoints = 0;
+    m_dataSize = 0;
+
+    uint64_t sourceSize = 0;
+    int64_t sourceModified = 0;
+    if(!getFileStamp(cloudFileName, sourceSize, sourceModified))
+    {
+        return false;
+    }
+    if(m_dataFile.is_open())
+    {
+        m_dataFile.close();
+    }
+    m_dataFile.clear();
+    m_dataFile.open(dataFileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    if(!m_dataFile.is_open())
+    {
+        return false;
+    }
+    if(!readNodeTable(sourceSize, sourceModified))
+    {
+        m_dataFile.close();
+        m_nodes.clear();
+        m_numPoints = 0;
+        return false;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Build the tree from a cloud file
+ *
+ * The cloud file is read twice, once to find its bounds and once to insert the points. Node points and the node table
+ * are written to the data file, which is kept open for loadNode() and overwritten by the next build.
+ *
+ * @param[in] cloudFileName path and name of the input PCD or PLY file
+ * @param[in] dataFileName path and name of the file used to store the node points
+ * @param[in] chunkSize the number of points read from the cloud file at a time (default: 1000000)
+ * @return false if the cloud file could not be read or the data file could not be written
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::build(const std::string &cloudFileName, const std::string &dataFileName, size_t chunkSize)
+{
+    // reset the tree
+    m_nodes.clear();
+    m_buildState.clear();
+    m_numPoints = 0;
+    m_dataSize = 0;
+    m_numPending = 0;
+    m_occupancyBytes = 0;
+    uint64_t sourceSize = 0;
+    int64_t sourceModified = 0;
+    getFileStamp(cloudFileName, sourceSize, sourceModified);
+
+    // find the bounds of the finite points
+    ChunkedCloudReader reader;
+    if(!reader.open(cloudFileName, chunkSize))
+    {
+        return false;
+    }
+    m_sensorOrigin = reader.getSensorOrigin();
+    m_sensorOrientation = reader.getSensorOrientation();
+    pcl::PointCloud<pcl::PointXYZRGBA> chunk;
+    m_minBound.setConstant(std::numeric_limits<float>::max());
+    m_maxBound.setConstant(-std::numeric_limits<float>::max());
+    while(reader.readChunk(chunk))
+    {
+        for(size_t i = 0; i < chunk.points.size(); i++)
+        {
+            const pcl::PointXYZRGBA &p = chunk.points[i];
+            if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+            {
+                m_minBound = m_minBound.cwiseMin(p.getVector3fMap());
+                m_maxBound = m_maxBound.cwiseMax(p.getVector3fMap());
+            }
+        }
+    }
+    reader.close();
+    if(m_minBound[0] > m_maxBound[0])
+    {
+        PCL_ERROR("no finite points in cloud file: %s \n", cloudFileName.c_str());
+        m_minBound.setZero();
+        m_maxBound.setZero();
+        return false;
+    }
+
+    // open the data file
+    if(m_dataFile.is_open())
+    {
+        m_dataFile.close();
+    }
+    m_dataFile.clear();
+    m_dataFile.open(dataFileName.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!m_dataFile.is_open())
+    {
+        PCL_ERROR("error while attempting to create lod data file: %s \n", dataFileName.c_str());
+        return false;
+    }
+
+    // leave room for the header, which stays blank until the build completes
+    LODFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    m_dataFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_dataSize = sizeof(header);
+
+    // create a cubic root node slightly larger than the bounds
+    Eigen::Vector3f extent = m_maxBound - m_minBound;
+    float halfSize = std::max(0.5f * extent.maxCoeff() * 1.001f, 1e-6f);
+    createNode(0.5f * (m_minBound + m_maxBound), halfSize, 0);
+
+    // insert the points
+    if(!reader.open(cloudFileName, chunkSize))
+    {
+        return false;
+    }
+    bool success = true;
+    while(success && reader.readChunk(chunk))
+    {
+        for(size_t i = 0; i < chunk.points.size(); i++)
+        {
+            const pcl::PointXYZRGBA &p = chunk.points[i];
+            if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+            {
+                insertPoint(p);
+            }
+        }
+        success = m_dataFile.good();
+    }
+    reader.close();
+
+    // write the remaining buffered points and release the build state
+    for(size_t i = 0; i < m_nodes.size(); i++)
+    {
+        success = success && flushNode(static_cast<int>(i));
+    }
+    m_buildState.clear();
+    m_occupancyBytes = 0;
+    success = success && writeNodeTable(sourceSize, sourceModified);
+    m_dataFile.flush();
+    if(!success)
+    {
+        PCL_ERROR("error while writing lod data file: %s \n", dataFileName.c_str());
+    }
+    return success;
+}
+
+/***********************************************************************************************************************
+ * @brief Select the nodes to render for a camera view
+ *
+ * Visits nodes in order of decreasing projected size, starting from the root. A node is selected if it intersects the
+ * view frustum and projects to at least minNodePixels, and its children are only considered once it is selected.
+ * Selection stops when the point budget is reached, so the nodes closest to the camera get the most detail.
+ *
+ * @param[in] cameraPosition the position of the camera
+ * @param[in] frustum the six frustum planes as (a, b, c, d) with normals pointing inwards, as produced by
+ *                    pcl::visualization::getViewFrustum
+ * @param[in] screenScale the number of pixels covered by an object of unit size at unit distance
+ * @param[in] pointBudget the maximum number of points to select
+ * @param[in] minNodePixels the smallest projected node radius worth rendering, in pixels
+ * @param[out] nodesOut the indices of the selected nodes, coarsest first
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::selectNodes(const Eigen::Vector3d &cameraPosition, const double frustum[24], double screenScale, size_t pointBudget, double minNodePixels, std::vector<int> &nodesOut) const
+{
+    nodesOut.clear();
+    if(m_nodes.empty())
+    {
+        return;
+    }
+
+    // visit the nodes from the largest to the smallest on screen
+    std::priority_queue<std::pair<double, int> > candidates;
+    candidates.push(std::make_pair(std::numeric_limits<double>::max(), 0));
+    uint64_t numSelected = 0;
+    while(!candidates.empty())
+    {
+        double pixels = candidates.top().first;
+        int index = candidates.top().second;
+        candidates.pop();
+        const Node &node = m_nodes[index];
+
+        // cull nodes outside the frustum, using the box corner furthest along each plane normal
+        Eigen::Vector3d center = node.center.cast<double>();
+        double halfSize = node.halfSize;
+        bool visible = true;
+        for(int i = 0; i < 6 && visible; i++)
+        {
+            const double *plane = frustum + 4 * i;
+            double x = center[0] + (plane[0] >= 0 ? halfSize : -halfSize);
+            double y = center[1] + (plane[1] >= 0 ? halfSize : -halfSize);
+            double z = center[2] + (plane[2] >= 0 ? halfSize : -halfSize);
+            visible = plane[0] * x + plane[1] * y + plane[2] * z + plane[3] >= 0;
+        }
+        if(!visible || pixels < minNodePixels)
+        {
+            continue;
+        }
+
+        // stop once the budget is used up
+        if(numSelected + node.numPoints > pointBudget && !nodesOut.empty())
+        {
+            break;
+        }
+        nodesOut.push_back(index);
+        numSelected += node.numPoints;
+
+        // queue the children by projected size
+        for(int i = 0; i < 8; i++)
+        {
+            int child = node.children[i];
+            if(child >= 0)
+            {
+                const Node &childNode = m_nodes[child];
+                double radius = childNode.halfSize * std::sqrt(3.0);
+                double distance = (childNode.center.cast<double>() - cameraPosition).norm();
+                double childPixels = distance > radius ? screenScale * radius / distance : std::numeric_limits<double>::max();
+                candidates.push(std::make_pair(childPixels, child));
+            }
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Read the points stored in a node
+ * @param[in] index the index of the node
+ * @param[out] cloudOut the points of the node
+ * @return false if the index is invalid or the data file could not be read
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::loadNode(int index, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    if(index < 0 || static_cast<size_t>(index) >= m_nodes.size() || !m_dataFile.is_open())
+    {
+        return false;
+    }
+    const Node &node = m_nodes[index];
+
+    // allocate the output cloud
+    cloudOut.points.resize(node.numPoints);
+    cloudOut.width = static_cast<uint32_t>(node.numPoints);
+    cloudOut.height = 1;
+    cloudOut.is_dense = true;
+    cloudOut.sensor_origin_ = m_sensorOrigin;
+    cloudOut.sensor_orientation_ = m_sensorOrientation;
+
+    // read and unpack each block
+    size_t count = 0;
+    for(size_t i = 0; i < node.blocks.size(); i++)
+    {
+        size_t blockSize = node.blocks[i].second;
+        m_buffer.resize(blockSize * POINT_RECORD_SIZE);
+        m_dataFile.clear();
+        m_dataFile.seekg(static_cast<std::streamoff>(node.blocks[i].first));
+        m_dataFile.read(reinterpret_cast<char*>(&m_buffer[0]), m_buffer.size());
+        if(static_cast<size_t>(m_dataFile.gcount()) != m_buffer.size())
+        {
+            PCL_ERROR("unexpected end of lod data file while reading node %d \n", index);
+            return false;
+        }
+        for(size_t j = 0; j < blockSize; j++)
+        {
+            const uint8_t* record = &m_buffer[j * POINT_RECORD_SIZE];
+            pcl::PointXYZRGBA &p = cloudOut.points[count++];
+            std::memcpy(&p.x, record, sizeof(float));
+            std::memcpy(&p.y, record + 4, sizeof(float));
+            std::memcpy(&p.z, record + 8, sizeof(float));
+            std::memcpy(&p.rgba, record + 12, sizeof(uint32_t));
+        }
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of nodes in the tree
+ * @return the number of nodes
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t LODOctree::getNumberOfNodes() const
+{
+    return m_nodes.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points stored in the tree
+ * @return the number of finite points in the cloud file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint64_t LODOctree::getNumberOfPoints() const
+{
+    return m_numPoints;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points stored in a node
+ * @param[in] index the index of the node
+ * @return the number of points, or 0 if the index is invalid
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint64_t LODOctree::getNodeSize(int index) const
+{
+    if(index < 0 || static_cast<size_t>(index) >= m_nodes.size())
+    {
+        return 0;
+    }
+    return m_nodes[index].numPoints;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the bounds of the indexed points
+ * @param[out] minBound the minimum coordinate along each axis
+ * @param[out] maxBound the maximum coordinate along each axis
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::getBounds(Eigen::Vector3f &minBound, Eigen::Vector3f &maxBound) const
+{
+    minBound = m_minBound;
+    maxBound = m_maxBound;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the sensor origin of the cloud file
+ * @return the sensor origin
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const Eigen::Vector4f& LODOctree::getSensorOrigin() const
+{
+    return m_sensorOrigin;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the sensor orientation of the cloud file
+ * @return the sensor orientation
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const Eigen::Quaternionf& LODOctree::getSensorOrientation() const
+{
+    return m_sensorOrientation;
+}
+
+/***********************************************************************************************************************
+ * @brief Append a new empty node to the tree
+ * @param[in] center the center of the node cube
+ * @param[in] halfSize half of the edge length of the node cube
+ * @param[in] depth the depth of the node
+ * @return the index of the new node
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int LODOctree::createNode(const Eigen::Vector3f &center, float halfSize, int depth)
+{
+    Node node;
+    node.center = center;
+    node.halfSize = halfSize;
+    node.depth = depth;
+    std::fill(node.children, node.children + 8, -1);
+    node.numPoints = 0;
+    m_nodes.push_back(node);
+    m_buildState.push_back(BuildState());
+    return static_cast<int>(m_nodes.size() - 1);
+}
+
+/***********************************************************************************************************************
+ * @brief Store a point in the shallowest node with a free grid cell
+ * @param[in] point the finite point to insert
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void LODOctree::insertPoint(const pcl::PointXYZRGBA &point)
+{
+    int index = 0;
+    while(true)
+    {
+        // find the grid cell of the point within the node
+        Eigen::Vector3f center = m_nodes[index].center;
+        float halfSize = m_nodes[index].halfSize;
+        int depth = m_nodes[index].depth;
+        float scale = m_gridSize / (2.0f * halfSize);
+        uint64_t key = 0;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            int cell = static_cast<int>((point.data[axis] - center[axis] + halfSize) * scale);
+            cell = std::min(std::max(cell, 0), m_gridSize - 1);
+            key = key * m_gridSize + cell;
+        }
+
+        // keep the point here if the node cannot be refined or its cell is free
+        BuildState &state = m_buildState[index];
+        bool keep = depth >= m_maxDepth;
+        if(!keep)
+        {
+            keep = occupyCell(state, key);
+        }
+        if(keep)
+        {
+            state.pending.push_back(point);
+            m_nodes[index].numPoints++;
+            m_numPoints++;
+            m_numPending++;
+            if(state.pending.size() >= m_flushSize)
+            {
+                flushNode(index);
+            }
+            else if(m_numPending >= getPendingBudget())
+            {
+                flushLargestNodes();
+            }
+            return;
+        }
+
+        // otherwise descend into the child octant, creating it if needed
+        int octant = (point.x >= center[0] ? 1 : 0) | (point.y >= center[1] ? 2 : 0) | (point.z >= center[2] ? 4 : 0);
+        int child = m_nodes[index].children[octant];
+        if(child < 0)
+        {
+            float childHalfSize = 0.5f * halfSize;
+            Eigen::Vector3f childCenter(center[0] + ((octant & 1) ? childHalfSize : -childHalfSize), center[1] + ((octant & 2) ? childHalfSize : -childHalfSize), center[2] + ((octant & 4) ? childHalfSize : -childHalfSize));
+            child = createNode(childCenter, childHalfSize, depth + 1);
+            m_nodes[index].children[octant] = child;
+        }
+        index = child;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Mark a grid cell of a node as occupied
+ *
+ * Cells are kept in an open addressing hash table until it would take more memory than a bitset of every cell, and in
+ * the bitset from then on
+ *
+ * @param[in,out] state the build state of the node
+ * @param[in] key the index of the cell in the node grid
+ * @return true if the cell was free
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::occupyCell(BuildState &state, uint64_t key)
+{
+    std::vector<uint64_t> &table = state.occupancy;
+    if(state.denseOccupancy)
+    {
+        uint64_t bit = static_cast<uint64_t>(1) << (key % 64);
+        bool isFree = (table[key / 64] & bit) == 0;
+        table[key / 64] |= bit;
+        return isFree;
+    }
+
+    // look the cell up in the hash table
+    if(!table.empty())
+    {
+        size_t mask = table.size() - 1;
+        for(size_t slot = static_cast<size_t>(key * 0x9E3779B97F4A7C15ULL) & mask; table[slot] != OCCUPANCY_EMPTY_SLOT; slot = (slot + 1) & mask)
+        {
+            if(table[slot] == key)
+            {
+                return false;
+            }
+        }
+    }
+
+    // grow the table to keep it at most half full, or switch to the bitset once that is smaller
+    if((state.numOccupied + 1) * 2 > table.size())
+    {
+        const size_t numCells = static_cast<size_t>(m_gridSize) * m_gridSize * m_gridSize;
+        const size_t denseSize = (numCells + 63) / 64;
+        size_t tableSize = std::max<size_t>(table.size() * 2, OCCUPANCY_TABLE_SIZE);
+        std::vector<uint64_t> grown;
+        if(tableSize >= denseSize)
+        {
+            grown.assign(denseSize, 0);
+            for(size_t i = 0; i < table.size(); i++)
+            {
+                if(table[i] != OCCUPANCY_EMPTY_SLOT)
+                {
+                    grown[table[i] / 64] |= static_cast<uint64_t>(1) << (table[i] % 64);
+                }
+            }
+            state.denseOccupancy = true;
+        }
+        else
+        {
+            grown.assign(tableSize, OCCUPANCY_EMPTY_SLOT);
+            size_t mask = tableSize - 1;
+            for(size_t i = 0; i < table.size(); i++)
+            {
+                if(table[i] != OCCUPANCY_EMPTY_SLOT)
+                {
+                    size_t slot = static_cast<size_t>(table[i] * 0x9E3779B97F4A7C15ULL) & mask;
+                    while(grown[slot] != OCCUPANCY_EMPTY_SLOT)
+                    {
+                        slot = (slot + 1) & mask;
+                    }
+                    grown[slot] = table[i];
+                }
+            }
+        }
+        m_occupancyBytes += (grown.size() - table.size()) * sizeof(uint64_t);
+        table.swap(grown);
+        if(state.denseOccupancy)
+        {
+            return occupyCell(state, key);
+        }
+    }
+
+    // insert the cell
+    size_t mask = table.size() - 1;
+    size_t slot = static_cast<size_t>(key * 0x9E3779B97F4A7C15ULL) & mask;
+    while(table[slot] != OCCUPANCY_EMPTY_SLOT)
+    {
+        slot = (slot + 1) & mask;
+    }
+    table[slot] = key;
+    state.numOccupied++;
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points that may be buffered before the largest buffers are written
+ *
+ * The pending limit less the memory of the occupied cell tables, counted at the size of a buffered point, but never
+ * less than a quarter of the limit
+ *
+ * @return the number of points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t LODOctree::getPendingBudget() const
+{
+    size_t occupancyPoints = m_occupancyBytes / sizeof(pcl::PointXYZRGBA);
+    size_t minBudget = std::max<size_t>(m_pendingLimit / 4, 1);
+    return (occupancyPoints + minBudget < m_pendingLimit) ? m_pendingLimit - occupancyPoints : minBudget;
+}
+
+/***********************************************************************************************************************
+ * @brief Write the buffered points of a node to the end of the data file
+ * @param[in] index the index of the node
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::flushNode(int index)
+{
+    pcl::PointCloud<pcl::PointXYZRGBA>::VectorType &pending = m_buildState[index].pending;
+    if(pending.empty())
+    {
+        return true;
+    }
+
+    // pack the points into the file layout
+    m_buffer.resize(pending.size() * POINT_RECORD_SIZE);
+    for(size_t i = 0; i < pending.size(); i++)
+    {
+        const pcl::PointXYZRGBA &p = pending[i];
+        uint8_t* record = &m_buffer[i * POINT_RECORD_SIZE];
+        std::memcpy(record, &p.x, sizeof(float));
+        std::memcpy(record + 4, &p.y, sizeof(float));
+        std::memcpy(record + 8, &p.z, sizeof(float));
+        std::memcpy(record + 12, &p.rgba, sizeof(uint32_t));
+    }
+
+    // append the block and remember where it was written
+    m_dataFile.seekp(static_cast<std::streamoff>(m_dataSize));
+    m_dataFile.write(reinterpret_cast<const char*>(&m_buffer[0]), m_buffer.size());
+    m_nodes[index].blocks.push_back(std::make_pair(m_dataSize, static_cast<uint32_t>(pending.size())));
+    m_dataSize += m_buffer.size();
+
+    // release the buffer memory
+    m_numPending -= pending.size();
+    pcl::PointCloud<pcl::PointXYZRGBA>::VectorType().swap(pending);
+    return m_dataFile.good();
+}
+
+/***********************************************************************************************************************
+ * @brief Write the largest node buffers to the data file until half of the pending limit is free
+ *
+ * Writing the largest buffers first keeps the written blocks large, so nodes are read back with few seeks
+ *
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::flushLargestNodes()
+{
+    std::vector<std::pair<size_t, int> > pendingNodes;
+    for(size_t i = 0; i < m_buildState.size(); i++)
+    {
+        if(!m_buildState[i].pending.empty())
+        {
+            pendingNodes.push_back(std::make_pair(m_buildState[i].pending.size(), static_cast<int>(i)));
+        }
+    }
+    std::sort(pendingNodes.begin(), pendingNodes.end(), std::greater<std::pair<size_t, int> >());
+    bool success = true;
+    const size_t target = getPendingBudget() / 2;
+    for(size_t i = 0; i < pendingNodes.size() && m_numPending > target; i++)
+    {
+        success = flushNode(pendingNodes[i].second) && success;
+    }
+    return success;
+}
+
+/***********************************************************************************************************************
+ * @brief Append the node table to the data file and complete its header
+ * @param[in] sourceSize the size of the cloud file the tree was built from
+ * @param[in] sourceModified the modification time of the cloud file the tree was built from
+ * @return false if an error occurred while writing
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::writeNodeTable(uint64_t sourceSize, int64_t sourceModified)
+{
+    // pack the nodes and their block lists
+    size_t numBlocks = 0;
+    for(size_t i = 0; i < m_nodes.size(); i++)
+    {
+        numBlocks += m_nodes[i].blocks.size();
+    }
+    m_buffer.resize(m_nodes.size() * NODE_RECORD_SIZE + numBlocks * BLOCK_RECORD_SIZE);
+    uint8_t* record = &m_buffer[0];
+    for(size_t i = 0; i < m_nodes.size(); i++)
+    {
+        const Node &node = m_nodes[i];
+        int32_t depth = node.depth;
+        uint64_t nodeBlocks = node.blocks.size();
+        std::memcpy(record, node.center.data(), 3 * sizeof(float));
+        std::memcpy(record + 12, &node.halfSize, sizeof(float));
+        std::memcpy(record + 16, &depth, sizeof(int32_t));
+        std::memcpy(record + 20, node.children, 8 * sizeof(int32_t));
+        std::memcpy(record + 52, &node.numPoints, sizeof(uint64_t));
+        std::memcpy(record + 60, &nodeBlocks, sizeof(uint64_t));
+        record += NODE_RECORD_SIZE;
+        for(size_t j = 0; j < node.blocks.size(); j++)
+        {
+            std::memcpy(record, &node.blocks[j].first, sizeof(uint64_t));
+            std::memcpy(record + 8, &node.blocks[j].second, sizeof(uint32_t));
+            record += BLOCK_RECORD_SIZE;
+        }
+    }
+    m_dataFile.seekp(static_cast<std::streamoff>(m_dataSize));
+    m_dataFile.write(reinterpret_cast<const char*>(&m_buffer[0]), m_buffer.size());
+    if(!m_dataFile.good())
+    {
+        return false;
+    }
+
+    // complete the header once the rest of the file is written
+    LODFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, LOD_FILE_MAGIC, sizeof(header.magic));
+    header.sourceSize = sourceSize;
+    header.sourceModified = sourceModified;
+    header.gridSize = m_gridSize;
+    header.maxDepth = m_maxDepth;
+    header.numPoints = m_numPoints;
+    header.numNodes = m_nodes.size();
+    header.tableOffset = m_dataSize;
+    std::memcpy(header.minBound, m_minBound.data(), sizeof(header.minBound));
+    std::memcpy(header.maxBound, m_maxBound.data(), sizeof(header.maxBound));
+    std::memcpy(header.sensorOrigin, m_sensorOrigin.data(), sizeof(header.sensorOrigin));
+    std::memcpy(header.sensorOrientation, m_sensorOrientation.coeffs().data(), sizeof(header.sensorOrientation));
+    m_dataFile.flush();
+    m_dataFile.seekp(0);
+    m_dataFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return m_dataFile.good();
+}
+
+/***********************************************************************************************************************
+ * @brief Read the node table of the open data file, checking that it was built from the current cloud file
+ * @param[in] sourceSize the size of the cloud file
+ * @param[in] sourceModified the modification time of the cloud file
+ * @return false if the data file is incomplete, malformed or out of date
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool LODOctree::readNodeTable(uint64_t sourceSize, int64_t sourceModified)
+{
+    // validate the header
+    LODFileHeader header;
+    m_dataFile.seekg(0);
+    if(!m_dataFile.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    if(std::memcmp(header.magic, LOD_FILE_MAGIC, sizeof(header.magic)) != 0 || header.sourceSize != sourceSize || header.sourceModified != sourceModified || header.gridSize != m_gridSize || header.maxDepth != m_maxDepth || header.numNodes == 0 || header.tableOffset < sizeof(header))
+    {
+        return false;
+    }
+
+    // read the rest of the file after the point blocks
+    m_dataFile.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(m_dataFile.tellg());
+    if(header.tableOffset > fileSize || (fileSize - header.tableOffset) < header.numNodes * NODE_RECORD_SIZE)
+    {
+        return false;
+    }
+    m_buffer.resize(static_cast<size_t>(fileSize - header.tableOffset));
+    m_dataFile.seekg(static_cast<std::streamoff>(header.tableOffset));
+    if(!m_dataFile.read(reinterpret_cast<char*>(&m_buffer[0]), m_buffer.size()))
+    {
+        return false;
+    }
+
+    // unpack the nodes, checking every child index and block range
+    m_nodes.resize(static_cast<size_t>(header.numNodes));
+    const uint8_t* record = &m_buffer[0];
+    const uint8_t* end = record + m_buffer.size();
+    for(size_t i = 0; i < m_nodes.size(); i++)
+    {
+        Node &node = m_nodes[i];
+        int32_t depth = 0;
+        uint64_t nodeBlocks = 0;
+        if(end - record < NODE_RECORD_SIZE)
+        {
+            return false;
+        }
+        std::memcpy(node.center.data(), record, 3 * sizeof(float));
+        std::memcpy(&node.halfSize, record + 12, sizeof(float));
+        std::memcpy(&depth, record + 16, sizeof(int32_t));
+        std::memcpy(node.children, record + 20, 8 * sizeof(int32_t));
+        std::memcpy(&node.numPoints, record + 52, sizeof(uint64_t));
+        std::memcpy(&nodeBlocks, record + 60, sizeof(uint64_t));
+        node.depth = depth;
+        record += NODE_RECORD_SIZE;
+        for(int j = 0; j < 8; j++)
+        {
+            if(node.children[j] < -1 || node.children[j] >= static_cast<int64_t>(header.numNodes))
+            {
+                return false;
+            }
+        }
+        if(static_cast<uint64_t>(end - record) < nodeBlocks * BLOCK_RECORD_SIZE)
+        {
+            return false;
+        }
+        node.blocks.resize(static_cast<size_t>(nodeBlocks));
+        uint64_t blockPoints = 0;
+        for(size_t j = 0; j < node.blocks.size(); j++)
+        {
+            std::memcpy(&node.blocks[j].first, record, sizeof(uint64_t));
+            std::memcpy(&node.blocks[j].second, record + 8, sizeof(uint32_t));
+            record += BLOCK_RECORD_SIZE;
+            if(node.blocks[j].first < sizeof(header) || node.blocks[j].first + static_cast<uint64_t>(node.blocks[j].second) * POINT_RECORD_SIZE > header.tableOffset)
+            {
+                return false;
+            }
+            blockPoints += node.blocks[j].second;
+        }
+        if(blockPoints != node.numPoints)
+        {
+            return false;
+        }
+    }
+
+    // restore the tree properties
+    m_numPoints = header.numPoints;
+    m_dataSize = header.tableOffset;
+    std::memcpy(m_minBound.data(), header.minBound, sizeof(header.minBound));
+    std::memcpy(m_maxBound.data(), header.maxBound, sizeof(header.maxBound));
+    std::memcpy(m_sensorOrigin.data(), header.sensorOrigin, sizeof(header.sensorOrigin));
+    std::memcpy(m_sensorOrientation.coeffs().data(), header.sensorOrientation, sizeof(header.sensorOrientation));
+    return true;
+}
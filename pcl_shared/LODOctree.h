@@ -0,0 +1,145 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file LODOctree.h
+ * @brief Header file for the LODOctree class
+ *
+ * This class stores a point cloud file as an octree of progressively subsampled point sets for level of detail rendering
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef LODOCTREE_H
+#define LODOCTREE_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class LODOctree
+ *
+ * @brief Class for building and querying an out-of-core level of detail octree over a cloud file
+ *
+ * Every node covers a cube of space divided into a grid of cells, and keeps at most one point per cell. A point is
+ * stored in the shallowest node whose cell is still free, so each level adds detail to its parents and any prefix of the
+ * tree is a spatially uniform subsample of the cloud. Nodes at the maximum depth keep all of their points. The cloud
+ * file is streamed with ChunkedCloudReader and node points are spilled to a data file in blocks, so neither the build
+ * nor rendering needs the whole cloud in memory. Points waiting to be written are bounded by a limit shared by all
+ * nodes, and the largest node buffers are written first when it is reached. The occupied cells of each node are kept
+ * in a small hash table, which becomes a bitset once that is smaller, so their memory follows the number of points
+ * stored in refinable nodes rather than the number of nodes, and it is counted against the same limit. The node table is stored at the end of the
+ * data file together with the size and modification time of the cloud file, so open() can reuse the data file of an
+ * unchanged cloud without rebuilding it.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class LODOctree
+{
+private:
+
+    // tree node, point data is stored in the data file as a list of blocks
+    struct Node
+    {
+        Eigen::Vector3f center;
+        float halfSize;
+        int depth;
+        int children[8];
+        uint64_t numPoints;
+        std::vector<std::pair<uint64_t, uint32_t> > blocks;
+    };
+
+    // per node state that is only needed while building
+    struct BuildState
+    {
+        std::vector<uint64_t> occupancy;
+        size_t numOccupied;
+        bool denseOccupancy;
+        pcl::PointCloud<pcl::PointXYZRGBA>::VectorType pending;
+
+        BuildState() : numOccupied(0), denseOccupancy(false) {}
+    };
+
+    // tree data
+    std::vector<Node> m_nodes;
+    std::vector<BuildState> m_buildState;
+    uint64_t m_numPoints;
+    Eigen::Vector3f m_minBound;
+    Eigen::Vector3f m_maxBound;
+    Eigen::Vector4f m_sensorOrigin;
+    Eigen::Quaternionf m_sensorOrientation;
+
+    // point data file
+    std::fstream m_dataFile;
+    uint64_t m_dataSize;
+    std::vector<uint8_t> m_buffer;
+    size_t m_numPending;
+    size_t m_occupancyBytes;
+
+    // settings
+    int m_gridSize;
+    int m_maxDepth;
+    size_t m_flushSize;
+    size_t m_pendingLimit;
+
+    // helper functions
+    int createNode(const Eigen::Vector3f &center, float halfSize, int depth);
+    void insertPoint(const pcl::PointXYZRGBA &point);
+    bool occupyCell(BuildState &state, uint64_t key);
+    size_t getPendingBudget() const;
+    bool flushNode(int index);
+    bool flushLargestNodes();
+    bool writeNodeTable(uint64_t sourceSize, int64_t sourceModified);
+    bool readNodeTable(uint64_t sourceSize, int64_t sourceModified);
+
+public:
+
+    // constructors
+    LODOctree();
+    ~LODOctree();
+
+    // settings
+    void setGridSize(int gridSize);
+    void setMaxDepth(int maxDepth);
+    void setFlushSize(size_t flushSize);
+    void setPendingLimit(size_t pendingLimit);
+
+    // building
+    bool open(const std::string &cloudFileName, const std::string &dataFileName);
+    bool build(const std::string &cloudFileName, const std::string &dataFileName, size_t chunkSize=1000000);
+
+    // querying
+    void selectNodes(const Eigen::Vector3d &cameraPosition, const double frustum[24], double screenScale, size_t pointBudget, double minNodePixels, std::vector<int> &nodesOut) const;
+    bool loadNode(int index, pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+
+    // accessors
+    size_t getNumberOfNodes() const;
+    uint64_t getNumberOfPoints() const;
+    uint64_t getNodeSize(int index) const;
+    void getBounds(Eigen::Vector3f &minBound, Eigen::Vector3f &maxBound) const;
+    const Eigen::Vector4f& getSensorOrigin() const;
+    const Eigen::Quaternionf& getSensorOrientation() const;
+};
+
+#endif // LODOCTREE_H
@@ -0,0 +1,187 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file LockFreeQueue.h
+ * @brief Header file for the LockFreeQueue class
+ *
+ * This class provides a bounded queue that can be shared by several producer and consumer threads without locking
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class LockFreeQueue
+ *
+ * @brief Bounded multi-producer, multi-consumer ring buffer
+ *
+ * Each slot carries a sequence number that tells producers when it is free and consumers when it is filled, so push
+ * and pop only contend on a compare-and-swap of the head or tail position and never block. A push into a full queue
+ * and a pop from an empty queue fail immediately. The capacity is rounded up to a power of two.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+template<typename T>
+class LockFreeQueue
+{
+private:
+
+    // ring slot, the sequence is the position the slot is ready for
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // ring storage
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+
+    // positions, kept on separate cache lines so producers and consumers do not share one
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) std::atomic<size_t> m_head;
+
+    // not copyable
+    LockFreeQueue(const LockFreeQueue&);
+    LockFreeQueue& operator=(const LockFreeQueue&);
+
+public:
+
+    /*******************************************************************************************************************
+     * @brief Class constructor
+     * @param[in] capacity the minimum number of elements the queue can hold
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    explicit LockFreeQueue(size_t capacity) : m_tail(0), m_head(0)
+    {
+        size_t size = 2;
+        while(size < capacity)
+        {
+            size *= 2;
+        }
+        m_slots = std::vector<Slot>(size);
+        m_mask = size - 1;
+        for(size_t i = 0; i < size; i++)
+        {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /*******************************************************************************************************************
+     * @brief Add an element to the back of the queue
+     * @param[in] value the element to add
+     * @return false if the queue is full
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    bool tryPush(const T &value)
+    {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Slot &slot = m_slots[position & m_mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if(sequence == position)
+            {
+                // the slot is free, claim it
+                if(m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.value = value;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(sequence < position)
+            {
+                // the slot still holds an element from the previous lap
+                return false;
+            }
+            else
+            {
+                // another producer claimed the slot first
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*******************************************************************************************************************
+     * @brief Remove the element at the front of the queue
+     * @param[out] value the removed element
+     * @return false if the queue is empty
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    bool tryPop(T &value)
+    {
+        size_t position = m_head.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Slot &slot = m_slots[position & m_mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if(sequence == position + 1)
+            {
+                // the slot is filled, claim it
+                if(m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(slot.value);
+                    slot.value = T();
+                    slot.sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(sequence < position + 1)
+            {
+                // the slot has not been filled yet
+                return false;
+            }
+            else
+            {
+                // another consumer claimed the slot first
+                position = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*******************************************************************************************************************
+     * @brief Get the approximate number of queued elements
+     * @return the number of elements, which may be stale if other threads are pushing or popping
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    size_t size() const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    /*******************************************************************************************************************
+     * @brief Get the capacity of the queue
+     * @return the maximum number of elements
+     * @author Christopher D. McMurrough
+     ******************************************************************************************************************/
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+};
+
+#endif // LOCKFREEQUEUE_H
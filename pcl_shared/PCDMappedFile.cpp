@@ -0,0 +1,658 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file PCDMappedFile.cpp
+ * @brief Implementation file for the PCDMappedFile class
+ *
+ * This class provides read-only, memory-mapped access to binary and binary_compressed PCD files
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "PCDMappedFile.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+#include <pcl/io/lzf.h>
+
+#include <cmath>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/***********************************************************************************************************************
+ * @brief Convert a stored field value to float
+ * @param[in] ptr pointer to the first byte of the (possibly unaligned) field value
+ * @param[in] field the field describing the stored type and size
+ * @return the field value converted to float
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float readFieldAsFloat(const uint8_t* ptr, const PCDField &field)
+{
+    // convert from the stored type
+    switch(field.type)
+    {
+        case 'F':
+            if(field.size == 8)
+            {
+                double value;
+                std::memcpy(&value, ptr, sizeof(value));
+                return static_cast<float>(value);
+            }
+            else
+            {
+                float value;
+                std::memcpy(&value, ptr, sizeof(value));
+                return value;
+            }
+        case 'U':
+            if(field.size == 1)
+            {
+                return static_cast<float>(*ptr);
+            }
+            else if(field.size == 2)
+            {
+                uint16_t value;
+                std::memcpy(&value, ptr, sizeof(value));
+                return static_cast<float>(value);
+            }
+            else
+            {
+                uint32_t value;
+                std::memcpy(&value, ptr, sizeof(value));
+                return static_cast<float>(value);
+            }
+        case 'I':
+            if(field.size == 1)
+            {
+                return static_cast<float>(static_cast<int8_t>(*ptr));
+            }
+            else if(field.size == 2)
+            {
+                int16_t value;
+                std::memcpy(&value, ptr, sizeof(value));
+                return static_cast<float>(value);
+            }
+            else
+            {
+                int32_t value;
+                std::memcpy(&value, ptr, sizeof(value));
+                return static_cast<float>(value);
+            }
+        default:
+            return 0.0f;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Initializes an empty PCDMappedFile, call open() to map a file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+PCDMappedFile::PCDMappedFile()
+{
+    m_fileDescriptor = -1;
+    m_mapping = NULL;
+    m_mappingSize = 0;
+    m_data = NULL;
+    m_fieldX = -1;
+    m_fieldY = -1;
+    m_fieldZ = -1;
+    m_fieldRGBA = -1;
+    m_header.numPoints = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ *
+ * Releases the memory mapping and closes the underlying file
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+PCDMappedFile::~PCDMappedFile()
+{
+    close();
+}
+
+/***********************************************************************************************************************
+ * @brief Parse a PCD header
+ *
+ * Parses the text header at the start of the given buffer and computes the field layout of the point data
+ *
+ * @param[in] buffer pointer to the start of the file contents
+ * @param[in] bufferSize number of bytes available in the buffer
+ * @param[out] header the parsed header
+ * @return false if the header is malformed or incomplete
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::readHeader(const uint8_t* buffer, size_t bufferSize, PCDHeader &header)
+{
+    header.fields.clear();
+    header.width = 0;
+    header.height = 1;
+    header.numPoints = 0;
+    header.pointSize = 0;
+    header.dataType.clear();
+    header.dataOffset = 0;
+    header.sensorOrigin = Eigen::Vector4f::Zero();
+    header.sensorOrientation = Eigen::Quaternionf::Identity();
+
+    // parse the header one line at a time until the DATA line is reached
+    size_t position = 0;
+    bool pointsSpecified = false;
+    while(position < bufferSize && header.dataType.empty())
+    {
+        // extract the next line
+        const char* lineStart = reinterpret_cast<const char*>(buffer + position);
+        const void* lineEnd = std::memchr(lineStart, '\n', bufferSize - position);
+        if(lineEnd == NULL)
+        {
+            return false;
+        }
+        size_t lineLength = static_cast<const char*>(lineEnd) - lineStart;
+        std::string line(lineStart, lineLength);
+        position += lineLength + 1;
+
+        // skip empty lines and comments
+        if(line.empty() || line.at(0) == '#')
+        {
+            continue;
+        }
+
+        // handle each header entry
+        std::stringstream ss(line);
+        std::string key;
+        ss >> key;
+        if(key.compare("FIELDS") == 0)
+        {
+            std::string name;
+            while(ss >> name)
+            {
+                PCDField field;
+                field.name = name;
+                field.type = 'F';
+                field.size = 4;
+                field.count = 1;
+                field.offset = 0;
+                field.stride = 0;
+                header.fields.push_back(field);
+            }
+        }
+        else if(key.compare("SIZE") == 0)
+        {
+            for(size_t i = 0; i < header.fields.size(); i++)
+            {
+                ss >> header.fields.at(i).size;
+            }
+        }
+        else if(key.compare("TYPE") == 0)
+        {
+            for(size_t i = 0; i < header.fields.size(); i++)
+            {
+                ss >> header.fields.at(i).type;
+            }
+        }
+        else if(key.compare("COUNT") == 0)
+        {
+            for(size_t i = 0; i < header.fields.size(); i++)
+            {
+                ss >> header.fields.at(i).count;
+            }
+        }
+        else if(key.compare("WIDTH") == 0)
+        {
+            ss >> header.width;
+        }
+        else if(key.compare("HEIGHT") == 0)
+        {
+            ss >> header.height;
+        }
+        else if(key.compare("VIEWPOINT") == 0)
+        {
+            float tx, ty, tz, qw, qx, qy, qz;
+            ss >> tx >> ty >> tz >> qw >> qx >> qy >> qz;
+            header.sensorOrigin = Eigen::Vector4f(tx, ty, tz, 0.0f);
+            header.sensorOrientation = Eigen::Quaternionf(qw, qx, qy, qz);
+        }
+        else if(key.compare("POINTS") == 0)
+        {
+            ss >> header.numPoints;
+            pointsSpecified = true;
+        }
+        else if(key.compare("DATA") == 0)
+        {
+            ss >> header.dataType;
+            header.dataOffset = position;
+        }
+    }
+
+    // make sure the essential entries were found
+    if(header.fields.empty() || header.dataType.empty())
+    {
+        return false;
+    }
+    if(!pointsSpecified)
+    {
+        header.numPoints = static_cast<size_t>(header.width) * header.height;
+    }
+
+    // compute the interleaved layout used by binary files
+    for(size_t i = 0; i < header.fields.size(); i++)
+    {
+        header.fields.at(i).offset = header.pointSize;
+        header.pointSize += header.fields.at(i).size * header.fields.at(i).count;
+    }
+    for(size_t i = 0; i < header.fields.size(); i++)
+    {
+        header.fields.at(i).stride = header.pointSize;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Open and map a PCD file
+ *
+ * Maps the given file into memory and parses its header. Only binary and binary_compressed files are supported,
+ * ascii files should be loaded with pcl::io::loadPCDFile instead.
+ *
+ * @param[in] fileName path and name of input file
+ * @return false if the file could not be mapped or is not a binary PCD file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::open(const std::string &fileName)
+{
+    close();
+
+    // open the file and get its size
+    m_fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+    if(m_fileDescriptor < 0)
+    {
+        PCL_ERROR("error while attempting to open pcd file: %s \n", fileName.c_str());
+        return false;
+    }
+    struct stat fileStats;
+    if(fstat(m_fileDescriptor, &fileStats) != 0 || fileStats.st_size == 0)
+    {
+        PCL_ERROR("error while attempting to stat pcd file: %s \n", fileName.c_str());
+        close();
+        return false;
+    }
+    m_mappingSize = static_cast<size_t>(fileStats.st_size);
+
+    // map the whole file, the data will be paged in as it is touched
+    void* mapping = mmap(NULL, m_mappingSize, PROT_READ, MAP_PRIVATE, m_fileDescriptor, 0);
+    if(mapping == MAP_FAILED)
+    {
+        PCL_ERROR("error while attempting to map pcd file: %s \n", fileName.c_str());
+        m_mappingSize = 0;
+        close();
+        return false;
+    }
+    m_mapping = static_cast<uint8_t*>(mapping);
+    madvise(m_mapping, m_mappingSize, MADV_SEQUENTIAL);
+
+    // parse the header
+    if(!readHeader(m_mapping, m_mappingSize, m_header))
+    {
+        PCL_ERROR("error while attempting to parse pcd header: %s \n", fileName.c_str());
+        close();
+        return false;
+    }
+
+    // locate the point data
+    if(m_header.dataType.compare("binary") == 0)
+    {
+        // binary points are read in place
+        if(m_header.dataOffset + m_header.numPoints * m_header.pointSize > m_mappingSize)
+        {
+            PCL_ERROR("pcd file is truncated: %s \n", fileName.c_str());
+            close();
+            return false;
+        }
+        m_data = m_mapping + m_header.dataOffset;
+    }
+    else if(m_header.dataType.compare("binary_compressed") == 0)
+    {
+        // read the compressed and uncompressed payload sizes
+        uint32_t compressedSize = 0;
+        uint32_t uncompressedSize = 0;
+        if(m_header.dataOffset + 2 * sizeof(uint32_t) > m_mappingSize)
+        {
+            PCL_ERROR("pcd file is truncated: %s \n", fileName.c_str());
+            close();
+            return false;
+        }
+        std::memcpy(&compressedSize, m_mapping + m_header.dataOffset, sizeof(uint32_t));
+        std::memcpy(&uncompressedSize, m_mapping + m_header.dataOffset + sizeof(uint32_t), sizeof(uint32_t));
+        size_t payloadOffset = m_header.dataOffset + 2 * sizeof(uint32_t);
+        if(payloadOffset + compressedSize > m_mappingSize || uncompressedSize != m_header.numPoints * m_header.pointSize)
+        {
+            PCL_ERROR("pcd file has an invalid compressed payload: %s \n", fileName.c_str());
+            close();
+            return false;
+        }
+
+        // decompress the payload, the fields are stored one after another
+        m_decompressed.resize(uncompressedSize);
+        if(uncompressedSize > 0 && pcl::lzfDecompress(m_mapping + payloadOffset, compressedSize, &m_decompressed[0], uncompressedSize) != uncompressedSize)
+        {
+            PCL_ERROR("error while attempting to decompress pcd file: %s \n", fileName.c_str());
+            close();
+            return false;
+        }
+        size_t blockOffset = 0;
+        for(size_t i = 0; i < m_header.fields.size(); i++)
+        {
+            PCDField &field = m_header.fields.at(i);
+            field.stride = field.size * field.count;
+            field.offset = blockOffset;
+            blockOffset += field.stride * m_header.numPoints;
+        }
+        m_data = m_decompressed.empty() ? NULL : &m_decompressed[0];
+
+        // the compressed bytes are no longer needed
+        munmap(m_mapping, m_mappingSize);
+        m_mapping = NULL;
+        m_mappingSize = 0;
+    }
+    else
+    {
+        // ascii files are not mapped
+        close();
+        return false;
+    }
+
+    // look up the commonly used fields
+    m_fieldX = getFieldIndex("x");
+    m_fieldY = getFieldIndex("y");
+    m_fieldZ = getFieldIndex("z");
+    m_fieldRGBA = getFieldIndex("rgba");
+    if(m_fieldRGBA < 0)
+    {
+        m_fieldRGBA = getFieldIndex("rgb");
+    }
+    if(m_fieldRGBA >= 0 && m_header.fields.at(m_fieldRGBA).size != 4)
+    {
+        m_fieldRGBA = -1;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Close the mapped file
+ *
+ * Releases the memory mapping and any decompressed data. Pointers previously returned by the accessors become invalid.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PCDMappedFile::close()
+{
+    if(m_mapping != NULL)
+    {
+        munmap(m_mapping, m_mappingSize);
+        m_mapping = NULL;
+    }
+    if(m_fileDescriptor >= 0)
+    {
+        ::close(m_fileDescriptor);
+        m_fileDescriptor = -1;
+    }
+    m_mappingSize = 0;
+    std::vector<uint8_t>().swap(m_decompressed);
+    m_data = NULL;
+    m_header.fields.clear();
+    m_header.dataType.clear();
+    m_header.numPoints = 0;
+    m_fieldX = -1;
+    m_fieldY = -1;
+    m_fieldZ = -1;
+    m_fieldRGBA = -1;
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if a file is currently mapped
+ * @return true if the point data can be accessed
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::isOpen() const
+{
+    return !m_header.dataType.empty();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the parsed file header
+ * @return reference to the header of the mapped file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const PCDHeader& PCDMappedFile::getHeader() const
+{
+    return m_header;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points in the mapped file
+ * @return the number of points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t PCDMappedFile::size() const
+{
+    return m_header.numPoints;
+}
+
+/***********************************************************************************************************************
+ * @brief Look up a field by name
+ * @param[in] name the field name as written in the FIELDS header entry
+ * @return the index of the field, or -1 if the field does not exist
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+int PCDMappedFile::getFieldIndex(const std::string &name) const
+{
+    for(size_t i = 0; i < m_header.fields.size(); i++)
+    {
+        if(m_header.fields.at(i).name.compare(name) == 0)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/***********************************************************************************************************************
+ * @brief Get a pointer to a field value without copying
+ *
+ * The returned pointer refers directly into the mapped (or decompressed) file data and is not necessarily aligned
+ *
+ * @param[in] fieldIndex the field index returned by getFieldIndex
+ * @param[in] pointIndex the index of the point
+ * @return pointer to the first byte of the field value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+const uint8_t* PCDMappedFile::getFieldPointer(int fieldIndex, size_t pointIndex) const
+{
+    const PCDField &field = m_header.fields[fieldIndex];
+    return m_data + field.offset + pointIndex * field.stride;
+}
+
+/***********************************************************************************************************************
+ * @brief Read a scalar field value as a float
+ * @param[in] fieldIndex the field index returned by getFieldIndex
+ * @param[in] pointIndex the index of the point
+ * @return the field value converted to float
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float PCDMappedFile::getFieldAsFloat(int fieldIndex, size_t pointIndex) const
+{
+    return readFieldAsFloat(getFieldPointer(fieldIndex, pointIndex), m_header.fields[fieldIndex]);
+}
+
+/***********************************************************************************************************************
+ * @brief Read the coordinates of a point
+ * @param[in] pointIndex the index of the point
+ * @param[out] x the x coordinate
+ * @param[out] y the y coordinate
+ * @param[out] z the z coordinate
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PCDMappedFile::getXYZ(size_t pointIndex, float &x, float &y, float &z) const
+{
+    x = getFieldAsFloat(m_fieldX, pointIndex);
+    y = getFieldAsFloat(m_fieldY, pointIndex);
+    z = getFieldAsFloat(m_fieldZ, pointIndex);
+}
+
+/***********************************************************************************************************************
+ * @brief Read the packed color of a point
+ *
+ * Returns the raw 32 bit value of the rgba (or rgb) field, matching the memory layout of PointXYZRGBA::rgba
+ *
+ * @param[in] pointIndex the index of the point
+ * @return the packed color, or 0 if the file has no color field
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint32_t PCDMappedFile::getRGBA(size_t pointIndex) const
+{
+    uint32_t value = 0;
+    if(m_fieldRGBA >= 0)
+    {
+        std::memcpy(&value, getFieldPointer(m_fieldRGBA, pointIndex), sizeof(value));
+    }
+    return value;
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if the file contains x, y, and z fields
+ * @return true if all coordinate fields are present
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::hasXYZ() const
+{
+    return m_fieldX >= 0 && m_fieldY >= 0 && m_fieldZ >= 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Check to see if the file contains a packed color field
+ * @return true if an rgba or rgb field is present
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::hasRGBA() const
+{
+    return m_fieldRGBA >= 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Deserialize the whole file into a point cloud
+ *
+ * Converts all points of the mapped file into the output cloud, preserving the organized dimensions and viewpoint
+ *
+ * @param[out] cloudOut the output point cloud
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @return false if the file is not open or has no coordinate fields
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::toCloud(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut, int numThreads) const
+{
+    if(!toCloud(cloudOut, 0, m_header.numPoints, numThreads))
+    {
+        return false;
+    }
+
+    // restore the organized structure if the header describes one
+    if(static_cast<size_t>(m_header.width) * m_header.height == m_header.numPoints)
+    {
+        cloudOut.width = m_header.width;
+        cloudOut.height = m_header.height;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Deserialize a range of points into a point cloud
+ *
+ * Converts the points in [beginIndex, endIndex) into an unorganized output cloud. The range is split across threads,
+ * each of which reads its block straight out of the mapping, so the conversion runs as fast as pages can be faulted in.
+ *
+ * @param[out] cloudOut the output point cloud
+ * @param[in] beginIndex the index of the first point to convert
+ * @param[in] endIndex one past the index of the last point to convert
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @return false if the file is not open, has no coordinate fields, or the range is invalid
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool PCDMappedFile::toCloud(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut, size_t beginIndex, size_t endIndex, int numThreads) const
+{
+    if(!isOpen() || !hasXYZ() || beginIndex > endIndex || endIndex > m_header.numPoints)
+    {
+        return false;
+    }
+
+    // allocate the output cloud
+    size_t count = endIndex - beginIndex;
+    cloudOut.points.resize(count);
+    cloudOut.width = static_cast<uint32_t>(count);
+    cloudOut.height = 1;
+    cloudOut.sensor_origin_ = m_header.sensorOrigin;
+    cloudOut.sensor_orientation_ = m_header.sensorOrientation;
+
+    // use a direct copy if the coordinates are stored as consecutive 32 bit floats
+    const PCDField &fieldX = m_header.fields.at(m_fieldX);
+    const PCDField &fieldY = m_header.fields.at(m_fieldY);
+    const PCDField &fieldZ = m_header.fields.at(m_fieldZ);
+    bool packedXYZ = fieldX.type == 'F' && fieldX.size == 4 && fieldY.type == 'F' && fieldY.size == 4 && fieldZ.type == 'F' && fieldZ.size == 4;
+
+    // convert the points in parallel, tracking non-finite points per thread
+    std::vector<char> threadHasNaN(getThreadCount(numThreads), 0);
+    parallelFor(beginIndex, endIndex, [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        bool hasNaN = false;
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            pcl::PointXYZRGBA &p = cloudOut.points[i - beginIndex];
+            if(packedXYZ)
+            {
+                std::memcpy(&p.x, getFieldPointer(m_fieldX, i), sizeof(float));
+                std::memcpy(&p.y, getFieldPointer(m_fieldY, i), sizeof(float));
+                std::memcpy(&p.z, getFieldPointer(m_fieldZ, i), sizeof(float));
+            }
+            else
+            {
+                getXYZ(i, p.x, p.y, p.z);
+            }
+            if(m_fieldRGBA >= 0)
+            {
+                p.rgba = getRGBA(i);
+            }
+            hasNaN = hasNaN || !std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z);
+        }
+        threadHasNaN[threadIndex] = hasNaN;
+    }, numThreads);
+
+    // the cloud is dense only if every point is finite
+    cloudOut.is_dense = true;
+    for(size_t i = 0; i < threadHasNaN.size(); i++)
+    {
+        if(threadHasNaN.at(i))
+        {
+            cloudOut.is_dense = false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,145 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file PCDMappedFile.h
+ * @brief Header file for the PCDMappedFile class
+ *
+ * This class provides read-only, memory-mapped access to binary and binary_compressed PCD files
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PCDMAPPEDFILE_H
+#define PCDMAPPEDFILE_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @struct PCDField
+ * @brief Location of one named field inside the point data of a PCD file
+ *
+ * The address of the field value for point i is data + offset + i * stride. For binary files the points are stored
+ * interleaved (stride is the point size), for binary_compressed files each field is stored as its own block (stride
+ * is the field size).
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct PCDField
+{
+    std::string name;
+    char type;
+    int size;
+    int count;
+    size_t offset;
+    size_t stride;
+};
+
+// field conversion functions
+float readFieldAsFloat(const uint8_t* ptr, const PCDField &field);
+
+/*******************************************************************************************************************//**
+ * @struct PCDHeader
+ * @brief Parsed contents of a PCD file header
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct PCDHeader
+{
+    std::vector<PCDField> fields;
+    uint32_t width;
+    uint32_t height;
+    size_t numPoints;
+    size_t pointSize;
+    std::string dataType;
+    size_t dataOffset;
+    Eigen::Vector4f sensorOrigin;
+    Eigen::Quaternionf sensorOrientation;
+};
+
+/*******************************************************************************************************************//**
+ * @class PCDMappedFile
+ *
+ * @brief Class providing zero-copy access to the point data of a binary PCD file
+ *
+ * Binary files are mapped into memory and their points are read in place, so opening a multi-GB scan costs only the
+ * header parse. Binary_compressed files are mapped and decompressed once into an owned buffer. The points can be
+ * accessed directly through the field accessors or deserialized into a PointXYZRGBA cloud using multiple threads.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class PCDMappedFile
+{
+private:
+
+    // memory mapping state
+    int m_fileDescriptor;
+    uint8_t* m_mapping;
+    size_t m_mappingSize;
+
+    // decompressed point data for binary_compressed files
+    std::vector<uint8_t> m_decompressed;
+
+    // parsed header and pointer to the first point
+    PCDHeader m_header;
+    const uint8_t* m_data;
+
+    // indices of commonly used fields (-1 if not present)
+    int m_fieldX;
+    int m_fieldY;
+    int m_fieldZ;
+    int m_fieldRGBA;
+
+    // disable copying of the mapping
+    PCDMappedFile(const PCDMappedFile&);
+    PCDMappedFile& operator=(const PCDMappedFile&);
+
+public:
+
+    // constructors
+    PCDMappedFile();
+    ~PCDMappedFile();
+
+    // file handling
+    bool open(const std::string &fileName);
+    void close();
+    bool isOpen() const;
+    static bool readHeader(const uint8_t* buffer, size_t bufferSize, PCDHeader &header);
+
+    // accessors
+    const PCDHeader& getHeader() const;
+    size_t size() const;
+    int getFieldIndex(const std::string &name) const;
+    const uint8_t* getFieldPointer(int fieldIndex, size_t pointIndex) const;
+    float getFieldAsFloat(int fieldIndex, size_t pointIndex) const;
+    void getXYZ(size_t pointIndex, float &x, float &y, float &z) const;
+    uint32_t getRGBA(size_t pointIndex) const;
+    bool hasXYZ() const;
+    bool hasRGBA() const;
+
+    // conversion
+    bool toCloud(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut, int numThreads=0) const;
+    bool toCloud(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut, size_t beginIndex, size_t endIndex, int numThreads=0) const;
+};
+
+#endif // PCDMAPPEDFILE_H
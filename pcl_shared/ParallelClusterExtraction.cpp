@@ -0,0 +1,421 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelClusterExtraction.cpp
+ * @brief Implementation file for the ParallelClusterExtraction class
+ *
+ * This class provides a multithreaded replacement for pcl::EuclideanClusterExtraction
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ParallelClusterExtraction.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+/***********************************************************************************************************************
+ * @brief Find the root of an element in a concurrent union-find forest
+ *
+ * Uses path halving with compare-and-swap so that multiple threads can search and compress the forest at once
+ *
+ * @param[in] parents the parent link of each element
+ * @param[in] element the element to search from
+ * @return the root of the element's set
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static int findRoot(std::vector<std::atomic<int> > &parents, int element)
+{
+    while(true)
+    {
+        int parent = parents[element].load(std::memory_order_relaxed);
+        if(parent == element)
+        {
+            return element;
+        }
+        int grandparent = parents[parent].load(std::memory_order_relaxed);
+        if(parent != grandparent)
+        {
+            parents[element].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
+        }
+        element = grandparent;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Join the sets of two elements in a concurrent union-find forest
+ *
+ * The root with the larger index is always linked below the smaller one, which keeps the forest acyclic when several
+ * threads link the same roots at the same time
+ *
+ * @param[in] parents the parent link of each element
+ * @param[in] a the first element
+ * @param[in] b the second element
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static void unite(std::vector<std::atomic<int> > &parents, int a, int b)
+{
+    while(true)
+    {
+        a = findRoot(parents, a);
+        b = findRoot(parents, b);
+        if(a == b)
+        {
+            return;
+        }
+        if(a < b)
+        {
+            std::swap(a, b);
+        }
+        int expected = a;
+        if(parents[a].compare_exchange_strong(expected, b))
+        {
+            return;
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ *
+ * Uses the same defaults as pcl::EuclideanClusterExtraction
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ParallelClusterExtraction::ParallelClusterExtraction()
+{
+    m_clusterTolerance = 0.0;
+    m_minClusterSize = 1;
+    m_maxClusterSize = std::numeric_limits<int>::max();
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the cloud to be clustered
+ * @param[in] cloud pointer to the input point cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelClusterExtraction::setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud)
+{
+    m_cloud = cloud;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum distance between neighboring points of the same cluster
+ * @param[in] clusterTolerance the distance threshold
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelClusterExtraction::setClusterTolerance(double clusterTolerance)
+{
+    m_clusterTolerance = clusterTolerance;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the minimum number of points in a valid cluster
+ * @param[in] minClusterSize the minimum cluster size (default: 1)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelClusterExtraction::setMinClusterSize(int minClusterSize)
+{
+    m_minClusterSize = minClusterSize;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum number of points in a valid cluster
+ * @param[in] maxClusterSize the maximum cluster size (default: INT_MAX)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelClusterExtraction::setMaxClusterSize(int maxClusterSize)
+{
+    m_maxClusterSize = maxClusterSize;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelClusterExtraction::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Extract the clusters of the input cloud
+ *
+ * Non-finite points never belong to a cluster
+ *
+ * @param[out] clusters the point indices of each cluster, sorted by decreasing cluster size
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelClusterExtraction::extract(std::vector<pcl::PointIndices> &clusters)
+{
+    clusters.clear();
+    if(!m_cloud || m_cloud->points.empty() || m_clusterTolerance <= 0.0)
+    {
+        return;
+    }
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn = *m_cloud;
+    const size_t numThreads = static_cast<size_t>(getThreadCount(m_numThreads));
+
+    // compute the bounding box of the finite points, one partial result per thread
+    const float maxFloat = std::numeric_limits<float>::max();
+    std::vector<float> threadMin(numThreads * 3, maxFloat);
+    std::vector<float> threadMax(numThreads * 3, -maxFloat);
+    parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        float* minPt = &threadMin[threadIndex * 3];
+        float* maxPt = &threadMax[threadIndex * 3];
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[i];
+            if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+            {
+                continue;
+            }
+            minPt[0] = std::min(minPt[0], p.x);
+            minPt[1] = std::min(minPt[1], p.y);
+            minPt[2] = std::min(minPt[2], p.z);
+            maxPt[0] = std::max(maxPt[0], p.x);
+            maxPt[1] = std::max(maxPt[1], p.y);
+            maxPt[2] = std::max(maxPt[2], p.z);
+        }
+    }, m_numThreads);
+    float minPt[3] = {maxFloat, maxFloat, maxFloat};
+    float maxPt[3] = {-maxFloat, -maxFloat, -maxFloat};
+    for(size_t t = 0; t < numThreads; t++)
+    {
+        for(int d = 0; d < 3; d++)
+        {
+            minPt[d] = std::min(minPt[d], threadMin[t * 3 + d]);
+            maxPt[d] = std::max(maxPt[d], threadMax[t * 3 + d]);
+        }
+    }
+    if(minPt[0] > maxPt[0])
+    {
+        return;
+    }
+
+    // size the grid cells to the cluster tolerance, padded by one cell on each side so neighbor keys never wrap
+    const double inverseCellSize = 1.0 / m_clusterTolerance;
+    int64_t minCell[3];
+    uint64_t gridSize[3];
+    for(int d = 0; d < 3; d++)
+    {
+        minCell[d] = static_cast<int64_t>(std::floor(minPt[d] * inverseCellSize)) - 1;
+        gridSize[d] = static_cast<uint64_t>(static_cast<int64_t>(std::floor(maxPt[d] * inverseCellSize)) - minCell[d] + 2);
+    }
+    if(static_cast<double>(gridSize[0]) * gridSize[1] * gridSize[2] > static_cast<double>(std::numeric_limits<int64_t>::max()))
+    {
+        PCL_WARN("[ParallelClusterExtraction::extract] Cluster tolerance is too small for the input dataset.\n");
+        return;
+    }
+    const uint64_t strideY = gridSize[0];
+    const uint64_t strideZ = gridSize[0] * gridSize[1];
+
+    // compute the cell key of each finite point
+    const uint64_t invalidKey = std::numeric_limits<uint64_t>::max();
+    std::vector<std::pair<uint64_t, int> > sortedPoints(cloudIn.points.size());
+    parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[i];
+            uint64_t key = invalidKey;
+            if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+            {
+                uint64_t ix = static_cast<uint64_t>(static_cast<int64_t>(std::floor(p.x * inverseCellSize)) - minCell[0]);
+                uint64_t iy = static_cast<uint64_t>(static_cast<int64_t>(std::floor(p.y * inverseCellSize)) - minCell[1]);
+                uint64_t iz = static_cast<uint64_t>(static_cast<int64_t>(std::floor(p.z * inverseCellSize)) - minCell[2]);
+                key = ix + iy * strideY + iz * strideZ;
+            }
+            sortedPoints[i] = std::make_pair(key, static_cast<int>(i));
+        }
+    }, m_numThreads);
+
+    // bucket the points by sorting on the cell key, non-finite points sort to the end
+    parallelSort(sortedPoints.begin(), sortedPoints.end(), [](const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b)
+    {
+        return a.first < b.first;
+    }, m_numThreads);
+    size_t numValid = sortedPoints.size();
+    while(numValid > 0 && sortedPoints[numValid - 1].first == invalidKey)
+    {
+        numValid--;
+    }
+
+    // record the range of sorted points that belongs to each occupied cell
+    std::vector<uint64_t> cellKeys;
+    std::vector<size_t> cellStart;
+    for(size_t k = 0; k < numValid; k++)
+    {
+        if(k == 0 || sortedPoints[k].first != sortedPoints[k - 1].first)
+        {
+            cellKeys.push_back(sortedPoints[k].first);
+            cellStart.push_back(k);
+        }
+    }
+    cellStart.push_back(numValid);
+
+    // copy the coordinates in cell order for cache friendly neighbor scans
+    std::vector<float> sortedXYZ(numValid * 3);
+    parallelFor(0, numValid, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t k = blockBegin; k < blockEnd; k++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[sortedPoints[k].second];
+            sortedXYZ[k * 3] = p.x;
+            sortedXYZ[k * 3 + 1] = p.y;
+            sortedXYZ[k * 3 + 2] = p.z;
+        }
+    }, m_numThreads);
+
+    // list the 13 neighbor cell offsets that come after the current cell, so each cell pair is visited once
+    std::vector<uint64_t> forwardOffsets;
+    for(int dz = -1; dz <= 1; dz++)
+    {
+        for(int dy = -1; dy <= 1; dy++)
+        {
+            for(int dx = -1; dx <= 1; dx++)
+            {
+                int64_t offset = dx + dy * static_cast<int64_t>(strideY) + dz * static_cast<int64_t>(strideZ);
+                if(offset > 0)
+                {
+                    forwardOffsets.push_back(static_cast<uint64_t>(offset));
+                }
+            }
+        }
+    }
+
+    // initialize the union-find forest over the sorted points
+    std::vector<std::atomic<int> > parents(numValid);
+    parallelFor(0, numValid, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t k = blockBegin; k < blockEnd; k++)
+        {
+            parents[k].store(static_cast<int>(k), std::memory_order_relaxed);
+        }
+    }, m_numThreads);
+
+    // join every pair of points closer than the tolerance, scanning the cells in parallel
+    const float squaredTolerance = static_cast<float>(m_clusterTolerance * m_clusterTolerance);
+    parallelFor(0, cellKeys.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t c = blockBegin; c < blockEnd; c++)
+        {
+            // pairs within the cell
+            for(size_t a = cellStart[c]; a < cellStart[c + 1]; a++)
+            {
+                const float* pa = &sortedXYZ[a * 3];
+                for(size_t b = a + 1; b < cellStart[c + 1]; b++)
+                {
+                    const float* pb = &sortedXYZ[b * 3];
+                    float dx = pa[0] - pb[0];
+                    float dy = pa[1] - pb[1];
+                    float dz = pa[2] - pb[2];
+                    if(dx * dx + dy * dy + dz * dz <= squaredTolerance)
+                    {
+                        unite(parents, static_cast<int>(a), static_cast<int>(b));
+                    }
+                }
+            }
+
+            // pairs with the forward neighbor cells
+            for(size_t n = 0; n < forwardOffsets.size(); n++)
+            {
+                uint64_t neighborKey = cellKeys[c] + forwardOffsets[n];
+                std::vector<uint64_t>::const_iterator it = std::lower_bound(cellKeys.begin() + c + 1, cellKeys.end(), neighborKey);
+                if(it == cellKeys.end() || *it != neighborKey)
+                {
+                    continue;
+                }
+                size_t neighbor = static_cast<size_t>(it - cellKeys.begin());
+                for(size_t a = cellStart[c]; a < cellStart[c + 1]; a++)
+                {
+                    const float* pa = &sortedXYZ[a * 3];
+                    for(size_t b = cellStart[neighbor]; b < cellStart[neighbor + 1]; b++)
+                    {
+                        const float* pb = &sortedXYZ[b * 3];
+                        float dx = pa[0] - pb[0];
+                        float dy = pa[1] - pb[1];
+                        float dz = pa[2] - pb[2];
+                        if(dx * dx + dy * dy + dz * dz <= squaredTolerance)
+                        {
+                            unite(parents, static_cast<int>(a), static_cast<int>(b));
+                        }
+                    }
+                }
+            }
+        }
+    }, m_numThreads, 64);
+
+    // resolve the final root of every point and count the component sizes
+    std::vector<int> roots(numValid);
+    parallelFor(0, numValid, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t k = blockBegin; k < blockEnd; k++)
+        {
+            roots[k] = findRoot(parents, static_cast<int>(k));
+        }
+    }, m_numThreads);
+    std::vector<int> componentSize(numValid, 0);
+    for(size_t k = 0; k < numValid; k++)
+    {
+        componentSize[roots[k]]++;
+    }
+
+    // assign a cluster to each component within the size limits
+    std::vector<int> clusterIndex(numValid, -1);
+    for(size_t k = 0; k < numValid; k++)
+    {
+        if(roots[k] == static_cast<int>(k) && componentSize[k] >= m_minClusterSize && componentSize[k] <= m_maxClusterSize)
+        {
+            clusterIndex[k] = static_cast<int>(clusters.size());
+            clusters.push_back(pcl::PointIndices());
+            clusters.back().indices.reserve(componentSize[k]);
+        }
+    }
+    for(size_t k = 0; k < numValid; k++)
+    {
+        int cluster = clusterIndex[roots[k]];
+        if(cluster >= 0)
+        {
+            clusters[cluster].indices.push_back(sortedPoints[k].second);
+        }
+    }
+
+    // sort the indices within each cluster, then order the clusters by decreasing size
+    parallelFor(0, clusters.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            std::sort(clusters[i].indices.begin(), clusters[i].indices.end());
+            clusters[i].header = cloudIn.header;
+        }
+    }, m_numThreads, 1);
+    std::sort(clusters.begin(), clusters.end(), [](const pcl::PointIndices &a, const pcl::PointIndices &b)
+    {
+        return a.indices.size() > b.indices.size();
+    });
+}
@@ -0,0 +1,75 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelClusterExtraction.h
+ * @brief Header file for the ParallelClusterExtraction class
+ *
+ * This class provides a multithreaded replacement for pcl::EuclideanClusterExtraction
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PARALLELCLUSTEREXTRACTION_H
+#define PARALLELCLUSTEREXTRACTION_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/PointIndices.h>
+
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class ParallelClusterExtraction
+ *
+ * @brief Class for extracting Euclidean clusters from a point cloud using multiple threads
+ *
+ * Points are bucketed into a grid with cells the size of the cluster tolerance, so every neighbor of a point lies in
+ * the surrounding 27 cells. Threads scan the cells in parallel and join neighboring points in a lock-free union-find
+ * forest, whose connected components are the clusters. The result matches pcl::EuclideanClusterExtraction: clusters
+ * outside [minClusterSize, maxClusterSize] are discarded, indices are sorted within each cluster, and clusters are
+ * sorted by decreasing size.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ParallelClusterExtraction
+{
+private:
+
+    // input data and settings
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr m_cloud;
+    double m_clusterTolerance;
+    int m_minClusterSize;
+    int m_maxClusterSize;
+    int m_numThreads;
+
+public:
+
+    // constructors
+    ParallelClusterExtraction();
+
+    // settings
+    void setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud);
+    void setClusterTolerance(double clusterTolerance);
+    void setMinClusterSize(int minClusterSize);
+    void setMaxClusterSize(int maxClusterSize);
+    void setNumberOfThreads(int numThreads);
+
+    // processing
+    void extract(std::vector<pcl::PointIndices> &clusters);
+};
+
+#endif // PARALLELCLUSTEREXTRACTION_H
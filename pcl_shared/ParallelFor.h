@@ -0,0 +1,156 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelFor.h
+ * @brief Minimal thread helpers shared by the pcl_* tools
+ *
+ * Splits an index range into contiguous blocks and runs each block on its own std::thread. The calling thread
+ * processes the first block so that small inputs do not pay for a thread launch. A block-sort-and-merge parallel sort
+ * is built on top of the same helper.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @brief Resolve the number of worker threads to use
+ * @param[in] numThreads the requested thread count, or 0 to use all hardware threads
+ * @return the number of threads to launch (at least 1)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+inline int getThreadCount(int numThreads=0)
+{
+    if(numThreads > 0)
+    {
+        return numThreads;
+    }
+    int hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(hardwareThreads, 1);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Run a function over an index range using multiple threads
+ *
+ * The range [begin, end) is split into at most numThreads contiguous blocks. The function is called once per block
+ * as fn(blockBegin, blockEnd, threadIndex), where threadIndex is in [0, numThreads) and can be used to address
+ * per-thread scratch storage.
+ *
+ * @param[in] begin first index of the range
+ * @param[in] end one past the last index of the range
+ * @param[in] fn the function to call for each block
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @param[in] minBlockSize the smallest block worth giving its own thread (default: 1024)
+ * @return the number of blocks (and thread indices) that were used
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+template<typename Function>
+int parallelFor(size_t begin, size_t end, Function fn, int numThreads=0, size_t minBlockSize=1024)
+{
+    if(end <= begin)
+    {
+        return 0;
+    }
+
+    // limit the number of blocks so that each thread gets a useful amount of work
+    size_t count = end - begin;
+    size_t maxBlocks = std::max<size_t>(count / std::max<size_t>(minBlockSize, 1), 1);
+    int numBlocks = static_cast<int>(std::min<size_t>(static_cast<size_t>(getThreadCount(numThreads)), maxBlocks));
+
+    // launch the worker threads for all but the first block
+    std::vector<std::thread> workers;
+    workers.reserve(numBlocks - 1);
+    for(int i = 1; i < numBlocks; i++)
+    {
+        size_t blockBegin = begin + (count * i) / numBlocks;
+        size_t blockEnd = begin + (count * (i + 1)) / numBlocks;
+        workers.push_back(std::thread(fn, blockBegin, blockEnd, i));
+    }
+
+    // process the first block on the calling thread
+    fn(begin, begin + count / numBlocks, 0);
+
+    // wait for the workers to finish
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        workers.at(i).join();
+    }
+    return numBlocks;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Sort a random access range using multiple threads
+ *
+ * Each thread sorts one contiguous block with std::sort, then neighboring blocks are merged pairwise in parallel until
+ * a single sorted range remains.
+ *
+ * @param[in] begin iterator to the first element
+ * @param[in] end iterator one past the last element
+ * @param[in] comp the strict weak ordering used to compare elements
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+template<typename Iterator, typename Compare>
+void parallelSort(Iterator begin, Iterator end, Compare comp, int numThreads=0)
+{
+    // split the range into one block per thread
+    const size_t minBlockSize = 16384;
+    size_t count = static_cast<size_t>(end - begin);
+    size_t maxBlocks = std::max<size_t>(count / minBlockSize, 1);
+    size_t numBlocks = std::min<size_t>(static_cast<size_t>(getThreadCount(numThreads)), maxBlocks);
+    std::vector<size_t> bounds(numBlocks + 1);
+    for(size_t i = 0; i <= numBlocks; i++)
+    {
+        bounds[i] = (count * i) / numBlocks;
+    }
+
+    // sort each block independently
+    parallelFor(0, numBlocks, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t b = blockBegin; b < blockEnd; b++)
+        {
+            std::sort(begin + bounds[b], begin + bounds[b + 1], comp);
+        }
+    }, static_cast<int>(numBlocks), 1);
+
+    // merge neighboring sorted runs, doubling the run length each pass
+    for(size_t width = 1; width < numBlocks; width *= 2)
+    {
+        size_t numMerges = (numBlocks + 2 * width - 1) / (2 * width);
+        parallelFor(0, numMerges, [&](size_t mergeBegin, size_t mergeEnd, int)
+        {
+            for(size_t m = mergeBegin; m < mergeEnd; m++)
+            {
+                size_t low = m * 2 * width;
+                size_t middle = std::min(low + width, numBlocks);
+                size_t high = std::min(low + 2 * width, numBlocks);
+                if(middle < high)
+                {
+                    std::inplace_merge(begin + bounds[low], begin + bounds[middle], begin + bounds[high], comp);
+                }
+            }
+        }, static_cast<int>(numMerges), 1);
+    }
+}
+
+#endif // PARALLELFOR_H
@@ -0,0 +1,453 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelNormalEstimation.cpp
+ * @brief Implementation file for the ParallelNormalEstimation class
+ *
+ * This class estimates the normals of an organized point cloud from integral images using multiple threads
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ParallelNormalEstimation.h"
+#include "ParallelFor.h"
+
+#include <pcl/common/eigen.h>
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// values per integral image cell: finite point count, sums of x y z, sums of xx xy xz yy yz zz
+#define INTEGRAL_CHANNELS 10
+
+// smallest number of rows worth giving its own thread
+#define MIN_ROWS_PER_THREAD 8
+
+/***********************************************************************************************************************
+ * @brief Add two arrays of doubles element by element
+ * @param[in] a the first array
+ * @param[in] b the second array
+ * @param[out] sum the sum array, which may alias a or b
+ * @param[in] count the number of elements
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline void addValues(const double* a, const double* b, double* sum, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 2 <= count; i += 2)
+    {
+        _mm_storeu_pd(sum + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+#endif
+    for(; i < count; i++)
+    {
+        sum[i] = a[i] + b[i];
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Determine if the depth changes too much between two neighboring points
+ * @param[in] depth the depth of the first point, which sets the allowed change
+ * @param[in] depthOther the depth of the neighboring point
+ * @param[in] maxDepthChangeFactor the depth dependent change factor
+ * @return true if either depth is invalid or the change exceeds the allowed change
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline bool isDepthChange(float depth, float depthOther, float maxDepthChangeFactor)
+{
+    const float allowedChange = maxDepthChangeFactor * (std::fabs(depth) + 1.0f) * 2.0f;
+    return !std::isfinite(depth) || !std::isfinite(depthOther) || std::fabs(depth - depthOther) > allowedChange;
+}
+
+/***********************************************************************************************************************
+ * @brief Set a normal to NaN
+ * @param[out] normal the normal to invalidate
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline void setInvalid(pcl::Normal &normal)
+{
+    const float bad = std::numeric_limits<float>::quiet_NaN();
+    normal.normal_x = bad;
+    normal.normal_y = bad;
+    normal.normal_z = bad;
+    normal.curvature = bad;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ParallelNormalEstimation::ParallelNormalEstimation()
+{
+    m_maxDepthChangeFactor = 20.0f * 0.001f;
+    m_normalSmoothingSize = 10.0f;
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the organized cloud to estimate normals for
+ * @param[in] cloud the input cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud)
+{
+    m_cloud = cloud;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the factor of the depth dependent change between neighbors that is treated as a depth discontinuity
+ * @param[in] maxDepthChangeFactor the depth change factor (default: 0.02)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::setMaxDepthChangeFactor(float maxDepthChangeFactor)
+{
+    m_maxDepthChangeFactor = maxDepthChangeFactor;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the size of the largest smoothing window, in pixels
+ * @param[in] normalSmoothingSize the smoothing window size (default: 10)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::setNormalSmoothingSize(float normalSmoothingSize)
+{
+    if(normalSmoothingSize <= 0)
+    {
+        PCL_ERROR("[ParallelNormalEstimation::setNormalSmoothingSize] Invalid normal smoothing size given! (%f). Allowed ranges are: 0 < N. Defaulting to %f.\n", normalSmoothingSize, m_normalSmoothingSize);
+        return;
+    }
+    m_normalSmoothingSize = normalSmoothingSize;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Mark the points next to a depth discontinuity or an invalid point with 0, and all others with 255
+ *
+ * Each pixel is compared with its right and lower neighbors using the allowed change of its own depth, and both pixels
+ * of a failing pair are marked. Every pixel evaluates the pairs it belongs to, so rows are processed independently.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::computeDepthChangeMap()
+{
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloud = *m_cloud;
+    const size_t width = cloud.width;
+    const size_t height = cloud.height;
+    const float factor = m_maxDepthChangeFactor;
+    m_depthChangeMap.resize(width * height);
+
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd, int)
+    {
+        for(size_t r = rowBegin; r < rowEnd; r++)
+        {
+            for(size_t c = 0; c < width; c++)
+            {
+                const size_t index = r * width + c;
+                const float depth = cloud.points[index].z;
+                bool change = false;
+                if(r + 1 < height && c + 1 < width)
+                {
+                    // pairs starting at this pixel
+                    change = isDepthChange(depth, cloud.points[index + 1].z, factor) || isDepthChange(depth, cloud.points[index + width].z, factor);
+                }
+                if(!change && c > 0 && r + 1 < height)
+                {
+                    // pair starting at the left neighbor
+                    change = isDepthChange(cloud.points[index - 1].z, depth, factor);
+                }
+                if(!change && r > 0 && c + 1 < width)
+                {
+                    // pair starting at the upper neighbor
+                    change = isDepthChange(cloud.points[index - width].z, depth, factor);
+                }
+                m_depthChangeMap[index] = change ? 0 : 255;
+            }
+        }
+    }, m_numThreads, MIN_ROWS_PER_THREAD);
+}
+
+/***********************************************************************************************************************
+ * @brief Compute the approximate distance of each pixel to the nearest depth discontinuity
+ *
+ * This is a two pass chamfer distance transform that matches pcl::IntegralImageNormalEstimation, including its reads
+ * across the row boundaries at the first and last columns. Each pass depends on the previous row, so it runs on one
+ * thread; it is a small fraction of the total time.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::computeDistanceMap()
+{
+    const int width = static_cast<int>(m_cloud->width);
+    const int height = static_cast<int>(m_cloud->height);
+    const float farDistance = static_cast<float>(width + height);
+    m_distanceMap.resize(m_depthChangeMap.size());
+    for(size_t i = 0; i < m_depthChangeMap.size(); i++)
+    {
+        m_distanceMap[i] = m_depthChangeMap[i] == 0 ? 0.0f : farDistance;
+    }
+
+    // forward pass
+    float* previousRow = m_distanceMap.data();
+    float* currentRow = previousRow + width;
+    for(int r = 1; r < height; r++)
+    {
+        for(int c = 1; c < width; c++)
+        {
+            const float upLeft = previousRow[c - 1] + 1.4f;
+            const float up = previousRow[c] + 1.0f;
+            const float upRight = previousRow[c + 1] + 1.4f;
+            const float left = currentRow[c - 1] + 1.0f;
+            const float minValue = std::min(std::min(upLeft, up), std::min(left, upRight));
+            if(minValue < currentRow[c])
+            {
+                currentRow[c] = minValue;
+            }
+        }
+        previousRow = currentRow;
+        currentRow += width;
+    }
+
+    // backward pass
+    float* nextRow = m_distanceMap.data() + width * (height - 1);
+    currentRow = nextRow - width;
+    for(int r = height - 2; r >= 0; r--)
+    {
+        for(int c = width - 2; c >= 0; c--)
+        {
+            const float lowerLeft = nextRow[c - 1] + 1.4f;
+            const float lower = nextRow[c] + 1.0f;
+            const float lowerRight = nextRow[c + 1] + 1.4f;
+            const float right = currentRow[c + 1] + 1.0f;
+            const float minValue = std::min(std::min(lowerLeft, lower), std::min(right, lowerRight));
+            if(minValue < currentRow[c])
+            {
+                currentRow[c] = minValue;
+            }
+        }
+        nextRow = currentRow;
+        currentRow -= width;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Compute the integral image of the finite point count, coordinate sums and second order moments
+ *
+ * The image has one more row and column than the cloud, with the first row and column set to zero. Rows are prefix
+ * summed in parallel, then each thread accumulates a range of columns down the image with SIMD additions.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::computeIntegralImage()
+{
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloud = *m_cloud;
+    const size_t width = cloud.width;
+    const size_t height = cloud.height;
+    const size_t rowSize = (width + 1) * INTEGRAL_CHANNELS;
+    m_integralImage.resize(rowSize * (height + 1));
+    std::fill(m_integralImage.begin(), m_integralImage.begin() + rowSize, 0.0);
+
+    // prefix sum each row
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd, int)
+    {
+        double values[INTEGRAL_CHANNELS];
+        for(size_t r = rowBegin; r < rowEnd; r++)
+        {
+            double* row = &m_integralImage[(r + 1) * rowSize];
+            std::fill(row, row + INTEGRAL_CHANNELS, 0.0);
+            for(size_t c = 0; c < width; c++)
+            {
+                const pcl::PointXYZRGBA &p = cloud.points[r * width + c];
+                double* cell = row + (c + 1) * INTEGRAL_CHANNELS;
+                if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+                {
+                    const double x = p.x;
+                    const double y = p.y;
+                    const double z = p.z;
+                    values[0] = 1.0;
+                    values[1] = x;
+                    values[2] = y;
+                    values[3] = z;
+                    values[4] = x * x;
+                    values[5] = x * y;
+                    values[6] = x * z;
+                    values[7] = y * y;
+                    values[8] = y * z;
+                    values[9] = z * z;
+                    addValues(cell - INTEGRAL_CHANNELS, values, cell, INTEGRAL_CHANNELS);
+                }
+                else
+                {
+                    std::copy(cell - INTEGRAL_CHANNELS, cell, cell);
+                }
+            }
+        }
+    }, m_numThreads, MIN_ROWS_PER_THREAD);
+
+    // accumulate down the columns, each thread owns a contiguous slice of every row
+    parallelFor(0, rowSize, [&](size_t begin, size_t end, int)
+    {
+        for(size_t r = 2; r <= height; r++)
+        {
+            double* row = &m_integralImage[r * rowSize];
+            addValues(row + begin - rowSize, row + begin, row + begin, end - begin);
+        }
+    }, m_numThreads, MIN_ROWS_PER_THREAD * INTEGRAL_CHANNELS);
+}
+
+/***********************************************************************************************************************
+ * @brief Estimate the normal of one point from the covariance of a square window centered on it
+ * @param[in] x the column of the point
+ * @param[in] y the row of the point
+ * @param[in] rectSize the window size, the window must lie within the image
+ * @param[out] normal the estimated normal and curvature
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::computePointNormal(int x, int y, int rectSize, pcl::Normal &normal) const
+{
+    // sum the window from the four corners of the integral image
+    const size_t rowSize = (m_cloud->width + 1) * INTEGRAL_CHANNELS;
+    const int startX = x - rectSize / 2;
+    const int startY = y - rectSize / 2;
+    const double* upperLeft = &m_integralImage[startY * rowSize + startX * INTEGRAL_CHANNELS];
+    const double* upperRight = upperLeft + rectSize * INTEGRAL_CHANNELS;
+    const double* lowerLeft = upperLeft + rectSize * rowSize;
+    const double* lowerRight = lowerLeft + rectSize * INTEGRAL_CHANNELS;
+    double sums[INTEGRAL_CHANNELS];
+    for(int i = 0; i < INTEGRAL_CHANNELS; i++)
+    {
+        sums[i] = lowerRight[i] + upperLeft[i] - upperRight[i] - lowerLeft[i];
+    }
+
+    const unsigned int count = static_cast<unsigned int>(sums[0] + 0.5);
+    if(count == 0)
+    {
+        setInvalid(normal);
+        return;
+    }
+
+    // covariance scaled by the point count, computed in single precision like the PCL estimator
+    Eigen::Vector3f center(static_cast<float>(sums[1]), static_cast<float>(sums[2]), static_cast<float>(sums[3]));
+    Eigen::Matrix3f covariance;
+    covariance.coeffRef(0) = static_cast<float>(sums[4]);
+    covariance.coeffRef(1) = covariance.coeffRef(3) = static_cast<float>(sums[5]);
+    covariance.coeffRef(2) = covariance.coeffRef(6) = static_cast<float>(sums[6]);
+    covariance.coeffRef(4) = static_cast<float>(sums[7]);
+    covariance.coeffRef(5) = covariance.coeffRef(7) = static_cast<float>(sums[8]);
+    covariance.coeffRef(8) = static_cast<float>(sums[9]);
+    covariance -= (center * center.transpose()) / static_cast<float>(count);
+
+    // the normal is the eigenvector of the smallest eigenvalue
+    float eigenValue;
+    Eigen::Vector3f eigenVector;
+    pcl::eigen33(covariance, eigenValue, eigenVector);
+
+    // flip the normal towards the sensor at the origin
+    const pcl::PointXYZRGBA &p = m_cloud->points[y * m_cloud->width + x];
+    if(-(p.x * eigenVector[0] + p.y * eigenVector[1] + p.z * eigenVector[2]) < 0)
+    {
+        eigenVector = -eigenVector;
+    }
+    normal.normal_x = eigenVector[0];
+    normal.normal_y = eigenVector[1];
+    normal.normal_z = eigenVector[2];
+    if(eigenValue > 0.0f)
+    {
+        normal.curvature = std::fabs(eigenValue / (covariance.coeff(0) + covariance.coeff(4) + covariance.coeff(8)));
+    }
+    else
+    {
+        normal.curvature = 0;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Estimate the normals of the input cloud
+ * @param[out] normalsOut the normals, organized like the input cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelNormalEstimation::compute(pcl::PointCloud<pcl::Normal> &normalsOut)
+{
+    normalsOut.header = m_cloud ? m_cloud->header : pcl::PCLHeader();
+    if(!m_cloud || m_cloud->height < 2 || m_cloud->width < 2)
+    {
+        PCL_ERROR("[ParallelNormalEstimation::compute] No input dataset given, or the input dataset is not organized.\n");
+        normalsOut.points.clear();
+        normalsOut.width = 0;
+        normalsOut.height = 0;
+        return;
+    }
+
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloud = *m_cloud;
+    const int width = static_cast<int>(cloud.width);
+    const int height = static_cast<int>(cloud.height);
+    normalsOut.points.resize(cloud.points.size());
+    normalsOut.width = cloud.width;
+    normalsOut.height = cloud.height;
+    normalsOut.is_dense = false;
+
+    // build the per frame maps
+    computeDepthChangeMap();
+    computeDistanceMap();
+    computeIntegralImage();
+
+    // estimate the normals in bands of rows, points within the smoothing size of the border are left invalid
+    const int border = static_cast<int>(m_normalSmoothingSize);
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd, int)
+    {
+        for(int r = static_cast<int>(rowBegin); r < static_cast<int>(rowEnd); r++)
+        {
+            for(int c = 0; c < width; c++)
+            {
+                const size_t index = static_cast<size_t>(r) * width + c;
+                pcl::Normal &normal = normalsOut.points[index];
+                const pcl::PointXYZRGBA &p = cloud.points[index];
+                if(r < border || r >= height - border || c < border || c >= width - border || !std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                {
+                    setInvalid(normal);
+                    continue;
+                }
+
+                // shrink the window near depth discontinuities
+                const float smoothing = std::min(m_distanceMap[index], m_normalSmoothingSize);
+                if(smoothing > 2.0f)
+                {
+                    computePointNormal(c, r, static_cast<int>(smoothing), normal);
+                }
+                else
+                {
+                    setInvalid(normal);
+                }
+            }
+        }
+    }, m_numThreads, MIN_ROWS_PER_THREAD);
+}
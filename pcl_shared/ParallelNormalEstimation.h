@@ -0,0 +1,84 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelNormalEstimation.h
+ * @brief Header file for the ParallelNormalEstimation class
+ *
+ * This class estimates the normals of an organized point cloud from integral images using multiple threads
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PARALLELNORMALESTIMATION_H
+#define PARALLELNORMALESTIMATION_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class ParallelNormalEstimation
+ *
+ * @brief Class for estimating the normals of an organized point cloud using multiple threads
+ *
+ * This is a multithreaded version of pcl::IntegralImageNormalEstimation with the COVARIANCE_MATRIX method and the
+ * BORDER_POLICY_IGNORE border policy, and produces the same normals. The depth change map, the integral image of the
+ * point sums and second order moments, and the normals are each computed over bands of rows on all threads, and the
+ * integral image columns are accumulated two values at a time with SSE2. The smoothing window of each point shrinks
+ * with its distance to the nearest depth change, and points closer than the smoothing size to the image border get NaN
+ * normals. Buffers are kept between calls so that consecutive frames of the same size do not reallocate.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ParallelNormalEstimation
+{
+private:
+
+    // input data and settings
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr m_cloud;
+    float m_maxDepthChangeFactor;
+    float m_normalSmoothingSize;
+    int m_numThreads;
+
+    // per frame buffers, reused between calls
+    std::vector<unsigned char> m_depthChangeMap;
+    std::vector<float> m_distanceMap;
+    std::vector<double> m_integralImage;
+
+    // helper functions
+    void computeDepthChangeMap();
+    void computeDistanceMap();
+    void computeIntegralImage();
+    void computePointNormal(int x, int y, int rectSize, pcl::Normal &normal) const;
+
+public:
+
+    // constructors
+    ParallelNormalEstimation();
+
+    // settings
+    void setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud);
+    void setMaxDepthChangeFactor(float maxDepthChangeFactor);
+    void setNormalSmoothingSize(float normalSmoothingSize);
+    void setNumberOfThreads(int numThreads);
+
+    // processing
+    void compute(pcl::PointCloud<pcl::Normal> &normalsOut);
+};
+
+#endif // PARALLELNORMALESTIMATION_H
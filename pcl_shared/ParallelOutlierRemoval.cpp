@@ -0,0 +1,621 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelOutlierRemoval.cpp
+ * @brief Implementation file for the ParallelOutlierRemoval class
+ *
+ * This class provides a multithreaded approximate replacement for pcl::StatisticalOutlierRemoval
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ParallelOutlierRemoval.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// bits per axis of a bucket key
+#define BUCKET_KEY_BITS 21
+#define BUCKET_KEY_MASK ((1ULL << BUCKET_KEY_BITS) - 1)
+
+// coordinate used to pad the candidate arrays to a multiple of 4, far enough away to never be a neighbor
+#define PADDING_COORDINATE 1e15f
+
+// largest number of buckets searched on each side of a point before the missing neighbors are estimated
+#define MAX_SEARCH_RADIUS 8
+
+/***********************************************************************************************************************
+ * @struct CandidateSet
+ * @brief Coordinates of the candidate neighbors of a point, padded to a multiple of 4 for vectorized distances
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct CandidateSet
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    size_t count;
+
+    CandidateSet() : count(0) {}
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        count = 0;
+    }
+
+    void pad()
+    {
+        count = x.size();
+        size_t padded = (count + 3) & ~static_cast<size_t>(3);
+        x.resize(padded, PADDING_COORDINATE);
+        y.resize(padded, PADDING_COORDINATE);
+        z.resize(padded, PADDING_COORDINATE);
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+};
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ParallelOutlierRemoval::ParallelOutlierRemoval()
+{
+    m_meanK = 50;
+    m_stddevMul = 1.0;
+    m_bucketSize = 0.0f;
+    m_lastBucketSize = 0.0f;
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the cloud to be filtered
+ * @param[in] cloud pointer to the input point cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud)
+{
+    m_cloud = cloud;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of nearest neighbors used to compute the mean distance of each point
+ * @param[in] meanK the number of neighbors (default: 50)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::setMeanK(int meanK)
+{
+    m_meanK = meanK;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of standard deviations above the mean distance at which a point becomes an outlier
+ * @param[in] stddevMul the standard deviation multiplier (default: 1.0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::setStddevMulThresh(double stddevMul)
+{
+    m_stddevMul = stddevMul;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the size of the neighbor search buckets
+ * @param[in] bucketSize the bucket size, or 0 to choose it from the point density (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::setBucketSize(float bucketSize)
+{
+    m_bucketSize = bucketSize;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the bucket size used by the last call to filter()
+ * @return the bucket size
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float ParallelOutlierRemoval::getBucketSize() const
+{
+    return m_lastBucketSize;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Sort points into grid buckets
+ * @param[in] indices the input indices of the points to sort
+ * @param[in] minPt the minimum corner of the grid
+ * @param[in] bucketSize the bucket size
+ * @return the average number of points in the bucket of a point
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+double ParallelOutlierRemoval::sortIntoBuckets(const std::vector<int> &indices, const float* minPt, float bucketSize)
+{
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn = *m_cloud;
+    const float inverseBucketSize = 1.0f / bucketSize;
+    const float maxIndex = static_cast<float>(BUCKET_KEY_MASK);
+
+    // compute the bucket key of each point and sort the points by key
+    m_sortedPoints.resize(indices.size());
+    parallelFor(0, indices.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[indices[i]];
+            uint64_t ix = static_cast<uint64_t>(std::min((p.x - minPt[0]) * inverseBucketSize, maxIndex));
+            uint64_t iy = static_cast<uint64_t>(std::min((p.y - minPt[1]) * inverseBucketSize, maxIndex));
+            uint64_t iz = static_cast<uint64_t>(std::min((p.z - minPt[2]) * inverseBucketSize, maxIndex));
+            m_sortedPoints[i] = std::make_pair(ix | (iy << BUCKET_KEY_BITS) | (iz << (2 * BUCKET_KEY_BITS)), indices[i]);
+        }
+    }, m_numThreads);
+    parallelSort(m_sortedPoints.begin(), m_sortedPoints.end(), [](const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b)
+    {
+        return a.first < b.first;
+    }, m_numThreads);
+
+    // find the first point of each bucket
+    m_bucketStarts.clear();
+    double squaredCounts = 0.0;
+    for(size_t i = 0; i < m_sortedPoints.size(); i++)
+    {
+        if(i == 0 || m_sortedPoints[i].first != m_sortedPoints[i - 1].first)
+        {
+            if(i > 0)
+            {
+                double count = static_cast<double>(i - m_bucketStarts.back());
+                squaredCounts += count * count;
+            }
+            m_bucketStarts.push_back(i);
+        }
+    }
+    double count = static_cast<double>(m_sortedPoints.size() - m_bucketStarts.back());
+    squaredCounts += count * count;
+    m_bucketStarts.push_back(m_sortedPoints.size());
+    return squaredCounts / static_cast<double>(m_sortedPoints.size());
+}
+
+/***********************************************************************************************************************
+ * @brief Gather the points of the buckets within a radius of a bucket
+ *
+ * Buckets along x have consecutive keys, so each row of buckets is found with one binary search.
+ *
+ * @param[in] key the key of the center bucket
+ * @param[in] radius the number of buckets to search on each side of the center bucket
+ * @param[out] candidates the coordinates of the points found
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::gatherCandidates(uint64_t key, int radius, CandidateSet &candidates) const
+{
+    const size_t numPoints = m_sortedPoints.size();
+    const float* sortedX = &m_sortedCoords[0];
+    const float* sortedY = sortedX + numPoints;
+    const float* sortedZ = sortedY + numPoints;
+    const std::vector<size_t>::const_iterator bucketsBegin = m_bucketStarts.begin();
+    const std::vector<size_t>::const_iterator bucketsEnd = m_bucketStarts.end() - 1;
+    const uint64_t ix = key & BUCKET_KEY_MASK;
+    const uint64_t iy = (key >> BUCKET_KEY_BITS) & BUCKET_KEY_MASK;
+    const uint64_t iz = key >> (2 * BUCKET_KEY_BITS);
+    const uint64_t r = static_cast<uint64_t>(radius);
+
+    candidates.clear();
+    for(uint64_t z = (iz > r ? iz - r : 0); z <= std::min<uint64_t>(iz + r, BUCKET_KEY_MASK); z++)
+    {
+        for(uint64_t y = (iy > r ? iy - r : 0); y <= std::min<uint64_t>(iy + r, BUCKET_KEY_MASK); y++)
+        {
+            const uint64_t rowKey = (y << BUCKET_KEY_BITS) | (z << (2 * BUCKET_KEY_BITS));
+            const uint64_t lowKey = rowKey | (ix > r ? ix - r : 0);
+            const uint64_t highKey = rowKey | std::min<uint64_t>(ix + r, BUCKET_KEY_MASK);
+            std::vector<size_t>::const_iterator first = std::lower_bound(bucketsBegin, bucketsEnd, lowKey, [&](size_t start, uint64_t value)
+            {
+                return m_sortedPoints[start].first < value;
+            });
+            std::vector<size_t>::const_iterator last = std::upper_bound(first, bucketsEnd, highKey, [&](uint64_t value, size_t start)
+            {
+                return value < m_sortedPoints[start].first;
+            });
+            if(first != last)
+            {
+                candidates.x.insert(candidates.x.end(), sortedX + *first, sortedX + *last);
+                candidates.y.insert(candidates.y.end(), sortedY + *first, sortedY + *last);
+                candidates.z.insert(candidates.z.end(), sortedZ + *first, sortedZ + *last);
+            }
+        }
+    }
+    candidates.pad();
+}
+
+/***********************************************************************************************************************
+ * @brief Compute the radius around a point within which a bucket search finds every point
+ * @param[in] point the coordinates of the point
+ * @param[in] key the key of the bucket of the point
+ * @param[in] radius the number of buckets searched on each side of the bucket
+ * @param[in] bucketSize the bucket size
+ * @param[in] minPt the minimum corner of the grid
+ * @param[in] maxPt the maximum corner of the points
+ * @return the distance from the point to the nearest face of the searched buckets that has points beyond it
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static float getSearchCoverage(const float* point, uint64_t key, int radius, float bucketSize, const float* minPt, const float* maxPt)
+{
+    float coverage = std::numeric_limits<float>::max();
+    for(int d = 0; d < 3; d++)
+    {
+        int64_t index = static_cast<int64_t>((key >> (d * BUCKET_KEY_BITS)) & BUCKET_KEY_MASK);
+        float lowFace = minPt[d] + (index - radius) * bucketSize;
+        float highFace = minPt[d] + (index + radius + 1) * bucketSize;
+        if(index >= radius)
+        {
+            coverage = std::min(coverage, point[d] - lowFace);
+        }
+        if(highFace <= maxPt[d])
+        {
+            coverage = std::min(coverage, highFace - point[d]);
+        }
+    }
+    return coverage;
+}
+
+/***********************************************************************************************************************
+ * @brief Sum the distances from a point to its nearest candidates within a maximum distance
+ *
+ * The candidates within the maximum distance are compacted before the selection, which is much cheaper than selecting
+ * from all candidates since most of them are in the corners of the searched buckets.
+ *
+ * @param[in] candidates the candidate points
+ * @param[in] px the x coordinate of the point
+ * @param[in] py the y coordinate of the point
+ * @param[in] pz the z coordinate of the point
+ * @param[in] numNearest the number of nearest candidates to sum
+ * @param[in] maxDistance the distance beyond which candidates are ignored
+ * @param[in,out] distances scratch space for the squared distances
+ * @param[out] sum the sum of the distances to the nearest candidates
+ * @param[out] kthDistance the distance to the farthest of the summed candidates
+ * @return the number of candidates summed, which is less than numNearest if there are fewer within the distance
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static size_t sumNearestDistances(const CandidateSet &candidates, float px, float py, float pz, size_t numNearest, float maxDistance, std::vector<float> &distances, double &sum, float &kthDistance)
+{
+    // compute the squared distances to all candidates, keeping the ones within the maximum distance
+    const float maxSquared = maxDistance < std::sqrt(std::numeric_limits<float>::max()) ? maxDistance * maxDistance : std::numeric_limits<float>::max();
+    distances.resize(candidates.x.size());
+    size_t numWithin = 0;
+#ifdef __SSE2__
+    const __m128 x = _mm_set1_ps(px);
+    const __m128 y = _mm_set1_ps(py);
+    const __m128 z = _mm_set1_ps(pz);
+    const __m128 limit = _mm_set1_ps(maxSquared);
+    float squared[4];
+    const size_t numCandidates = candidates.size();
+    for(size_t j = 0; j < candidates.x.size(); j += 4)
+    {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(&candidates.x[j]), x);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(&candidates.y[j]), y);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(&candidates.z[j]), z);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        int mask = _mm_movemask_ps(_mm_cmple_ps(d, limit));
+
+        // ignore the padding lanes, which pass the limit when the search has no maximum distance
+        if(j + 4 > numCandidates)
+        {
+            mask &= (1 << (numCandidates - j)) - 1;
+        }
+        if(mask != 0)
+        {
+            _mm_storeu_ps(squared, d);
+            for(int lane = 0; lane < 4; lane++)
+            {
+                if(mask & (1 << lane))
+                {
+                    distances[numWithin++] = squared[lane];
+                }
+            }
+        }
+    }
+#else
+    for(size_t j = 0; j < candidates.size(); j++)
+    {
+        float dx = candidates.x[j] - px;
+        float dy = candidates.y[j] - py;
+        float dz = candidates.z[j] - pz;
+        float d = dx * dx + dy * dy + dz * dz;
+        if(d <= maxSquared)
+        {
+            distances[numWithin++] = d;
+        }
+    }
+#endif
+
+    // select the nearest candidates and sum their distances
+    numNearest = std::min(numNearest, numWithin);
+    sum = 0.0;
+    kthDistance = 0.0f;
+    if(numNearest == 0)
+    {
+        return 0;
+    }
+    std::nth_element(distances.begin(), distances.begin() + (numNearest - 1), distances.begin() + numWithin);
+    for(size_t j = 0; j < numNearest; j++)
+    {
+        sum += std::sqrt(distances[j]);
+    }
+    kthDistance = std::sqrt(distances[numNearest - 1]);
+    return numNearest;
+}
+
+/***********************************************************************************************************************
+ * @brief Remove the outliers of the input cloud
+ *
+ * Non-finite points are removed. If there are no more finite points than neighbors, all finite points are kept.
+ *
+ * @param[out] cloudOut the filtered point cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelOutlierRemoval::filter(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    cloudOut.points.clear();
+    cloudOut.width = 0;
+    cloudOut.height = 1;
+    cloudOut.is_dense = true;
+    if(!m_cloud || m_cloud->points.empty())
+    {
+        return;
+    }
+    if(m_meanK < 1)
+    {
+        PCL_ERROR("[ParallelOutlierRemoval::filter] The number of neighbors must be at least 1.\n");
+        return;
+    }
+    cloudOut.sensor_origin_ = m_cloud->sensor_origin_;
+    cloudOut.sensor_orientation_ = m_cloud->sensor_orientation_;
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn = *m_cloud;
+    const size_t numThreads = static_cast<size_t>(getThreadCount(m_numThreads));
+
+    // collect the finite points and their bounding box, one partial result per thread
+    const float maxFloat = std::numeric_limits<float>::max();
+    std::vector<float> threadMin(numThreads * 3, maxFloat);
+    std::vector<float> threadMax(numThreads * 3, -maxFloat);
+    m_keptIndices.resize(numThreads);
+    int numBlocks = parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        float* minPt = &threadMin[threadIndex * 3];
+        float* maxPt = &threadMax[threadIndex * 3];
+        std::vector<int> &finite = m_keptIndices[threadIndex];
+        finite.clear();
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[i];
+            if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+            {
+                continue;
+            }
+            finite.push_back(static_cast<int>(i));
+            minPt[0] = std::min(minPt[0], p.x);
+            minPt[1] = std::min(minPt[1], p.y);
+            minPt[2] = std::min(minPt[2], p.z);
+            maxPt[0] = std::max(maxPt[0], p.x);
+            maxPt[1] = std::max(maxPt[1], p.y);
+            maxPt[2] = std::max(maxPt[2], p.z);
+        }
+    }, m_numThreads);
+    std::vector<int> finiteIndices;
+    float minPt[3] = {maxFloat, maxFloat, maxFloat};
+    float maxPt[3] = {-maxFloat, -maxFloat, -maxFloat};
+    for(int t = 0; t < numBlocks; t++)
+    {
+        finiteIndices.insert(finiteIndices.end(), m_keptIndices[t].begin(), m_keptIndices[t].end());
+        for(int d = 0; d < 3; d++)
+        {
+            minPt[d] = std::min(minPt[d], threadMin[t * 3 + d]);
+            maxPt[d] = std::max(maxPt[d], threadMax[t * 3 + d]);
+        }
+    }
+    const size_t numPoints = finiteIndices.size();
+    if(numPoints <= static_cast<size_t>(m_meanK))
+    {
+        PCL_WARN("[ParallelOutlierRemoval::filter] Not enough points for %d neighbors, keeping all finite points.\n", m_meanK);
+        cloudOut.points.resize(numPoints);
+        for(size_t i = 0; i < numPoints; i++)
+        {
+            cloudOut.points[i] = cloudIn.points[finiteIndices[i]];
+        }
+        cloudOut.width = static_cast<uint32_t>(numPoints);
+        return;
+    }
+
+    // the bucket size must keep the grid within the key range
+    float maxExtent = std::max(std::max(maxPt[0] - minPt[0], maxPt[1] - minPt[1]), maxPt[2] - minPt[2]);
+    const float minBucketSize = std::max(maxExtent / static_cast<float>(BUCKET_KEY_MASK - 1), std::numeric_limits<float>::min() * 1e6f);
+
+    // sort the points into buckets, estimating the bucket size from the density if it is not set
+    float bucketSize = m_bucketSize;
+    if(bucketSize <= 0.0f)
+    {
+        // start from the size that would hold k points if the points filled their bounding box, which is too large for
+        // points on surfaces, then correct it from the measured occupancy assuming a surface
+        double volume = 1.0;
+        for(int d = 0; d < 3; d++)
+        {
+            volume *= std::max(maxPt[d] - minPt[d], maxExtent * 0.01f);
+        }
+        bucketSize = std::max(static_cast<float>(std::cbrt(volume * m_meanK / numPoints)), minBucketSize);
+        double occupancy = sortIntoBuckets(finiteIndices, minPt, bucketSize);
+        if(occupancy < 0.5 * m_meanK || occupancy > 2.0 * m_meanK)
+        {
+            bucketSize = std::max(static_cast<float>(bucketSize * std::sqrt(m_meanK / occupancy)), minBucketSize);
+            sortIntoBuckets(finiteIndices, minPt, bucketSize);
+        }
+    }
+    else
+    {
+        bucketSize = std::max(bucketSize, minBucketSize);
+        sortIntoBuckets(finiteIndices, minPt, bucketSize);
+    }
+    m_lastBucketSize = bucketSize;
+    const size_t numBuckets = m_bucketStarts.size() - 1;
+
+    // store the coordinates in bucket order so that the points of neighboring buckets are contiguous
+    m_sortedCoords.resize(numPoints * 3);
+    float* sortedX = &m_sortedCoords[0];
+    float* sortedY = sortedX + numPoints;
+    float* sortedZ = sortedY + numPoints;
+    parallelFor(0, numPoints, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[m_sortedPoints[i].second];
+            sortedX[i] = p.x;
+            sortedY[i] = p.y;
+            sortedZ[i] = p.z;
+        }
+    }, m_numThreads);
+
+    // compute the mean distance to the k nearest neighbors of each point, one bucket at a time
+    const size_t meanK = static_cast<size_t>(m_meanK);
+    m_meanDistances.resize(numPoints);
+    parallelFor(0, numBuckets, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        CandidateSet candidates;
+        CandidateSet wideCandidates;
+        std::vector<float> distances;
+        for(size_t bucket = blockBegin; bucket < blockEnd; bucket++)
+        {
+            // the candidates include the point itself at distance 0, so the k + 1 smallest distances are summed
+            const uint64_t key = m_sortedPoints[m_bucketStarts[bucket]].first;
+            gatherCandidates(key, 1, candidates);
+            float lastKthDistance = 0.0f;
+            for(size_t i = m_bucketStarts[bucket]; i < m_bucketStarts[bucket + 1]; i++)
+            {
+                // the result is exact if the k nearest neighbors are within the radius covered by the searched buckets,
+                // so the selection is first tried within a little more than the distance to the k-th neighbor of the
+                // previous point, which has a similar density, and then within the whole covered radius
+                const float point[3] = {sortedX[i], sortedY[i], sortedZ[i]};
+                const float coverage = getSearchCoverage(point, key, 1, bucketSize, minPt, maxPt);
+                const float bound = lastKthDistance > 0.0f ? std::min(coverage, lastKthDistance * 1.25f) : coverage;
+                double sum;
+                float kthDistance;
+                size_t numFound = sumNearestDistances(candidates, point[0], point[1], point[2], meanK + 1, bound, distances, sum, kthDistance);
+                if(numFound <= meanK && bound < coverage)
+                {
+                    numFound = sumNearestDistances(candidates, point[0], point[1], point[2], meanK + 1, coverage, distances, sum, kthDistance);
+                }
+                lastKthDistance = numFound > meanK ? kthDistance : 0.0f;
+
+                // otherwise widen the search for this point, which is rare except for the sparse points being removed
+                int radius = 1;
+                while(numFound <= meanK && radius < MAX_SEARCH_RADIUS)
+                {
+                    radius++;
+                    gatherCandidates(key, radius, wideCandidates);
+                    float maxDistance = radius < MAX_SEARCH_RADIUS ? getSearchCoverage(point, key, radius, bucketSize, minPt, maxPt) : std::numeric_limits<float>::max();
+                    numFound = sumNearestDistances(wideCandidates, point[0], point[1], point[2], meanK + 1, maxDistance, distances, sum, kthDistance);
+                }
+
+                // neighbors that were not found are at least the covered radius away
+                sum += static_cast<double>(meanK + 1 - numFound) * getSearchCoverage(point, key, radius, bucketSize, minPt, maxPt);
+                m_meanDistances[i] = static_cast<float>(sum / meanK);
+            }
+        }
+    }, m_numThreads, 16);
+
+    // compute the mean and standard deviation of the mean distances
+    std::vector<double> threadSums(numThreads * 2, 0.0);
+    parallelFor(0, numPoints, [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        double sum = 0.0;
+        double squaredSum = 0.0;
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            sum += m_meanDistances[i];
+            squaredSum += static_cast<double>(m_meanDistances[i]) * m_meanDistances[i];
+        }
+        threadSums[threadIndex * 2] = sum;
+        threadSums[threadIndex * 2 + 1] = squaredSum;
+    }, m_numThreads);
+    double sum = 0.0;
+    double squaredSum = 0.0;
+    for(size_t t = 0; t < numThreads; t++)
+    {
+        sum += threadSums[t * 2];
+        squaredSum += threadSums[t * 2 + 1];
+    }
+    const double mean = sum / numPoints;
+    const double variance = (squaredSum - sum * sum / numPoints) / (numPoints - 1);
+    const double threshold = mean + m_stddevMul * std::sqrt(std::max(variance, 0.0));
+
+    // mark the inliers by input index
+    m_keepMask.assign(cloudIn.points.size(), 0);
+    parallelFor(0, numPoints, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            m_keepMask[m_sortedPoints[i].second] = m_meanDistances[i] <= threshold ? 1 : 0;
+        }
+    }, m_numThreads);
+
+    // copy the inliers in input order, each block of points to its offset in the output
+    numBlocks = parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        std::vector<int> &kept = m_keptIndices[threadIndex];
+        kept.clear();
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            if(m_keepMask[i])
+            {
+                kept.push_back(static_cast<int>(i));
+            }
+        }
+    }, m_numThreads);
+    std::vector<size_t> offsets(numBlocks + 1, 0);
+    for(int b = 0; b < numBlocks; b++)
+    {
+        offsets[b + 1] = offsets[b] + m_keptIndices[b].size();
+    }
+    cloudOut.points.resize(offsets[numBlocks]);
+    cloudOut.width = static_cast<uint32_t>(offsets[numBlocks]);
+    parallelFor(0, numBlocks, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t b = blockBegin; b < blockEnd; b++)
+        {
+            const std::vector<int> &kept = m_keptIndices[b];
+            for(size_t k = 0; k < kept.size(); k++)
+            {
+                cloudOut.points[offsets[b] + k] = cloudIn.points[kept[k]];
+            }
+        }
+    }, numBlocks, 1);
+}
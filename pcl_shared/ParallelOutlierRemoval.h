@@ -0,0 +1,99 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelOutlierRemoval.h
+ * @brief Header file for the ParallelOutlierRemoval class
+ *
+ * This class provides a multithreaded approximate replacement for pcl::StatisticalOutlierRemoval
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PARALLELOUTLIERREMOVAL_H
+#define PARALLELOUTLIERREMOVAL_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// candidate neighbor storage used by the search
+struct CandidateSet;
+
+/*******************************************************************************************************************//**
+ * @class ParallelOutlierRemoval
+ *
+ * @brief Class for removing sparse outliers from a point cloud using multiple threads
+ *
+ * Follows pcl::StatisticalOutlierRemoval: the mean distance from each point to its k nearest neighbors is computed, and
+ * points whose mean distance is more than a multiple of the standard deviation above the mean of all points are removed.
+ * The neighbors are searched among the points of the 27 buckets of a regular grid around each point instead of a kd-tree.
+ * When the k nearest candidates are not all within one bucket size, the search is widened for that point until they are,
+ * so the mean distances are exact except for points with fewer than k neighbors within 8 buckets, whose missing neighbors
+ * are counted at that radius. Unless set, the bucket size is chosen so that the bucket of an average point holds about k
+ * points. Buckets are processed in parallel, and distances
+ * to the candidate neighbors are computed with SSE2 where available. The point order is preserved.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ParallelOutlierRemoval
+{
+private:
+
+    // input data and settings
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr m_cloud;
+    int m_meanK;
+    double m_stddevMul;
+    float m_bucketSize;
+    float m_lastBucketSize;
+    int m_numThreads;
+
+    // points sorted by bucket key, the first sorted point of each bucket, and the mean neighbor distance of each sorted
+    // point, reused between calls
+    std::vector<std::pair<uint64_t, int> > m_sortedPoints;
+    std::vector<float> m_sortedCoords;
+    std::vector<size_t> m_bucketStarts;
+    std::vector<float> m_meanDistances;
+
+    // output selection in input order, reused between calls
+    std::vector<uint8_t> m_keepMask;
+    std::vector<std::vector<int> > m_keptIndices;
+
+    // helper functions
+    double sortIntoBuckets(const std::vector<int> &indices, const float* minPt, float bucketSize);
+    void gatherCandidates(uint64_t key, int radius, CandidateSet &candidates) const;
+
+public:
+
+    // constructors
+    ParallelOutlierRemoval();
+
+    // settings
+    void setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud);
+    void setMeanK(int meanK);
+    void setStddevMulThresh(double stddevMul);
+    void setBucketSize(float bucketSize);
+    float getBucketSize() const;
+    void setNumberOfThreads(int numThreads);
+
+    // processing
+    void filter(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+};
+
+#endif // PARALLELOUTLIERREMOVAL_H
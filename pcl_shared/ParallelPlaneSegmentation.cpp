@@ -0,0 +1,438 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelPlaneSegmentation.cpp
+ * @brief Implementation file for the ParallelPlaneSegmentation class
+ *
+ * This class extracts multiple planes from a point cloud with a multithreaded RANSAC
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ParallelPlaneSegmentation.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// number of points scored between checks for early rejection of a hypothesis
+#define SCORE_BLOCK_SIZE 4096
+
+// number of hypotheses scored per round, fixed so that the rounds do not depend on the number of threads
+#define HYPOTHESES_PER_ROUND 64
+
+/***********************************************************************************************************************
+ * @brief Hash a 64 bit value into a well mixed pseudorandom 64 bit value (splitmix64)
+ * @param[in,out] state the generator state, advanced on every call
+ * @return the next pseudorandom value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static uint64_t nextRandom(uint64_t &state)
+{
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/***********************************************************************************************************************
+ * @brief Count the points within the distance threshold of a plane
+ *
+ * Scoring stops early once the hypothesis can no longer score more than the best count
+ *
+ * @param[in] x the x coordinates of the points
+ * @param[in] y the y coordinates of the points
+ * @param[in] z the z coordinates of the points
+ * @param[in] numPoints the number of points
+ * @param[in] coefficients the plane coefficients [a b c d] with a unit normal
+ * @param[in] threshold the inlier distance threshold
+ * @param[in] bestCount the inlier count to beat
+ * @return the number of inliers, or a value no greater than bestCount if the hypothesis was rejected early
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static size_t countInliers(const float* x, const float* y, const float* z, size_t numPoints, const float coefficients[4], float threshold, size_t bestCount)
+{
+    const float a = coefficients[0];
+    const float b = coefficients[1];
+    const float c = coefficients[2];
+    const float d = coefficients[3];
+    size_t count = 0;
+    for(size_t blockBegin = 0; blockBegin < numPoints; blockBegin += SCORE_BLOCK_SIZE)
+    {
+        // reject the hypothesis once the remaining points cannot lift it above the best count
+        if(count + (numPoints - blockBegin) <= bestCount)
+        {
+            return count;
+        }
+
+        // simple counting loop over contiguous arrays, left for the compiler to vectorize
+        size_t blockEnd = std::min(blockBegin + SCORE_BLOCK_SIZE, numPoints);
+        unsigned int blockCount = 0;
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            float distance = a * x[i] + b * y[i] + c * z[i] + d;
+            blockCount += (std::fabs(distance) <= threshold) ? 1 : 0;
+        }
+        count += blockCount;
+    }
+    return count;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ParallelPlaneSegmentation::ParallelPlaneSegmentation()
+{
+    m_distanceThreshold = 0.0;
+    m_maxIterations = 1000;
+    m_probability = 0.99;
+    m_maxPlanes = 1;
+    m_minInliers = 3;
+    m_numThreads = 0;
+    m_seed = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the cloud to be segmented
+ * @param[in] cloud pointer to the input point cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud)
+{
+    m_cloud = cloud;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum distance of a point to a plane to be considered an inlier
+ * @param[in] distanceThreshold the distance threshold
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setDistanceThreshold(double distanceThreshold)
+{
+    m_distanceThreshold = distanceThreshold;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum number of hypotheses to try for each plane
+ * @param[in] maxIterations the iteration limit (default: 1000)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setMaxIterations(int maxIterations)
+{
+    m_maxIterations = maxIterations;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the probability of drawing at least one outlier free sample, used for early termination
+ * @param[in] probability the confidence target in (0, 1) (default: 0.99)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setProbability(double probability)
+{
+    m_probability = probability;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the maximum number of planes to extract
+ * @param[in] maxPlanes the plane limit (default: 1)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setMaxPlanes(int maxPlanes)
+{
+    m_maxPlanes = maxPlanes;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the minimum number of inliers for a plane to be accepted, extraction stops at the first smaller plane
+ * @param[in] minInliers the minimum plane size (default: 3)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setMinInliers(int minInliers)
+{
+    m_minInliers = minInliers;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the seed of the hypothesis sampler
+ * @param[in] seed the random seed (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::setSeed(uint64_t seed)
+{
+    m_seed = seed;
+}
+
+/***********************************************************************************************************************
+ * @brief Extract the planes of the input cloud, largest first
+ * @param[out] planeInliers the point indices of each plane
+ * @param[out] planeCoefficients the coefficients [a b c d] of each plane, with a unit normal
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelPlaneSegmentation::segment(std::vector<pcl::PointIndices> &planeInliers, std::vector<pcl::ModelCoefficients> &planeCoefficients)
+{
+    planeInliers.clear();
+    planeCoefficients.clear();
+    if(!m_cloud || m_distanceThreshold <= 0.0)
+    {
+        PCL_ERROR("[ParallelPlaneSegmentation::segment] No input cloud or invalid distance threshold given!\n");
+        return;
+    }
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn = *m_cloud;
+
+    // gather the finite points into structure of arrays form (x block, then y block, then z block)
+    std::vector<int> remaining;
+    remaining.reserve(cloudIn.points.size());
+    for(size_t i = 0; i < cloudIn.points.size(); i++)
+    {
+        const pcl::PointXYZRGBA &p = cloudIn.points[i];
+        if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+        {
+            remaining.push_back(static_cast<int>(i));
+        }
+    }
+    std::vector<float> xyz(remaining.size() * 3);
+    for(size_t k = 0; k < remaining.size(); k++)
+    {
+        const pcl::PointXYZRGBA &p = cloudIn.points[remaining[k]];
+        xyz[k] = p.x;
+        xyz[remaining.size() + k] = p.y;
+        xyz[remaining.size() * 2 + k] = p.z;
+    }
+
+    // extract one plane at a time, removing its inliers before searching for the next one
+    const size_t minInliers = static_cast<size_t>(std::max(m_minInliers, 3));
+    for(int plane = 0; plane < m_maxPlanes && remaining.size() >= minInliers; plane++)
+    {
+        std::vector<int> inliers;
+        float coefficients[4];
+        if(!findPlane(xyz, m_seed + static_cast<uint64_t>(plane) * 0x100000000ULL, inliers, coefficients) || inliers.size() < minInliers)
+        {
+            break;
+        }
+
+        // store the plane, mapping the inliers back to cloud indices
+        planeInliers.push_back(pcl::PointIndices());
+        planeInliers.back().header = cloudIn.header;
+        planeInliers.back().indices.resize(inliers.size());
+        for(size_t k = 0; k < inliers.size(); k++)
+        {
+            planeInliers.back().indices[k] = remaining[inliers[k]];
+        }
+        planeCoefficients.push_back(pcl::ModelCoefficients());
+        planeCoefficients.back().header = cloudIn.header;
+        planeCoefficients.back().values.assign(coefficients, coefficients + 4);
+
+        // compact the remaining points, the inlier list is sorted so a single pass removes them
+        size_t numRemaining = remaining.size();
+        size_t kept = 0;
+        size_t nextInlier = 0;
+        for(size_t k = 0; k < numRemaining; k++)
+        {
+            if(nextInlier < inliers.size() && inliers[nextInlier] == static_cast<int>(k))
+            {
+                nextInlier++;
+                continue;
+            }
+            remaining[kept] = remaining[k];
+            xyz[kept] = xyz[k];
+            xyz[numRemaining + kept] = xyz[numRemaining + k];
+            xyz[numRemaining * 2 + kept] = xyz[numRemaining * 2 + k];
+            kept++;
+        }
+        remaining.resize(kept);
+        std::copy(xyz.begin() + numRemaining, xyz.begin() + numRemaining + kept, xyz.begin() + kept);
+        std::copy(xyz.begin() + numRemaining * 2, xyz.begin() + numRemaining * 2 + kept, xyz.begin() + kept * 2);
+        xyz.resize(kept * 3);
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Find the plane with the most inliers using RANSAC with parallel hypothesis scoring
+ * @param[in] xyz the point coordinates in structure of arrays form
+ * @param[in] seed the seed of the first hypothesis
+ * @param[out] inliers the sorted positions of the plane inliers
+ * @param[out] coefficients the refined plane coefficients [a b c d]
+ * @return true if a non-degenerate plane was found
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool ParallelPlaneSegmentation::findPlane(const std::vector<float> &xyz, uint64_t seed, std::vector<int> &inliers, float coefficients[4])
+{
+    const size_t numPoints = xyz.size() / 3;
+    const float* x = &xyz[0];
+    const float* y = x + numPoints;
+    const float* z = y + numPoints;
+    const float threshold = static_cast<float>(m_distanceThreshold);
+    const int numThreads = getThreadCount(m_numThreads);
+    const size_t batchSize = HYPOTHESES_PER_ROUND;
+
+    // score rounds of hypotheses until the confidence target or the iteration limit is reached
+    std::vector<float> batchModels(batchSize * 4);
+    std::vector<size_t> batchCounts(batchSize);
+    float bestModel[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    size_t bestCount = 0;
+    size_t iterations = 0;
+    double requiredIterations = static_cast<double>(m_maxIterations);
+    while(iterations < requiredIterations && iterations < static_cast<size_t>(m_maxIterations))
+    {
+        size_t numHypotheses = std::min(batchSize, static_cast<size_t>(m_maxIterations) - iterations);
+        const size_t countToBeat = bestCount;
+        parallelFor(0, numHypotheses, [&](size_t blockBegin, size_t blockEnd, int)
+        {
+            for(size_t h = blockBegin; h < blockEnd; h++)
+            {
+                float* model = &batchModels[h * 4];
+                batchCounts[h] = 0;
+
+                // draw three distinct points, seeded by the hypothesis number
+                uint64_t state = seed + iterations + h;
+                size_t sample[3];
+                sample[0] = static_cast<size_t>(nextRandom(state) % numPoints);
+                do
+                {
+                    sample[1] = static_cast<size_t>(nextRandom(state) % numPoints);
+                } while(sample[1] == sample[0]);
+                do
+                {
+                    sample[2] = static_cast<size_t>(nextRandom(state) % numPoints);
+                } while(sample[2] == sample[0] || sample[2] == sample[1]);
+
+                // compute the plane through the samples, skipping collinear samples
+                Eigen::Vector3f p0(x[sample[0]], y[sample[0]], z[sample[0]]);
+                Eigen::Vector3f p1(x[sample[1]], y[sample[1]], z[sample[1]]);
+                Eigen::Vector3f p2(x[sample[2]], y[sample[2]], z[sample[2]]);
+                Eigen::Vector3f normal = (p1 - p0).cross(p2 - p0);
+                float norm = normal.norm();
+                if(norm < std::numeric_limits<float>::epsilon())
+                {
+                    continue;
+                }
+                normal /= norm;
+                model[0] = normal[0];
+                model[1] = normal[1];
+                model[2] = normal[2];
+                model[3] = -normal.dot(p0);
+                batchCounts[h] = countInliers(x, y, z, numPoints, model, threshold, countToBeat);
+            }
+        }, m_numThreads, 1);
+
+        // keep the best hypothesis, preferring the earliest one on ties
+        for(size_t h = 0; h < numHypotheses; h++)
+        {
+            if(batchCounts[h] > bestCount)
+            {
+                bestCount = batchCounts[h];
+                std::copy(&batchModels[h * 4], &batchModels[h * 4] + 4, bestModel);
+            }
+        }
+        iterations += numHypotheses;
+
+        // update the number of iterations needed to reach the confidence target
+        double inlierRatio = static_cast<double>(bestCount) / static_cast<double>(numPoints);
+        double sampleSuccess = inlierRatio * inlierRatio * inlierRatio;
+        if(sampleSuccess >= 1.0)
+        {
+            break;
+        }
+        if(sampleSuccess > 0.0)
+        {
+            requiredIterations = std::log(1.0 - m_probability) / std::log(1.0 - sampleSuccess);
+        }
+    }
+    if(bestCount < 3)
+    {
+        return false;
+    }
+
+    // select the inliers of a model in parallel, keeping them in ascending order
+    std::vector<std::vector<int> > threadInliers(static_cast<size_t>(numThreads));
+    const float* model = bestModel;
+    auto selectInliers = [&]()
+    {
+        int numBlocks = parallelFor(0, numPoints, [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+        {
+            std::vector<int> &blockInliers = threadInliers[threadIndex];
+            blockInliers.clear();
+            for(size_t i = blockBegin; i < blockEnd; i++)
+            {
+                if(std::fabs(model[0] * x[i] + model[1] * y[i] + model[2] * z[i] + model[3]) <= threshold)
+                {
+                    blockInliers.push_back(static_cast<int>(i));
+                }
+            }
+        }, m_numThreads);
+        inliers.clear();
+        for(int t = 0; t < numBlocks; t++)
+        {
+            inliers.insert(inliers.end(), threadInliers[t].begin(), threadInliers[t].end());
+        }
+    };
+    selectInliers();
+
+    // refine the plane to the least squares fit of its inliers
+    Eigen::Vector3d centroid(0.0, 0.0, 0.0);
+    for(size_t k = 0; k < inliers.size(); k++)
+    {
+        centroid += Eigen::Vector3d(x[inliers[k]], y[inliers[k]], z[inliers[k]]);
+    }
+    centroid /= static_cast<double>(inliers.size());
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+    for(size_t k = 0; k < inliers.size(); k++)
+    {
+        Eigen::Vector3d v = Eigen::Vector3d(x[inliers[k]], y[inliers[k]], z[inliers[k]]) - centroid;
+        covariance += v * v.transpose();
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+    Eigen::Vector3d normal = solver.eigenvectors().col(0);
+    float refinedModel[4];
+    refinedModel[0] = static_cast<float>(normal[0]);
+    refinedModel[1] = static_cast<float>(normal[1]);
+    refinedModel[2] = static_cast<float>(normal[2]);
+    refinedModel[3] = static_cast<float>(-normal.dot(centroid));
+
+    // keep the refined plane if it supports at least as many points as the sampled one
+    std::vector<int> sampledInliers;
+    sampledInliers.swap(inliers);
+    model = refinedModel;
+    selectInliers();
+    if(inliers.size() >= sampledInliers.size())
+    {
+        std::copy(refinedModel, refinedModel + 4, coefficients);
+    }
+    else
+    {
+        inliers.swap(sampledInliers);
+        std::copy(bestModel, bestModel + 4, coefficients);
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelPlaneSegmentation.h
+ * @brief Header file for the ParallelPlaneSegmentation class
+ *
+ * This class extracts multiple planes from a point cloud with a multithreaded RANSAC
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PARALLELPLANESEGMENTATION_H
+#define PARALLELPLANESEGMENTATION_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/PointIndices.h>
+#include <pcl/ModelCoefficients.h>
+
+#include <cstdint>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class ParallelPlaneSegmentation
+ *
+ * @brief Class for extracting the dominant planes of a point cloud using multiple threads
+ *
+ * Planes are found one at a time with RANSAC. Each round draws a fixed size batch of plane hypotheses and scores them
+ * on all threads, stopping once the number of rounds reaches the count needed for the requested confidence given the best
+ * inlier ratio so far, or the iteration limit. The winning plane is refit to its inliers by least squares, its inliers
+ * are removed, and the search repeats on the remaining points until the plane limit is reached or no plane has enough
+ * inliers. Hypotheses are seeded by their index and the round size does not depend on the number of threads, so
+ * neither does the result.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ParallelPlaneSegmentation
+{
+private:
+
+    // input data and settings
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr m_cloud;
+    double m_distanceThreshold;
+    int m_maxIterations;
+    double m_probability;
+    int m_maxPlanes;
+    int m_minInliers;
+    int m_numThreads;
+    uint64_t m_seed;
+
+    // helper functions
+    bool findPlane(const std::vector<float> &xyz, uint64_t seed, std::vector<int> &inliers, float coefficients[4]);
+
+public:
+
+    // constructors
+    ParallelPlaneSegmentation();
+
+    // settings
+    void setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud);
+    void setDistanceThreshold(double distanceThreshold);
+    void setMaxIterations(int maxIterations);
+    void setProbability(double probability);
+    void setMaxPlanes(int maxPlanes);
+    void setMinInliers(int minInliers);
+    void setNumberOfThreads(int numThreads);
+    void setSeed(uint64_t seed);
+
+    // processing
+    void segment(std::vector<pcl::PointIndices> &planeInliers, std::vector<pcl::ModelCoefficients> &planeCoefficients);
+};
+
+#endif // PARALLELPLANESEGMENTATION_H
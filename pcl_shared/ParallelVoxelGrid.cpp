@@ -0,0 +1,318 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelVoxelGrid.cpp
+ * @brief Implementation file for the ParallelVoxelGrid class
+ *
+ * This class provides a multithreaded replacement for pcl::VoxelGrid
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "ParallelVoxelGrid.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+/*******************************************************************************************************************//**
+ * @struct VoxelAccumulator
+ * @brief Running sums for the points that fall into one voxel
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+struct VoxelAccumulator
+{
+    double x;
+    double y;
+    double z;
+    uint64_t r;
+    uint64_t g;
+    uint64_t b;
+    uint32_t count;
+
+    VoxelAccumulator() : x(0), y(0), z(0), r(0), g(0), b(0), count(0) {}
+
+    void add(const pcl::PointXYZRGBA &p)
+    {
+        x += p.x;
+        y += p.y;
+        z += p.z;
+        r += p.r;
+        g += p.g;
+        b += p.b;
+        count++;
+    }
+
+    void add(const VoxelAccumulator &other)
+    {
+        x += other.x;
+        y += other.y;
+        z += other.z;
+        r += other.r;
+        g += other.g;
+        b += other.b;
+        count += other.count;
+    }
+};
+
+typedef std::unordered_map<uint64_t, VoxelAccumulator> VoxelTable;
+
+/***********************************************************************************************************************
+ * @brief Assign a voxel table partition to a key
+ * @param[in] key the voxel key
+ * @param[in] numPartitions the number of partitions
+ * @return the partition index
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline size_t getPartition(uint64_t key, size_t numPartitions)
+{
+    // mix the key bits so that neighboring voxels spread evenly across partitions
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key % numPartitions);
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+ParallelVoxelGrid::ParallelVoxelGrid()
+{
+    m_leafSize[0] = 0.0f;
+    m_leafSize[1] = 0.0f;
+    m_leafSize[2] = 0.0f;
+    m_minPointsPerVoxel = 0;
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the cloud to be downsampled
+ * @param[in] cloud pointer to the input point cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelVoxelGrid::setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud)
+{
+    m_cloud = cloud;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the voxel dimensions
+ * @param[in] leafSizeX the voxel size along the x axis
+ * @param[in] leafSizeY the voxel size along the y axis
+ * @param[in] leafSizeZ the voxel size along the z axis
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelVoxelGrid::setLeafSize(float leafSizeX, float leafSizeY, float leafSizeZ)
+{
+    m_leafSize[0] = leafSizeX;
+    m_leafSize[1] = leafSizeY;
+    m_leafSize[2] = leafSizeZ;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the minimum number of points a voxel needs to produce an output point
+ * @param[in] minPointsPerVoxel the minimum number of points (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelVoxelGrid::setMinimumPointsNumberPerVoxel(unsigned int minPointsPerVoxel)
+{
+    m_minPointsPerVoxel = minPointsPerVoxel;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelVoxelGrid::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Downsample the input cloud
+ *
+ * Replaces the points in each occupied voxel with their centroid. Non-finite points are ignored.
+ *
+ * @param[out] cloudOut the downsampled point cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void ParallelVoxelGrid::filter(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut)
+{
+    cloudOut.points.clear();
+    cloudOut.width = 0;
+    cloudOut.height = 1;
+    cloudOut.is_dense = true;
+    if(!m_cloud || m_cloud->points.empty() || m_leafSize[0] <= 0.0f || m_leafSize[1] <= 0.0f || m_leafSize[2] <= 0.0f)
+    {
+        return;
+    }
+    cloudOut.sensor_origin_ = m_cloud->sensor_origin_;
+    cloudOut.sensor_orientation_ = m_cloud->sensor_orientation_;
+    const pcl::PointCloud<pcl::PointXYZRGBA> &cloudIn = *m_cloud;
+    const size_t numThreads = static_cast<size_t>(getThreadCount(m_numThreads));
+
+    // compute the bounding box of the finite points, one partial result per thread
+    const float maxFloat = std::numeric_limits<float>::max();
+    std::vector<float> threadMin(numThreads * 3, maxFloat);
+    std::vector<float> threadMax(numThreads * 3, -maxFloat);
+    parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        float* minPt = &threadMin[threadIndex * 3];
+        float* maxPt = &threadMax[threadIndex * 3];
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[i];
+            if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+            {
+                continue;
+            }
+            minPt[0] = std::min(minPt[0], p.x);
+            minPt[1] = std::min(minPt[1], p.y);
+            minPt[2] = std::min(minPt[2], p.z);
+            maxPt[0] = std::max(maxPt[0], p.x);
+            maxPt[1] = std::max(maxPt[1], p.y);
+            maxPt[2] = std::max(maxPt[2], p.z);
+        }
+    }, m_numThreads);
+    float minPt[3] = {maxFloat, maxFloat, maxFloat};
+    float maxPt[3] = {-maxFloat, -maxFloat, -maxFloat};
+    for(size_t t = 0; t < numThreads; t++)
+    {
+        for(int d = 0; d < 3; d++)
+        {
+            minPt[d] = std::min(minPt[d], threadMin[t * 3 + d]);
+            maxPt[d] = std::max(maxPt[d], threadMax[t * 3 + d]);
+        }
+    }
+    if(minPt[0] > maxPt[0])
+    {
+        return;
+    }
+
+    // check that the voxel indices fit in an int, and compute the voxel grid bounds, the same way as pcl::VoxelGrid
+    float inverseLeafSize[3];
+    int64_t gridExtent[3];
+    for(int d = 0; d < 3; d++)
+    {
+        inverseLeafSize[d] = 1.0f / m_leafSize[d];
+        gridExtent[d] = static_cast<int64_t>((maxPt[d] - minPt[d]) * inverseLeafSize[d]) + 1;
+    }
+    if(gridExtent[0] * gridExtent[1] * gridExtent[2] > static_cast<int64_t>(std::numeric_limits<int32_t>::max()))
+    {
+        PCL_WARN("[ParallelVoxelGrid::filter] Leaf size is too small for the input dataset. Integer indices would overflow.\n");
+        cloudOut = *m_cloud;
+        return;
+    }
+    int minVoxel[3];
+    int gridSize[3];
+    for(int d = 0; d < 3; d++)
+    {
+        minVoxel[d] = static_cast<int>(std::floor(minPt[d] * inverseLeafSize[d]));
+        gridSize[d] = static_cast<int>(std::floor(maxPt[d] * inverseLeafSize[d])) - minVoxel[d] + 1;
+    }
+    const uint64_t strideY = static_cast<uint64_t>(gridSize[0]);
+    const uint64_t strideZ = static_cast<uint64_t>(gridSize[0]) * static_cast<uint64_t>(gridSize[1]);
+
+    // reduce each block of points into per-thread voxel tables, split into one partition per merge thread
+    std::vector<std::vector<VoxelTable> > threadTables(numThreads, std::vector<VoxelTable>(numThreads));
+    parallelFor(0, cloudIn.points.size(), [&](size_t blockBegin, size_t blockEnd, int threadIndex)
+    {
+        std::vector<VoxelTable> &tables = threadTables[threadIndex];
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloudIn.points[i];
+            if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+            {
+                continue;
+            }
+
+            // the same float floor and int conversion as pcl::VoxelGrid, so points on a voxel boundary match
+            int i0 = static_cast<int>(std::floor(p.x * inverseLeafSize[0]) - static_cast<float>(minVoxel[0]));
+            int i1 = static_cast<int>(std::floor(p.y * inverseLeafSize[1]) - static_cast<float>(minVoxel[1]));
+            int i2 = static_cast<int>(std::floor(p.z * inverseLeafSize[2]) - static_cast<float>(minVoxel[2]));
+            uint64_t key = static_cast<uint64_t>(i0) + static_cast<uint64_t>(i1) * strideY + static_cast<uint64_t>(i2) * strideZ;
+            tables[getPartition(key, numThreads)][key].add(p);
+        }
+    }, m_numThreads);
+
+    // merge the partitions in parallel, each partition holds a disjoint set of keys
+    std::vector<std::vector<std::pair<uint64_t, VoxelAccumulator> > > partitionVoxels(numThreads);
+    parallelFor(0, numThreads, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t partition = blockBegin; partition < blockEnd; partition++)
+        {
+            VoxelTable merged;
+            merged.swap(threadTables[0][partition]);
+            for(size_t t = 1; t < numThreads; t++)
+            {
+                VoxelTable &table = threadTables[t][partition];
+                for(VoxelTable::const_iterator it = table.begin(); it != table.end(); ++it)
+                {
+                    merged[it->first].add(it->second);
+                }
+                VoxelTable().swap(table);
+            }
+            std::vector<std::pair<uint64_t, VoxelAccumulator> > &voxels = partitionVoxels[partition];
+            voxels.reserve(merged.size());
+            for(VoxelTable::const_iterator it = merged.begin(); it != merged.end(); ++it)
+            {
+                if(it->second.count >= m_minPointsPerVoxel)
+                {
+                    voxels.push_back(*it);
+                }
+            }
+        }
+    }, m_numThreads, 1);
+
+    // order the voxels by index to match the output order of pcl::VoxelGrid
+    std::vector<std::pair<uint64_t, VoxelAccumulator> > voxels;
+    for(size_t partition = 0; partition < numThreads; partition++)
+    {
+        voxels.insert(voxels.end(), partitionVoxels[partition].begin(), partitionVoxels[partition].end());
+        std::vector<std::pair<uint64_t, VoxelAccumulator> >().swap(partitionVoxels[partition]);
+    }
+    std::sort(voxels.begin(), voxels.end(), [](const std::pair<uint64_t, VoxelAccumulator> &a, const std::pair<uint64_t, VoxelAccumulator> &b)
+    {
+        return a.first < b.first;
+    });
+
+    // compute the centroid and mean color of each voxel, leaving alpha zero as pcl::VoxelGrid packs only r, g and b
+    cloudOut.points.resize(voxels.size());
+    cloudOut.width = static_cast<uint32_t>(voxels.size());
+    parallelFor(0, voxels.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            const VoxelAccumulator &voxel = voxels[i].second;
+            pcl::PointXYZRGBA &p = cloudOut.points[i];
+            p.x = static_cast<float>(voxel.x / voxel.count);
+            p.y = static_cast<float>(voxel.y / voxel.count);
+            p.z = static_cast<float>(voxel.z / voxel.count);
+            p.r = static_cast<uint8_t>(voxel.r / voxel.count);
+            p.g = static_cast<uint8_t>(voxel.g / voxel.count);
+            p.b = static_cast<uint8_t>(voxel.b / voxel.count);
+            p.a = 0;
+        }
+    }, m_numThreads);
+}
@@ -0,0 +1,73 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file ParallelVoxelGrid.h
+ * @brief Header file for the ParallelVoxelGrid class
+ *
+ * This class provides a multithreaded replacement for pcl::VoxelGrid
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef PARALLELVOXELGRID_H
+#define PARALLELVOXELGRID_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class ParallelVoxelGrid
+ *
+ * @brief Class for downsampling a point cloud to voxel centroids using multiple threads
+ *
+ * Follows pcl::VoxelGrid<pcl::PointXYZRGBA> with the same leaf size: voxel indices use the same float floor and grid
+ * overflow check, and there is one point per occupied voxel ordered by voxel index, with r, g and b set to the
+ * truncated mean of the channel and alpha left zero. Centroids are summed in double precision rather than float, so
+ * they can differ from those of pcl::VoxelGrid in the last bits. Each thread reduces its block of points into its own
+ * voxel tables, and the tables are merged in parallel by key partition.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class ParallelVoxelGrid
+{
+private:
+
+    // input data and settings
+    pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr m_cloud;
+    float m_leafSize[3];
+    unsigned int m_minPointsPerVoxel;
+    int m_numThreads;
+
+public:
+
+    // constructors
+    ParallelVoxelGrid();
+
+    // settings
+    void setInputCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud);
+    void setLeafSize(float leafSizeX, float leafSizeY, float leafSizeZ);
+    void setMinimumPointsNumberPerVoxel(unsigned int minPointsPerVoxel);
+    void setNumberOfThreads(int numThreads);
+
+    // processing
+    void filter(pcl::PointCloud<pcl::PointXYZRGBA> &cloudOut);
+};
+
+#endif // PARALLELVOXELGRID_H
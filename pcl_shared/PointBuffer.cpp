@@ -0,0 +1,392 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file PointBuffer.cpp
+ * @brief Implementation file for the PointBuffer class
+ *
+ * This class stores the channels of a point cloud in separate arrays for vectorized processing
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "PointBuffer.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// smallest number of points worth giving a conversion thread
+#define MIN_CONVERSION_BLOCK 65536
+
+// number of points colored from one random seed, so the colors do not depend on the number of threads
+#define RANDOM_BLOCK_SIZE 4096
+
+// mask of the color bits of a packed rgba value
+#define RGB_MASK 0x00FFFFFFu
+
+/***********************************************************************************************************************
+ * @brief Hash a 64 bit value into a well mixed pseudorandom 64 bit value (splitmix64)
+ * @param[in] value the value to hash
+ * @return the hashed value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static uint64_t mixBits(uint64_t value)
+{
+    uint64_t z = value + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/***********************************************************************************************************************
+ * @brief Advance a xorshift32 generator
+ * @param[in] state the generator state, which must not be zero
+ * @return the next state
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline uint32_t nextXorshift(uint32_t state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+PointBuffer::PointBuffer()
+{
+    m_numThreads = 0;
+}
+
+/***********************************************************************************************************************
+ * @brief Set the number of worker threads used by conversions and kernels
+ * @param[in] numThreads the number of threads to use, or 0 to use all hardware threads (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::setNumberOfThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+/***********************************************************************************************************************
+ * @brief Resize all channel arrays
+ * @param[in] numPoints the number of points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::resize(size_t numPoints)
+{
+    m_x.resize(numPoints);
+    m_y.resize(numPoints);
+    m_z.resize(numPoints);
+    m_rgba.resize(numPoints);
+}
+
+/***********************************************************************************************************************
+ * @brief Get the number of points
+ * @return the number of points
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+size_t PointBuffer::size() const
+{
+    return m_rgba.size();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the channel arrays
+ * @return pointer to the first element of the channel
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+float* PointBuffer::x()
+{
+    return m_x.data();
+}
+
+float* PointBuffer::y()
+{
+    return m_y.data();
+}
+
+float* PointBuffer::z()
+{
+    return m_z.data();
+}
+
+uint32_t* PointBuffer::rgba()
+{
+    return m_rgba.data();
+}
+
+const float* PointBuffer::x() const
+{
+    return m_x.data();
+}
+
+const float* PointBuffer::y() const
+{
+    return m_y.data();
+}
+
+const float* PointBuffer::z() const
+{
+    return m_z.data();
+}
+
+const uint32_t* PointBuffer::rgba() const
+{
+    return m_rgba.data();
+}
+
+/***********************************************************************************************************************
+ * @brief Copy all channels of a cloud into the buffer
+ * @param[in] cloud the cloud to copy
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::fromCloud(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud)
+{
+    resize(cloud.points.size());
+    parallelFor(0, cloud.points.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        size_t i = blockBegin;
+#ifdef __SSE2__
+        // transpose four points at a time into the coordinate arrays
+        for(; i + 4 <= blockEnd; i += 4)
+        {
+            __m128 p0 = _mm_loadu_ps(cloud.points[i].data);
+            __m128 p1 = _mm_loadu_ps(cloud.points[i + 1].data);
+            __m128 p2 = _mm_loadu_ps(cloud.points[i + 2].data);
+            __m128 p3 = _mm_loadu_ps(cloud.points[i + 3].data);
+            _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+            _mm_storeu_ps(&m_x[i], p0);
+            _mm_storeu_ps(&m_y[i], p1);
+            _mm_storeu_ps(&m_z[i], p2);
+            m_rgba[i] = cloud.points[i].rgba;
+            m_rgba[i + 1] = cloud.points[i + 1].rgba;
+            m_rgba[i + 2] = cloud.points[i + 2].rgba;
+            m_rgba[i + 3] = cloud.points[i + 3].rgba;
+        }
+#endif
+        for(; i < blockEnd; i++)
+        {
+            const pcl::PointXYZRGBA &p = cloud.points[i];
+            m_x[i] = p.x;
+            m_y[i] = p.y;
+            m_z[i] = p.z;
+            m_rgba[i] = p.rgba;
+        }
+    }, m_numThreads, MIN_CONVERSION_BLOCK);
+}
+
+/***********************************************************************************************************************
+ * @brief Copy all channels of the buffer into a cloud, which is resized to the buffer
+ *
+ * Only the point data is written, the cloud keeps its header, organization and sensor pose unless it is resized.
+ *
+ * @param[out] cloud the cloud to fill
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::toCloud(pcl::PointCloud<pcl::PointXYZRGBA> &cloud) const
+{
+    if(cloud.points.size() != size())
+    {
+        cloud.points.resize(size());
+        cloud.width = static_cast<uint32_t>(size());
+        cloud.height = 1;
+    }
+    parallelFor(0, size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        size_t i = blockBegin;
+#ifdef __SSE2__
+        // transpose four points at a time out of the coordinate arrays
+        const __m128 one = _mm_set1_ps(1.0f);
+        for(; i + 4 <= blockEnd; i += 4)
+        {
+            __m128 p0 = _mm_loadu_ps(&m_x[i]);
+            __m128 p1 = _mm_loadu_ps(&m_y[i]);
+            __m128 p2 = _mm_loadu_ps(&m_z[i]);
+            __m128 p3 = one;
+            _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+            _mm_storeu_ps(cloud.points[i].data, p0);
+            _mm_storeu_ps(cloud.points[i + 1].data, p1);
+            _mm_storeu_ps(cloud.points[i + 2].data, p2);
+            _mm_storeu_ps(cloud.points[i + 3].data, p3);
+            cloud.points[i].rgba = m_rgba[i];
+            cloud.points[i + 1].rgba = m_rgba[i + 1];
+            cloud.points[i + 2].rgba = m_rgba[i + 2];
+            cloud.points[i + 3].rgba = m_rgba[i + 3];
+        }
+#endif
+        for(; i < blockEnd; i++)
+        {
+            pcl::PointXYZRGBA &p = cloud.points[i];
+            p.x = m_x[i];
+            p.y = m_y[i];
+            p.z = m_z[i];
+            p.data[3] = 1.0f;
+            p.rgba = m_rgba[i];
+        }
+    }, m_numThreads, MIN_CONVERSION_BLOCK);
+}
+
+/***********************************************************************************************************************
+ * @brief Copy only the colors of a cloud into the buffer
+ *
+ * Only the color array is sized to the cloud. The coordinate arrays are emptied rather than allocated, so recoloring
+ * touches 4 bytes per point, and must be filled with fromCloud() before any kernel reads them.
+ *
+ * @param[in] cloud the cloud to copy
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::loadColors(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud)
+{
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_rgba.resize(cloud.points.size());
+    parallelFor(0, cloud.points.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            m_rgba[i] = cloud.points[i].rgba;
+        }
+    }, m_numThreads, MIN_CONVERSION_BLOCK);
+}
+
+/***********************************************************************************************************************
+ * @brief Copy only the colors of the buffer into a cloud of the same size
+ * @param[in,out] cloud the cloud to recolor
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::storeColors(pcl::PointCloud<pcl::PointXYZRGBA> &cloud) const
+{
+    if(cloud.points.size() != size())
+    {
+        PCL_ERROR("[PointBuffer::storeColors] Cloud has %zu points, but the buffer has %zu.\n", cloud.points.size(), size());
+        return;
+    }
+    parallelFor(0, size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            cloud.points[i].rgba = m_rgba[i];
+        }
+    }, m_numThreads, MIN_CONVERSION_BLOCK);
+}
+
+/***********************************************************************************************************************
+ * @brief Set the color of a list of points, keeping their alpha values
+ * @param[in] indices the indices of the points to color, which must be unique
+ * @param[in] r the red value
+ * @param[in] g the green value
+ * @param[in] b the blue value
+ * @throw std::out_of_range if an index is outside the buffer, before any point is colored
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::setColor(const std::vector<int> &indices, uint8_t r, uint8_t g, uint8_t b)
+{
+    // check the indices up front as std::vector::at did, since the worker threads cannot throw
+    for(size_t i = 0; i < indices.size(); i++)
+    {
+        if(indices[i] < 0 || static_cast<size_t>(indices[i]) >= m_rgba.size())
+        {
+            throw std::out_of_range("PointBuffer::setColor: point index out of range");
+        }
+    }
+
+    const uint32_t color = packColor(r, g, b, 0);
+    uint32_t* rgba = m_rgba.data();
+    const int* index = indices.data();
+    parallelFor(0, indices.size(), [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t i = blockBegin; i < blockEnd; i++)
+        {
+            uint32_t &value = rgba[index[i]];
+            value = (value & ~RGB_MASK) | color;
+        }
+    }, m_numThreads, MIN_CONVERSION_BLOCK);
+}
+
+/***********************************************************************************************************************
+ * @brief Set every point to a pseudorandom color, keeping their alpha values
+ *
+ * Each block of points runs four xorshift generators seeded from the block index, one per SIMD lane, so the result
+ * depends only on the seed.
+ *
+ * @param[in] seed the random seed
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void PointBuffer::randomizeColors(uint64_t seed)
+{
+    const size_t numBlocks = (size() + RANDOM_BLOCK_SIZE - 1) / RANDOM_BLOCK_SIZE;
+    parallelFor(0, numBlocks, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t block = blockBegin; block < blockEnd; block++)
+        {
+            // seed one generator per lane, xorshift states must not be zero
+            uint64_t bits[2] = {mixBits(seed ^ (2 * block)), mixBits(seed ^ (2 * block + 1))};
+            uint32_t state[4];
+            for(int lane = 0; lane < 4; lane++)
+            {
+                state[lane] = static_cast<uint32_t>(bits[lane / 2] >> (32 * (lane % 2))) | 1u;
+            }
+
+            size_t i = block * RANDOM_BLOCK_SIZE;
+            const size_t end = std::min(i + RANDOM_BLOCK_SIZE, size());
+#ifdef __SSE2__
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+            const __m128i rgbMask = _mm_set1_epi32(static_cast<int>(RGB_MASK));
+            for(; i + 4 <= end; i += 4)
+            {
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+                s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+                __m128i* target = reinterpret_cast<__m128i*>(&m_rgba[i]);
+                __m128i alpha = _mm_andnot_si128(rgbMask, _mm_loadu_si128(target));
+                _mm_storeu_si128(target, _mm_or_si128(alpha, _mm_and_si128(s, rgbMask)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state), s);
+#endif
+            for(int lane = 0; i < end; i++, lane = (lane + 1) % 4)
+            {
+                state[lane] = nextXorshift(state[lane]);
+                m_rgba[i] = (m_rgba[i] & ~RGB_MASK) | (state[lane] & RGB_MASK);
+            }
+        }
+    }, m_numThreads, 1);
+}
+
+/***********************************************************************************************************************
+ * @brief Pack color channels into the rgba layout of PointXYZRGBA
+ * @param[in] r the red value
+ * @param[in] g the green value
+ * @param[in] b the blue value
+ * @param[in] a the alpha value (default: 255)
+ * @return the packed color
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint32_t PointBuffer::packColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | static_cast<uint32_t>(b);
+}
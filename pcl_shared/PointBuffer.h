@@ -0,0 +1,93 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file PointBuffer.h
+ * @brief Header file for the PointBuffer class
+ *
+ * This class stores the channels of a point cloud in separate arrays for vectorized processing
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef POINTBUFFER_H
+#define POINTBUFFER_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class PointBuffer
+ *
+ * @brief Structure of arrays container for PointXYZRGBA data
+ *
+ * The x, y and z coordinates and the packed rgba colors are kept in separate 16 byte aligned arrays, so kernels that
+ * touch one channel stream through contiguous memory instead of striding over 32 byte points. Conversions to and from a
+ * cloud run on multiple threads, and the color channel can be converted on its own so that recoloring kernels do not
+ * move the coordinates. Buffers keep their storage between conversions.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class PointBuffer
+{
+private:
+
+    // channel arrays
+    std::vector<float, Eigen::aligned_allocator<float> > m_x;
+    std::vector<float, Eigen::aligned_allocator<float> > m_y;
+    std::vector<float, Eigen::aligned_allocator<float> > m_z;
+    std::vector<uint32_t, Eigen::aligned_allocator<uint32_t> > m_rgba;
+
+    // settings
+    int m_numThreads;
+
+public:
+
+    // constructors
+    PointBuffer();
+
+    // settings
+    void setNumberOfThreads(int numThreads);
+
+    // storage
+    void resize(size_t numPoints);
+    size_t size() const;
+    float* x();
+    float* y();
+    float* z();
+    uint32_t* rgba();
+    const float* x() const;
+    const float* y() const;
+    const float* z() const;
+    const uint32_t* rgba() const;
+
+    // conversion
+    void fromCloud(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud);
+    void toCloud(pcl::PointCloud<pcl::PointXYZRGBA> &cloud) const;
+    void loadColors(const pcl::PointCloud<pcl::PointXYZRGBA> &cloud);
+    void storeColors(pcl::PointCloud<pcl::PointXYZRGBA> &cloud) const;
+
+    // kernels
+    void setColor(const std::vector<int> &indices, uint8_t r, uint8_t g, uint8_t b);
+    void randomizeColors(uint64_t seed);
+    static uint32_t packColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a=255);
+};
+
+#endif // POINTBUFFER_H
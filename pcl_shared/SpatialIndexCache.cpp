@@ -0,0 +1,444 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file SpatialIndexCache.cpp
+ * @brief Implementation file for the SpatialIndexCache class
+ *
+ * This class stores spatial search structures on disk next to the cloud file they were built from
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#include "SpatialIndexCache.h"
+#include "ParallelFor.h"
+
+#include <pcl/console/print.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// cache file identification
+#define CACHE_FILE_MAGIC "PCLIDX02"
+#define CACHE_FILE_EXTENSION ".idx"
+
+// index types stored in the cache file header
+#define INDEX_TYPE_KDTREE 1
+#define INDEX_TYPE_OCTREE 2
+
+// size of the file segments hashed independently by each thread
+#define HASH_SEGMENT_SIZE (64 * 1024 * 1024)
+
+// hash constants
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+
+/*******************************************************************************************************************//**
+ * @brief Header stored at the start of every cache file
+ **********************************************************************************************************************/
+struct CacheFileHeader
+{
+    char magic[8];
+    uint32_t indexType;
+    uint32_t reserved;
+    uint64_t contentHash;
+    uint64_t fileSize;
+    uint64_t payloadSize;
+};
+
+/***********************************************************************************************************************
+ * @brief Mix a 64 bit word into a hash lane
+ * @param[in] lane the current lane value
+ * @param[in] word the word to mix in
+ * @return the updated lane value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline uint64_t mixWord(uint64_t lane, uint64_t word)
+{
+    lane ^= word * HASH_PRIME_2;
+    lane = (lane << 31) | (lane >> 33);
+    return lane * HASH_PRIME_1;
+}
+
+/***********************************************************************************************************************
+ * @brief Finalize a hash value so that every input bit affects every output bit
+ * @param[in] hash the hash value
+ * @return the finalized hash value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static inline uint64_t finalizeHash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/***********************************************************************************************************************
+ * @brief Hash a buffer using four independent lanes over 32 byte stripes
+ * @param[in] data pointer to the buffer
+ * @param[in] size the number of bytes to hash
+ * @return the hash value
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static uint64_t hashBuffer(const uint8_t* data, size_t size)
+{
+    uint64_t lanes[4] = {HASH_PRIME_1, HASH_PRIME_2, HASH_PRIME_1 ^ HASH_PRIME_2, ~HASH_PRIME_1};
+    size_t offset = 0;
+    for(; offset + 32 <= size; offset += 32)
+    {
+        uint64_t words[4];
+        std::memcpy(words, data + offset, sizeof(words));
+        lanes[0] = mixWord(lanes[0], words[0]);
+        lanes[1] = mixWord(lanes[1], words[1]);
+        lanes[2] = mixWord(lanes[2], words[2]);
+        lanes[3] = mixWord(lanes[3], words[3]);
+    }
+    uint64_t hash = static_cast<uint64_t>(size);
+    for(int i = 0; i < 4; i++)
+    {
+        hash = mixWord(hash, lanes[i]);
+    }
+    for(; offset < size; offset++)
+    {
+        hash = mixWord(hash, data[offset]);
+    }
+    return finalizeHash(hash);
+}
+
+/***********************************************************************************************************************
+ * @brief Class constructor, hashes the cloud file
+ * @param[in] cloudFileName path and name of the cloud file
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+SpatialIndexCache::SpatialIndexCache(const std::string &cloudFileName)
+{
+    m_cloudFileName = cloudFileName;
+    m_contentHash = 0;
+    m_fileSize = 0;
+    m_hashValid = computeFileHash(cloudFileName, m_contentHash, m_fileSize);
+}
+
+/***********************************************************************************************************************
+ * @brief Check whether the cloud file could be hashed, which is required to load or save indices
+ * @return true if the cache can be used
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::isValid() const
+{
+    return m_hashValid;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the content hash of the cloud file
+ * @return the 64 bit hash
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+uint64_t SpatialIndexCache::getContentHash() const
+{
+    return m_contentHash;
+}
+
+/***********************************************************************************************************************
+ * @brief Get the path of the cache file for an index
+ * @param[in] indexName the name of the index
+ * @return the cache file path
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+std::string SpatialIndexCache::getCacheFileName(const std::string &indexName) const
+{
+    return m_cloudFileName + "." + indexName + CACHE_FILE_EXTENSION;
+}
+
+/***********************************************************************************************************************
+ * @brief Hash the contents of a file
+ *
+ * The file is memory mapped and split into fixed size segments that are hashed in parallel, then the segment hashes
+ * are combined in order, so the result does not depend on the number of threads
+ *
+ * @param[in] fileName path and name of the file
+ * @param[out] hash the 64 bit content hash
+ * @param[out] fileSize the file size in bytes
+ * @return false if the file could not be read
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::computeFileHash(const std::string &fileName, uint64_t &hash, uint64_t &fileSize)
+{
+    // open the file and get its size
+    int fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+    if(fileDescriptor < 0)
+    {
+        PCL_ERROR("error while attempting to open file for hashing: %s \n", fileName.c_str());
+        return false;
+    }
+    struct stat fileStats;
+    if(fstat(fileDescriptor, &fileStats) != 0 || fileStats.st_size == 0)
+    {
+        PCL_ERROR("error while attempting to stat file for hashing: %s \n", fileName.c_str());
+        ::close(fileDescriptor);
+        return false;
+    }
+    size_t size = static_cast<size_t>(fileStats.st_size);
+
+    // map the whole file
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    ::close(fileDescriptor);
+    if(mapping == MAP_FAILED)
+    {
+        PCL_ERROR("error while attempting to map file for hashing: %s \n", fileName.c_str());
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    const uint8_t* data = static_cast<const uint8_t*>(mapping);
+
+    // hash the segments in parallel
+    size_t numSegments = (size + HASH_SEGMENT_SIZE - 1) / HASH_SEGMENT_SIZE;
+    std::vector<uint64_t> segmentHashes(numSegments);
+    parallelFor(0, numSegments, [&](size_t blockBegin, size_t blockEnd, int)
+    {
+        for(size_t s = blockBegin; s < blockEnd; s++)
+        {
+            size_t offset = s * HASH_SEGMENT_SIZE;
+            segmentHashes[s] = hashBuffer(data + offset, std::min<size_t>(HASH_SEGMENT_SIZE, size - offset));
+        }
+    }, 0, 1);
+    munmap(mapping, size);
+
+    // combine the segment hashes in order
+    hash = static_cast<uint64_t>(size);
+    for(size_t s = 0; s < numSegments; s++)
+    {
+        hash = mixWord(hash, segmentHashes[s]);
+    }
+    hash = finalizeHash(hash);
+    fileSize = static_cast<uint64_t>(size);
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Read the payload of a cache file, checking that it matches the current cloud file
+ * @param[in] indexName the name of the index
+ * @param[in] indexType the expected index type
+ * @param[out] payload the index data
+ * @return false if the cache file is missing, malformed or stale
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::readCacheFile(const std::string &indexName, uint32_t indexType, std::vector<char> &payload) const
+{
+    if(!m_hashValid)
+    {
+        return false;
+    }
+    std::ifstream file(getCacheFileName(indexName).c_str(), std::ios::binary);
+    if(!file.is_open())
+    {
+        return false;
+    }
+
+    // validate the header against the cloud file
+    CacheFileHeader header;
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    if(std::memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.indexType != indexType)
+    {
+        PCL_WARN("ignoring unrecognized index cache file: %s \n", getCacheFileName(indexName).c_str());
+        return false;
+    }
+    if(header.contentHash != m_contentHash || header.fileSize != m_fileSize)
+    {
+        PCL_WARN("ignoring stale index cache file: %s \n", getCacheFileName(indexName).c_str());
+        return false;
+    }
+
+    // read the payload
+    payload.resize(static_cast<size_t>(header.payloadSize));
+    if(!payload.empty() && !file.read(&payload[0], static_cast<std::streamsize>(payload.size())))
+    {
+        PCL_WARN("ignoring truncated index cache file: %s \n", getCacheFileName(indexName).c_str());
+        return false;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Write a cache file, replacing any previous version
+ *
+ * The data is written to a temporary file that is renamed into place, so a concurrent reader never sees a partial file
+ *
+ * @param[in] indexName the name of the index
+ * @param[in] indexType the index type
+ * @param[in] payload the index data
+ * @return false if the file could not be written
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::writeCacheFile(const std::string &indexName, uint32_t indexType, const std::vector<char> &payload) const
+{
+    if(!m_hashValid)
+    {
+        return false;
+    }
+    std::string fileName = getCacheFileName(indexName);
+    std::string tempFileName = fileName + ".tmp";
+
+    // fill in the header
+    CacheFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+    header.indexType = indexType;
+    header.contentHash = m_contentHash;
+    header.fileSize = m_fileSize;
+    header.payloadSize = payload.size();
+
+    // write the temporary file
+    {
+        std::ofstream file(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if(!file.is_open())
+        {
+            PCL_ERROR("error while attempting to write index cache file: %s \n", tempFileName.c_str());
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if(!payload.empty())
+        {
+            file.write(&payload[0], static_cast<std::streamsize>(payload.size()));
+        }
+        if(!file.good())
+        {
+            PCL_ERROR("error while attempting to write index cache file: %s \n", tempFileName.c_str());
+            file.close();
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+    }
+
+    // move it into place
+    if(std::rename(tempFileName.c_str(), fileName.c_str()) != 0)
+    {
+        PCL_ERROR("error while attempting to rename index cache file: %s \n", fileName.c_str());
+        std::remove(tempFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Load a cached kd-tree for a cloud
+ * @param[in] indexName the name of the index
+ * @param[in] cloud pointer to the cloud the tree was built for
+ * @param[out] tree the restored tree, attached to the cloud
+ * @return false if there is no valid cached tree for the cloud
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::loadKdTree(const std::string &indexName, const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, FlatKdTree &tree) const
+{
+    std::vector<char> payload;
+    if(!readCacheFile(indexName, INDEX_TYPE_KDTREE, payload))
+    {
+        return false;
+    }
+    if(!tree.deserializeTree(payload, cloud))
+    {
+        PCL_WARN("ignoring index cache file that does not match the cloud: %s \n", getCacheFileName(indexName).c_str());
+        return false;
+    }
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Save a kd-tree to the cache
+ * @param[in] indexName the name of the index
+ * @param[in] tree the tree to save
+ * @return false if the tree could not be saved
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::saveKdTree(const std::string &indexName, const FlatKdTree &tree) const
+{
+    std::vector<char> payload;
+    tree.serializeTree(payload);
+    return writeCacheFile(indexName, INDEX_TYPE_KDTREE, payload);
+}
+
+/***********************************************************************************************************************
+ * @brief Load a cached octree
+ *
+ * The octree must already be constructed with the resolution it was saved with. The restored tree holds the occupied
+ * leaves only, which is enough for occupancy queries such as getOccupiedVoxelCenters, but not the point indices.
+ *
+ * @param[in] indexName the name of the index
+ * @param[in,out] octree the octree to restore into
+ * @return false if there is no valid cached octree with the same resolution
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::loadOctree(const std::string &indexName, pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> &octree) const
+{
+    std::vector<char> payload;
+    if(!readCacheFile(indexName, INDEX_TYPE_OCTREE, payload))
+    {
+        return false;
+    }
+
+    // read the resolution and bounding box
+    double parameters[7];
+    if(payload.size() < sizeof(parameters))
+    {
+        return false;
+    }
+    std::memcpy(parameters, &payload[0], sizeof(parameters));
+    if(parameters[0] != octree.getResolution())
+    {
+        PCL_WARN("ignoring index cache file with a different octree resolution: %s \n", getCacheFileName(indexName).c_str());
+        return false;
+    }
+
+    // restore the tree structure within the saved bounding box
+    std::vector<char> treeData(payload.begin() + sizeof(parameters), payload.end());
+    octree.deleteTree();
+    octree.defineBoundingBox(parameters[1], parameters[2], parameters[3], parameters[4], parameters[5], parameters[6]);
+    octree.deserializeTree(treeData);
+    return true;
+}
+
+/***********************************************************************************************************************
+ * @brief Save an octree to the cache
+ * @param[in] indexName the name of the index
+ * @param[in] octree the octree to save
+ * @return false if the octree could not be saved
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+bool SpatialIndexCache::saveOctree(const std::string &indexName, pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> &octree) const
+{
+    // store the resolution and bounding box ahead of the tree structure
+    double parameters[7];
+    parameters[0] = octree.getResolution();
+    octree.getBoundingBox(parameters[1], parameters[2], parameters[3], parameters[4], parameters[5], parameters[6]);
+    std::vector<char> treeData;
+    octree.serializeTree(treeData);
+    std::vector<char> payload(sizeof(parameters) + treeData.size());
+    std::memcpy(&payload[0], parameters, sizeof(parameters));
+    std::copy(treeData.begin(), treeData.end(), payload.begin() + sizeof(parameters));
+    return writeCacheFile(indexName, INDEX_TYPE_OCTREE, payload);
+}
@@ -0,0 +1,87 @@
+//
+//    Copyright 2021 Christopher D. McMurrough
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+/*******************************************************************************************************************//**
+ * @file SpatialIndexCache.h
+ * @brief Header file for the SpatialIndexCache class
+ *
+ * This class stores spatial search structures on disk next to the cloud file they were built from
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+
+#ifndef SPATIALINDEXCACHE_H
+#define SPATIALINDEXCACHE_H
+
+#include "FlatKdTree.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/octree/octree.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*******************************************************************************************************************//**
+ * @class SpatialIndexCache
+ *
+ * @brief Class for saving and loading spatial indices built from a cloud file
+ *
+ * Each index is stored as <cloud_file>.<index_name>.idx and tagged with a 64 bit hash of the cloud file contents. A
+ * cached index is only loaded if the tag matches the current file, so an edited or replaced cloud is detected and the
+ * index is rebuilt. The index name should encode any processing applied to the cloud before indexing (such as the
+ * voxel size), since the cache can only check the file it was built from. Files are written in native byte order.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+class SpatialIndexCache
+{
+private:
+
+    // cloud file identity
+    std::string m_cloudFileName;
+    uint64_t m_contentHash;
+    uint64_t m_fileSize;
+    bool m_hashValid;
+
+    // helper functions
+    bool readCacheFile(const std::string &indexName, uint32_t indexType, std::vector<char> &payload) const;
+    bool writeCacheFile(const std::string &indexName, uint32_t indexType, const std::vector<char> &payload) const;
+
+public:
+
+    // constructors
+    SpatialIndexCache(const std::string &cloudFileName);
+
+    // accessors
+    bool isValid() const;
+    uint64_t getContentHash() const;
+    std::string getCacheFileName(const std::string &indexName) const;
+
+    // kd-tree caching
+    bool loadKdTree(const std::string &indexName, const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, FlatKdTree &tree) const;
+    bool saveKdTree(const std::string &indexName, const FlatKdTree &tree) const;
+
+    // octree caching
+    bool loadOctree(const std::string &indexName, pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> &octree) const;
+    bool saveOctree(const std::string &indexName, pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> &octree) const;
+
+    // static functions
+    static bool computeFileHash(const std::string &fileName, uint64_t &hash, uint64_t &fileSize);
+};
+
+#endif // SPATIALINDEXCACHE_H
@@ -24,13 +24,37 @@
  **********************************************************************************************************************/
 
 #include "CloudVisualizer.h"
+#include "SpatialIndexCache.h"
 
 #include <pcl/visualization/pcl_visualizer.h>
+#include <pcl/visualization/common/common.h>
 #include <pcl/octree/octree.h>
 #include <Eigen/Core>
 
+#include <vtkSmartPointer.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkCubeSource.h>
+#include <vtkSphereSource.h>
+#include <vtkGlyph3D.h>
+#include <vtkFloatArray.h>
+#include <vtkUnsignedCharArray.h>
+#include <vtkCellArray.h>
+#include <vtkPointData.h>
+#include <vtkDataSetMapper.h>
+#include <vtkPolyDataMapper.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <vector>
+
 using namespace std;
 
+// function prototypes
+static vtkSmartPointer<vtkPolyData> createVoxelGlyphs(const pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::AlignedPointTVector &centers, vtkAlgorithmOutput *glyphSource);
+
 /***********************************************************************************************************************
  * @brief Class constructor
  *
@@ -44,6 +68,25 @@ CloudVisualizer::CloudVisualizer(const string &windowName)
     myViewer.reset(new pcl::visualization::PCLVisualizer(windowName));
     myViewer->initCameraParameters();
     myViewer->setBackgroundColor(0, 0, 0);
+
+    // no level of detail cloud is rendered initially
+    myLODTree = NULL;
+    myLODPointBudget = 0;
+    myLODPointSize = 1.0;
+    myLODMinNodePixels = 0.0;
+    myLODStopRequested = false;
+}
+
+/***********************************************************************************************************************
+ * @brief Class destructor
+ *
+ * Stops the level of detail loader thread, if one is running
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+CloudVisualizer::~CloudVisualizer()
+{
+    removeLODCloud();
 }
 
 /***********************************************************************************************************************
@@ -56,6 +99,7 @@ CloudVisualizer::CloudVisualizer(const string &windowName)
  **********************************************************************************************************************/
 void CloudVisualizer::spin(int maxTimeMs)
 {
+    updateLODCloud();
     myViewer->spinOnce(maxTimeMs);
 }
 
@@ -132,6 +176,415 @@ void CloudVisualizer::updateCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::Cons
     myViewer->updatePointCloud(cloud, id);
 }
 
+/***********************************************************************************************************************
+ * @brief Update a range of points in a rendered cloud
+ *
+ * Patches the positions and colors of a contiguous range of points in place, leaving the rest of the rendered
+ * geometry untouched. The cloud must have the same size as the one previously added with the given id. Points are
+ * matched by cloud index, so invalid points are kept in the geometry with their non-finite coordinates.
+ *
+ * @param[in] cloud the point cloud containing the updated points
+ * @param[in] firstIndex the index of the first changed point
+ * @param[in] numPoints the number of changed points
+ * @param[in] id the unique identifier of the input cloud (default: "cloud")
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::updateCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, size_t firstIndex, size_t numPoints, const string &id)
+{
+    // obtain the indexed geometry of the rendered cloud
+    vtkPolyData *data = getIndexedCloudData(cloud, id);
+    if(data == NULL)
+    {
+        return;
+    }
+
+    // clamp the range to the cloud
+    if(firstIndex >= cloud->size())
+    {
+        return;
+    }
+    size_t lastIndex = std::min(firstIndex + numPoints, cloud->size());
+
+    // patch the changed points
+    float *xyz = vtkFloatArray::SafeDownCast(data->GetPoints()->GetData())->GetPointer(0);
+    vtkUnsignedCharArray *colors = vtkUnsignedCharArray::SafeDownCast(data->GetPointData()->GetScalars());
+    unsigned char *rgb = colors->GetPointer(0);
+    int numComponents = colors->GetNumberOfComponents();
+    for(size_t i = firstIndex; i < lastIndex; i++)
+    {
+        patchPoint(cloud->points[i], xyz + 3 * i, rgb + numComponents * i, numComponents);
+    }
+
+    // flag the geometry for upload
+    data->GetPoints()->Modified();
+    colors->Modified();
+    data->Modified();
+}
+
+/***********************************************************************************************************************
+ * @brief Update a subset of points in a rendered cloud
+ *
+ * Patches the positions and colors of the points flagged in the mask in place, leaving the rest of the rendered
+ * geometry untouched. The cloud must have the same size as the one previously added with the given id.
+ *
+ * @param[in] cloud the point cloud containing the updated points
+ * @param[in] changedMask flags for each cloud point, true where the point has changed
+ * @param[in] id the unique identifier of the input cloud (default: "cloud")
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::updateCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, const std::vector<bool> &changedMask, const string &id)
+{
+    // obtain the indexed geometry of the rendered cloud
+    vtkPolyData *data = getIndexedCloudData(cloud, id);
+    if(data == NULL)
+    {
+        return;
+    }
+
+    // patch the changed points
+    float *xyz = vtkFloatArray::SafeDownCast(data->GetPoints()->GetData())->GetPointer(0);
+    vtkUnsignedCharArray *colors = vtkUnsignedCharArray::SafeDownCast(data->GetPointData()->GetScalars());
+    unsigned char *rgb = colors->GetPointer(0);
+    int numComponents = colors->GetNumberOfComponents();
+    size_t numPoints = std::min(changedMask.size(), cloud->size());
+    for(size_t i = 0; i < numPoints; i++)
+    {
+        if(changedMask[i])
+        {
+            patchPoint(cloud->points[i], xyz + 3 * i, rgb + numComponents * i, numComponents);
+        }
+    }
+
+    // flag the geometry for upload
+    data->GetPoints()->Modified();
+    colors->Modified();
+    data->Modified();
+}
+
+/***********************************************************************************************************************
+ * @brief Get the rendered geometry of a cloud with one vertex per cloud point
+ *
+ * PCL drops invalid points when it converts a cloud that is not dense, so the rendered vertices cannot be matched to
+ * cloud indices. The first time a cloud is updated incrementally, or whenever its size changes, its geometry is
+ * rebuilt with one vertex per cloud point and attached to the existing actor. Later updates reuse the same arrays.
+ *
+ * @param[in] cloud the point cloud being rendered
+ * @param[in] id the unique identifier of the rendered cloud
+ * @return the indexed geometry, or NULL if no cloud with the given id is rendered
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+vtkPolyData* CloudVisualizer::getIndexedCloudData(const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, const string &id)
+{
+    // find the actor of the rendered cloud
+    pcl::visualization::CloudActorMapPtr actors = myViewer->getCloudActorMap();
+    pcl::visualization::CloudActorMap::iterator it = actors->find(id);
+    if(it == actors->end())
+    {
+        return NULL;
+    }
+    vtkMapper *mapper = it->second.actor->GetMapper();
+
+    // reuse the current geometry if it is already indexed by cloud point
+    vtkPolyData *data = vtkPolyData::SafeDownCast(mapper->GetInput());
+    if(data != NULL && data->GetPoints() != NULL && data->GetNumberOfPoints() == static_cast<vtkIdType>(cloud->size())
+        && vtkFloatArray::SafeDownCast(data->GetPoints()->GetData()) != NULL
+        && vtkUnsignedCharArray::SafeDownCast(data->GetPointData()->GetScalars()) != NULL)
+    {
+        return data;
+    }
+
+    // build geometry with one vertex per cloud point
+    vtkIdType numPoints = static_cast<vtkIdType>(cloud->size());
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetDataTypeToFloat();
+    points->SetNumberOfPoints(numPoints);
+    vtkSmartPointer<vtkUnsignedCharArray> colors = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    colors->SetName("RGB");
+    colors->SetNumberOfComponents(3);
+    colors->SetNumberOfTuples(numPoints);
+    vtkSmartPointer<vtkCellArray> vertices = vtkSmartPointer<vtkCellArray>::New();
+    vertices->Allocate(2 * numPoints);
+    float *xyz = vtkFloatArray::SafeDownCast(points->GetData())->GetPointer(0);
+    unsigned char *rgb = colors->GetPointer(0);
+    for(vtkIdType i = 0; i < numPoints; i++)
+    {
+        patchPoint(cloud->points[i], xyz + 3 * i, rgb + 3 * i, 3);
+        vertices->InsertNextCell(1, &i);
+    }
+    vtkSmartPointer<vtkPolyData> indexedData = vtkSmartPointer<vtkPolyData>::New();
+    indexedData->SetPoints(points);
+    indexedData->SetVerts(vertices);
+    indexedData->GetPointData()->SetScalars(colors);
+
+    // attach the new geometry to the existing actor
+    if(vtkDataSetMapper *dataSetMapper = vtkDataSetMapper::SafeDownCast(mapper))
+    {
+        dataSetMapper->SetInputData(indexedData);
+    }
+    else if(vtkPolyDataMapper *polyDataMapper = vtkPolyDataMapper::SafeDownCast(mapper))
+    {
+        polyDataMapper->SetInputData(indexedData);
+    }
+    else
+    {
+        return NULL;
+    }
+    mapper->SetScalarModeToUsePointData();
+    mapper->ScalarVisibilityOn();
+
+    return indexedData;
+}
+
+/***********************************************************************************************************************
+ * @brief Copy the position and color of a cloud point into vertex arrays
+ * @param[in] point the source cloud point
+ * @param[out] xyz pointer to the three vertex coordinates
+ * @param[out] rgb pointer to the vertex color components
+ * @param[in] numComponents the number of color components (3 or 4)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::patchPoint(const pcl::PointXYZRGBA &point, float *xyz, unsigned char *rgb, int numComponents)
+{
+    xyz[0] = point.x;
+    xyz[1] = point.y;
+    xyz[2] = point.z;
+    rgb[0] = point.r;
+    rgb[1] = point.g;
+    rgb[2] = point.b;
+    if(numComponents == 4)
+    {
+        rgb[3] = point.a;
+    }
+}
+
+/***********************************************************************************************************************
+ * @brief Add a level of detail cloud to the rendering window
+ *
+ * Renders the nodes of a level of detail octree selected for the current camera view. The selection is refreshed on
+ * every call to spin(), and node points are read from the tree data file by a background thread, so the render loop
+ * never waits on the disk. Only one level of detail cloud can be rendered at a time, and the tree must outlive the
+ * visualizer or the call to removeLODCloud().
+ *
+ * @param[in] tree the level of detail octree to render
+ * @param[in] pointBudget the maximum number of points to render (default: 5000000)
+ * @param[in] pointSize the display size of the individual cloud points (default: 1.0)
+ * @param[in] minNodePixels the smallest projected node radius worth rendering, in pixels (default: 4.0)
+ * @param[in] id the unique identifier of the rendered cloud (default: "lod")
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::addLODCloud(LODOctree &tree, size_t pointBudget, double pointSize, double minNodePixels, const string &id)
+{
+    // replace any existing level of detail cloud
+    removeLODCloud();
+    myLODTree = &tree;
+    myLODId = id;
+    myLODPointBudget = pointBudget;
+    myLODPointSize = pointSize;
+    myLODMinNodePixels = minNodePixels;
+
+    // show the root node and fit the camera to it
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr root(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    if(!myLODTree->loadNode(0, *root))
+    {
+        myLODTree = NULL;
+        return;
+    }
+    myLODCache[0] = root;
+    myLODNodes.assign(1, 0);
+    myLODSelection.assign(1, 0);
+    CloudVisualizer::addCloud(root, myLODPointSize, myLODId);
+    myViewer->resetCamera();
+
+    // start loading nodes in the background
+    myLODStopRequested = false;
+    myLODLoader = std::thread(&CloudVisualizer::loadLODNodes, this);
+
+    // refine the selection for the new view
+    updateLODCloud();
+}
+
+/***********************************************************************************************************************
+ * @brief Refresh the level of detail cloud for the current camera view
+ *
+ * Selects the octree nodes for the current view and queues the ones that are not cached for the loader thread. The
+ * rendered points are replaced when the loaded part of the selection changes, so nodes appear as they finish loading
+ * while their already loaded parents fill in the view. Nodes that are no longer selected stay cached until the cache
+ * holds more than twice the point budget.
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::updateLODCloud()
+{
+    if(myLODTree == NULL)
+    {
+        return;
+    }
+
+    // compute the view frustum of the active camera
+    std::vector<pcl::visualization::Camera> cameras;
+    myViewer->getCameras(cameras);
+    if(cameras.empty())
+    {
+        return;
+    }
+    const pcl::visualization::Camera &camera = cameras.at(0);
+    Eigen::Matrix4d viewMatrix;
+    Eigen::Matrix4d projectionMatrix;
+    camera.computeViewMatrix(viewMatrix);
+    camera.computeProjectionMatrix(projectionMatrix);
+    Eigen::Matrix4d viewProjectionMatrix = projectionMatrix * viewMatrix;
+    double frustum[24];
+    pcl::visualization::getViewFrustum(viewProjectionMatrix, frustum);
+
+    // select the nodes to render, keeping the current points if nothing changed
+    double screenScale = camera.window_size[1] / (2.0 * std::tan(0.5 * camera.fovy));
+    std::vector<int> selection;
+    myLODTree->selectNodes(Eigen::Vector3d(camera.pos[0], camera.pos[1], camera.pos[2]), frustum, screenScale, myLODPointBudget, myLODMinNodePixels, selection);
+    {
+        std::lock_guard<std::mutex> lock(myLODMutex);
+
+        // take the nodes finished by the loader thread
+        for(std::map<int, pcl::PointCloud<pcl::PointXYZRGBA>::Ptr>::iterator it = myLODLoaded.begin(); it != myLODLoaded.end(); ++it)
+        {
+            myLODCache[it->first] = it->second;
+        }
+        myLODLoaded.clear();
+
+        // queue the uncached nodes of a new selection, coarsest first, replacing the requests of the previous view
+        if(selection != myLODSelection)
+        {
+            myLODSelection = selection;
+            myLODRequests.clear();
+            for(size_t i = 0; i < selection.size(); i++)
+            {
+                if(myLODCache.find(selection[i]) == myLODCache.end())
+                {
+                    myLODRequests.push_back(selection[i]);
+                }
+            }
+            myLODCondition.notify_one();
+        }
+    }
+
+    // render the loaded part of the selection, keeping the current points if it has not changed
+    std::vector<int> nodes;
+    for(size_t i = 0; i < selection.size(); i++)
+    {
+        if(myLODCache.find(selection[i]) != myLODCache.end())
+        {
+            nodes.push_back(selection[i]);
+        }
+    }
+    if(nodes == myLODNodes)
+    {
+        return;
+    }
+    myLODNodes = nodes;
+
+    // gather the points of the loaded nodes
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr visibleCloud(new pcl::PointCloud<pcl::PointXYZRGBA>);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &nodeCloud = myLODCache[nodes[i]];
+        visibleCloud->points.insert(visibleCloud->points.end(), nodeCloud->points.begin(), nodeCloud->points.end());
+    }
+    visibleCloud->width = static_cast<uint32_t>(visibleCloud->points.size());
+    visibleCloud->height = 1;
+    visibleCloud->is_dense = true;
+
+    // evict unselected nodes other than the root once the cache grows past twice the budget
+    size_t cachedPoints = 0;
+    for(std::map<int, pcl::PointCloud<pcl::PointXYZRGBA>::Ptr>::iterator it = myLODCache.begin(); it != myLODCache.end(); ++it)
+    {
+        cachedPoints += it->second->points.size();
+    }
+    std::sort(selection.begin(), selection.end());
+    std::map<int, pcl::PointCloud<pcl::PointXYZRGBA>::Ptr>::iterator it = myLODCache.begin();
+    while(cachedPoints > 2 * myLODPointBudget && it != myLODCache.end())
+    {
+        if(it->first == 0 || std::binary_search(selection.begin(), selection.end(), it->first))
+        {
+            ++it;
+        }
+        else
+        {
+            cachedPoints -= it->second->points.size();
+            myLODCache.erase(it++);
+        }
+    }
+
+    // replace the rendered points
+    pcl::visualization::PointCloudColorHandlerRGBField<pcl::PointXYZRGBA> rgb(visibleCloud);
+    myViewer->updatePointCloud<pcl::PointXYZRGBA>(visibleCloud, rgb, myLODId);
+}
+
+/***********************************************************************************************************************
+ * @brief Remove the level of detail cloud from the rendering window
+ *
+ * Stops the loader thread, removes the rendered points and releases the cached node points
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::removeLODCloud()
+{
+    if(myLODLoader.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(myLODMutex);
+            myLODStopRequested = true;
+            myLODRequests.clear();
+        }
+        myLODCondition.notify_one();
+        myLODLoader.join();
+    }
+    if(myLODTree != NULL)
+    {
+        myViewer->removePointCloud(myLODId);
+    }
+    myLODTree = NULL;
+    myLODNodes.clear();
+    myLODSelection.clear();
+    myLODCache.clear();
+    myLODLoaded.clear();
+}
+
+/***********************************************************************************************************************
+ * @brief Loader thread function, reads the requested level of detail nodes from the tree data file
+ *
+ * Requests are taken coarsest first, and finished nodes are handed to the render thread through myLODLoaded
+ *
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::loadLODNodes()
+{
+    std::unique_lock<std::mutex> lock(myLODMutex);
+    while(true)
+    {
+        // wait for a request
+        myLODCondition.wait(lock, [this]() { return myLODStopRequested || !myLODRequests.empty(); });
+        if(myLODStopRequested)
+        {
+            return;
+        }
+        int index = myLODRequests.front();
+        myLODRequests.pop_front();
+        if(myLODLoaded.find(index) != myLODLoaded.end())
+        {
+            continue;
+        }
+
+        // read the node without holding the lock, an unreadable node is rendered empty
+        lock.unlock();
+        pcl::PointCloud<pcl::PointXYZRGBA>::Ptr nodeCloud(new pcl::PointCloud<pcl::PointXYZRGBA>);
+        if(!myLODTree->loadNode(index, *nodeCloud))
+        {
+            nodeCloud->clear();
+        }
+        lock.lock();
+        myLODLoaded[index] = nodeCloud;
+    }
+}
+
 /***********************************************************************************************************************
  * @brief Add a coordinate frame to the display
  *
@@ -490,7 +943,8 @@ void CloudVisualizer::addPlane(const Eigen::Vector4f &plane, double r, double g,
 /***********************************************************************************************************************
  * @brief Add an occupancy grid to the viewer
  *
- * Adds an occupancy grid represented by the input octree structure
+ * Adds an occupancy grid represented by the input octree structure. All occupied voxels are rendered as wireframe
+ * cubes glyphed onto the voxel centers in a single shape, which can be removed with removeShape(id).
  *
  * @param[in] octree the input octree structure
  * @param[in] r the red color component (default: 255.0)
@@ -498,7 +952,7 @@ void CloudVisualizer::addPlane(const Eigen::Vector4f &plane, double r, double g,
  * @param[in] b the blue color component (default: 255.0)
  * @param[in] opacity the opacity of the rendered box frame (default: 1.0)
  * @param[in] frameSize the size of the box frame (default: 1.0)
- * @param[in] id the unique identifier of the rendered box (default: "box")
+ * @param[in] id the unique identifier of the rendered grid (default: "octree")
  * @param[in] viewPort the viewPort id if using multiple viewports (default: 0)
  * @author Christopher D. McMurrough
  **********************************************************************************************************************/
@@ -508,19 +962,26 @@ void CloudVisualizer::addOccupancyGrid(const pcl::octree::OctreePointCloud<pcl::
     pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::AlignedPointTVector vcs;
     octree.getOccupiedVoxelCenters(vcs);
 
-    // render each leaf node as a cube or sphere
-    for(int i = 0; i < vcs.size(); i++)
-    {
-        std::stringstream ss;
-        ss << id << "_leaf_" << i;
-        CloudVisualizer::addBox(vcs.at(i).x, vcs.at(i).y, vcs.at(i).z, 0, 0, 0, leafSize, leafSize, leafSize, r, g, b, opacity, frameSize, false, ss.str(), viewPort);
-    }
+    // build a single cube glyph mesh covering every leaf node
+    vtkSmartPointer<vtkCubeSource> cube = vtkSmartPointer<vtkCubeSource>::New();
+    cube->SetXLength(leafSize);
+    cube->SetYLength(leafSize);
+    cube->SetZLength(leafSize);
+    vtkSmartPointer<vtkPolyData> mesh = createVoxelGlyphs(vcs, cube->GetOutputPort());
+
+    // add the mesh to the display as one shape
+    myViewer->addModelFromPolyData(mesh, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_REPRESENTATION, pcl::visualization::PCL_VISUALIZER_REPRESENTATION_WIREFRAME, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_COLOR, r, g, b, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_LINE_WIDTH, frameSize, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY, opacity, id, viewPort);
 }
 
 /***********************************************************************************************************************
  * @brief Add an occupancy grid to the viewer
  *
- * Adds an occupancy grid represented by the input octree structure
+ * Adds an occupancy grid represented by the input octree structure. All occupied voxels are rendered as wireframe
+ * cubes glyphed onto the voxel centers in a single shape, which can be removed with removeShape(id).
  *
  * @param[in] octree pointer to the input octree structure
  * @param[in] r the red color component (default: 255.0)
@@ -528,37 +989,61 @@ void CloudVisualizer::addOccupancyGrid(const pcl::octree::OctreePointCloud<pcl::
  * @param[in] b the blue color component (default: 255.0)
  * @param[in] opacity the opacity of the rendered box frame (default: 1.0)
  * @param[in] frameSize the size of the box frame (default: 1.0)
- * @param[in] id the unique identifier of the rendered box (default: "box")
+ * @param[in] id the unique identifier of the rendered grid (default: "octree")
  * @param[in] viewPort the viewPort id if using multiple viewports (default: 0)
  * @author Christopher D. McMurrough
  **********************************************************************************************************************/
 void CloudVisualizer::addOccupancyGrid(const pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::ConstPtr octree, double r, double g, double b, double opacity, double frameSize, const string &id, int viewPort)
 {
-    double leafSize = octree->getResolution();
-    pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::AlignedPointTVector vcs;
-    octree->getOccupiedVoxelCenters(vcs);
+    CloudVisualizer::addOccupancyGrid(*octree, r, g, b, opacity, frameSize, id, viewPort);
+}
 
-    // render each leaf node as a cube
-    for(int i = 0; i < vcs.size(); i++)
+/***********************************************************************************************************************
+ * @brief Add the occupancy grid of a cloud loaded from a file to the viewer
+ *
+ * The octree is restored from the index cache next to the cloud file if one exists for the same file contents and
+ * resolution. Otherwise it is built from the cloud and saved to the cache for the next run.
+ *
+ * @param[in] cloudFileName path and name of the file the cloud was loaded from
+ * @param[in] cloud pointer to the cloud loaded from the file
+ * @param[in] resolution the voxel size of the grid
+ * @param[in] r the red color component (default: 255.0)
+ * @param[in] g the green color component (default: 255.0)
+ * @param[in] b the blue color component (default: 255.0)
+ * @param[in] opacity the opacity of the rendered box frame (default: 1.0)
+ * @param[in] frameSize the size of the box frame (default: 1.0)
+ * @param[in] id the unique identifier of the rendered grid (default: "octree")
+ * @param[in] viewPort the viewPort id if using multiple viewports (default: 0)
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+void CloudVisualizer::addOccupancyGrid(const string &cloudFileName, const pcl::PointCloud<pcl::PointXYZRGBA>::ConstPtr &cloud, double resolution, double r, double g, double b, double opacity, double frameSize, const string &id, int viewPort)
+{
+    // restore the octree from the cache, or build and cache it
+    pcl::octree::OctreePointCloud<pcl::PointXYZRGBA> octree(resolution);
+    SpatialIndexCache indexCache(cloudFileName);
+    std::ostringstream indexName;
+    indexName << "octree_" << resolution;
+    if(!indexCache.loadOctree(indexName.str(), octree))
     {
-        std::stringstream ss;
-        ss << id << "_leaf_" << i;
-        CloudVisualizer::addBox(vcs.at(i).x, vcs.at(i).y, vcs.at(i).z, 0, 0, 0, leafSize, leafSize, leafSize, r, g, b, opacity, frameSize, false, ss.str(), viewPort);
+        octree.setInputCloud(cloud);
+        octree.addPointsFromInputCloud();
+        indexCache.saveOctree(indexName.str(), octree);
     }
+    CloudVisualizer::addOccupancyGrid(octree, r, g, b, opacity, frameSize, id, viewPort);
 }
 
 /***********************************************************************************************************************
  * @brief Add an occupancy grid to the viewer, represented by centroid spheres
  *
- * Adds an occupancy grid represented by the input octree structure
+ * Adds an occupancy grid represented by the input octree structure. All occupied voxels are rendered as spheres
+ * glyphed onto the voxel centers in a single shape, which can be removed with removeShape(id).
  *
  * @param[in] octree the input octree structure
  * @param[in] r the red color component (default: 255.0)
  * @param[in] g the green color component (default: 255.0)
  * @param[in] b the blue color component (default: 255.0)
- * @param[in] opacity the opacity of the rendered box frame (default: 1.0)
- * @param[in] frameSize the size of the box frame (default: 1.0)
- * @param[in] id the unique identifier of the rendered box (default: "centroid")
+ * @param[in] opacity the opacity of the rendered spheres (default: 1.0)
+ * @param[in] id the unique identifier of the rendered grid (default: "centroid")
  * @param[in] viewPort the viewPort id if using multiple viewports (default: 0)
  * @author Christopher D. McMurrough
  **********************************************************************************************************************/
@@ -568,13 +1053,18 @@ void CloudVisualizer::addOccupancyGridSpheres(const pcl::octree::OctreePointClou
     pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::AlignedPointTVector vcs;
     octree.getOccupiedVoxelCenters(vcs);
 
-    // render each leaf node as a cube or sphere
-    for(int i = 0; i < vcs.size(); i++)
-    {
-        std::stringstream ss;
-        ss << id << "_leaf_" << i;
-        CloudVisualizer::addSphere(vcs.at(i).x, vcs.at(i).y, vcs.at(i).z, leafSize*0.5, r, g, b, opacity, ss.str(), viewPort);
-    }
+    // build a single sphere glyph mesh covering every leaf node
+    vtkSmartPointer<vtkSphereSource> sphere = vtkSmartPointer<vtkSphereSource>::New();
+    sphere->SetRadius(leafSize * 0.5);
+    sphere->SetThetaResolution(8);
+    sphere->SetPhiResolution(8);
+    vtkSmartPointer<vtkPolyData> mesh = createVoxelGlyphs(vcs, sphere->GetOutputPort());
+
+    // add the mesh to the display as one shape
+    myViewer->addModelFromPolyData(mesh, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_REPRESENTATION, pcl::visualization::PCL_VISUALIZER_REPRESENTATION_SURFACE, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_COLOR, r, g, b, id, viewPort);
+    myViewer->setShapeRenderingProperties(pcl::visualization::PCL_VISUALIZER_OPACITY, opacity, id, viewPort);
 }
 
 /***********************************************************************************************************************
@@ -718,5 +1208,36 @@ void CloudVisualizer::getColor(int index, int &r, int &g, int &b)
     }
 }
 
+/***********************************************************************************************************************
+ * @brief Build a mesh containing one copy of a glyph at each voxel center
+ *
+ * Copies the voxel centers into a VTK point set and places the unscaled glyph geometry at each of them, producing a
+ * single poly data object that can be rendered with one actor
+ *
+ * @param[in] centers the occupied voxel centers
+ * @param[in] glyphSource the output port of the source producing the glyph geometry
+ * @return the combined glyph mesh
+ * @author Christopher D. McMurrough
+ **********************************************************************************************************************/
+static vtkSmartPointer<vtkPolyData> createVoxelGlyphs(const pcl::octree::OctreePointCloud<pcl::PointXYZRGBA>::AlignedPointTVector &centers, vtkAlgorithmOutput *glyphSource)
+{
+    // copy the voxel centers into a vtk point set
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetNumberOfPoints(static_cast<vtkIdType>(centers.size()));
+    for(size_t i = 0; i < centers.size(); i++)
+    {
+        points->SetPoint(static_cast<vtkIdType>(i), centers[i].x, centers[i].y, centers[i].z);
+    }
+    vtkSmartPointer<vtkPolyData> centerData = vtkSmartPointer<vtkPolyData>::New();
+    centerData->SetPoints(points);
 
+    // place a copy of the glyph at every center
+    vtkSmartPointer<vtkGlyph3D> glyphs = vtkSmartPointer<vtkGlyph3D>::New();
+    glyphs->SetSourceConnection(glyphSource);
+    glyphs->SetInputData(centerData);
+    glyphs->ScalingOff();
+    glyphs->OrientOff();
+    glyphs->Update();
 
+    return glyphs->GetOutput();
+}
@@ -24,6 +24,8 @@
 **********************************************************************************************************************/
 
 #include "CloudVisualizer.h"
+#include "CloudIO.h"
+#include "LODOctree.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -33,6 +35,14 @@
 
 #define NUM_COMMAND_ARGS 1
 
+// rendering modes selectable from the command line
+#define RENDER_MODE_FULL 0
+#define RENDER_MODE_LOD 1
+#define RENDER_MODE_OCCUPANCY 2
+
+// voxel size of the occupancy grid rendering mode
+#define OCCUPANCY_RESOLUTION 0.05
+
 using namespace std;
 
 // function prototypes
@@ -92,56 +102,6 @@ void keyboardCallback(const pcl::visualization::KeyboardEvent &event, void* view
     }
 }
 
-/***********************************************************************************************************************
-* @brief Opens a point cloud file
-*
-* Opens a point cloud file in either PCD or PLY format
-*
-* @param[out] cloudOut pointer to opened point cloud
-* @param[in] filename path and name of input file
-* @return false if an error occurred while opening file
-* @author Christopher D. McMurrough
-**********************************************************************************************************************/
-bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fileName)
-{
-    // convert the file name to string
-    std::string fileNameStr(fileName);
-
-    // handle various file types
-    std::string fileExtension = fileNameStr.substr(fileNameStr.find_last_of(".") + 1);
-    if(fileExtension.compare("pcd") == 0)
-    {
-        // attempt to open the file
-        if(pcl::io::loadPCDFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcd file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
-        {
-            return true;
-        }
-    }
-    else if(fileExtension.compare("ply") == 0)
-    {
-        // attempt to open the file
-        if(pcl::io::loadPLYFile<pcl::PointXYZRGBA>(fileNameStr, *cloudOut) == -1)
-        {
-            PCL_ERROR("error while attempting to read pcl file: %s \n", fileNameStr.c_str());
-            return false;
-        }
-        else
-        {
-            return true;
-        }
-    }
-    else
-    {
-        PCL_ERROR("error while attempting to read unsupported file: %s \n", fileNameStr.c_str());
-        return false;
-    }
-}
-
 /***********************************************************************************************************************
 * @brief program entry point
 * @param[in] argc number of command line arguments
@@ -152,34 +112,73 @@ bool openCloud(pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &cloudOut, const char* fi
 int main(int argc, char** argv)
 {
     // validate and parse the command line arguments
-    if(argc != NUM_COMMAND_ARGS + 1)
+    if(argc != NUM_COMMAND_ARGS + 1 && argc != NUM_COMMAND_ARGS + 2)
     {
-        std::printf("USAGE: %s <file_name>\n", argv[0]);
+        std::printf("USAGE: %s <file_name> [render_mode]\n", argv[0]);
+        std::printf("    render_mode 0: full resolution cloud (default), 1: level of detail octree, 2: cloud and occupancy grid\n");
         return 0;
     }
 
     // parse the command line arguments
     char* fileName = argv[1];
+    int renderMode = RENDER_MODE_FULL;
+    if(argc == NUM_COMMAND_ARGS + 2)
+    {
+        renderMode = atoi(argv[2]);
+    }
 
     // create a stop watch for measuring time
     pcl::StopWatch watch;
 
+    // declare the level of detail tree before the viewer, so the viewer and its node loader thread are destroyed first
+    LODOctree lodTree;
+
     // initialize the cloud viewer
     CloudVisualizer CV("Rendering Window");
 
     // start timing the processing step
     watch.reset();
 
-    // open the point cloud
+    // open the point cloud, or index it for level of detail rendering
     pcl::PointCloud<pcl::PointXYZRGBA>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBA>);
-    openCloud(cloud, fileName);
+    if(renderMode == RENDER_MODE_LOD)
+    {
+        // reuse the index of a previous run if the cloud file has not changed since
+        std::string dataFileName = std::string(fileName) + ".lod";
+        if(lodTree.open(fileName, dataFileName))
+        {
+            cout << "Loaded level of detail index from " << dataFileName << std::endl;
+        }
+        else if(!lodTree.build(fileName, dataFileName))
+        {
+            return 0;
+        }
+        cloud->sensor_origin_ = lodTree.getSensorOrigin();
+        cloud->sensor_orientation_ = lodTree.getSensorOrientation();
+        cout << lodTree.getNumberOfPoints() << " points indexed in " << lodTree.getNumberOfNodes() << " nodes" << std::endl;
+    }
+    else
+    {
+        openCloud(cloud, fileName);
+    }
 
     // get the elapsed time
     double elapsedTime = watch.getTimeSeconds();
     cout << elapsedTime << " seconds passed " << std::endl;
 
     // render the scene
-    CV.addCloud(cloud);
+    if(renderMode == RENDER_MODE_LOD)
+    {
+        CV.addLODCloud(lodTree);
+    }
+    else
+    {
+        CV.addCloud(cloud);
+    }
+    if(renderMode == RENDER_MODE_OCCUPANCY)
+    {
+        CV.addOccupancyGrid(fileName, cloud, OCCUPANCY_RESOLUTION);
+    }
     CV.addCoordinateFrame(cloud->sensor_origin_, cloud->sensor_orientation_);
 
     // register mouse and keyboard event callbacks